@@ -0,0 +1,545 @@
+#include "Util.hpp"
+#include "FlatAst.hpp"
+#include "Lexer.hpp"
+#include "LuaHeap.hpp"
+#include "LuaTable.hpp"
+#include "Parser.hpp"
+
+#include <fmt/format.h>
+#include <argparse/argparse.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace LuNI;
+
+// ========================================
+// 内存分配统计
+// ========================================
+
+namespace {
+std::atomic<u64> allocatedBytes{ 0 };
+std::atomic<u64> allocationCount{ 0 };
+
+struct AllocationStats {
+	u64 bytes;
+	u64 count;
+};
+
+auto AllocationSnapshot() -> AllocationStats {
+	return AllocationStats{
+		allocatedBytes.load(std::memory_order_relaxed),
+		allocationCount.load(std::memory_order_relaxed),
+	};
+}
+
+auto CountedAllocate(std::size_t size) -> void* {
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (auto ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+	throw std::bad_alloc{};
+}
+} // namespace
+
+// 替换全局的operator new/delete以统计前端在运行过程中分配了多少内存
+auto operator new(std::size_t size) -> void* { return CountedAllocate(size); }
+auto operator new[](std::size_t size) -> void* { return CountedAllocate(size); }
+auto operator delete(void* ptr) noexcept -> void { std::free(ptr); }
+auto operator delete[](void* ptr) noexcept -> void { std::free(ptr); }
+auto operator delete(void* ptr, std::size_t) noexcept -> void { std::free(ptr); }
+auto operator delete[](void* ptr, std::size_t) noexcept -> void { std::free(ptr); }
+
+// ========================================
+// 合成语料
+// ========================================
+
+namespace {
+enum class CorpusKind {
+	IDENTIFIERS,
+	STRINGS,
+	NUMBERS,
+	NESTED,
+};
+
+constexpr CorpusKind corpusKinds[] = {
+	CorpusKind::IDENTIFIERS,
+	CorpusKind::STRINGS,
+	CorpusKind::NUMBERS,
+	CorpusKind::NESTED,
+};
+
+auto CorpusName(CorpusKind kind) -> std::string_view {
+	switch (kind) {
+		case CorpusKind::IDENTIFIERS: return "identifiers";
+		case CorpusKind::STRINGS: return "strings";
+		case CorpusKind::NUMBERS: return "numbers";
+		case CorpusKind::NESTED: return "nested";
+	}
+	UNREACHABLE;
+}
+
+/// 使用固定种子的伪随机数，保证同一个版本每次生成的语料完全相同，结果才能互相比较
+class CorpusWriter {
+private:
+	std::string text;
+	std::mt19937_64 rng;
+
+public:
+	explicit CorpusWriter(u64 seed)
+		: rng{ seed } {}
+
+	auto Size() const -> usize { return text.size(); }
+	auto Take() -> std::string { return std::move(text); }
+
+	auto Uniform(u64 lo, u64 hi) -> u64 {
+		return std::uniform_int_distribution<u64>{ lo, hi }(rng);
+	}
+
+	auto Append(std::string_view s) -> void { text += s; }
+
+	template <typename... Args>
+	auto Append(fmt::format_string<Args...> format, Args&&... args) -> void {
+		fmt::format_to(std::back_inserter(text), format, std::forward<Args>(args)...);
+	}
+
+	auto Indent(usize depth) -> void { text.append(depth, '\t'); }
+
+	auto Identifier() -> void {
+		static constexpr std::string_view prefixes[] = {
+			"value", "count", "index", "player", "buffer", "node", "result", "x", "y", "_tmp",
+		};
+		Append("{}_{}", prefixes[Uniform(0, std::size(prefixes) - 1)], Uniform(0, 999));
+	}
+
+	auto Number() -> void {
+		switch (Uniform(0, 4)) {
+			case 0: Append("{}", Uniform(0, 1'000'000)); break;
+			case 1: Append("{}.{}", Uniform(0, 9999), Uniform(0, 999999)); break;
+			case 2: Append("0x{:X}", Uniform(0, 0xFFFF'FFFF)); break;
+			case 3: Append("{}.{}e{}", Uniform(1, 9), Uniform(0, 9999), Uniform(0, 30)); break;
+			case 4: Append("0x{:x}.{:x}p{}", Uniform(1, 0xFFF), Uniform(0, 0xFF), Uniform(0, 10)); break;
+		}
+	}
+
+	auto String() -> void {
+		static constexpr std::string_view words[] = {
+			"lorem", "ipsum", "dolor", "sit", "amet", "\\n", "\\\"quoted\\\"", "\\t", "end", "local",
+		};
+		auto count = Uniform(1, 24);
+		auto quoted = Uniform(0, 3) != 0;
+		Append(quoted ? "\"" : "[==[");
+		for (u64 i = 0; i < count; ++i) {
+			if (i > 0) Append(" ");
+			auto word = words[Uniform(0, std::size(words) - 1)];
+			// 长字符串中不处理转义，换成普通的单词
+			Append(quoted || word.front() != '\\' ? word : "text");
+		}
+		Append(quoted ? "\"" : "]==]");
+	}
+};
+
+auto WriteIdentifierHeavy(CorpusWriter& w) -> void {
+	switch (w.Uniform(0, 2)) {
+		case 0: {
+			w.Append("local ");
+			w.Identifier();
+			w.Append(" = ");
+			w.Identifier();
+			break;
+		}
+		case 1: {
+			w.Identifier();
+			w.Append("(");
+			auto args = w.Uniform(0, 4);
+			for (u64 i = 0; i < args; ++i) {
+				if (i > 0) w.Append(", ");
+				w.Identifier();
+			}
+			w.Append(")");
+			break;
+		}
+		case 2: {
+			w.Identifier();
+			w.Append(" = ");
+			w.Identifier();
+			w.Append(" + ");
+			w.Identifier();
+			break;
+		}
+	}
+	w.Append("\n");
+}
+
+auto WriteStringHeavy(CorpusWriter& w) -> void {
+	switch (w.Uniform(0, 3)) {
+		case 0: {
+			w.Append("-- ");
+			w.Append("line comment with some {} text\n", w.Uniform(0, 99999));
+			return;
+		}
+		case 1: {
+			w.Append("--[[ block comment\n   spanning {} lines ]]\n", w.Uniform(2, 9));
+			return;
+		}
+		default: {
+			w.Append("local s = ");
+			w.String();
+			w.Append("\n");
+			return;
+		}
+	}
+}
+
+auto WriteNumberHeavy(CorpusWriter& w) -> void {
+	w.Append("local t = { ");
+	auto count = w.Uniform(4, 16);
+	for (u64 i = 0; i < count; ++i) {
+		if (i > 0) w.Append(", ");
+		w.Number();
+	}
+	w.Append(" }\n");
+}
+
+auto WriteNested(CorpusWriter& w, usize depth, usize maxDepth) -> void {
+	if (depth >= maxDepth) {
+		w.Indent(depth);
+		w.Append("x = ");
+		for (usize i = 0; i < depth; ++i) w.Append("(");
+		w.Append("1");
+		for (usize i = 0; i < depth; ++i) w.Append(")");
+		w.Append("\n");
+		return;
+	}
+
+	w.Indent(depth);
+	switch (w.Uniform(0, 2)) {
+		case 0: {
+			w.Append("if x then\n");
+			WriteNested(w, depth + 1, maxDepth);
+			w.Indent(depth);
+			w.Append("else\n");
+			// else分支只放一条语句，否则语料的大小会随深度指数增长
+			WriteNested(w, depth + 1, depth + 1);
+			break;
+		}
+		case 1: {
+			w.Append("while x do\n");
+			WriteNested(w, depth + 1, maxDepth);
+			break;
+		}
+		case 2: {
+			// 函数定义只能出现在顶层，块内的嵌套使用repeat
+			w.Append("repeat\n");
+			WriteNested(w, depth + 1, maxDepth);
+			w.Indent(depth);
+			w.Append("until x\n");
+			return;
+		}
+	}
+	w.Indent(depth);
+	w.Append("end\n");
+}
+
+auto GenerateCorpus(CorpusKind kind, usize targetBytes) -> std::string {
+	auto w = CorpusWriter{ 0x4C754E49 /* "LuNI" */ + static_cast<u64>(kind) };
+	while (w.Size() < targetBytes) {
+		switch (kind) {
+			case CorpusKind::IDENTIFIERS: WriteIdentifierHeavy(w); break;
+			case CorpusKind::STRINGS: WriteStringHeavy(w); break;
+			case CorpusKind::NUMBERS: WriteNumberHeavy(w); break;
+			case CorpusKind::NESTED: WriteNested(w, 0, 24); break;
+		}
+	}
+	return w.Take();
+}
+
+// ========================================
+// 测量
+// ========================================
+
+struct Measurement {
+	std::string_view corpus;
+	std::string_view phase;
+	usize bytes = 0;
+	usize tokens = 0;
+	usize astNodes = 0;
+	/// 所有迭代中最快的一次
+	f64 seconds = 0;
+	/// 单次运行中通过operator new分配的内存，包括之后被释放的部分
+	AllocationStats allocations{};
+};
+
+auto CountNodes(const AstNode& node) -> usize {
+	usize count = 1;
+	for (auto& child : node.children) {
+		count += CountNodes(*child);
+	}
+	return count;
+}
+
+template <typename F>
+auto Measure(u32 iterations, F&& run) -> std::pair<f64, AllocationStats> {
+	f64 best = std::numeric_limits<f64>::infinity();
+	AllocationStats allocations{};
+	for (u32 i = 0; i < iterations; ++i) {
+		auto before = AllocationSnapshot();
+		auto start = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		auto after = AllocationSnapshot();
+
+		best = std::min(best, std::chrono::duration<f64>(end - start).count());
+		allocations = AllocationStats{ after.bytes - before.bytes, after.count - before.count };
+	}
+	return { best, allocations };
+}
+
+/// 语料有错误时测得的是出错之前的那一部分，吞吐量没有意义，直接让整个benchmark失败
+auto RequireNoErrors(CorpusKind kind, std::string_view phase, const std::vector<StandardError>& errors) -> void {
+	if (errors.empty()) return;
+	throw std::runtime_error(fmt::format("{} corpus failed {} with {} error(s), first: {}",
+		CorpusName(kind), phase, errors.size(), errors.front().msg));
+}
+
+auto MeasureLexing(CorpusKind kind, std::string_view source, u32 iterations) -> Measurement {
+	auto result = Measurement{ .corpus = CorpusName(kind), .phase = "lexing", .bytes = source.size() };
+	auto [seconds, allocations] = Measure(iterations, [&]() {
+		auto lexed = DoLexing(source);
+		RequireNoErrors(kind, "lexing", lexed.errors);
+		result.tokens = lexed.tokens.size();
+	});
+	result.seconds = seconds;
+	result.allocations = allocations;
+	return result;
+}
+
+auto MeasureParsing(CorpusKind kind, std::string_view source, u32 iterations) -> Measurement {
+	auto result = Measurement{ .corpus = CorpusName(kind), .phase = "parsing", .bytes = source.size() };
+	// AST的析构不计入解析时间
+	std::vector<ParsingResult> asts;
+	asts.reserve(iterations);
+	auto [seconds, allocations] = Measure(iterations, [&]() {
+		auto tokens = TokenStream{ source };
+		asts.push_back(DoParsing(tokens));
+		RequireNoErrors(kind, "parsing", asts.back().errors);
+		result.tokens = tokens.Position();
+	});
+	result.seconds = seconds;
+	result.allocations = allocations;
+	if (!asts.empty() && asts.back().root) {
+		result.astNodes = CountNodes(*asts.back().root);
+	}
+	return result;
+}
+
+auto MeasureFlattening(CorpusKind kind, std::string_view source, u32 iterations) -> Measurement {
+	auto result = Measurement{ .corpus = CorpusName(kind), .phase = "flattening", .bytes = source.size() };
+	auto tokens = TokenStream{ source };
+	auto ast = DoParsing(tokens);
+	RequireNoErrors(kind, "flattening", ast.errors);
+	result.tokens = tokens.Position();
+	auto [seconds, allocations] = Measure(iterations, [&]() {
+		result.astNodes = FlatAst::Build(*ast.root).Size();
+	});
+	result.seconds = seconds;
+	result.allocations = allocations;
+	return result;
+}
+
+// ========================================
+// 垃圾回收
+// ========================================
+
+/// 回收器在模拟的请求处理负载上的表现。"stopped"不进行回收，作为计算回收开销的基准
+struct GcMeasurement {
+	std::string_view mode;
+	usize requests = 0;
+	/// 所有迭代中最快的一次
+	f64 seconds = 0;
+	/// 减去"stopped"的时间
+	f64 overheadSeconds = 0;
+	/// `LuaHeap::BytesInUse`在安全点的最大值
+	usize peakBytes = 0;
+	AllocationStats allocations{};
+};
+
+/// 长期存在的缓存中的条目数，以及每个请求创建的临时表的个数
+constexpr usize kCacheEntries = 20000;
+constexpr usize kTemporariesPerRequest = 32;
+/// 每隔这么多个请求把一个请求的结果放进缓存，替换掉旧的条目
+constexpr usize kCacheUpdateInterval = 16;
+
+/// 模拟解释器处理请求：每个请求创建许多短命的表和字符串，偶尔更新一个长期存在的大缓存。
+/// 每条“语句”之后是一个安全点，根只有缓存和当前请求的局部变量
+auto RunRequests(LuaHeap& heap, usize requests) -> usize {
+	auto cache = LuaValue{ heap.NewTable(0, 0) };
+	auto locals = std::array<LuaValue, 2>{};
+	heap.SetRootMarker([&](LuaHeap& heap) {
+		heap.Mark(cache);
+		for (auto& value : locals) heap.Mark(value);
+	});
+
+	auto keys = std::vector<LuaValue>{};
+	keys.reserve(kCacheEntries);
+	for (usize i = 0; i < kCacheEntries; ++i) {
+		auto entry = heap.NewTable(1, 0);
+		entry->SetInteger(1, LuaValue{ heap.NewString(fmt::format("cached value {}", i)) });
+		keys.push_back(LuaValue{ heap.NewString(fmt::format("key{}", i)) });
+		cache.AsObject<LuaTable>()->Set(keys.back(), LuaValue{ entry });
+		heap.Barrier(cache.AsObject<LuaTable>(), LuaValue{ entry });
+		heap.Step();
+	}
+
+	usize peakBytes = heap.BytesInUse();
+	for (usize r = 0; r < requests; ++r) {
+		auto request = heap.NewTable(kTemporariesPerRequest, 0);
+		locals[0] = LuaValue{ request };
+		for (usize i = 0; i < kTemporariesPerRequest; ++i) {
+			auto item = heap.NewTable(2, 0);
+			item->SetInteger(1, LuaValue{ heap.NewString(fmt::format("item {} of request {}", i, r)) });
+			item->SetInteger(2, LuaValue{ static_cast<i64>(i) });
+			request->SetInteger(static_cast<i64>(i + 1), LuaValue{ item });
+			heap.Barrier(request, LuaValue{ item });
+			heap.Step();
+			peakBytes = std::max(peakBytes, heap.BytesInUse());
+		}
+		if (r % kCacheUpdateInterval == 0) {
+			// 缓存已经是老对象，写入新的请求需要经过屏障
+			auto table = cache.AsObject<LuaTable>();
+			table->Set(keys[r / kCacheUpdateInterval % kCacheEntries], locals[0]);
+			heap.Barrier(table, locals[0]);
+		}
+		locals[0] = LuaValue{};
+	}
+	// 根引用的是这个函数的局部变量，返回之前清掉
+	heap.SetRootMarker({});
+	return peakBytes;
+}
+
+auto MeasureGc(std::string_view mode, usize requests, u32 iterations) -> GcMeasurement {
+	auto result = GcMeasurement{ .mode = mode, .requests = requests };
+	auto [seconds, allocations] = Measure(iterations, [&]() {
+		auto heap = LuaHeap{};
+		if (mode == "stopped") heap.SetRunning(false);
+		if (mode == "generational") heap.SetMode(GcMode::GENERATIONAL);
+		result.peakBytes = RunRequests(heap, requests);
+	});
+	result.seconds = seconds;
+	result.allocations = allocations;
+	return result;
+}
+
+auto PerSecond(usize count, f64 seconds) -> f64 {
+	return seconds > 0 ? static_cast<f64>(count) / seconds : 0;
+}
+
+auto ToJson(const std::vector<Measurement>& measurements, const std::vector<GcMeasurement>& gcMeasurements, usize corpusBytes, u32 iterations) -> std::string {
+	std::string out;
+	auto it = std::back_inserter(out);
+	fmt::format_to(it, "{{\n  \"corpusBytes\": {},\n  \"iterations\": {},\n  \"results\": [\n", corpusBytes, iterations);
+	for (usize i = 0; i < measurements.size(); ++i) {
+		auto& m = measurements[i];
+		fmt::format_to(it,
+			"    {{\"corpus\": \"{}\", \"phase\": \"{}\", \"bytes\": {}, \"tokens\": {}, \"astNodes\": {}, "
+			"\"seconds\": {:.6f}, \"bytesPerSecond\": {:.0f}, \"tokensPerSecond\": {:.0f}, \"astNodesPerSecond\": {:.0f}, "
+			"\"allocatedBytes\": {}, \"allocations\": {}}}{}\n",
+			m.corpus, m.phase, m.bytes, m.tokens, m.astNodes,
+			m.seconds, PerSecond(m.bytes, m.seconds), PerSecond(m.tokens, m.seconds), PerSecond(m.astNodes, m.seconds),
+			m.allocations.bytes, m.allocations.count,
+			i + 1 < measurements.size() ? "," : "");
+	}
+	fmt::format_to(it, "  ],\n  \"gc\": [\n");
+	for (usize i = 0; i < gcMeasurements.size(); ++i) {
+		auto& m = gcMeasurements[i];
+		fmt::format_to(it,
+			"    {{\"mode\": \"{}\", \"requests\": {}, \"seconds\": {:.6f}, \"overheadSeconds\": {:.6f}, "
+			"\"requestsPerSecond\": {:.0f}, \"peakBytes\": {}, \"allocatedBytes\": {}, \"allocations\": {}}}{}\n",
+			m.mode, m.requests, m.seconds, m.overheadSeconds,
+			PerSecond(m.requests, m.seconds), m.peakBytes, m.allocations.bytes, m.allocations.count,
+			i + 1 < gcMeasurements.size() ? "," : "");
+	}
+	fmt::format_to(it, "  ]\n}}\n");
+	return out;
+}
+} // namespace
+
+auto SetupArgParse() -> argparse::ArgumentParser {
+	auto program = argparse::ArgumentParser("LuNI front-end and garbage collector benchmark");
+	program.add_argument("--size")
+		.help("Approximate size of each synthetic corpus in bytes")
+		.default_value(usize{ 4 << 20 })
+		.action([](const std::string& value) { return static_cast<usize>(std::stoull(value)); });
+	program.add_argument("--iterations")
+		.help("Number of runs per measurement, the fastest one is reported")
+		.default_value(u32{ 5 })
+		.action([](const std::string& value) { return static_cast<u32>(std::stoul(value)); });
+	program.add_argument("--gc-requests")
+		.help("Number of simulated requests in the garbage collector workload")
+		.default_value(usize{ 20000 })
+		.action([](const std::string& value) { return static_cast<usize>(std::stoull(value)); });
+	program.add_argument("--output")
+		.help("Write the JSON report to this file instead of stdout")
+		.default_value(std::string{});
+	return program;
+}
+
+int main(int argc, char* argv[]) {
+	auto args = SetupArgParse();
+	try {
+		args.parse_args(argc, argv);
+	} catch (const std::runtime_error& err) {
+		std::cout << err.what() << '\n';
+		std::cout << args;
+		return -1;
+	}
+
+	auto size = args.get<usize>("--size");
+	auto iterations = std::max(args.get<u32>("--iterations"), 1u);
+	auto gcRequests = args.get<usize>("--gc-requests");
+	auto output = args.get<std::string>("--output");
+
+	std::vector<Measurement> measurements;
+	try {
+		for (auto kind : corpusKinds) {
+			auto source = GenerateCorpus(kind, size);
+			measurements.push_back(MeasureLexing(kind, source, iterations));
+			measurements.push_back(MeasureParsing(kind, source, iterations));
+			measurements.push_back(MeasureFlattening(kind, source, iterations));
+		}
+	} catch (const std::runtime_error& err) {
+		std::cerr << err.what() << '\n';
+		return -1;
+	}
+
+	std::vector<GcMeasurement> gcMeasurements;
+	for (auto mode : { "stopped", "incremental", "generational" }) {
+		gcMeasurements.push_back(MeasureGc(mode, gcRequests, iterations));
+	}
+	for (auto& m : gcMeasurements) {
+		m.overheadSeconds = m.seconds - gcMeasurements.front().seconds;
+	}
+
+	auto json = ToJson(measurements, gcMeasurements, size, iterations);
+	if (output.empty()) {
+		std::cout << json;
+	} else {
+		auto ofs = std::ofstream{ output };
+		if (!ofs) {
+			std::cerr << "Unable to open output file " << output << '\n';
+			return -1;
+		}
+		ofs << json;
+	}
+	return 0;
+}
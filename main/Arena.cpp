@@ -0,0 +1,90 @@
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace LuNI;
+
+Arena::~Arena() noexcept {
+	Release();
+}
+
+Arena::Arena(Arena&& that) noexcept
+	: head{ std::exchange(that.head, nullptr) }
+	, cursor{ std::exchange(that.cursor, nullptr) }
+	, limit{ std::exchange(that.limit, nullptr) }
+	, nextChunkSize{ std::exchange(that.nextChunkSize, kInitialChunkSize) }
+	, bytesUsed{ std::exchange(that.bytesUsed, 0) } {
+}
+
+Arena& Arena::operator=(Arena&& that) noexcept {
+	if (this != &that) {
+		Release();
+		head = std::exchange(that.head, nullptr);
+		cursor = std::exchange(that.cursor, nullptr);
+		limit = std::exchange(that.limit, nullptr);
+		nextChunkSize = std::exchange(that.nextChunkSize, kInitialChunkSize);
+		bytesUsed = std::exchange(that.bytesUsed, 0);
+	}
+	return *this;
+}
+
+auto Arena::Adopt(Arena&& that) noexcept -> void {
+	if (this == &that || !that.head) return;
+	if (!head) {
+		*this = std::move(that);
+		return;
+	}
+
+	// 接在链表头之后，链表头（通常是当前正在使用的块）保持不变
+	auto tail = that.head;
+	while (tail->next) {
+		tail = tail->next;
+	}
+	tail->next = head->next;
+	head->next = that.head;
+	bytesUsed += that.bytesUsed;
+
+	that.head = nullptr;
+	that.Release();
+}
+
+auto Arena::Release() noexcept -> void {
+	auto chunk = head;
+	while (chunk) {
+		auto next = chunk->next;
+		std::free(chunk);
+		chunk = next;
+	}
+	head = nullptr;
+	cursor = nullptr;
+	limit = nullptr;
+	nextChunkSize = kInitialChunkSize;
+	bytesUsed = 0;
+}
+
+auto Arena::AllocateSlow(usize size, usize alignment) -> void* {
+	// 块头之后的空间按照最坏情况预留对齐所需的填充
+	auto required = sizeof(Chunk) + size + alignment;
+	auto chunkSize = std::max(nextChunkSize, required);
+	nextChunkSize = std::min(nextChunkSize * 2, kMaxChunkSize);
+
+	auto chunk = static_cast<Chunk*>(std::malloc(chunkSize));
+	if (!chunk) throw std::bad_alloc{};
+	chunk->next = head;
+	chunk->size = chunkSize;
+	head = chunk;
+
+	auto begin = reinterpret_cast<uintptr_t>(chunk + 1);
+	auto aligned = (begin + alignment - 1) & ~(uintptr_t{ alignment } - 1);
+	bytesUsed += size;
+
+	// 超大的分配独占一个块，继续使用当前块剩下的空间
+	if (chunkSize == required && cursor) {
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	cursor = reinterpret_cast<char*>(aligned + size);
+	limit = reinterpret_cast<char*>(chunk) + chunkSize;
+	return reinterpret_cast<void*>(aligned);
+}
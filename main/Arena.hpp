@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace LuNI {
+
+/// 只能整体释放的bump分配器
+///
+/// 内存以块为单位向系统申请，分配只是移动块内的指针。分配出去的对象永远不会被析构，
+/// 所以只接受可平凡析构的类型；`Release`或者析构时一次性释放所有块。
+class Arena {
+private:
+	struct Chunk {
+		Chunk* next;
+		usize size;
+	};
+
+	static constexpr usize kInitialChunkSize = 64 * 1024;
+	static constexpr usize kMaxChunkSize = 4 * 1024 * 1024;
+
+	Chunk* head = nullptr;
+	char* cursor = nullptr;
+	char* limit = nullptr;
+	usize nextChunkSize = kInitialChunkSize;
+	usize bytesUsed = 0;
+
+public:
+	Arena() noexcept = default;
+	~Arena() noexcept;
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	Arena(Arena&& that) noexcept;
+	Arena& operator=(Arena&& that) noexcept;
+
+	auto Allocate(usize size, usize alignment) -> void* {
+		// 用整数运算，避免在还没有任何块（cursor为空）时对空指针做指针运算
+		auto aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t{ alignment } - 1);
+		if (aligned + size > reinterpret_cast<uintptr_t>(limit) || !cursor) {
+			return AllocateSlow(size, alignment);
+		}
+		cursor = reinterpret_cast<char*>(aligned + size);
+		bytesUsed += size;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	template <typename T, typename... Args>
+	auto New(Args&&... args) -> T* {
+		static_assert(std::is_trivially_destructible_v<T>, "Arena never runs destructors");
+		return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	/// 把`items`复制到arena中
+	template <typename T>
+	auto NewArray(std::span<const T> items) -> std::span<T> {
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+		if (items.empty()) return {};
+		auto ptr = static_cast<T*>(Allocate(items.size_bytes(), alignof(T)));
+		std::memcpy(ptr, items.data(), items.size_bytes());
+		return std::span<T>(ptr, items.size());
+	}
+
+	/// 实际分配给对象的字节数，不包括对齐和块尾部浪费的空间
+	auto BytesUsed() const -> usize {
+		return bytesUsed;
+	}
+
+	/// 接管`that`的所有块，之前从`that`分配出去的指针继续有效，它们会随着这个arena一起释放
+	///
+	/// 之后的分配仍然使用这个arena当前的块，`that`变为空。
+	auto Adopt(Arena&& that) noexcept -> void;
+
+	/// 释放所有块，之前分配出去的所有指针都会失效
+	auto Release() noexcept -> void;
+
+private:
+	auto AllocateSlow(usize size, usize alignment) -> void*;
+};
+
+} // namespace LuNI
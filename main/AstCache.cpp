@@ -0,0 +1,443 @@
+#include "AstCache.hpp"
+
+#include "SourceFile.hpp"
+#include "Symbol.hpp"
+#include "Trace.hpp"
+
+#include <fmt/format.h>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using namespace LuNI;
+
+// 缓存文件的格式：
+//
+// Header，然后是：
+// - 名字和字符串：数量，之后每一项是长度和文本。文件中的SymbolId是这张表里的下标
+// - 所有节点，按前序排列。每个节点是kind（1字节）、节点自带的数据、子节点数量
+// - 顶层节点的范围：数量，之后每一项是和上一项结尾的距离以及长度
+//
+// 除了kind和浮点数之外，所有整数都是LEB128变长编码，绝大多数只占1到2个字节。
+
+namespace {
+/// 节点的最大嵌套深度。读取是递归的，损坏的条目不能因为嵌套过深而耗尽栈；
+/// 更深的树（正常的代码不会出现）不写入缓存
+constexpr usize kMaxNodeDepth = 1024;
+
+struct Header {
+	static constexpr u32 kMagic = 0x4E55'4C41; //< "ALUN"
+
+	u32 magic;
+	u32 version;
+	u32 flags;
+	u32 sourceSize;
+	u64 sourceHash;
+	/// Header之后所有内容的哈希值，用于发现损坏的文件
+	u64 bodyHash;
+};
+static_assert(std::is_trivially_copyable_v<Header>);
+
+class Writer {
+public:
+	std::string buffer;
+
+	auto WriteByte(u8 byte) -> void {
+		buffer.push_back(static_cast<char>(byte));
+	}
+
+	auto WriteVarint(u64 value) -> void {
+		while (value >= 0x80) {
+			WriteByte(static_cast<u8>(value | 0x80));
+			value >>= 7;
+		}
+		WriteByte(static_cast<u8>(value));
+	}
+
+	auto WriteText(std::string_view text) -> void {
+		WriteVarint(text.size());
+		buffer += text;
+	}
+};
+
+/// 越界或者格式错误时返回空，调用者直接放弃整个条目
+class Reader {
+private:
+	const u8* cursor;
+	const u8* end;
+
+public:
+	explicit Reader(std::string_view data)
+		: cursor{ reinterpret_cast<const u8*>(data.data()) }
+		, end{ reinterpret_cast<const u8*>(data.data() + data.size()) } {}
+
+	auto ReadByte() -> std::optional<u8> {
+		if (cursor == end) return {};
+		return *cursor++;
+	}
+
+	auto ReadVarint() -> std::optional<u64> {
+		u64 value = 0;
+		for (u32 shift = 0; shift < 64; shift += 7) {
+			if (cursor == end) return {};
+			auto byte = *cursor++;
+			value |= u64{ byte & 0x7Fu } << shift;
+			if (byte < 0x80) return value;
+		}
+		return {};
+	}
+
+	auto ReadText() -> std::optional<std::string_view> {
+		auto size = ReadVarint();
+		if (!size || *size > static_cast<usize>(end - cursor)) return {};
+		auto text = std::string_view(reinterpret_cast<const char*>(cursor), *size);
+		cursor += *size;
+		return text;
+	}
+
+	auto ReadF64() -> std::optional<f64> {
+		if (end - cursor < 8) return {};
+		u64 bits;
+		std::memcpy(&bits, cursor, 8);
+		cursor += 8;
+		return std::bit_cast<f64>(bits);
+	}
+
+	auto Finished() const -> bool {
+		return cursor == end;
+	}
+};
+
+class AstWriter {
+private:
+	/// 文件内的编号按照第一次出现的顺序分配
+	std::unordered_map<SymbolId, u32> localIds;
+	std::vector<SymbolId> symbols;
+
+public:
+	Writer nodes;
+	/// 树的深度超过了`kMaxNodeDepth`，写出的内容不能被读取
+	bool tooDeep = false;
+
+	auto WriteSymbol(SymbolId id) -> void {
+		auto [it, inserted] = localIds.try_emplace(id, static_cast<u32>(symbols.size()));
+		if (inserted) symbols.push_back(id);
+		nodes.WriteVarint(it->second);
+	}
+
+	auto WriteNode(const AstNode& node, usize depth = 1) -> void {
+		if (depth > kMaxNodeDepth) {
+			tooDeep = true;
+			return;
+		}
+		nodes.WriteByte(static_cast<u8>(node.kind));
+		switch (node.kind) {
+			case AstNode::KD_Identifier: WriteSymbol(node.As<AstIdentifierNode>().name); break;
+			case AstNode::KD_StringLiteral: WriteSymbol(node.As<AstStringLiteralNode>().value); break;
+			case AstNode::KD_LocalVarDef:
+			case AstNode::KD_GlobalVarDef: WriteSymbol(node.As<AstVarDefNode>().name); break;
+			case AstNode::KD_For: WriteSymbol(node.As<AstForNode>().variable); break;
+			case AstNode::KD_NumericLiteral: {
+				auto& literal = node.As<AstNumericLiteralNode>();
+				nodes.WriteByte(literal.isInteger ? 1 : 0);
+				if (literal.isInteger) {
+					// zigzag，让绝对值小的负数也很短
+					auto value = static_cast<u64>(literal.integer);
+					nodes.WriteVarint((value << 1) ^ (literal.integer < 0 ? ~u64{ 0 } : 0));
+				} else {
+					auto bits = std::bit_cast<u64>(literal.number);
+					nodes.buffer.append(reinterpret_cast<const char*>(&bits), 8);
+				}
+				break;
+			}
+			case AstNode::KD_FunctionDefinition: {
+				auto& def = node.As<AstFunctionDefinitionNode>();
+				WriteSymbol(def.name);
+				nodes.WriteVarint(def.params.size());
+				for (auto param : def.params) {
+					WriteSymbol(param);
+				}
+				break;
+			}
+			case AstNode::KD_BooleanLiteral: nodes.WriteByte(node.As<AstBooleanLiteralNode>().value ? 1 : 0); break;
+			case AstNode::KD_BinaryOp: nodes.WriteByte(static_cast<u8>(node.As<AstBinaryOpNode>().op)); break;
+			case AstNode::KD_UnaryOp: nodes.WriteByte(static_cast<u8>(node.As<AstUnaryOpNode>().op)); break;
+			case AstNode::KD_MetatableLiteral: nodes.WriteVarint(node.As<AstMetatableLiteralNode>().arrayCount); break;
+			default: break;
+		}
+
+		nodes.WriteVarint(node.children.size());
+		for (auto child : node.GetChildren()) {
+			WriteNode(*child, depth + 1);
+		}
+	}
+
+	auto WriteSymbols(Writer& writer) const -> void {
+		writer.WriteVarint(symbols.size());
+		for (auto id : symbols) {
+			writer.WriteText(Symbols().Text(id));
+		}
+	}
+};
+
+class AstReader {
+private:
+	Reader& reader;
+	Arena& arena;
+	/// 文件内的编号到当前进程中的SymbolId
+	std::vector<SymbolId> symbols;
+	/// 和parser一样，所有正在构建的子节点列表共用一个栈
+	std::vector<AstNode*> pending;
+	std::vector<SymbolId> pendingNames;
+
+public:
+	AstReader(Reader& reader, Arena& arena)
+		: reader{ reader }
+		, arena{ arena } {}
+
+	auto ReadSymbols() -> bool {
+		auto count = reader.ReadVarint();
+		if (!count) return false;
+		for (u64 i = 0; i < *count; ++i) {
+			auto text = reader.ReadText();
+			if (!text) return false;
+			symbols.push_back(Symbols().Intern(*text));
+		}
+		return true;
+	}
+
+	auto ReadNode(usize depth = 1) -> AstNode* {
+		if (depth > kMaxNodeDepth) return nullptr;
+		auto kindByte = reader.ReadByte();
+		if (!kindByte || *kindByte >= AstNode::kKindCount) return nullptr;
+
+		auto kind = static_cast<AstNode::Kind>(*kindByte);
+		auto node = NewNode(kind);
+		if (!node) return nullptr;
+
+		auto childCount = reader.ReadVarint();
+		if (!childCount) return nullptr;
+		auto begin = pending.size();
+		for (u64 i = 0; i < *childCount; ++i) {
+			auto child = ReadNode(depth + 1);
+			if (!child) return nullptr;
+			pending.push_back(child);
+		}
+		node->children = arena.NewArray(std::span<AstNode* const>(pending).subspan(begin));
+		pending.resize(begin);
+		return node;
+	}
+
+private:
+	auto ReadSymbol() -> std::optional<SymbolId> {
+		auto index = reader.ReadVarint();
+		if (!index || *index >= symbols.size()) return {};
+		return symbols[*index];
+	}
+
+	/// 读取节点自带的数据并创建节点，子节点由调用者读取
+	auto NewNode(AstNode::Kind kind) -> AstNode* {
+		switch (kind) {
+			case AstNode::KD_Script: return arena.New<AstScriptNode>();
+			case AstNode::KD_Identifier: {
+				auto name = ReadSymbol();
+				return name ? arena.New<AstIdentifierNode>(*name) : nullptr;
+			}
+			case AstNode::KD_StringLiteral: {
+				auto value = ReadSymbol();
+				return value ? arena.New<AstStringLiteralNode>(*value) : nullptr;
+			}
+			case AstNode::KD_LocalVarDef:
+			case AstNode::KD_GlobalVarDef: {
+				auto name = ReadSymbol();
+				return name ? arena.New<AstVarDefNode>(kind, *name) : nullptr;
+			}
+			case AstNode::KD_For: {
+				auto variable = ReadSymbol();
+				return variable ? arena.New<AstForNode>(*variable) : nullptr;
+			}
+			case AstNode::KD_NumericLiteral: {
+				auto isInteger = reader.ReadByte();
+				if (!isInteger) return nullptr;
+				if (*isInteger) {
+					auto zigzag = reader.ReadVarint();
+					if (!zigzag) return nullptr;
+					auto value = static_cast<i64>((*zigzag >> 1) ^ (~(*zigzag & 1) + 1));
+					return arena.New<AstNumericLiteralNode>(value);
+				}
+				auto value = reader.ReadF64();
+				return value ? arena.New<AstNumericLiteralNode>(*value) : nullptr;
+			}
+			case AstNode::KD_FunctionDefinition: {
+				auto name = ReadSymbol();
+				auto paramCount = reader.ReadVarint();
+				if (!name || !paramCount) return nullptr;
+				auto begin = pendingNames.size();
+				for (u64 i = 0; i < *paramCount; ++i) {
+					auto param = ReadSymbol();
+					if (!param) return nullptr;
+					pendingNames.push_back(*param);
+				}
+				auto def = arena.New<AstFunctionDefinitionNode>(*name);
+				def->params = arena.NewArray(std::span<const SymbolId>(pendingNames).subspan(begin));
+				pendingNames.resize(begin);
+				return def;
+			}
+			case AstNode::KD_BooleanLiteral: {
+				auto value = reader.ReadByte();
+				return value ? arena.New<AstBooleanLiteralNode>(*value != 0) : nullptr;
+			}
+			case AstNode::KD_BinaryOp: {
+				auto op = reader.ReadByte();
+				if (!op || *op > static_cast<u8>(BinaryOp::EXPONENT)) return nullptr;
+				return arena.New<AstBinaryOpNode>(static_cast<BinaryOp>(*op));
+			}
+			case AstNode::KD_UnaryOp: {
+				auto op = reader.ReadByte();
+				if (!op || *op > static_cast<u8>(UnaryOp::LENGTH)) return nullptr;
+				return arena.New<AstUnaryOpNode>(static_cast<UnaryOp>(*op));
+			}
+			case AstNode::KD_MetatableLiteral: {
+				auto arrayCount = reader.ReadVarint();
+				if (!arrayCount || *arrayCount > std::numeric_limits<u32>::max()) return nullptr;
+				auto table = arena.New<AstMetatableLiteralNode>();
+				table->arrayCount = static_cast<u32>(*arrayCount);
+				return table;
+			}
+			case AstNode::KD_ArrayLiteral: return arena.New<AstArrayLiteralNode>();
+			case AstNode::KD_If: return arena.New<AstIfNode>();
+			case AstNode::KD_While: return arena.New<AstWhileNode>();
+			case AstNode::KD_Until: return arena.New<AstUntilNode>();
+			case AstNode::KD_StatementBlock: return arena.New<AstStatementBlockNode>();
+			case AstNode::KD_FunctionCall: return arena.New<AstFunctionCallNode>();
+			case AstNode::KD_Nil: return arena.New<AstNilNode>();
+			case AstNode::KD_Vararg: return arena.New<AstVarargNode>();
+			case AstNode::KD_Index: return arena.New<AstIndexNode>();
+			// 没有专门的节点类型
+			default: return arena.New<AstNode>(kind);
+		}
+	}
+};
+}
+
+AstCache::AstCache(std::filesystem::path directory)
+	: directory{ std::move(directory) } {}
+
+auto AstCache::PathOf(std::string_view source, u32 flags) const -> std::filesystem::path {
+	return directory / fmt::format("{:016x}.{}.luniast", SymbolTable::HashOf(source), flags);
+}
+
+auto AstCache::Load(std::string_view source, u32 flags) const -> std::optional<ParsingResult> {
+	auto path = PathOf(source, flags);
+	auto file = SourceFile::Open(path.string());
+	if (!file) return {};
+
+	auto contents = file->Text();
+	Header header;
+	if (contents.size() < sizeof(Header)) return {};
+	std::memcpy(&header, contents.data(), sizeof(Header));
+	auto body = contents.substr(sizeof(Header));
+
+	if (header.magic != Header::kMagic
+		|| header.version != kFormatVersion
+		|| header.flags != flags
+		|| header.sourceSize != source.size()
+		|| header.sourceHash != SymbolTable::HashOf(source)
+		|| header.bodyHash != SymbolTable::HashOf(body)) {
+		LUNI_TRACE(INFO, PARSER, "[AstCache] Ignoring stale or damaged entry {}", path.string());
+		return {};
+	}
+
+	auto result = ParsingResult{};
+	result.source = source;
+
+	Reader reader{ body };
+	AstReader ast{ reader, result.arena };
+	auto root = ast.ReadSymbols() ? ast.ReadNode() : nullptr;
+	auto rangeCount = reader.ReadVarint();
+	if (!root || root->kind != AstNode::KD_Script || !rangeCount || *rangeCount != root->children.size()) {
+		LUNI_TRACE(WARN, PARSER, "[AstCache] Malformed entry {}", path.string());
+		return {};
+	}
+	result.root = &root->As<AstScriptNode>();
+
+	u64 end = 0;
+	for (u64 i = 0; i < *rangeCount; ++i) {
+		auto gap = reader.ReadVarint();
+		auto length = reader.ReadVarint();
+		if (!gap || !length || end + *gap + *length > source.size()) return {};
+		auto begin = static_cast<u32>(end + *gap);
+		end = begin + *length;
+		result.ranges.push_back(SourceRange{ begin, static_cast<u32>(end) });
+	}
+	if (!reader.Finished()) return {};
+
+	LUNI_TRACE(INFO, PARSER, "[AstCache] Loaded {} top-level nodes from {}", result.ranges.size(), path.string());
+	return result;
+}
+
+auto AstCache::Store(std::string_view source, u32 flags, const ParsingResult& ast) const -> void {
+	// 有错误的树可能含有空的子节点，也不值得缓存
+	if (!ast.root || !ast.errors.empty()) return;
+
+	AstWriter nodes;
+	nodes.WriteNode(*ast.root);
+	if (nodes.tooDeep) return;
+
+	Writer body;
+	nodes.WriteSymbols(body);
+	body.buffer += nodes.nodes.buffer;
+	body.WriteVarint(ast.ranges.size());
+	u32 end = 0;
+	for (auto range : ast.ranges) {
+		body.WriteVarint(range.begin - end);
+		body.WriteVarint(range.end - range.begin);
+		end = range.end;
+	}
+
+	auto header = Header{
+		.magic = Header::kMagic,
+		.version = kFormatVersion,
+		.flags = flags,
+		.sourceSize = static_cast<u32>(source.size()),
+		.sourceHash = SymbolTable::HashOf(source),
+		.bodyHash = SymbolTable::HashOf(body.buffer),
+	};
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error) {
+		LUNI_TRACE(WARN, PARSER, "[AstCache] Unable to create {}: {}", directory.string(), error.message());
+		return;
+	}
+
+	// 先写入一个不会和其他写入者冲突的临时文件，完整写入之后再重命名
+	auto path = PathOf(source, flags);
+	auto temp = path;
+	temp += fmt::format(".{:08x}.tmp", std::random_device{}());
+	{
+		auto ofs = std::ofstream{ temp, std::ios::binary | std::ios::trunc };
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		ofs.write(body.buffer.data(), static_cast<std::streamsize>(body.buffer.size()));
+		if (!ofs) {
+			LUNI_TRACE(WARN, PARSER, "[AstCache] Unable to write {}", temp.string());
+			ofs.close();
+			std::filesystem::remove(temp, error);
+			return;
+		}
+	}
+	std::filesystem::rename(temp, path, error);
+	if (error) {
+		LUNI_TRACE(WARN, PARSER, "[AstCache] Unable to rename {}: {}", temp.string(), error.message());
+		std::filesystem::remove(temp, error);
+		return;
+	}
+	LUNI_TRACE(INFO, PARSER, "[AstCache] Stored {} bytes to {}", sizeof(Header) + body.buffer.size(), path.string());
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Parser.hpp"
+#include "Util.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace LuNI {
+
+/// 磁盘上的AST缓存，源文件没有变化时跳过lexing和parsing
+///
+/// 每个条目是一个以源文件内容的哈希值命名的文件，内容是按前序排列、用变长整数编码的节点，加上其中用到的
+/// 所有名字和字符串的文本（SymbolId只在一个进程中有意义，加载时重新驻留），大小和源文件相近。
+/// 条目还记录了格式版本、编译选项和源文件的大小，任何一项不匹配都视为未命中。只缓存没有语法错误、嵌套深度不超过上限的结果。
+///
+/// 所有成员函数都是线程安全的；写入时先写临时文件再重命名，多个进程同时使用同一个目录也不会读到写了一半的条目。
+/// 缓存的读写失败不会影响编译，只会退回到正常的解析。
+class AstCache {
+public:
+	/// 改变AST节点或者序列化格式时必须增加，旧的条目会因为版本不匹配而被忽略
+	static constexpr u32 kFormatVersion = 2;
+
+	/// 影响缓存内容的编译选项
+	enum Flags : u32 {
+		OPTIMIZED = 1 << 0, //< 经过了`OptimizeAst`
+	};
+
+private:
+	std::filesystem::path directory;
+
+public:
+	/// `directory`不存在时会在第一次写入时创建
+	explicit AstCache(std::filesystem::path directory);
+
+	/// 未命中时返回空。返回的结果引用`source`，`ResolveScopes`需要重新进行
+	auto Load(std::string_view source, u32 flags) const -> std::optional<ParsingResult>;
+
+	auto Store(std::string_view source, u32 flags, const ParsingResult& ast) const -> void;
+
+private:
+	auto PathOf(std::string_view source, u32 flags) const -> std::filesystem::path;
+};
+
+} // namespace LuNI
@@ -9,9 +9,80 @@ using namespace LuNI;
 AstNode::AstNode(Kind kind) noexcept
 	: kind{ kind } {}
 
-AstScriptNode::AstScriptNode()
+AstScriptNode::AstScriptNode() noexcept
 	: AstNode(KD_Script) {}
 
-AstNumericLiteralNode::AstNumericLiteralNode()
-	: AstNode(KD_NumericLiteral) {
+AstIdentifierNode::AstIdentifierNode(SymbolId name) noexcept
+	: AstNode(KD_Identifier)
+	, name{ name } {}
+
+AstStatementBlockNode::AstStatementBlockNode() noexcept
+	: AstNode(KD_StatementBlock) {}
+
+AstNumericLiteralNode::AstNumericLiteralNode(i64 integer) noexcept
+	: AstNode(KD_NumericLiteral)
+	, isInteger{ true }
+	, integer{ integer } {}
+
+AstNumericLiteralNode::AstNumericLiteralNode(f64 number) noexcept
+	: AstNode(KD_NumericLiteral)
+	, isInteger{ false }
+	, number{ number } {}
+
+AstStringLiteralNode::AstStringLiteralNode(SymbolId value) noexcept
+	: AstNode(KD_StringLiteral)
+	, value{ value } {}
+
+AstArrayLiteralNode::AstArrayLiteralNode() noexcept
+	: AstNode(KD_ArrayLiteral) {}
+
+AstMetatableLiteralNode::AstMetatableLiteralNode() noexcept
+	: AstNode(KD_MetatableLiteral) {}
+
+AstFunctionDefinitionNode::AstFunctionDefinitionNode(SymbolId name) noexcept
+	: AstNode(KD_FunctionDefinition)
+	, name{ name } {}
+
+AstVarDefNode::AstVarDefNode(Kind kind, SymbolId name) noexcept
+	: AstNode(kind)
+	, name{ name }
+	, scope{ kind == KD_LocalVarDef ? VariableScope::LOCAL : VariableScope::GLOBAL } {
+	assert(Accepts(kind));
 }
+
+AstIfNode::AstIfNode() noexcept
+	: AstNode(KD_If) {}
+
+AstWhileNode::AstWhileNode() noexcept
+	: AstNode(KD_While) {}
+
+AstUntilNode::AstUntilNode() noexcept
+	: AstNode(KD_Until) {}
+
+AstForNode::AstForNode(SymbolId variable) noexcept
+	: AstNode(KD_For)
+	, variable{ variable } {}
+
+AstFunctionCallNode::AstFunctionCallNode() noexcept
+	: AstNode(KD_FunctionCall) {}
+
+AstNilNode::AstNilNode() noexcept
+	: AstNode(KD_Nil) {}
+
+AstBooleanLiteralNode::AstBooleanLiteralNode(bool value) noexcept
+	: AstNode(KD_BooleanLiteral)
+	, value{ value } {}
+
+AstVarargNode::AstVarargNode() noexcept
+	: AstNode(KD_Vararg) {}
+
+AstBinaryOpNode::AstBinaryOpNode(BinaryOp op) noexcept
+	: AstNode(KD_BinaryOp)
+	, op{ op } {}
+
+AstUnaryOpNode::AstUnaryOpNode(UnaryOp op) noexcept
+	: AstNode(KD_UnaryOp)
+	, op{ op } {}
+
+AstIndexNode::AstIndexNode() noexcept
+	: AstNode(KD_Index) {}
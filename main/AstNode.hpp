@@ -1,17 +1,57 @@
 #pragma once
 
-#include <memory>
+#include "Symbol.hpp"
+#include "Util.hpp"
+
+#include <cassert>
 #include <span>
 #include <string_view>
-#include <vector>
 
 namespace LuNI {
 
+/// 二元运算符，按照优先级从低到高排列
+enum class BinaryOp : u8 {
+	OR,
+	AND,
+	LESS,
+	GREATER,
+	LESS_EQ,
+	GREATER_EQ,
+	NOT_EQUAL,
+	EQUALS,
+	CONCAT,
+	ADD,
+	SUBTRACT,
+	MULTIPLY,
+	DIVIDE,
+	MOD,
+	EXPONENT,
+};
+
+enum class UnaryOp : u8 {
+	NOT,
+	NEGATE,
+	LENGTH,
+};
+
+/// 名字所引用的变量存放在哪里，由`ResolveScopes`填写
+enum class VariableScope : u8 {
+	GLOBAL, //< 按名字查找全局变量表
+	LOCAL, //< 当前函数栈帧中的槽位
+	UPVALUE, //< 外层函数（也就是脚本本身）栈帧中的槽位
+};
+
+/// AST节点的基类
+///
+/// 所有节点都分配在`ParsingResult`所拥有的`Arena`中，子节点通过指针引用，整棵树随着arena一次性释放。
+/// 因此节点必须可平凡析构：名字和字符串使用驻留在`SymbolTable::Global()`中的`SymbolId`，列表使用指向arena的`std::span`。
+/// 节点不引用源文件，源文件可以在解析之后释放。
 class AstNode {
 public:
 	enum Kind {
 		KD_Script, //< 根节点
 
+		KD_Identifier,
 		KD_NumericLiteral,
 		KD_StringLiteral,
 		KD_ArrayLiteral,
@@ -26,31 +66,87 @@ public:
 		KD_StatementBlock, //< 既可以是表达式也可以是语句
 
 		KD_FunctionCall,
+		KD_Nil,
+		KD_BooleanLiteral,
+		KD_Vararg, //< "..."
+		KD_BinaryOp,
+		KD_UnaryOp,
+		KD_Index, //< `a[b]`或者`a.b`
 
 		kKindCount,
 	};
 
 public:
 	Kind kind;
+	/// 所有子节点，按照源代码中的顺序排列。具体每个位置的含义由子类的访问函数给出
+	std::span<AstNode*> children;
 
 public:
 	AstNode(Kind kind) noexcept;
 	AstNode(const AstNode& that) noexcept = delete;
 	AstNode& operator=(const AstNode& that) noexcept = delete;
-	AstNode(AstNode&& that) noexcept = default;
-	AstNode& operator=(AstNode&& that) noexcept = default;
 
-	virtual std::span<AstNode> GetChildren() const = 0;
+	auto GetChildren() const -> std::span<AstNode* const> {
+		return children;
+	}
+
+	/// 转换到具体的节点类型，`kind`必须是`T`所能表示的类型
+	template <typename T>
+	auto As() -> T& {
+		assert(T::Accepts(kind));
+		return static_cast<T&>(*this);
+	}
+
+	template <typename T>
+	auto As() const -> const T& {
+		assert(T::Accepts(kind));
+		return static_cast<const T&>(*this);
+	}
 };
 
+#define LUNI_AST_NODE_ACCEPTS(...) \
+	static constexpr auto Accepts(Kind kind) -> bool { \
+		for (auto k : { __VA_ARGS__ }) { \
+			if (k == kind) return true; \
+		} \
+		return false; \
+	}
+
 // ========================================
 // Misc nodes
 // ========================================
 
+/// children: 所有顶层语句和定义
 class AstScriptNode : public AstNode {
 public:
-	AstScriptNode();
-	// TODO
+	/// 脚本顶层的局部变量所需的槽位数
+	u32 slotCount = 0;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Script)
+
+	AstScriptNode() noexcept;
+};
+
+class AstIdentifierNode : public AstNode {
+public:
+	SymbolId name;
+	VariableScope scope = VariableScope::GLOBAL;
+	/// `scope`不是GLOBAL时有效
+	u32 slot = 0;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Identifier)
+
+	AstIdentifierNode(SymbolId name) noexcept;
+};
+
+/// children: 所有语句
+class AstStatementBlockNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_StatementBlock)
+
+	AstStatementBlockNode() noexcept;
 };
 
 // ========================================
@@ -59,37 +155,231 @@ public:
 
 class AstNumericLiteralNode : public AstNode {
 public:
-	double value;
+	bool isInteger;
+	union {
+		i64 integer;
+		f64 number;
+	};
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_NumericLiteral)
+
+	explicit AstNumericLiteralNode(i64 integer) noexcept;
+	explicit AstNumericLiteralNode(f64 number) noexcept;
+};
+
+class AstStringLiteralNode : public AstNode {
+public:
+	/// 源文件中引号之内的原始文本，转义序列保持原样
+	SymbolId value;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_StringLiteral)
+
+	AstStringLiteralNode(SymbolId value) noexcept;
+};
+
+/// `{ a, b, c }`，所有元素都没有键，依次对应从1开始的整数
+/// children: 所有元素
+class AstArrayLiteralNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_ArrayLiteral)
+
+	AstArrayLiteralNode() noexcept;
+};
+
+/// 至少有一个`name = value`或者`[key] = value`的表构造器。没有键的元素使用从1开始的整数字面量作为键，
+/// 所有元素按照源文件中的顺序求值和赋值
+/// children: [key0, value0, key1, value1, ...]
+class AstMetatableLiteralNode : public AstNode {
+public:
+	/// 没有键的元素个数，创建表时作为数组部分的大小，其余的元素放进哈希部分
+	u32 arrayCount = 0;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_MetatableLiteral)
+
+	AstMetatableLiteralNode() noexcept;
+
+	auto FieldCount() const -> usize { return children.size() / 2; }
+	auto Key(usize index) const -> AstNode* { return children[index * 2]; }
+	auto Value(usize index) const -> AstNode* { return children[index * 2 + 1]; }
+};
+
+// ========================================
+// Definition nodes
+// ========================================
+
+/// children: [body]
+class AstFunctionDefinitionNode : public AstNode {
+public:
+	SymbolId name;
+	/// 参数依次占用槽位0到`params.size() - 1`
+	std::span<SymbolId> params;
+	/// 参数和所有局部变量所需的槽位数，调用之前就可以分配好整个栈帧
+	u32 slotCount = 0;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_FunctionDefinition)
+
+	AstFunctionDefinitionNode(SymbolId name) noexcept;
+
+	auto Body() const -> AstNode* { return children[0]; }
+};
+
+/// children: [value]
+///
+/// KD_GlobalVarDef是不带`local`的赋值，名字在作用域内有同名的局部变量时赋值给局部变量，由`scope`区分
+class AstVarDefNode : public AstNode {
+public:
+	SymbolId name;
+	VariableScope scope = VariableScope::GLOBAL;
+	/// `scope`不是GLOBAL时有效
+	u32 slot = 0;
 
 public:
-	AstNumericLiteralNode();
+	LUNI_AST_NODE_ACCEPTS(KD_LocalVarDef, KD_GlobalVarDef)
+
+	AstVarDefNode(Kind kind, SymbolId name) noexcept;
+
+	auto Value() const -> AstNode* { return children[0]; }
 };
 
 // ========================================
 // Control flow nodes
 // ========================================
 
+/// children: [condition, ifBody] 或者 [condition, ifBody, elseBody]
 class AstIfNode : public AstNode {
 public:
-	std::unique_ptr<AstNode> condition;
-	std::unique_ptr<AstNode> ifBody;
-	std::unique_ptr<AstNode> elseBody;
+	LUNI_AST_NODE_ACCEPTS(KD_If)
 
-public:
-	AstIfNode();
+	AstIfNode() noexcept;
+
+	auto Condition() const -> AstNode* { return children[0]; }
+	auto IfBody() const -> AstNode* { return children[1]; }
+	auto ElseBody() const -> AstNode* { return children.size() > 2 ? children[2] : nullptr; }
 };
 
+/// children: [condition, body]
 class AstWhileNode : public AstNode {
 public:
-	std::unique_ptr<AstNode> condition;
-	bool invertCondition = false; // If true, this will the effectively an `until` statement
+	LUNI_AST_NODE_ACCEPTS(KD_While)
+
+	AstWhileNode() noexcept;
+
+	auto Condition() const -> AstNode* { return children[0]; }
+	auto Body() const -> AstNode* { return children[1]; }
+};
+
+/// `repeat ... until cond`，和while不同的是先执行循环体再检查条件
+/// children: [body, condition]
+class AstUntilNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Until)
+
+	AstUntilNode() noexcept;
+
+	auto Body() const -> AstNode* { return children[0]; }
+	auto Condition() const -> AstNode* { return children[1]; }
+};
+
+/// children: [start, stop, step, body]
+class AstForNode : public AstNode {
+public:
+	SymbolId variable;
+	/// 循环变量的槽位
+	u32 slot = 0;
 
 public:
-	AstWhileNode();
+	LUNI_AST_NODE_ACCEPTS(KD_For)
+
+	AstForNode(SymbolId variable) noexcept;
+
+	auto Start() const -> AstNode* { return children[0]; }
+	auto Stop() const -> AstNode* { return children[1]; }
+	auto Step() const -> AstNode* { return children[2]; }
+	auto Body() const -> AstNode* { return children[3]; }
 };
 
 // ========================================
 // Expression nodes
 // ========================================
 
+/// children: [callee, arguments...]
+class AstFunctionCallNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_FunctionCall)
+
+	AstFunctionCallNode() noexcept;
+
+	auto Callee() const -> AstNode* { return children[0]; }
+	auto Arguments() const -> std::span<AstNode* const> { return GetChildren().subspan(1); }
+};
+
+class AstNilNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Nil)
+
+	AstNilNode() noexcept;
+};
+
+class AstBooleanLiteralNode : public AstNode {
+public:
+	bool value;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_BooleanLiteral)
+
+	AstBooleanLiteralNode(bool value) noexcept;
+};
+
+class AstVarargNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Vararg)
+
+	AstVarargNode() noexcept;
+};
+
+/// children: [lhs, rhs]
+class AstBinaryOpNode : public AstNode {
+public:
+	BinaryOp op;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_BinaryOp)
+
+	AstBinaryOpNode(BinaryOp op) noexcept;
+
+	auto Lhs() const -> AstNode* { return children[0]; }
+	auto Rhs() const -> AstNode* { return children[1]; }
+};
+
+/// children: [operand]
+class AstUnaryOpNode : public AstNode {
+public:
+	UnaryOp op;
+
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_UnaryOp)
+
+	AstUnaryOpNode(UnaryOp op) noexcept;
+
+	auto Operand() const -> AstNode* { return children[0]; }
+};
+
+/// `a.b`会被表示成`a["b"]`，也就是key为字符串字面量
+/// children: [object, key]
+class AstIndexNode : public AstNode {
+public:
+	LUNI_AST_NODE_ACCEPTS(KD_Index)
+
+	AstIndexNode() noexcept;
+
+	auto Object() const -> AstNode* { return children[0]; }
+	auto Key() const -> AstNode* { return children[1]; }
+};
+
+#undef LUNI_AST_NODE_ACCEPTS
+
 } // namespace LuNI
@@ -17,9 +17,18 @@ struct RuntimeError {
 
 namespace ErrorCodes {
 	constexpr u32 INPUT_FILE_NOT_FOUND = 0;
+	constexpr u32 INPUT_FILE_TOO_LARGE = 1;
+
+	constexpr u32 LEXER_UNEXPECTED_CHARACTER = 50;
+	constexpr u32 LEXER_UNFINISHED_STRING = 51;
+	constexpr u32 LEXER_UNFINISHED_COMMENT = 52;
+	constexpr u32 LEXER_MALFORMED_NUMBER = 53;
 
 	constexpr u32 PARSER_EXPECTED_IDENTIFIER = 100;
 	constexpr u32 PARSER_EXPECTED_OPERATOR = 101;
+	constexpr u32 PARSER_EXPECTED_EXPRESSION = 102;
+	constexpr u32 PARSER_EXPECTED_KEYWORD = 103;
+	constexpr u32 PARSER_EXPECTED_STATEMENT = 104;
 	// TODO
 } // namespace ErrorCodes
 
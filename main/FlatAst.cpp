@@ -0,0 +1,132 @@
+#include "FlatAst.hpp"
+
+#include <cassert>
+
+using namespace LuNI;
+
+auto FlatAst::Build(const AstNode& root) -> FlatAst {
+	FlatAst ast;
+	ast.Append(root);
+	return ast;
+}
+
+auto FlatAst::Append(const AstNode& node) -> NodeId {
+	auto id = static_cast<NodeId>(kinds.size());
+	kinds.push_back(static_cast<u8>(node.kind));
+	firstChild.push_back(kNone);
+	nextSibling.push_back(kNone);
+	payload.push_back(kNone);
+
+	switch (node.kind) {
+		case AstNode::KD_Identifier: {
+			payload[id] = node.As<AstIdentifierNode>().name;
+			break;
+		}
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = node.As<AstNumericLiteralNode>();
+			auto& constant = numbers.emplace_back();
+			constant.isInteger = literal.isInteger;
+			if (literal.isInteger) {
+				constant.integer = literal.integer;
+			} else {
+				constant.number = literal.number;
+			}
+			payload[id] = static_cast<u32>(numbers.size() - 1);
+			break;
+		}
+		case AstNode::KD_StringLiteral: {
+			payload[id] = node.As<AstStringLiteralNode>().value;
+			break;
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& def = node.As<AstFunctionDefinitionNode>();
+			auto info = FunctionInfo{ def.name, static_cast<u32>(params.size()), static_cast<u32>(def.params.size()) };
+			params.insert(params.end(), def.params.begin(), def.params.end());
+			functions.push_back(info);
+			payload[id] = static_cast<u32>(functions.size() - 1);
+			break;
+		}
+		case AstNode::KD_LocalVarDef:
+		case AstNode::KD_GlobalVarDef: {
+			payload[id] = node.As<AstVarDefNode>().name;
+			break;
+		}
+		case AstNode::KD_For: {
+			payload[id] = node.As<AstForNode>().variable;
+			break;
+		}
+		// 以下几种节点的数据直接放在payload中，不使用附表
+		case AstNode::KD_BooleanLiteral: {
+			payload[id] = node.As<AstBooleanLiteralNode>().value ? 1 : 0;
+			break;
+		}
+		case AstNode::KD_BinaryOp: {
+			payload[id] = static_cast<u32>(node.As<AstBinaryOpNode>().op);
+			break;
+		}
+		case AstNode::KD_UnaryOp: {
+			payload[id] = static_cast<u32>(node.As<AstUnaryOpNode>().op);
+			break;
+		}
+		case AstNode::KD_MetatableLiteral: {
+			payload[id] = node.As<AstMetatableLiteralNode>().arrayCount;
+			break;
+		}
+		default: break;
+	}
+
+	// 子节点紧跟在父节点之后，保证整个数组是前序排列的
+	auto previous = kNone;
+	for (auto child : node.GetChildren()) {
+		auto childId = Append(*child);
+		if (previous == kNone) {
+			firstChild[id] = childId;
+		} else {
+			nextSibling[previous] = childId;
+		}
+		previous = childId;
+	}
+	return id;
+}
+
+auto FlatAst::SymbolOf(NodeId id) const -> SymbolId {
+	if (KindOf(id) == AstNode::KD_FunctionDefinition) {
+		return functions[payload[id]].name;
+	}
+	return payload[id];
+}
+
+auto FlatAst::BooleanOf(NodeId id) const -> bool {
+	assert(KindOf(id) == AstNode::KD_BooleanLiteral);
+	return payload[id] != 0;
+}
+
+auto FlatAst::BinaryOpOf(NodeId id) const -> BinaryOp {
+	assert(KindOf(id) == AstNode::KD_BinaryOp);
+	return static_cast<BinaryOp>(payload[id]);
+}
+
+auto FlatAst::UnaryOpOf(NodeId id) const -> UnaryOp {
+	assert(KindOf(id) == AstNode::KD_UnaryOp);
+	return static_cast<UnaryOp>(payload[id]);
+}
+
+auto FlatAst::ArrayCountOf(NodeId id) const -> u32 {
+	assert(KindOf(id) == AstNode::KD_MetatableLiteral);
+	return payload[id];
+}
+
+auto FlatAst::NumberOf(NodeId id) const -> const NumericConstant& {
+	assert(KindOf(id) == AstNode::KD_NumericLiteral);
+	return numbers[payload[id]];
+}
+
+auto FlatAst::ParamCountOf(NodeId id) const -> usize {
+	assert(KindOf(id) == AstNode::KD_FunctionDefinition);
+	return functions[payload[id]].paramCount;
+}
+
+auto FlatAst::ParamOf(NodeId id, usize index) const -> SymbolId {
+	assert(index < ParamCountOf(id));
+	return params[functions[payload[id]].firstParam + index];
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "AstNode.hpp"
+#include "Util.hpp"
+
+#include <span>
+#include <vector>
+
+namespace LuNI {
+
+/// 扁平的、按列储存（structure of arrays）的AST
+///
+/// 节点按照前序遍历的顺序编号，每个节点的各个字段分别放在并行的数组中，子节点通过`firstChild`/`nextSibling`
+/// 下标串联。节点自带的数据放在`payload`中，放不下的（数字、函数信息）放在按类型区分的附表中，由`payload`索引。
+/// 因为按前序排列，线性扫描所有下标就是一次完整的前序遍历；所有数据都是整数，可以直接按字节序列化
+/// （名字和字符串是`SymbolId`，只在当前进程的`SymbolTable::Global()`中有意义）。
+class FlatAst {
+public:
+	using NodeId = u32;
+	static constexpr NodeId kNone = ~NodeId{ 0 };
+
+	struct NumericConstant {
+		bool isInteger;
+		union {
+			i64 integer;
+			f64 number;
+		};
+	};
+
+	struct FunctionInfo {
+		SymbolId name;
+		u32 firstParam; //< 参数名在`params`中连续排列
+		u32 paramCount;
+	};
+
+public:
+	// ======== 每个节点一项 ========
+	std::vector<u8> kinds; //< AstNode::Kind
+	std::vector<NodeId> firstChild;
+	std::vector<NodeId> nextSibling;
+	/// KD_Identifier、KD_StringLiteral、KD_LocalVarDef、KD_GlobalVarDef和KD_For是名字或字符串的SymbolId，
+	/// KD_BooleanLiteral、KD_BinaryOp和KD_UnaryOp是值本身，KD_MetatableLiteral是没有键的元素个数，
+	/// KD_NumericLiteral和KD_FunctionDefinition是附表中的下标，没有数据时为kNone
+	std::vector<u32> payload;
+
+	// ======== 附表 ========
+	std::vector<NumericConstant> numbers; //< KD_NumericLiteral
+	std::vector<FunctionInfo> functions; //< KD_FunctionDefinition
+	std::vector<SymbolId> params; //< 所有函数的参数名
+
+public:
+	/// 从arena中的树构建
+	static auto Build(const AstNode& root) -> FlatAst;
+
+	auto Root() const -> NodeId {
+		return kinds.empty() ? kNone : 0;
+	}
+
+	auto Size() const -> usize {
+		return kinds.size();
+	}
+
+	auto KindOf(NodeId id) const -> AstNode::Kind {
+		return static_cast<AstNode::Kind>(kinds[id]);
+	}
+
+	/// KD_Identifier、KD_LocalVarDef、KD_GlobalVarDef和KD_For的名字，KD_FunctionDefinition的函数名，
+	/// KD_StringLiteral的内容
+	auto SymbolOf(NodeId id) const -> SymbolId;
+	auto BooleanOf(NodeId id) const -> bool;
+	auto BinaryOpOf(NodeId id) const -> BinaryOp;
+	auto UnaryOpOf(NodeId id) const -> UnaryOp;
+	auto ArrayCountOf(NodeId id) const -> u32;
+	auto NumberOf(NodeId id) const -> const NumericConstant&;
+	auto ParamCountOf(NodeId id) const -> usize;
+	auto ParamOf(NodeId id, usize index) const -> SymbolId;
+
+	/// 子节点的前向迭代器
+	class ChildIterator {
+	private:
+		const FlatAst* ast;
+		NodeId current;
+
+	public:
+		ChildIterator(const FlatAst* ast, NodeId current) noexcept
+			: ast{ ast }
+			, current{ current } {}
+
+		auto operator*() const -> NodeId { return current; }
+		auto operator++() -> ChildIterator& {
+			current = ast->nextSibling[current];
+			return *this;
+		}
+		auto operator==(const ChildIterator& that) const -> bool { return current == that.current; }
+	};
+
+	struct ChildRange {
+		ChildIterator first;
+
+		auto begin() const -> ChildIterator { return first; }
+		auto end() const -> ChildIterator { return ChildIterator{ nullptr, kNone }; }
+	};
+
+	auto Children(NodeId id) const -> ChildRange {
+		return ChildRange{ ChildIterator{ this, firstChild[id] } };
+	}
+
+	/// 深度优先遍历以`id`为根的子树，不经过任何虚函数调用
+	///
+	/// `visitor`需要提供`Enter(const FlatAst&, NodeId) -> bool`和`Leave(const FlatAst&, NodeId) -> void`，
+	/// `Enter`返回false时跳过该节点的子节点（但仍然会调用`Leave`）。
+	template <typename Visitor>
+	auto Walk(NodeId id, Visitor&& visitor) const -> void {
+		if (id == kNone) return;
+
+		// 显式的栈，避免深层嵌套的脚本耗尽调用栈
+		std::vector<NodeId> stack;
+		auto node = id;
+		while (true) {
+			auto descend = visitor.Enter(*this, node);
+			if (descend && firstChild[node] != kNone) {
+				stack.push_back(node);
+				node = firstChild[node];
+				continue;
+			}
+
+			visitor.Leave(*this, node);
+			// 向上回溯，直到找到一个还有下一个兄弟节点的祖先
+			while (node != id && nextSibling[node] == kNone) {
+				node = stack.back();
+				stack.pop_back();
+				visitor.Leave(*this, node);
+			}
+			if (node == id) return;
+			node = nextSibling[node];
+		}
+	}
+
+private:
+	auto Append(const AstNode& node) -> NodeId;
+};
+
+} // namespace LuNI
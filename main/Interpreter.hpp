@@ -9,7 +9,7 @@ namespace LuNI {
 
 auto RunProgram_WalkAST(
 	argparse::ArgumentParser& args,
-	const ASTNode& root
+	const AstScriptNode& root
 ) -> void;
 
 auto RunProgram(
@@ -1,194 +1,520 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <span>
 #include <string>
 #include <utility>
 #include <variant>
-#include <any>
 #include <vector>
 #include <unordered_map>
-#include <stack>
+#include <deque>
 #include <stdexcept>
 #include <tl/expected.hpp>
 #include <tsl/ordered_map.h>
+#include <fmt/format.h>
+#include <magic_enum.hpp>
 #include "Util.hpp"
+#include "LuaHeap.hpp"
+#include "LuaTable.hpp"
+#include "LuaValue.hpp"
 #include "Parser.hpp"
+#include "Symbol.hpp"
 #include "Interpreter.hpp"
+#include "Trace.hpp"
 
 using namespace LuNI;
 
 namespace {
-// TODO gc + 默认引用传参
-class LuaValue {
-public:
-	std::any val;
-
-	static auto Wrap(std::any val) -> LuaValue {
-		return LuaValue{std::move(val)};
-	}
-
-	static auto Eval(const ASTNode& exprNode) -> LuaValue {
-		return {}; // TODO
-	}
-};
+class StackFrame;
 
-using LuaVariableStore = tsl::ordered_map<std::string_view, LuaValue>;
+/// 全局变量，以驻留后的名字为键，查找只需要比较整数。局部变量不在这里，而是在栈帧的槽位中
+using LuaVariableStore = tsl::ordered_map<SymbolId, LuaValue>;
 using LuaVariable = LuaVariableStore::value_type;
 
 const auto LUA_NIL = LuaValue{};
 const auto LUA_TRUE = LuaValue{true};
 const auto LUA_FALSE = LuaValue{false};
 
-class SystemFunction {
-public:
-	using P = hn::ConstSlice<LuaVariableStore>&;
-	using ErasedFunction = auto(*)(P params) -> LuaValue;
-
-private:
-	ErasedFunction ptr;
+class LuaFunctionDef;
 
-public:
-	SystemFunction(ErasedFunction ptr) noexcept : ptr{ ptr } {}
-	operator ErasedFunction() const { return ptr; }
+/// 求值表达式时除了当前栈帧以外需要的所有状态
+struct ExecutionContext {
+	/// 脚本本身的栈帧，upvalue位于其中
+	StackFrame& script;
+	LuaVariableStore& globals;
+	LuaHeap& heap;
+	/// 以函数定义节点为键，LuaFunction对象只引用节点
+	std::unordered_map<const AstNode*, LuaFunctionDef>& functionDefs;
 };
 
+/// `frame`是当前函数的栈帧
+auto Eval(const AstNode& exprNode, const StackFrame& frame, ExecutionContext& context) -> LuaValue;
+
 namespace SystemImpl {
-	usize MAX_PARAMS = 15;
-	std::vector<std::string> paramNames = []() {
-		std::vector<std::string> result{15};
-		for (usize i = 0; i < MAX_PARAMS; ++i) {
-			result.push_back(std::to_string(i));
-		}
-		return result;
-	}();
+	using P = std::span<const LuaValue>;
 
-	auto Print(SystemFunction::P params) -> LuaValue {
-		auto& text = std::any_cast<const std::string&>(params[0].second.val);
+	auto Print([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		auto line = std::string{};
+		for (auto& param : params) {
+			if (!line.empty()) line += '\t';
+			line += param.ToString();
+		}
+		fmt::print("{}\n", line);
 		return LUA_NIL;
 	}
 
-	auto Sqrt(SystemFunction::P& params) -> LuaValue {
-		auto in = std::any_cast<f32>(params[0].second.val);
-		return LuaValue{static_cast<f32>(std::sqrt(in))};
+	/// 第一个参数不是数字时为空，数学函数此时返回nil
+	auto NumberParam(P params) -> std::optional<f64> {
+		return params.empty() ? std::nullopt : params[0].ToNumber();
 	}
 
-	auto Sin(SystemFunction::P& params) -> LuaValue {
-		auto in = std::any_cast<f32>(params[0].second.val);
-		return LuaValue{static_cast<f32>(std::sin(in))};
+	auto SetMetatable(LuaHeap& heap, P params) -> LuaValue {
+		if (params.empty() || params[0].Type() != LuaType::TABLE) {
+			throw std::runtime_error("Bad argument #1 to 'setmetatable' (table expected)");
+		}
+		auto metatable = params.size() > 1 ? params[1] : LUA_NIL;
+		if (!metatable.IsNil() && metatable.Type() != LuaType::TABLE) {
+			throw std::runtime_error("Bad argument #2 to 'setmetatable' (nil or table expected)");
+		}
+		auto table = params[0].AsObject<LuaTable>();
+		table->SetMetatable(metatable.IsNil() ? nullptr : metatable.AsObject<LuaTable>());
+		heap.Barrier(table, metatable);
+		return params[0];
 	}
 
-	auto Cos(SystemFunction::P& params) -> LuaValue {
-		auto in = std::any_cast<f32>(params[0].second.val);
-		return LuaValue{static_cast<f32>(std::cos(in))};
+	auto GetMetatable([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		if (params.empty() || params[0].Type() != LuaType::TABLE) return LUA_NIL;
+		auto metatable = params[0].AsObject<LuaTable>()->Metatable();
+		return metatable ? LuaValue{metatable} : LUA_NIL;
 	}
 
-	auto Tan(SystemFunction::P& params) -> LuaValue {
-		auto in = std::any_cast<f32>(params[0].second.val);
-		return LuaValue{static_cast<f32>(std::tan(in))};
+	auto Sqrt([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		auto in = NumberParam(params);
+		return in ? LuaValue{std::sqrt(*in)} : LUA_NIL;
+	}
+
+	auto Sin([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		auto in = NumberParam(params);
+		return in ? LuaValue{std::sin(*in)} : LUA_NIL;
+	}
+
+	auto Cos([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		auto in = NumberParam(params);
+		return in ? LuaValue{std::cos(*in)} : LUA_NIL;
+	}
+
+	auto Tan([[maybe_unused]] LuaHeap& heap, P params) -> LuaValue {
+		auto in = NumberParam(params);
+		return in ? LuaValue{std::tan(*in)} : LUA_NIL;
+	}
+
+	/// 第`index`个参数，不存在或者不是数字时为`fallback`
+	auto IntegerParam(P params, usize index, i64 fallback) -> i64 {
+		if (index >= params.size()) return fallback;
+		if (params[index].Type() == LuaType::INTEGER) return params[index].AsInteger();
+		auto number = params[index].ToNumber();
+		return number ? static_cast<i64>(*number) : fallback;
+	}
+
+	auto ModeName(LuaHeap& heap, GcMode mode) -> LuaValue {
+		return heap.Constant(Symbols().Intern(mode == GcMode::GENERATIONAL ? "generational" : "incremental"));
+	}
+
+	/// `collectgarbage(opt, ...)`，支持Lua 5.4中除了"setpause"等旧选项以外的所有选项
+	///
+	/// 这个函数可能在表达式中被调用，此时其他的临时值还没有写入栈帧，所以"collect"和"step"只是请求回收，
+	/// 实际的工作在下一个安全点进行
+	auto CollectGarbage(LuaHeap& heap, P params) -> LuaValue {
+		auto option = std::string_view{ "collect" };
+		if (!params.empty() && !params[0].IsNil()) {
+			if (params[0].Type() != LuaType::STRING) {
+				throw std::runtime_error("Bad argument #1 to 'collectgarbage' (string expected)");
+			}
+			option = params[0].AsObject<LuaString>()->Text();
+		}
+
+		if (option == "collect") {
+			heap.RequestCollection(LuaHeap::Request::FULL);
+			return LuaValue{i64{ 0 }};
+		}
+		if (option == "step") {
+			// 步骤还没有进行，不知道它是否会结束一个周期
+			heap.RequestCollection(LuaHeap::Request::STEP);
+			return LUA_FALSE;
+		}
+		if (option == "count") return LuaValue{static_cast<f64>(heap.BytesInUse()) / 1024.0};
+		if (option == "stop") {
+			heap.SetRunning(false);
+			return LuaValue{i64{ 0 }};
+		}
+		if (option == "restart") {
+			heap.SetRunning(true);
+			return LuaValue{i64{ 0 }};
+		}
+		if (option == "isrunning") return LuaValue{heap.IsRunning()};
+		// 切换模式并返回之前的模式。参数为0或者省略时保持原值
+		if (option == "incremental") {
+			// 第三个参数是一次增量步骤的时间上限，单位为微秒
+			auto parameters = heap.Parameters();
+			auto pause = IntegerParam(params, 1, 0);
+			auto stepMultiplier = IntegerParam(params, 2, 0);
+			auto budget = IntegerParam(params, 3, 0);
+			if (pause > 0) parameters.pause = static_cast<u32>(pause);
+			if (stepMultiplier > 0) parameters.stepMultiplier = static_cast<u32>(stepMultiplier);
+			if (budget > 0) parameters.stepBudget = std::chrono::microseconds{ budget };
+			heap.SetParameters(parameters);
+
+			auto previous = heap.Mode();
+			heap.SetMode(GcMode::INCREMENTAL);
+			return ModeName(heap, previous);
+		}
+		if (option == "generational") {
+			auto parameters = heap.Parameters();
+			auto minorMultiplier = IntegerParam(params, 1, 0);
+			auto majorMultiplier = IntegerParam(params, 2, 0);
+			if (minorMultiplier > 0) parameters.minorMultiplier = static_cast<u32>(minorMultiplier);
+			if (majorMultiplier > 0) parameters.majorMultiplier = static_cast<u32>(majorMultiplier);
+			heap.SetParameters(parameters);
+
+			auto previous = heap.Mode();
+			heap.SetMode(GcMode::GENERATIONAL);
+			return ModeName(heap, previous);
+		}
+		throw std::runtime_error(fmt::format("Bad argument #1 to 'collectgarbage' (invalid option '{}')", option));
 	}
 }
 
 class StackFrame;
 class LuaFunctionDef {
 public:
-	using NodeFunction = std::reference_wrapper<const ASTNode>;
-	using Impl = std::variant<NodeFunction, SystemFunction>;
-
 	struct FuncCall {
-		std::string_view calleeName;
+		/// 被调用的值，由解释器检查它是不是函数
+		LuaValue callee;
+		/// 只用于日志和栈帧的名字，被调用的不是一个名字（`t.f(x)`、`f(x)(y)`）时为"?"
+		SymbolId calleeName;
 		/// 函数调用表达式所提供的所有参数，不足的将由Interpreter填充成LUA_NIL，而多余的则会被直接扔掉
 		std::vector<LuaValue> params;
 	};
 	using YieldResult = std::variant<FuncCall, LuaValue>;
 
-	Impl impl;
+	/// 函数定义节点，对于脚本本身则是根节点
+	const AstNode& node;
 	u32 paramsCount;
+	/// 参数和所有局部变量所需的槽位数，由`ResolveScopes`计算
+	u32 slotCount;
 
-	LuaFunctionDef(Impl impl, u32 paramsCount) noexcept
-		: impl{ std::move(impl) }
-		, paramsCount{ std::move(paramsCount) } {}
+	LuaFunctionDef(const AstNode& node, u32 paramsCount, u32 slotCount) noexcept
+		: node{ node }
+		, paramsCount{ paramsCount }
+		, slotCount{ slotCount } {}
 
 	// 注意LuaFunctionDef是无状态的函数定义，LuaFunction的“实例”是Interpreter::StackFrame
-	auto Invoke(StackFrame& stackFrame, LuaVariableStore& globalVars) const -> YieldResult;
+	auto Invoke(StackFrame& stackFrame, ExecutionContext& context) const -> YieldResult;
 };
 
 class StackFrame {
 public:
-	std::string_view name;
+	SymbolId name;
 	std::reference_wrapper<const LuaFunctionDef> source;
 
-	LuaVariableStore vars;
-	hn::ConstSlice<LuaVariableStore> params;
-	hn::ConstSlice<LuaVariableStore> locals;
+	/// 参数和局部变量，按照`ResolveScopes`分配的槽位直接访问，前`paramsCount`个是参数。
+	/// 槽位数在调用之前就已经确定，执行过程中不会再分配
+	std::vector<LuaValue> slots;
 	u32 insCounter = 0;
 
-	StackFrame(std::string_view name, const LuaFunctionDef& def) noexcept
-		: name{ std::move(name) }
-		, source{ std::cref(def) }
-		, vars{def.paramsCount} // Reserve enough space for the parameters
-		, params{ hn::SliceOf(std::as_const(vars), 0, def.paramsCount) }
-		, locals{ hn::SliceOf(std::as_const(vars), def.paramsCount, vars.size()) } {}
-
-	StackFrame(const LuaFunctionDef& def) noexcept
-		: name{ std::get<std::string>(
-			*std::get<LuaFunctionDef::NodeFunction>(def.impl).get().extraData
-		)}
+	StackFrame(SymbolId name, const LuaFunctionDef& def)
+		: name{ name }
 		, source{ std::cref(def) }
-		, vars{def.paramsCount} // Reserve enough space for the parameters
-		, params{ hn::SliceOf(std::as_const(vars), 0, def.paramsCount) }
-		, locals{ hn::SliceOf(std::as_const(vars), def.paramsCount, vars.size()) } {}
+		, slots(def.slotCount) {}
+
+	StackFrame(const LuaFunctionDef& def)
+		: StackFrame(def.node.As<AstFunctionDefinitionNode>().name, def) {}
 };
 
-auto LuaFunctionDef::Invoke(StackFrame& stackFrame, LuaVariableStore& globalVars) const -> LuaFunctionDef::YieldResult {
-	//using LuaFunctionDef::NodeFunction;
-	//using LuaFunctionDef::Impl;
+// ========================================
+// 运算符和元方法
+// ========================================
+//
+// 操作数都是数字（或者字符串）时直接计算，只有失败时才查找元方法。查找元方法时先检查元表中
+// 缓存的“不存在”标记，所以没有元方法的表不需要任何字符串键的查找。
+
+/// `__index`链的最大长度，超过时认为出现了循环
+constexpr usize kMaxMetamethodChain = 2000;
 
-	if (impl.index() != 0) {
-		return std::get<SystemFunction>(impl)(stackFrame.params);
+/// 元方法目前只能是C++函数，在表达式中调用脚本函数需要解释器支持嵌套调用
+auto CallMetamethod(const LuaValue& handler, std::initializer_list<LuaValue> args, LuaHeap& heap) -> LuaValue {
+	if (handler.Type() == LuaType::LIGHT_FUNCTION) {
+		return handler.AsLightFunction()(heap, std::span(args.begin(), args.size()));
 	}
+	throw std::runtime_error("Calling script functions as metamethods is not supported yet");
+}
 
-	auto& vars = stackFrame.vars;
+/// `value`的元表中的元方法，`value`不是表或者没有这个元方法时为nil
+auto MetamethodOf(const LuaValue& value, Metamethod event, const LuaHeap& heap) -> LuaValue {
+	if (value.Type() != LuaType::TABLE) return LUA_NIL;
+	return value.AsObject<LuaTable>()->FindMetamethod(event, heap);
+}
 
-	while (true) {
-		auto& node = std::get<NodeFunction>(impl).get();
-		if (stackFrame.insCounter >= node.children.size()) {
+/// 二元运算的元方法依次在左右操作数中查找
+auto BinaryMetamethodOf(const LuaValue& lhs, const LuaValue& rhs, Metamethod event, const LuaHeap& heap) -> LuaValue {
+	auto handler = MetamethodOf(lhs, event, heap);
+	return handler.IsNil() ? MetamethodOf(rhs, event, heap) : handler;
+}
+
+auto TypeError(std::string_view action, const LuaValue& value) -> std::runtime_error {
+	return std::runtime_error(fmt::format("Attempted to {} a {} value", action, magic_enum::enum_name(value.Type())));
+}
+
+/// `object[key]`，沿着`__index`链查找
+auto Index(LuaValue object, const LuaValue& key, LuaHeap& heap) -> LuaValue {
+	for (usize depth = 0; depth < kMaxMetamethodChain; ++depth) {
+		if (object.Type() != LuaType::TABLE) throw TypeError("index", object);
+
+		auto table = object.AsObject<LuaTable>();
+		auto value = table->Get(key);
+		if (!value.IsNil()) return value;
+
+		auto handler = table->FindMetamethod(Metamethod::INDEX, heap);
+		if (handler.IsNil()) return LUA_NIL;
+		if (handler.Type() != LuaType::TABLE) return CallMetamethod(handler, { object, key }, heap);
+		object = handler;
+	}
+	throw std::runtime_error("'__index' chain too long; possible loop");
+}
+
+auto ArithmeticMetamethod(BinaryOp op) -> Metamethod {
+	switch (op) {
+		case BinaryOp::ADD: return Metamethod::ADD;
+		case BinaryOp::SUBTRACT: return Metamethod::SUB;
+		case BinaryOp::MULTIPLY: return Metamethod::MUL;
+		case BinaryOp::DIVIDE: return Metamethod::DIV;
+		case BinaryOp::MOD: return Metamethod::MOD;
+		default: return Metamethod::POW;
+	}
+}
+
+auto Arithmetic(BinaryOp op, const LuaValue& lhs, const LuaValue& rhs, LuaHeap& heap) -> LuaValue {
+	if (auto result = LuaValue::RawArith(op, lhs, rhs)) return *result;
+
+	auto handler = BinaryMetamethodOf(lhs, rhs, ArithmeticMetamethod(op), heap);
+	if (handler.IsNil()) throw TypeError("perform arithmetic on", lhs.ToNumber() ? rhs : lhs);
+	return CallMetamethod(handler, { lhs, rhs }, heap);
+}
+
+auto Equals(const LuaValue& lhs, const LuaValue& rhs, LuaHeap& heap) -> bool {
+	if (lhs.RawEquals(rhs)) return true;
+	// 只有两个表之间才会使用`__eq`
+	if (lhs.Type() != LuaType::TABLE || rhs.Type() != LuaType::TABLE) return false;
+
+	auto handler = BinaryMetamethodOf(lhs, rhs, Metamethod::EQ, heap);
+	return !handler.IsNil() && CallMetamethod(handler, { lhs, rhs }, heap).IsTruthy();
+}
+
+auto LessThan(const LuaValue& lhs, const LuaValue& rhs, LuaHeap& heap) -> bool {
+	if (auto result = LuaValue::RawLessThan(lhs, rhs)) return *result;
+
+	auto handler = BinaryMetamethodOf(lhs, rhs, Metamethod::LT, heap);
+	if (handler.IsNil()) throw TypeError("compare", lhs.ToNumber() ? rhs : lhs);
+	return CallMetamethod(handler, { lhs, rhs }, heap).IsTruthy();
+}
+
+auto LessEqual(const LuaValue& lhs, const LuaValue& rhs, LuaHeap& heap) -> bool {
+	if (auto result = LuaValue::RawLessEqual(lhs, rhs)) return *result;
+
+	auto handler = BinaryMetamethodOf(lhs, rhs, Metamethod::LE, heap);
+	if (handler.IsNil()) throw TypeError("compare", lhs.ToNumber() ? rhs : lhs);
+	return CallMetamethod(handler, { lhs, rhs }, heap).IsTruthy();
+}
+
+auto Concat(const LuaValue& lhs, const LuaValue& rhs, LuaHeap& heap) -> LuaValue {
+	auto concatenable = [](const LuaValue& value) {
+		return value.Type() == LuaType::STRING || value.ToNumber();
+	};
+	if (concatenable(lhs) && concatenable(rhs)) {
+		return heap.NewString(lhs.ToString() + rhs.ToString());
+	}
+
+	auto handler = BinaryMetamethodOf(lhs, rhs, Metamethod::CONCAT, heap);
+	if (handler.IsNil()) throw TypeError("concatenate", concatenable(lhs) ? rhs : lhs);
+	return CallMetamethod(handler, { lhs, rhs }, heap);
+}
+
+auto Length(const LuaValue& value, LuaHeap& heap) -> LuaValue {
+	if (value.Type() == LuaType::STRING) return LuaValue{static_cast<i64>(value.AsObject<LuaString>()->length)};
+	if (value.Type() != LuaType::TABLE) throw TypeError("get length of", value);
+
+	auto handler = MetamethodOf(value, Metamethod::LEN, heap);
+	if (!handler.IsNil()) return CallMetamethod(handler, { value }, heap);
+	return LuaValue{value.AsObject<LuaTable>()->Length()};
+}
+
+auto Negate(const LuaValue& value, LuaHeap& heap) -> LuaValue {
+	if (value.Type() == LuaType::INTEGER) return LuaValue{static_cast<i64>(0 - static_cast<u64>(value.AsInteger()))};
+	if (value.Type() == LuaType::NUMBER) return LuaValue{-value.AsNumber()};
+
+	auto handler = MetamethodOf(value, Metamethod::UNM, heap);
+	if (handler.IsNil()) throw TypeError("perform arithmetic on", value);
+	return CallMetamethod(handler, { value, value }, heap);
+}
+
+auto EvalBinaryOp(const AstBinaryOpNode& node, const StackFrame& frame, ExecutionContext& context) -> LuaValue {
+	auto lhs = Eval(*node.Lhs(), frame, context);
+	// `and`和`or`是短路的
+	if (node.op == BinaryOp::AND) return lhs.IsTruthy() ? Eval(*node.Rhs(), frame, context) : lhs;
+	if (node.op == BinaryOp::OR) return lhs.IsTruthy() ? lhs : Eval(*node.Rhs(), frame, context);
+
+	auto rhs = Eval(*node.Rhs(), frame, context);
+	auto& heap = context.heap;
+	switch (node.op) {
+		case BinaryOp::EQUALS: return LuaValue{Equals(lhs, rhs, heap)};
+		case BinaryOp::NOT_EQUAL: return LuaValue{!Equals(lhs, rhs, heap)};
+		case BinaryOp::LESS: return LuaValue{LessThan(lhs, rhs, heap)};
+		case BinaryOp::LESS_EQ: return LuaValue{LessEqual(lhs, rhs, heap)};
+		// `a > b`就是`b < a`
+		case BinaryOp::GREATER: return LuaValue{LessThan(rhs, lhs, heap)};
+		case BinaryOp::GREATER_EQ: return LuaValue{LessEqual(rhs, lhs, heap)};
+		case BinaryOp::CONCAT: return Concat(lhs, rhs, heap);
+		default: return Arithmetic(node.op, lhs, rhs, heap);
+	}
+}
+
+auto EvalUnaryOp(const AstUnaryOpNode& node, const StackFrame& frame, ExecutionContext& context) -> LuaValue {
+	auto operand = Eval(*node.Operand(), frame, context);
+	switch (node.op) {
+		case UnaryOp::NOT: return LuaValue{!operand.IsTruthy()};
+		case UnaryOp::NEGATE: return Negate(operand, context.heap);
+		case UnaryOp::LENGTH: return Length(operand, context.heap);
+	}
+	return LUA_NIL;
+}
+
+auto Eval(const AstNode& exprNode, const StackFrame& frame, ExecutionContext& context) -> LuaValue {
+	switch (exprNode.kind) {
+		case AstNode::KD_Nil: return LUA_NIL;
+		case AstNode::KD_BooleanLiteral: return exprNode.As<AstBooleanLiteralNode>().value ? LUA_TRUE : LUA_FALSE;
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = exprNode.As<AstNumericLiteralNode>();
+			return literal.isInteger ? LuaValue{literal.integer} : LuaValue{literal.number};
+		}
+		case AstNode::KD_StringLiteral: return context.heap.Constant(exprNode.As<AstStringLiteralNode>().value);
+		case AstNode::KD_ArrayLiteral: {
+			auto items = exprNode.GetChildren();
+			auto table = context.heap.NewTable(static_cast<u32>(items.size()), 0);
+			for (usize i = 0; i < items.size(); ++i) {
+				table->SetInteger(static_cast<i64>(i + 1), Eval(*items[i], frame, context));
+			}
+			return table;
+		}
+		case AstNode::KD_MetatableLiteral: {
+			// 按照构造器中的元素个数预先分配两部分，填充时不会重新分配
+			auto& literal = exprNode.As<AstMetatableLiteralNode>();
+			auto hashCount = static_cast<u32>(literal.FieldCount()) - literal.arrayCount;
+			auto table = context.heap.NewTable(literal.arrayCount, hashCount);
+			for (usize i = 0; i < literal.FieldCount(); ++i) {
+				auto key = Eval(*literal.Key(i), frame, context);
+				if (!table->Set(key, Eval(*literal.Value(i), frame, context))) {
+					throw std::runtime_error("Table index is nil or NaN");
+				}
+			}
+			return table;
+		}
+		case AstNode::KD_Index: {
+			auto& index = exprNode.As<AstIndexNode>();
+			auto object = Eval(*index.Object(), frame, context);
+			return Index(object, Eval(*index.Key(), frame, context), context.heap);
+		}
+		case AstNode::KD_BinaryOp: return EvalBinaryOp(exprNode.As<AstBinaryOpNode>(), frame, context);
+		case AstNode::KD_UnaryOp: return EvalUnaryOp(exprNode.As<AstUnaryOpNode>(), frame, context);
+		case AstNode::KD_FunctionCall: {
+			// 表达式中只能直接调用C++函数，脚本函数的调用需要经过解释器的调用栈
+			auto& call = exprNode.As<AstFunctionCallNode>();
+			auto callee = Eval(*call.Callee(), frame, context);
+			if (callee.Type() != LuaType::LIGHT_FUNCTION) {
+				throw std::runtime_error("Calling script functions inside expressions is not supported yet");
+			}
+			auto args = std::vector<LuaValue>{};
+			for (auto argNode : call.Arguments()) {
+				args.push_back(Eval(*argNode, frame, context));
+			}
+			return callee.AsLightFunction()(context.heap, args);
+		}
+		case AstNode::KD_Identifier: {
+			auto& identifier = exprNode.As<AstIdentifierNode>();
+			switch (identifier.scope) {
+				case VariableScope::LOCAL: return frame.slots[identifier.slot];
+				case VariableScope::UPVALUE: return context.script.slots[identifier.slot];
+				case VariableScope::GLOBAL: {
+					auto it = context.globals.find(identifier.name);
+					return it != context.globals.end() ? it->second : LUA_NIL;
+				}
+			}
 			return LUA_NIL;
 		}
+		default: return {}; // TODO
+	}
+}
+
+/// 执行到函数定义语句时才创建函数对象，和Lua一样，函数定义就是对全局变量的赋值
+auto DefineFunction(const AstFunctionDefinitionNode& funcDefNode, ExecutionContext& context) -> void {
+	auto paramsCount = static_cast<u32>(funcDefNode.params.size());
+
+	context.functionDefs.try_emplace(&funcDefNode, funcDefNode, paramsCount, funcDefNode.slotCount);
+	context.globals.insert_or_assign(funcDefNode.name, LuaValue{context.heap.NewFunction(funcDefNode)});
+	LUNI_TRACE(INFO, INTERPRETER, "[Interpreter] Defined function '{}'", Symbols().Text(funcDefNode.name));
+}
 
-		auto& childNode = *node.children[stackFrame.insCounter];
-		switch (childNode.type) {
-			case ASTType::FUNCTION_CALL: {
-				auto& calleeName = std::get<std::string>(*childNode.children[0]->extraData);
-				// TODO local函数调用
-				//auto it = vars.find(calleeName);
-				//if (it == vars.end()) return LUA_NIL;
-				//auto& func = std::get<LuaFunctionDef>(it->second.val);
+auto LuaFunctionDef::Invoke(StackFrame& stackFrame, ExecutionContext& context) const -> LuaFunctionDef::YieldResult {
+	while (true) {
+		// 安全点：两条语句之间所有存活的值都在栈帧或者全局变量中
+		context.heap.Step();
+
+		// 脚本的语句直接挂在根节点下，函数的语句则在函数体中
+		auto statements = node.kind == AstNode::KD_FunctionDefinition
+			? node.As<AstFunctionDefinitionNode>().Body()->GetChildren()
+			: node.GetChildren();
+		if (stackFrame.insCounter >= statements.size()) {
+			return LUA_NIL;
+		}
 
+		auto& childNode = *statements[stackFrame.insCounter];
+		switch (childNode.kind) {
+			case AstNode::KD_FunctionCall: {
+				auto& call = childNode.As<AstFunctionCallNode>();
+				// 被调用者可以是任意的后缀表达式，名字也按照解析出的作用域读取
+				auto callee = Eval(*call.Callee(), stackFrame, context);
+				auto calleeName = call.Callee()->kind == AstNode::KD_Identifier
+					? call.Callee()->As<AstIdentifierNode>().name
+					: Symbols().Intern("?");
+
+				// 被调用的函数返回之后从下一条语句继续
+				++stackFrame.insCounter;
 				return FuncCall {
+					.callee = callee,
 					.calleeName = calleeName,
 					.params = [&]() {
 						auto params = std::vector<LuaValue>{};
-						for (auto it = childNode.children.begin() + 1 /* 跳过函数名节点 */; it < childNode.children.end(); ++it) {
-							auto& paramNode = *it; // std::unique_ptr<...>
-							params.push_back(LuaValue::Eval(*paramNode));
+						for (auto paramNode : call.Arguments()) {
+							params.push_back(Eval(*paramNode, stackFrame, context));
 						}
 						return params;
 					}(),
 				};
 			}
-			case ASTType::FUNCTION_DEFINITION: {
-				// TODO
+			case AstNode::KD_FunctionDefinition: {
+				DefineFunction(childNode.As<AstFunctionDefinitionNode>(), context);
+				break;
 			}
-			case ASTType::VARIABLE_DECLARATION:
-			case ASTType::LOCAL_VARIABLE_DECLARATION: {
-				auto& storage = childNode.type == ASTType::LOCAL_VARIABLE_DECLARATION
-					? stackFrame.vars
-					: globalVars;
-
-				storage.insert({
-					// 变量名
-					std::get<std::string>(*childNode.children[0]->extraData),
-					// 内部储存的值（LuaValue）
-					LuaValue::Eval(*childNode.children[1]),
-				});
-				continue;
+			case AstNode::KD_GlobalVarDef:
+			case AstNode::KD_LocalVarDef: {
+				auto& varDef = childNode.As<AstVarDefNode>();
+				auto value = Eval(*varDef.Value(), stackFrame, context);
+				switch (varDef.scope) {
+					case VariableScope::LOCAL: stackFrame.slots[varDef.slot] = value; break;
+					case VariableScope::UPVALUE: context.script.slots[varDef.slot] = value; break;
+					case VariableScope::GLOBAL: context.globals.insert_or_assign(varDef.name, value); break;
+				}
+				break;
 			}
 			// TODO
 			default: {
@@ -203,126 +529,99 @@ auto LuaFunctionDef::Invoke(StackFrame& stackFrame, LuaVariableStore& globalVars
 
 class Interpreter {
 private:
-	std::stack<StackFrame> callStack;
-	std::unordered_map<std::string_view, LuaFunctionDef> functionDefs;
+	/// 用deque保证压栈时已有栈帧的地址不变，`global`一直指向第一个栈帧
+	std::deque<StackFrame> callStack;
+	/// 以函数定义节点为键，LuaFunction对象只引用节点
+	std::unordered_map<const AstNode*, LuaFunctionDef> functionDefs;
+	LuaHeap heap;
+	LuaVariableStore globals;
 	LuaFunctionDef main;
 	/// `main`的StackFrame
 	StackFrame* global;
-	bool verbose;
 
 public:
-	Interpreter(argparse::ArgumentParser& args, const ASTNode& root)
-		: functionDefs{
-			{ "print", LuaFunctionDef{SystemImpl::Print, 1} },
-			{ "sqrt", LuaFunctionDef{SystemImpl::Sqrt, 1} },
-			{ "sin", LuaFunctionDef{SystemImpl::Sin, 1} },
-			{ "cos", LuaFunctionDef{SystemImpl::Cos, 1} },
-			{ "tan", LuaFunctionDef{SystemImpl::Tan, 1} }
+	Interpreter(argparse::ArgumentParser& args, const AstScriptNode& root)
+		: globals{
+			{ Symbols().Intern("print"), LuaValue{SystemImpl::Print} },
+			{ Symbols().Intern("setmetatable"), LuaValue{SystemImpl::SetMetatable} },
+			{ Symbols().Intern("getmetatable"), LuaValue{SystemImpl::GetMetatable} },
+			{ Symbols().Intern("sqrt"), LuaValue{SystemImpl::Sqrt} },
+			{ Symbols().Intern("sin"), LuaValue{SystemImpl::Sin} },
+			{ Symbols().Intern("cos"), LuaValue{SystemImpl::Cos} },
+			{ Symbols().Intern("tan"), LuaValue{SystemImpl::Tan} },
+			{ Symbols().Intern("collectgarbage"), LuaValue{SystemImpl::CollectGarbage} }
 		}
-		, main{ LuaFunctionDef{root, 0} }
-		, verbose{ args["--verbose-execution"] == true }
+		, main{ LuaFunctionDef{root, 0, root.slotCount} }
 	{
-		callStack.push(StackFrame{"<main>", main});
-		global = &callStack.top();
+		callStack.push_back(StackFrame{Symbols().Intern("<main>"), main});
+		global = &callStack.back();
+		heap.SetRootMarker([this](LuaHeap& heap) {
+			for (auto& frame : callStack) {
+				for (auto& value : frame.slots) heap.Mark(value);
+			}
+			for (auto& [name, value] : globals) heap.Mark(value);
+		});
 	}
 
 	auto Run() -> tl::expected<u32, RuntimeError> {
+		auto context = ExecutionContext{ *global, globals, heap, functionDefs };
 		while (!callStack.empty()) {
-			auto& stackFrame = callStack.top();
+			auto& stackFrame = callStack.back();
 			auto& func = stackFrame.source.get();
 
-			bool finished = std::visit(
+			std::visit(
 				Overloaded {
 					[&](LuaFunctionDef::FuncCall&& funcCall) {
 						PushFuncCall(std::move(funcCall));
-						return false;
 				    },
 					[&](LuaValue&& ret) {
 						ReturnFromFuncCall(std::move(ret));
-						return true;
 					}
 				},
-				func.Invoke(stackFrame, global->vars)
+				func.Invoke(stackFrame, context)
 			);
-
-			if (finished) callStack.pop();
 		}
 		return 0;
 	}
 
 private:
-	auto DefineFunction(const ASTNode& funcDefNode) -> void {
-		auto& nameNode = *funcDefNode.children[0];
-		auto& funcName = std::get<std::string>(*nameNode.extraData);
-
-		auto& paramsNode = *funcDefNode.children[1];
-		auto paramsCount = static_cast<u32>(paramsNode.children.size());
-
-		functionDefs.insert({funcName, LuaFunctionDef{funcDefNode, paramsCount}});
-	}
-
 	auto PushFuncCall(LuaFunctionDef::FuncCall c) -> void {
-		auto funcDefOpt = LookupGlobalVariable<LuaFunctionDef>(c.calleeName);
-		if (!funcDefOpt) return;
-		auto& funcDef = *funcDefOpt;
+		auto& callee = c.callee;
+		if (callee.Type() == LuaType::LIGHT_FUNCTION) {
+			// C++函数不需要栈帧，直接调用
+			// 函数调用只能作为语句出现，返回值被丢弃
+			LUNI_TRACE(INFO, INTERPRETER, "[Interpreter] Calling builtin '{}' with {} arguments", Symbols().Text(c.calleeName), c.params.size());
+			callee.AsLightFunction()(heap, c.params);
+			return;
+		}
+		if (callee.Type() != LuaType::FUNCTION) {
+			LUNI_TRACE(WARN, INTERPRETER, "[Interpreter] Attempted to call undefined function '{}'", Symbols().Text(c.calleeName));
+			return;
+		}
+		auto& funcDef = functionDefs.at(&callee.AsObject<LuaFunction>()->definition);
+		LUNI_TRACE(INFO, INTERPRETER, "[Interpreter] Calling '{}' with {} arguments at depth {}", Symbols().Text(c.calleeName), c.params.size(), callStack.size());
 
 		auto stackFrame = StackFrame{c.calleeName, funcDef};
-		std::visit(
-			Overloaded {
-				[&](LuaFunctionDef::NodeFunction&& implRef) {
-					auto& impl = implRef.get();
-					// FUNCTION_DEFINITION的第一个子节点是该函数的名字
-					// 第二个子节点才是FUNC_DEF_PARAMETER_LIST
-					auto& funcParamDefs = *impl.children[1]; // ASTType::FUNC_DEF_PARAMETER_LIST
-					usize i = 0;
-					for (auto&& param : c.params) {
-						auto& paramDefNode = *funcParamDefs.children[i]; // ASTType::FUNC_DEF_PARAMETER
-						auto& paramNameNode = *paramDefNode.children[0]; // ASTType::IDENTIFIER
-						auto& paramName = std::get<std::string>(*paramNameNode.extraData); // const std::string&
-						stackFrame.vars.insert({
-							paramName,
-							std::move(param),
-						});
-						++i;
-					}
-				},
-				[&](SystemFunction&& impl) {
-					for (usize i = 0; i < c.params.size(); ++i) {
-						stackFrame.vars.insert({
-							SystemImpl::paramNames[i],
-							std::move(c.params[i]),
-						});
-					}
-				}
-			},
-			funcDef.impl
-		);
-		callStack.push(std::move(stackFrame));
+		// 参数依次放进前几个槽位，多余的参数直接扔掉，缺少的参数保持为nil
+		auto count = std::min<usize>(c.params.size(), funcDef.paramsCount);
+		std::move(c.params.begin(), c.params.begin() + count, stackFrame.slots.begin());
+		callStack.push_back(std::move(stackFrame));
 	}
 
+	/// 栈顶的函数执行完毕：弹出它的栈帧，调用者从调用语句的下一条语句继续执行
+	///
+	/// 脚本函数只能在调用语句中被调用，所以返回值没有去处，被直接丢弃
 	auto ReturnFromFuncCall(LuaValue ret) -> void {
-		// TODO
-	}
-
-	/// 尝试在全局变量空间里匹配一个拥有`name`和类型`Result`的变量
-	/// 如果成功则返回指向该变量的指针
-	/// 否则返回nullptr
-	template <typename Result>
-	auto LookupGlobalVariable(std::string_view name) -> Result* {
-		auto it = global->vars.find(name);
-		if (it == global->vars.end()) return nullptr;
-		
-		// std::any_cast有个针对指针的noexcept重载。带指针版本的any_cast会在类型不匹配时
-		// 返回空指针而不会抛异常
-		std::any* a = &it->second.val;
-		return std::any_cast<Result>(a);
+		LUNI_TRACE(INFO, INTERPRETER, "[Interpreter] Returning {} from '{}' at depth {}",
+			ret.ToString(), Symbols().Text(callStack.back().name), callStack.size());
+		callStack.pop_back();
 	}
 };
 }
 
 auto LuNI::RunProgram_WalkAST(
 	argparse::ArgumentParser& args,
-	const ASTNode& root
+	const AstScriptNode& root
 ) -> void {
 	auto interpreter = Interpreter{args, root};
 	interpreter.Run();
@@ -1,11 +1,17 @@
 #include "Lexer.hpp"
 
+#include "Symbol.hpp"
+#include "TextScan.hpp"
+#include "Trace.hpp"
+
 #include <fmt/format.h>
-#include <spdlog/spdlog.h>
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cstdlib>
 #include <functional>
 #include <magic_enum.hpp>
-#include <regex>
 #include <stdexcept>
 #include <unordered_set>
 #include <utility>
@@ -27,236 +33,16 @@ auto LuNI::NormalizeTokenType(TokenType type) -> TokenType {
 	}
 }
 
-auto LuNI::StringifyTokenType(TokenType type) -> std::string_view {
-	switch (type) {
-		case TokenType::KEYWORD_AND: return "and";
-		case TokenType::KEYWORD_BREAK: return "break";
-		case TokenType::KEYWORD_DO: return "do";
-		case TokenType::KEYWORD_ELSE: return "else";
-		case TokenType::KEYWORD_ELSEIF: return "elseif";
-		case TokenType::KEYWORD_END: return "end";
-		case TokenType::KEYWORD_FALSE: return "false";
-		case TokenType::KEYWORD_FOR: return "for";
-		case TokenType::KEYWORD_FUNCTION: return "function";
-		case TokenType::KEYWORD_IF: return "if";
-		case TokenType::KEYWORD_IN: return "in";
-		case TokenType::KEYWORD_LOCAL: return "local";
-		case TokenType::KEYWORD_NIL: return "nil";
-		case TokenType::KEYWORD_NOT: return "not";
-		case TokenType::KEYWORD_OR: return "or";
-		case TokenType::KEYWORD_REPEAT: return "repeat";
-		case TokenType::KEYWORD_RETURN: return "return";
-		case TokenType::KEYWORD_THEN: return "then";
-		case TokenType::KEYWORD_TRUE: return "true";
-		case TokenType::KEYWORD_UNTIL: return "until";
-		case TokenType::KEYWORD_WHILE: return "while";
-		case TokenType::OPERATOR_PLUS: return "+";
-		case TokenType::OPERATOR_MINUS: return "-";
-		case TokenType::OPERATOR_MULTIPLY: return "*";
-		case TokenType::OPERATOR_DIVIDE: return "/";
-		case TokenType::OPERATOR_MOD: return "%";
-		case TokenType::OPERATOR_EXPONENT: return "^";
-		case TokenType::OPERATOR_LENGTH: return "#";
-		case TokenType::OPERATOR_EQUALS: return "==";
-		case TokenType::OPERATOR_NOT_EQUAL: return "~=";
-		case TokenType::OPERATOR_LESS_EQ: return "<=";
-		case TokenType::OPERATOR_GREATER_EQ: return ">=";
-		case TokenType::OPERATOR_LESS: return "<";
-		case TokenType::OPERATOR_GREATER: return ">";
-		case TokenType::OPERATOR_ASSIGN: return "=";
-		case TokenType::SYMBOL_LEFT_PAREN: return "(";
-		case TokenType::SYMBOL_RIGHT_PAREN: return ")";
-		case TokenType::SYMBOL_LEFT_BRACE: return "{";
-		case TokenType::SYMBOL_RIGHT_BRACE: return "}";
-		case TokenType::SYMBOL_LEFT_BRACKET: return "[";
-		case TokenType::SYMBOL_RIGHT_BRACKET: return "]";
-		// 分号在lua里没什么卵用，就是让lexer正确分割token而已
-		// 实际上（TODO 看下specs）跟空白符一模一样
-		case TokenType::SYMBOL_SEMICOLON: return ";";
-		case TokenType::SYMBOL_COLON: return ":";
-		case TokenType::SYMBOL_COMMA: return ",";
-		case TokenType::SYMBOL_DOT: return ".";
-		case TokenType::SYMBOL_2_DOT: return "..";
-		case TokenType::SYMBOL_3_DOT: return "...";
-
-		case TokenType::IDENTIFIER: return "identifier";
-		case TokenType::KEYWORD: return "keyword";
-		case TokenType::OPERATOR: return "operator";
-		case TokenType::STRING_LITERAL: return "string literal";
-		case TokenType::INTEGER_LITERAL: return "integer literal";
-		case TokenType::FLOATING_POINT_LITERAL: return "floating point literal";
-
-		default: return "unknown token type";
-	}
-}
-
 namespace {
-class LexingState {
-public:
-	std::vector<Token> tokens;
-
-private:
-	const std::string* src;
-	std::string::const_iterator ptr;
-	u32 currentLine = 1;
-	u32 currentColumn = 1;
-
-public:
-	LexingState(const std::string& src) noexcept
-		: src{ &src }, ptr{ src.cbegin() } {
-	}
-
-	LexingState(const LexingState&) = delete;
-	LexingState& operator=(const LexingState&) = delete;
-	LexingState(LexingState&&) = default;
-	LexingState& operator=(LexingState&&) = default;
-
-	auto HasNext() const -> bool {
-		return ptr != src->cend();
-	}
-
-	auto Peek(usize offset = 0) const -> std::optional<char> {
-		if (!HasNext()) return {};
-		auto ptr = this->ptr + offset;
-		return *ptr;
-	}
-
-	auto PeekSome(usize chars, usize offset = 0) const -> std::optional<std::string_view> {
-		if (!HasNext()) return {};
-		auto ptr = this->ptr + offset;
-
-		// 从std::string::const_iterator::difference_type强制装换成usize
-		// 不知为何std::distance模板参数推导失败，得显示声明模板参数才行
-		usize dist = std::distance<std::string::const_iterator>(ptr, src->cend());
-		auto charsClamped = std::min(dist, chars);
-		return std::string_view(&*ptr, charsClamped);
-	}
-
-	auto Take() -> std::optional<char> {
-		if (!HasNext()) return {};
-		auto result = *ptr;
-		++ptr;
-
-		if (result == '\n') {
-			this->currentColumn = 1;
-			++this->currentLine;
-		} else {
-			++this->currentColumn;
-		}
-		return result;
-	}
-
-	auto TakeSome(usize chars) -> std::optional<std::string_view> {
-		if (!HasNext()) return {};
-		usize dist = std::distance(ptr, src->cend());
-		auto charsClamped = std::min(dist, chars);
-
-		// 将std::string::iterator转换为指针
-		auto result = std::string_view(&*ptr, charsClamped);
-
-		// TODO optimize?
-		for (usize i = 0; i < charsClamped; ++i) {
-			auto c = *ptr;
-			if (c == '\n') {
-				this->currentColumn = 1;
-				++this->currentLine;
-			} else {
-				++this->currentColumn;
-			}
-			++ptr;
-		}
-
-		return result;
-	}
-
-	auto Advance() -> bool {
-		if (!HasNext()) {
-			return false;
-		} else {
-			if (*ptr == '\n') {
-				this->currentColumn = 1;
-				++this->currentLine;
-			} else {
-				++this->currentColumn;
-			}
-			++ptr;
-			return true;
-		}
-	}
-
-	auto Advance(usize chars) -> usize {
-		usize dist = std::distance(ptr, src->cend());
-		auto charsClamped = std::min(dist, chars);
-
-		// TODO optimize?
-		for (usize i = 0; i < charsClamped; ++i) {
-			auto c = *ptr;
-			if (c == '\n') {
-				this->currentColumn = 1;
-				++this->currentLine;
-			} else {
-				++this->currentColumn;
-			}
-			++ptr;
-		}
-
-		return charsClamped;
-	}
-
-	auto Previous() -> bool {
-		if (ptr == src->cbegin()) {
-			return false;
-		} else {
-			--ptr;
-
-			if (*ptr == '\n') {
-				this->currentColumn = 1;
-				++this->currentLine;
-			} else {
-				++this->currentColumn;
-			}
-			return true;
-		}
-	}
-
-	auto Previous(usize chars) -> usize {
-		usize dist = std::distance(src->cbegin(), ptr);
-		auto charsClamped = std::min(dist, chars);
-
-		// TODO optimize?
-		for (usize i = 0; i < charsClamped; ++i) {
-			--ptr;
-			auto c = *ptr;
-			if (c == '\n') {
-				this->currentColumn = 1;
-				++this->currentLine;
-			} else {
-				++this->currentColumn;
-			}
-		}
-
-		return charsClamped;
-	}
-
-	auto AddToken(Token token) -> void {
-		tokens.push_back(token);
-	}
-
-	auto GetLastToken() const -> const Token& {
-		return tokens.back();
-	}
-
-	u32 line() const { return currentLine; }
-	u32 column() const { return currentColumn; }
+/// 关键字和运算符的拼写，是它们唯一的定义
+///
+/// 关键字查找表、运算符查找表以及`StringifyTokenType`都是在编译期由这个列表生成的。
+struct TokenSpelling {
+	std::string_view text;
+	TokenType type;
 };
-} // namespace
 
-static auto CurrentPosOf(const LexingState& state) -> TokenPos {
-	return TokenPos{ state.line(), state.column() };
-}
-
-// TODO 把上面那个巨型switch换成bimap
-static const std::unordered_map<std::string_view, TokenType> keywords{
+constexpr TokenSpelling tokenSpellings[] = {
 	{ "and", TokenType::KEYWORD_AND },
 	{ "break", TokenType::KEYWORD_BREAK },
 	{ "do", TokenType::KEYWORD_DO },
@@ -278,8 +64,6 @@ static const std::unordered_map<std::string_view, TokenType> keywords{
 	{ "true", TokenType::KEYWORD_TRUE },
 	{ "until", TokenType::KEYWORD_UNTIL },
 	{ "while", TokenType::KEYWORD_WHILE },
-};
-static const std::unordered_map<std::string_view, TokenType> operators{
 	{ "+", TokenType::OPERATOR_PLUS },
 	{ "-", TokenType::OPERATOR_MINUS },
 	{ "*", TokenType::OPERATOR_MULTIPLY },
@@ -300,6 +84,8 @@ static const std::unordered_map<std::string_view, TokenType> operators{
 	{ "}", TokenType::SYMBOL_RIGHT_BRACE },
 	{ "[", TokenType::SYMBOL_LEFT_BRACKET },
 	{ "]", TokenType::SYMBOL_RIGHT_BRACKET },
+	// 分号在lua里没什么卵用，就是让lexer正确分割token而已
+	// 实际上（TODO 看下specs）跟空白符一模一样
 	{ ";", TokenType::SYMBOL_SEMICOLON },
 	{ ":", TokenType::SYMBOL_COLON },
 	{ ",", TokenType::SYMBOL_COMMA },
@@ -307,296 +93,844 @@ static const std::unordered_map<std::string_view, TokenType> operators{
 	{ "..", TokenType::SYMBOL_2_DOT },
 	{ "...", TokenType::SYMBOL_3_DOT },
 };
-static const std::regex identifierBegin("[a-zA-Z_]");
-static const std::regex identifierAfter("[0-9a-zA-Z_]");
-static const std::regex integerLiteral("[0-9]");
-static const std::regex floatPointLiteral("[0-9]*\\.[0-9]+");
-static const std::string_view lineComment = "--";
-static const std::string_view blockCommentBeg = "--[[";
-static const std::string_view blockCommentEnd = "--]]";
 
-static auto TryLexIdentifierOrKeyword(LexingState& state) -> std::optional<Token> {
-	auto beginning = state.Peek().value_or(' ');
-	spdlog::trace("[Debug][Lexer.Iden] First char: '{}'\n", beginning);
+constexpr usize tokenTypeCount = static_cast<usize>(TokenType::SYMBOL_3_DOT) + 1;
+
+constexpr auto tokenTypeNames = []() {
+	std::array<std::string_view, tokenTypeCount> table{};
+	table[static_cast<usize>(TokenType::IDENTIFIER)] = "identifier";
+	table[static_cast<usize>(TokenType::KEYWORD)] = "keyword";
+	table[static_cast<usize>(TokenType::OPERATOR)] = "operator";
+	table[static_cast<usize>(TokenType::STRING_LITERAL)] = "string literal";
+	table[static_cast<usize>(TokenType::INTEGER_LITERAL)] = "integer literal";
+	table[static_cast<usize>(TokenType::FLOATING_POINT_LITERAL)] = "floating point literal";
+	for (auto& spelling : tokenSpellings) {
+		table[static_cast<usize>(spelling.type)] = spelling.text;
+	}
+	return table;
+}();
+} // namespace
 
-	if (!std::regex_match(std::string{ beginning }, identifierBegin)) {
-		spdlog::trace("[Debug][Lexer.Iden] First char cannot be a part of an identifier, returning\n");
-		return {};
+auto LuNI::StringifyTokenType(TokenType type) -> std::string_view {
+	auto id = static_cast<usize>(type);
+	if (id >= tokenTypeNames.size() || tokenTypeNames[id].empty()) {
+		return "unknown token type";
 	}
-	// 为了简化逻辑所以不直接使用Peek到的第一个字符，而是从头开始一个个地Take
+	return tokenTypeNames[id];
+}
 
-	// 接下来必然是identifier
-	auto pos = CurrentPosOf(state);
+namespace {
+/// 字符类别，以位标志的形式储存在`charClasses`中，一个字符可以同时属于多个类别
+enum CharClass : u8 {
+	CC_NONE = 0,
+	CC_WHITESPACE = 1 << 0,
+	CC_IDENTIFIER_BEGIN = 1 << 1,
+	CC_IDENTIFIER_PART = 1 << 2,
+	CC_DIGIT = 1 << 3,
+	CC_HEX_DIGIT = 1 << 4,
+	/// 可能出现在数字字面量中间的字符（不含指数的符号），和Lua一样先贪心地取出整个数字再检查格式
+	CC_NUMERAL = 1 << 5,
+};
 
-	std::string buf;
-	while (true) {
-		auto opt = state.Take();
-		if (!opt) break;
+/// lexer DFA的起始状态，由token的第一个字符决定
+enum class LexStart : u8 {
+	INVALID,
+	WHITESPACE,
+	IDENTIFIER,
+	NUMBER,
+	STRING,
+	DASH, //< "-"，减号或者注释
+	LEFT_BRACKET, //< "["，运算符或者多行字符串
+	OPERATOR,
+	DOT, //< "."，运算符或者以小数点开头的数字
+};
 
-		spdlog::trace("[Debug][Lexer.Iden] Fetched char: '{}'\n", *opt);
+constexpr auto charClasses = []() {
+	std::array<u8, 256> table{};
+	for (auto c : std::string_view(" \t\n\r\v\f")) {
+		table[static_cast<u8>(c)] |= CC_WHITESPACE;
+	}
+	for (usize c = 'a'; c <= 'z'; ++c) table[c] |= CC_IDENTIFIER_BEGIN | CC_IDENTIFIER_PART;
+	for (usize c = 'A'; c <= 'Z'; ++c) table[c] |= CC_IDENTIFIER_BEGIN | CC_IDENTIFIER_PART;
+	for (usize c = '0'; c <= '9'; ++c) table[c] |= CC_DIGIT | CC_IDENTIFIER_PART;
+	table['_'] |= CC_IDENTIFIER_BEGIN | CC_IDENTIFIER_PART;
+	for (usize c = '0'; c <= '9'; ++c) table[c] |= CC_HEX_DIGIT | CC_NUMERAL;
+	for (usize c = 'a'; c <= 'f'; ++c) table[c] |= CC_HEX_DIGIT | CC_NUMERAL;
+	for (usize c = 'A'; c <= 'F'; ++c) table[c] |= CC_HEX_DIGIT | CC_NUMERAL;
+	table['.'] |= CC_NUMERAL;
+	return table;
+}();
+
+constexpr auto ClassOf(char c) -> u8 {
+	return charClasses[static_cast<u8>(c)];
+}
+
+/// 同一个首字符的所有运算符在`tokenSpellings`中的下标，按照长度从长到短排列以保证最长匹配
+struct OperatorCandidates {
+	std::array<u8, 3> spellings;
+	u8 count;
+};
 
-		if (!std::regex_match(std::string{ *opt }, identifierAfter)) {
-			spdlog::trace("[Debug][Lexer.Iden] Fetched char cannot be a part of an identifier, result: '{}'\n", buf);
+constexpr auto operatorTable = []() {
+	std::array<OperatorCandidates, 256> table{};
+	for (usize i = 0; i < std::size(tokenSpellings); ++i) {
+		auto text = tokenSpellings[i].text;
+		if (ClassOf(text.front()) & CC_IDENTIFIER_BEGIN) continue;
 
-			state.Previous();
-			break;
+		auto& entry = table[static_cast<u8>(text.front())];
+		// 在常量求值中抛出异常会导致编译错误
+		if (entry.count >= entry.spellings.size()) throw "Too many operators sharing the same first character";
+
+		usize j = entry.count++;
+		while (j > 0 && tokenSpellings[entry.spellings[j - 1]].text.size() < text.size()) {
+			entry.spellings[j] = entry.spellings[j - 1];
+			--j;
+		}
+		entry.spellings[j] = static_cast<u8>(i);
+	}
+	return table;
+}();
+
+constexpr auto startStates = []() {
+	std::array<LexStart, 256> table{};
+	for (usize c = 0; c < table.size(); ++c) {
+		if (charClasses[c] & CC_WHITESPACE) {
+			table[c] = LexStart::WHITESPACE;
+		} else if (charClasses[c] & CC_IDENTIFIER_BEGIN) {
+			table[c] = LexStart::IDENTIFIER;
+		} else if (charClasses[c] & CC_DIGIT) {
+			table[c] = LexStart::NUMBER;
 		}
+	}
+	// 注意单独的“~”并不是运算符，它只能作为“~=”的开头，交给TryLexOperator判断
+	for (usize c = 0; c < table.size(); ++c) {
+		if (operatorTable[c].count > 0) table[c] = LexStart::OPERATOR;
+	}
+	table['-'] = LexStart::DASH;
+	table['['] = LexStart::LEFT_BRACKET;
+	table['.'] = LexStart::DOT;
+	table['"'] = LexStart::STRING;
+	table['\''] = LexStart::STRING;
+	return table;
+}();
+
+} // namespace
+
+namespace LuNI {
+class LexingState {
+private:
+	std::string_view src;
+	const char* ptr;
+	const char* end;
+	LineIndex lines;
+	std::vector<StandardError> errors;
 
-		buf += *opt;
-		spdlog::trace("[Debug][Lexer.Iden] Current buffer: '{}'\n", buf);
+public:
+	LexingState(std::string_view src, usize startOffset = 0) noexcept
+		: src{ src }, ptr{ src.data() + startOffset }, end{ src.data() + src.size() }, lines{ src } {
 	}
 
-	auto it = keywords.find(buf);
-	auto type = it == keywords.end()
-		? TokenType::IDENTIFIER
-		: it->second;
+	LexingState(const LexingState&) = delete;
+	LexingState& operator=(const LexingState&) = delete;
+	LexingState(LexingState&&) = default;
+	LexingState& operator=(LexingState&&) = default;
 
-	return Token{ std::move(buf), std::move(pos), type };
-}
+	auto HasNext() const -> bool {
+		return ptr != end;
+	}
 
-static auto TryLexOperator(LexingState& state) -> std::optional<Token> {
-	// 优先检测较长的运算符（“>”）以确保较短的运算符不会吞掉较长运算符的头部分
-	// 例：“<=”有可能会被当作“<"
-	// 注释以“--”开头且没有任何运算符以其结尾，所以不用管错误匹配到注释的一部分
-	for (usize n = 3; n >= 1; --n) {
-		auto opt = state.PeekSome(n);
-		if (!opt) return {};
-		auto view = *opt;
+	auto Remaining() const -> usize {
+		return static_cast<usize>(end - ptr);
+	}
 
-		spdlog::trace("[Debug][Lexer.Oper] Matching length {}, input: '{}'\n", n, view);
+	auto Offset() const -> usize {
+		return static_cast<usize>(ptr - src.data());
+	}
 
-		auto it = operators.find(view);
-		if (it != operators.end()) {
-			if (it->second == TokenType::SYMBOL_SEMICOLON) {
-				continue;
-			}
+	auto Source() const -> std::string_view {
+		return src;
+	}
 
-			spdlog::trace("[Debug][Lexer.Oper] Found matching operator '{}' with length {}\n", view, n);
+	auto Lines() const -> const LineIndex& {
+		return lines;
+	}
 
-			auto pos = CurrentPosOf(state);
-			state.Advance(n);
-			return Token{ std::string{ view }, std::move(pos), it->second };
-		}
+	auto Errors() const -> const std::vector<StandardError>& {
+		return errors;
+	}
 
-		spdlog::trace("[Debug][Lexer.Oper] No matching operator found with length {}\n", n);
+	auto TakeErrors() -> std::vector<StandardError> {
+		return std::move(errors);
 	}
 
-	spdlog::trace("[Debug][Lexer.Oper] No matching operator found with either lengths, aborting\n");
-	return {};
-}
+	/// 记录一个位于`offset`处的错误，lexer随后会跳过出错的字符继续前进。错误只通过解析结果报告一次，这里的trace仅用于调试
+	auto ReportError(u32 errorCode, usize offset, std::string_view message) -> void {
+		auto pos = lines.PosOf(static_cast<u32>(offset));
+		errors.push_back(StandardError{ errorCode, fmt::format("{} at {}", message, pos) });
+		LUNI_TRACE(DEBUG, LEXER, "[Debug][Lexer] {} at {}", message, pos);
+	}
 
-static auto TryLexSimpleString(LexingState& state) -> std::string {
-	std::string buf;
-	while (true) {
-		auto opt = state.Take();
-		if (!opt) break;
-		auto c = *opt;
+	auto Peek(usize offset = 0) const -> std::optional<char> {
+		if (offset >= Remaining()) return {};
+		return ptr[offset];
+	}
 
-		spdlog::trace("[Debug][Lexer.Str] Fetched char '{}'\n", c);
+	auto PeekSome(usize chars, usize offset = 0) const -> std::optional<std::string_view> {
+		if (offset >= Remaining()) return {};
+		auto charsClamped = std::min(Remaining() - offset, chars);
+		return std::string_view(ptr + offset, charsClamped);
+	}
 
-		if (c == '"') {
-			spdlog::trace("[Debug][Lexer.Str] Found string literal ending, result: '{}'\n", buf);
-			break;
+	/// 从当前位置（加上`offset`）开始，计算连续的、属于`mask`中任意一个类别的字符数量
+	auto PeekWhile(u8 mask, usize offset = 0) const -> usize {
+		if (offset >= Remaining()) return 0;
+		auto begin = ptr + offset;
+		auto it = begin;
+		while (it != end && (ClassOf(*it) & mask)) {
+			++it;
 		}
+		return static_cast<usize>(it - begin);
+	}
+
+	/// 从当前位置（加上`offset`）开始，到第一个等于`a`、`b`或`c`的字符的距离（相对于当前位置）
+	/// 没有找到时返回`Remaining()`
+	auto DistanceToAnyOf(usize offset, char a, char b, char c) const -> usize {
+		if (offset >= Remaining()) return Remaining();
+		return static_cast<usize>(FindAnyOf(ptr + offset, end, a, b, c) - ptr);
+	}
 
-		buf += c;
-		spdlog::trace("[Debug][Lexer.Str] Current buffer: '{}'\n", buf);
+	auto DistanceToAnyOf(usize offset, char a) const -> usize {
+		return DistanceToAnyOf(offset, a, a, a);
 	}
 
-	return buf;
+	/// 从当前位置开始的连续空白符数量
+	auto PeekWhitespace() const -> usize {
+		return static_cast<usize>(SkipWhitespace(ptr, end) - ptr);
+	}
+
+	auto Take() -> std::optional<char> {
+		if (!HasNext()) return {};
+		auto result = *ptr;
+		++ptr;
+		return result;
+	}
+
+	auto TakeSome(usize chars) -> std::optional<std::string_view> {
+		if (!HasNext()) return {};
+		auto charsClamped = std::min(Remaining(), chars);
+		auto result = std::string_view(ptr, charsClamped);
+		ptr += charsClamped;
+		return result;
+	}
+
+	auto Advance() -> bool {
+		if (!HasNext()) return false;
+		++ptr;
+		return true;
+	}
+
+	auto Advance(usize chars) -> usize {
+		auto charsClamped = std::min(Remaining(), chars);
+		ptr += charsClamped;
+		return charsClamped;
+	}
+};
+} // namespace LuNI
+
+/// 只在输出日志或错误信息时使用，第一次调用时会建立整个文件的行索引
+static auto CurrentPosOf(const LexingState& state) -> TokenPos {
+	return state.Lines().PosOf(static_cast<u32>(state.Offset()));
 }
 
-static auto TryLexMultilineString(LexingState& state) -> std::string {
-	std::string buf;
-	// TODO
-	return buf;
+/// `text`必须是`state`源文件中的一个切片
+static auto MakeToken(const LexingState& state, std::string_view text, TokenType type) -> Token {
+	auto offset = static_cast<u32>(text.data() - state.Source().data());
+	return Token{ .offset = offset, .length = static_cast<u32>(text.size()), .type = type, .integer = 0 };
 }
 
-static auto TryLexString(LexingState& state) -> std::optional<Token> {
-	if (state.Peek().value_or(' ') == '"') {
-		spdlog::trace("[Debug][Lexer.Str] Found string literal beginning\n");
+/// 关键字的完美哈希：首字符 + 尾字符 + 8 * 长度，Lua的21个关键字在64个槽位内没有冲突
+static constexpr auto KeywordHash(std::string_view text) -> usize {
+	return (static_cast<u8>(text.front()) + static_cast<u8>(text.back()) + 8 * text.size()) % 64;
+}
 
-		state.Advance();
-		auto pos = CurrentPosOf(state);
-		return Token{ TryLexSimpleString(state), std::move(pos), TokenType::STRING_LITERAL };
+static constexpr u8 kNoKeyword = 0xFF;
+
+static constexpr auto keywordTable = []() {
+	std::array<u8, 64> table{};
+	table.fill(kNoKeyword);
+	for (usize i = 0; i < std::size(tokenSpellings); ++i) {
+		auto text = tokenSpellings[i].text;
+		if (!(ClassOf(text.front()) & CC_IDENTIFIER_BEGIN)) continue;
+
+		auto& slot = table[KeywordHash(text)];
+		// 在常量求值中抛出异常会导致编译错误，以此保证修改关键字列表之后哈希函数依然是完美的
+		if (slot != kNoKeyword) throw "Keyword hash collision";
+		slot = static_cast<u8>(i);
 	}
+	return table;
+}();
 
-	if (state.PeekSome(2).value_or("") == "[[") {
-		spdlog::trace("[Debug][Lexer.Str] Found multiline string literal beginning\n");
+/// 一次哈希加上一次长度比较和memcmp，不存在的关键字通常在长度比较时就会被排除
+static auto LookupKeyword(std::string_view text) -> std::optional<TokenType> {
+	auto slot = keywordTable[KeywordHash(text)];
+	if (slot == kNoKeyword) return {};
+
+	auto& spelling = tokenSpellings[slot];
+	if (spelling.text != text) return {};
+	return spelling.type;
+}
 
-		state.Advance(2);
-		auto pos = CurrentPosOf(state);
-		return Token{ TryLexMultilineString(state), std::move(pos), TokenType::STRING_LITERAL };
+static const std::string_view lineComment = "--";
+
+static auto TryLexIdentifierOrKeyword(LexingState& state) -> std::optional<Token> {
+	auto beginning = state.Peek();
+	if (!beginning || !(ClassOf(*beginning) & CC_IDENTIFIER_BEGIN)) {
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Iden] First char cannot be a part of an identifier, returning");
+		return {};
 	}
 
-	spdlog::trace("[Debug][Lexer.Str] No string literal beginning found\n");
-	return {};
+	// 接下来必然是identifier
+	auto text = *state.TakeSome(state.PeekWhile(CC_IDENTIFIER_PART));
+	LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Iden] Result: '{}'", text);
+
+	auto type = LookupKeyword(text).value_or(TokenType::IDENTIFIER);
+
+	auto token = MakeToken(state, text, type);
+	if (type == TokenType::IDENTIFIER) token.symbol = Symbols().Intern(text);
+	return token;
 }
 
-// TODO 添加二进制、十六进制字面量的支持
-static auto TryLexIntegerLiteral(LexingState& state) -> std::optional<Token> {
-	auto firstOpt = state.Peek();
-	if (!firstOpt) return {};
-	char beginning = *firstOpt;
+static auto TryLexOperator(LexingState& state) -> std::optional<Token> {
+	auto opt = state.PeekSome(3);
+	if (!opt) return {};
+	auto view = *opt;
 
-	spdlog::trace("[Debug][Lexer.Int] First char: '{}'\n", beginning);
+	// 候选列表中较长的运算符排在前面，以确保较短的运算符不会吞掉较长运算符的头部分
+	// 例：“<=”有可能会被当作“<"
+	// 注释以“--”开头且没有任何运算符以其结尾，所以不用管错误匹配到注释的一部分
+	auto& candidates = operatorTable[static_cast<u8>(view.front())];
+	for (usize i = 0; i < candidates.count; ++i) {
+		auto& spelling = tokenSpellings[candidates.spellings[i]];
+		if (view.starts_with(spelling.text)) {
+			LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Oper] Found matching operator '{}'", spelling.text);
+
+			state.Advance(spelling.text.size());
+			return MakeToken(state, view.substr(0, spelling.text.size()), spelling.type);
+		}
+	}
 
-	if (!std::regex_match(std::string{ beginning }, integerLiteral)) {
-		spdlog::trace("[Debug][Lexer.Int] First char cannot be a part of an integer literal, returning\n");
-		return {};
+	LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Oper] No matching operator found, aborting");
+	return {};
+}
+
+/// 尝试匹配位于`offset`处的长括号开头（“[[”、“[=[”、“[==[”……）
+/// 成功时消耗掉当前位置到长括号结尾的所有字符，并返回长括号的等级（等号的数量）
+static auto TryLexLongBracketOpen(LexingState& state, usize offset = 0) -> std::optional<usize> {
+	if (state.Peek(offset) != '[') return {};
+
+	usize level = 0;
+	while (state.Peek(offset + 1 + level) == '=') {
+		++level;
 	}
+	if (state.Peek(offset + 1 + level) != '[') return {};
 
-	auto pos = CurrentPosOf(state);
+	state.Advance(offset + level + 2);
+	return level;
+}
 
-	std::string buf;
+/// 从当前位置开始寻找等级为`level`的长括号结尾（“]]”、“]=]”……）
+/// 返回长括号内容的长度，以及结尾本身的长度（如果直到文件末尾都没有找到结尾则为0）
+static auto FindLongBracketClose(const LexingState& state, usize level) -> std::pair<usize, usize> {
+	usize len = 0;
 	while (true) {
-		auto opt = state.Take();
-		if (!opt) break;
+		// 直接跳到下一个“]”，再检查它是不是一个完整的结尾
+		len = state.DistanceToAnyOf(len, ']');
+		if (len >= state.Remaining()) break;
 
-		spdlog::trace("[Debug][Lexer.Int] Fetched char: '{}'\n", *opt);
+		usize eqs = 0;
+		while (state.Peek(len + 1 + eqs) == '=') {
+			++eqs;
+		}
+		if (eqs == level && state.Peek(len + 1 + eqs) == ']') {
+			return { len, level + 2 };
+		}
+		++len;
+	}
+	return { state.Remaining(), 0 };
+}
 
-		if (!std::regex_match(std::string{ *opt }, integerLiteral)) {
-			spdlog::trace("[Debug][Lexer.Int] Fetched char cannot be a part of an integer literal, result: '{}'\n", buf);
+static auto TryLexSimpleString(LexingState& state, char quote) -> std::string_view {
+	// 转义序列被原样保留，这里只需要保证被转义的引号不会结束字符串
+	auto begin = state.Offset();
+	while (true) {
+		// 跳过所有普通字符，只有引号和反斜杠需要处理
+		state.Advance(state.DistanceToAnyOf(0, quote, '\\', quote));
 
-			state.Previous();
-			break;
+		auto opt = state.Take();
+		if (!opt) {
+			state.ReportError(ErrorCodes::LEXER_UNFINISHED_STRING, begin - 1, "Unfinished string");
+			return state.Source().substr(begin);
+		}
+		if (*opt == quote) {
+			LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Str] Found string literal ending");
+			return state.Source().substr(begin, state.Offset() - 1 - begin);
 		}
 
-		buf += *opt;
-		spdlog::trace("[Debug][Lexer.Int] Current buffer: '{}'\n", buf);
+		// 反斜杠，连同被转义的字符一起跳过
+		state.Advance();
 	}
+}
+
+static auto TryLexMultilineString(LexingState& state, usize level) -> std::string_view {
+	auto open = state.Offset() - level - 2;
+	// Lua会忽略紧跟在长括号开头之后的第一个换行符
+	if (state.Peek() == '\n') state.Advance();
 
-	return Token{ std::move(buf), std::move(pos), TokenType::INTEGER_LITERAL };
+	auto [bodyLen, closeLen] = FindLongBracketClose(state, level);
+	if (closeLen == 0) state.ReportError(ErrorCodes::LEXER_UNFINISHED_STRING, open, "Unfinished long string");
+	auto body = state.Source().substr(state.Offset(), bodyLen);
+	state.Advance(bodyLen + closeLen);
+	return body;
 }
 
-static auto TryLexFloatingPointLiteral(LexingState& state) -> std::optional<Token> {
-	auto front = TryLexIntegerLiteral(state);
+static auto TryLexString(LexingState& state) -> std::optional<Token> {
+	auto first = state.Peek();
+	if (first == '"' || first == '\'') {
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Str] Found string literal beginning");
+
+		state.Advance();
+		return MakeToken(state, TryLexSimpleString(state, *first), TokenType::STRING_LITERAL);
+	}
+
+	if (auto level = TryLexLongBracketOpen(state)) {
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Str] Found multiline string literal beginning");
+
+		return MakeToken(state, TryLexMultilineString(state, *level), TokenType::STRING_LITERAL);
+	}
+
+	LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Str] No string literal beginning found");
 	return {};
 }
 
-static auto TryLexLineComment(LexingState& state) -> void {
-	// 销毁所有字符直到一个换行符
+/// 按照Lua的规则取出一个数字字面量的完整范围（可能是格式错误的），返回其长度
+///
+/// 和Lua一样先贪心地读取所有可能属于数字的字符，然后再整体检查格式，所以“3..2”和“12abc”都会被当作格式错误的数字。
+static auto ScanNumeral(const LexingState& state, bool hex) -> usize {
+	usize length = hex ? 2 : 0;
 	while (true) {
-		auto opt = state.Take();
-		if (!opt) return;
-		auto c = *opt;
-		if (c == '\n') return;
+		length += state.PeekWhile(CC_NUMERAL, length);
+		auto c = state.Peek(length);
+		if (!c) break;
+		// 十进制的指数标记“e”已经包含在CC_NUMERAL里了，十六进制则使用“p”
+		if (hex && (*c == 'p' || *c == 'P')) {
+			++length;
+			continue;
+		}
+		auto prev = state.Peek(length - 1);
+		bool afterExponent = hex
+			? (*prev == 'p' || *prev == 'P')
+			: (*prev == 'e' || *prev == 'E');
+		if ((*c == '+' || *c == '-') && afterExponent) {
+			++length;
+			continue;
+		}
+		break;
 	}
+	// 紧跟在数字后面的字母或下划线同样属于这个（格式错误的）数字
+	if (auto c = state.Peek(length); c && (ClassOf(*c) & CC_IDENTIFIER_PART)) {
+		++length;
+	}
+	return length;
 }
 
-static auto TryLexMultilineComment(LexingState& state) -> void {
-	// 销毁所有字符直到“--]]”
-	u32 stage = 0;
-	while (true) {
-		auto opt = state.Take();
-		if (!opt) return;
-		auto c = *opt;
+/// 和Lua一样，超出int64范围的十六进制整数会回绕
+static auto ParseHexInteger(std::string_view digits) -> std::optional<i64> {
+	if (digits.empty()) return {};
+	u64 value = 0;
+	for (auto c : digits) {
+		if (!(ClassOf(c) & CC_HEX_DIGIT)) return {};
+		u64 digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+		value = (value << 4) | digit;
+	}
+	return static_cast<i64>(value);
+}
 
-		switch (c) {
-			case '-': {
-				if (stage < 2) ++stage;
-				break;
-			}
-			case ']': {
-				if (stage == 2 && stage < 4) {
-					++stage;
-				} else if (stage == 4) {
-					return;
-				}
-				break;
+static auto ParseFloat(std::string_view text, std::chars_format format) -> std::optional<f64> {
+	f64 value;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value, format);
+	if (end != text.data() + text.size()) return {};
+	if (ec == std::errc::result_out_of_range) {
+		// from_chars在溢出时不会写入结果，交给strtod得到和Lua一致的inf或者0
+		auto copy = std::string{ text };
+		if (format == std::chars_format::hex) copy.insert(0, "0x");
+		return std::strtod(copy.c_str(), nullptr);
+	}
+	if (ec != std::errc{}) return {};
+	return value;
+}
+
+/// 识别十进制、十六进制整数，以及带小数点和/或指数的十进制、十六进制浮点数，并直接转换成二进制值
+///
+/// 格式错误的数字会被报告并整个跳过，此时返回空。
+static auto TryLexNumericLiteral(LexingState& state) -> std::optional<Token> {
+	// 快速路径：不超过18位的十进制整数不可能溢出int64，可以边扫描边转换
+	auto digits = state.PeekWhile(CC_DIGIT);
+	if (auto next = state.Peek(digits); digits > 0 && digits <= 18
+		&& !(next && (ClassOf(*next) & (CC_NUMERAL | CC_IDENTIFIER_PART)))) {
+		auto text = *state.TakeSome(digits);
+		auto token = MakeToken(state, text, TokenType::INTEGER_LITERAL);
+		i64 value = 0;
+		for (auto c : text) value = value * 10 + (c - '0');
+		token.integer = value;
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Num] Integer '{}' = {}", text, token.integer);
+		return token;
+	}
+
+	auto prefix = state.PeekSome(2);
+	bool hex = prefix && ((*prefix)[0] == '0') && ((*prefix)[1] == 'x' || (*prefix)[1] == 'X');
+	auto text = *state.TakeSome(ScanNumeral(state, hex));
+
+	auto token = MakeToken(state, text, TokenType::INTEGER_LITERAL);
+	if (hex) {
+		auto body = text.substr(2);
+		if (body.find_first_of(".pP") == std::string_view::npos) {
+			if (auto value = ParseHexInteger(body)) {
+				token.integer = *value;
+				LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Num] Hex integer '{}' = {}", text, token.integer);
+				return token;
 			}
-			default: {
-				stage = 0;
-				break;
+		} else if (auto value = ParseFloat(body, std::chars_format::hex)) {
+			token.type = TokenType::FLOATING_POINT_LITERAL;
+			token.number = *value;
+			LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Num] Hex float '{}' = {}", text, token.number);
+			return token;
+		}
+	} else {
+		if (text.find_first_of(".eE") == std::string_view::npos) {
+			i64 value;
+			auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+			if (end == text.data() + text.size() && ec == std::errc{}) {
+				token.integer = value;
+				LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Num] Integer '{}' = {}", text, token.integer);
+				return token;
 			}
+			// 超出int64范围的十进制整数在Lua中会变成浮点数，由下面处理
+		}
+		if (auto value = ParseFloat(text, std::chars_format::general)) {
+			token.type = TokenType::FLOATING_POINT_LITERAL;
+			token.number = *value;
+			LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Num] Float '{}' = {}", text, token.number);
+			return token;
 		}
 	}
+
+	state.ReportError(ErrorCodes::LEXER_MALFORMED_NUMBER, token.offset, fmt::format("Malformed number '{}'", text));
+	return {};
+}
+
+static auto TryLexLineComment(LexingState& state) -> void {
+	// 销毁所有字符直到一个换行符（包括换行符本身）
+	state.Advance(state.DistanceToAnyOf(0, '\n') + 1);
 }
 
-static auto TryLexComments(LexingState& state) -> std::optional<TokenPos> {
-	auto first2Opt = state.PeekSome(2);
-	if (!first2Opt) return {};
-	auto first2 = *first2Opt;
+static auto TryLexMultilineComment(LexingState& state, usize level) -> void {
+	auto open = state.Offset() - level - 4;
+	// 销毁所有字符直到对应等级的长括号结尾，习惯上的“--]]”写法也是以“]]”结尾的
+	auto [bodyLen, closeLen] = FindLongBracketClose(state, level);
+	if (closeLen == 0) state.ReportError(ErrorCodes::LEXER_UNFINISHED_COMMENT, open, "Unfinished long comment");
+	state.Advance(bodyLen + closeLen);
+}
 
+/// 成功时返回注释开头的偏移量
+static auto TryLexComments(LexingState& state) -> std::optional<usize> {
 	// block comment marks also starts with --
-	if (first2 != lineComment) {
-		spdlog::trace("[Debug][Lexer.Comment] No comment beginning found\n");
+	if (state.PeekSome(2).value_or("") != lineComment) {
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Comment] No comment beginning found");
 		return {};
 	}
 
 	// From this point we know we have a comment
-	auto pos = CurrentPosOf(state);
+	auto begin = state.Offset();
 	state.Advance(2);
 
-	auto next2 = state.PeekSome(2, 2);
-	if (next2 && *next2 == "[[") {
-		spdlog::trace("[Debug][Lexer.Comment] Found multiline comment beginning\n");
+	if (auto level = TryLexLongBracketOpen(state)) {
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Comment] Found multiline comment beginning");
 
-		state.Advance(2);
-		TryLexMultilineComment(state);
+		TryLexMultilineComment(state, *level);
 	} else {
-		spdlog::trace("[Debug][Lexer.Comment] Found line comment beginning\n");
+		LUNI_TRACE(TRACE, LEXER, "[Debug][Lexer.Comment] Found line comment beginning");
 
 		TryLexLineComment(state);
 	}
-	return pos;
+	return begin;
 }
 
-auto LuNI::DoLexing(argparse::ArgumentParser& args, const std::string& text) -> std::vector<Token> {
-	auto verbose = args["--verbose-lexing"] == true;
+static auto LogToken(const LexingState& state, const Token& token) -> void {
+	// 参数只在LEXER类别启用时求值，因此关闭日志时不会建立行索引
+	LUNI_TRACE(INFO, LEXER, "[Lexer] Generated {} token '{}' starting at {}",
+		magic_enum::enum_name(token.type), token.Text(state.Source()), state.Lines().PosOf(token));
+}
 
-	LexingState state{ text };
+/// 跳过空白符和注释并生成下一个token，到达文件末尾时返回空
+static auto LexNextToken(LexingState& state) -> std::optional<Token> {
 	while (state.HasNext()) {
-		auto iden = TryLexIdentifierOrKeyword(state);
-		if (iden) {
-			spdlog::info("[Lexer] Generated {} token '{}'\n", magic_enum::enum_name(iden->type), iden->text);
-			spdlog::info("\tstarting at {}\n", iden->pos);
-			state.AddToken(std::move(*iden));
-			continue;
+		// 由第一个字符决定接下来使用哪个规则，每个位置上最多只会尝试两个规则
+		auto nextChar = *state.Peek();
+		std::optional<Token> token;
+		switch (startStates[static_cast<u8>(nextChar)]) {
+			case LexStart::WHITESPACE: {
+				LUNI_TRACE(INFO, LEXER, "[Lexer] Discarded whitespace at {}", CurrentPosOf(state));
+				state.Advance(state.PeekWhitespace());
+				continue;
+			}
+			case LexStart::IDENTIFIER: {
+				token = TryLexIdentifierOrKeyword(state);
+				break;
+			}
+			case LexStart::NUMBER: {
+				token = TryLexNumericLiteral(state);
+				// 格式错误的数字已经被报告并跳过
+				if (!token) continue;
+				break;
+			}
+			case LexStart::STRING: {
+				token = TryLexString(state);
+				break;
+			}
+			case LexStart::DASH: {
+				if (auto commentBegin = TryLexComments(state)) {
+					LUNI_TRACE(INFO, LEXER, "[Lexer] Discarded comments starting at {}", state.Lines().PosOf(static_cast<u32>(*commentBegin)));
+					continue;
+				}
+				token = TryLexOperator(state);
+				break;
+			}
+			case LexStart::LEFT_BRACKET: {
+				token = TryLexString(state);
+				if (!token) token = TryLexOperator(state);
+				break;
+			}
+			case LexStart::OPERATOR: {
+				token = TryLexOperator(state);
+				break;
+			}
+			case LexStart::DOT: {
+				if (auto c = state.Peek(1); c && (ClassOf(*c) & CC_DIGIT)) {
+					token = TryLexNumericLiteral(state);
+					if (!token) continue;
+				} else {
+					token = TryLexOperator(state);
+				}
+				break;
+			}
+			case LexStart::INVALID: break;
 		}
 
-		auto str = TryLexString(state);
-		if (str) {
-			spdlog::info("[Lexer] Generated string literal token '{}'\n", str->text);
-			spdlog::info("\tstarting at {}\n", str->pos);
-			state.AddToken(std::move(*str));
-			continue;
+		if (token) {
+			LogToken(state, *token);
+			return token;
 		}
 
-		auto commentPos = TryLexComments(state);
-		if (commentPos) {
-			spdlog::info("[Lexer] Discarded comments starting at {}\n", *commentPos);
-			continue;
+		// No rule matches the current character: report it, then drop it so the lexer always makes progress
+		auto printable = static_cast<u8>(nextChar) >= 0x20 && static_cast<u8>(nextChar) < 0x7F;
+		state.ReportError(ErrorCodes::LEXER_UNEXPECTED_CHARACTER, state.Offset(), printable
+			? fmt::format("Unexpected character '{}'", nextChar)
+			: fmt::format("Unexpected character '\\x{:02X}'", static_cast<u8>(nextChar)));
+		state.Advance();
+	}
+	return {};
+}
+
+auto Token::End(std::string_view source) const -> u32 {
+	auto end = offset + length;
+	// 未结束的字符串一直延伸到文件末尾
+	if (type != TokenType::STRING_LITERAL || end >= source.size()) return end;
+
+	// 字符串的内容中不会出现未转义的引号，也不会出现长括号的结尾，所以紧跟着的就是结尾
+	if (source[end] == '"' || source[end] == '\'') return end + 1;
+	auto close = end + 1;
+	while (close < source.size() && source[close] == '=') ++close;
+	return static_cast<u32>(close + 1);
+}
+
+LineIndex::LineIndex(std::string_view source) noexcept
+	: source{ source } {
+}
+
+auto LineIndex::PosOf(u32 offset) const -> TokenPos {
+	if (lineStarts.empty()) {
+		auto begin = source.data();
+		auto end = source.data() + source.size();
+
+		lineStarts.reserve(ScanNewlines(begin, end).count + 1);
+		lineStarts.push_back(0);
+		for (auto ptr = begin; (ptr = FindAnyOf(ptr, end, '\n', '\n', '\n')) != end; ++ptr) {
+			lineStarts.push_back(static_cast<u32>(ptr - begin + 1));
 		}
+	}
 
-		auto oper = TryLexOperator(state);
-		if (oper) {
-			spdlog::info("[Lexer] Generated operator token '{}'\n", oper->text);
-			spdlog::info("\tstarting at {}\n", oper->pos);
-			state.AddToken(std::move(*oper));
-			continue;
+	// 第一个大于`offset`的行开头的前一行就是`offset`所在的行
+	auto it = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+	auto line = static_cast<u32>(it - lineStarts.begin());
+	return TokenPos{ line, offset - lineStarts[line - 1] + 1 };
+}
+
+auto LineIndex::PosOf(const Token& token) const -> TokenPos {
+	return PosOf(token.offset);
+}
+
+auto LuNI::DoLexing(std::string_view source) -> LexingResult {
+	LexingState state{ source };
+	LexingResult result;
+	while (auto token = LexNextToken(state)) {
+		result.tokens.push_back(*token);
+	}
+	result.errors = state.TakeErrors();
+	return result;
+}
+
+TokenStream::TokenStream(std::string_view source, u32 startOffset)
+	: lexer{ std::make_unique<LexingState>(source, startOffset) }
+	, buffer(kWindowSize) {
+}
+
+TokenStream::~TokenStream() = default;
+
+auto TokenStream::Source() const -> std::string_view {
+	return lexer->Source();
+}
+
+auto TokenStream::Lines() const -> const LineIndex& {
+	return lexer->Lines();
+}
+
+auto TokenStream::Errors() const -> const std::vector<StandardError>& {
+	return lexer->Errors();
+}
+
+auto TokenStream::Unpin([[maybe_unused]] usize position) -> void {
+	assert(!pins.empty() && pins.back() == position);
+	pins.pop_back();
+}
+
+auto TokenStream::Rewind(usize position) -> void {
+	assert(position >= head && position <= produced);
+	cursor = position;
+}
+
+auto TokenStream::FillUntil(usize index) -> bool {
+	while (produced <= index) {
+		if (exhausted) return false;
+
+		auto token = LexNextToken(*lexer);
+		if (!token) {
+			exhausted = true;
+			return false;
 		}
 
-		auto nextChar = state.Peek().value_or('\0');
-		if (std::isspace(nextChar)) {
-#if 0
-			auto hasWhitepsace = state.GetLastToken().type == TokenType::WHITESPACE;
-			// 因为AST生成器会检查换行符（“\n”），所以必须保留所有的换行符
-			// 为了简化AST生成器的逻辑（不需要处处检查并吞掉空白符），其他的空白符就不保留了
-			// 只要能够正常分离不同的token就行了
-			if (nextChar != '\n') {
-				spdlog::info("Discarded whitespace at {}\n", CurrentPosOf(state));
-			} else if (!hasWhitepsace) {
-				// 同样是为了简化AST生成器的工作，只保留一个换行符
-				auto currentPos = CurrentPosOf(state);
-				spdlog::info("Generated whitespace token at {}\n", currentPos);
-				state.AddToken(Token{std::string{nextChar}, currentPos, TokenType::WHITESPACE});
+		if (produced - head == buffer.size()) {
+			// 缓冲区已满：丢弃最旧的token，除非它还可能被用到（尚未消耗或者被pin住）
+			auto keepFrom = pins.empty() ? cursor : std::min(cursor, pins.front());
+			if (head < keepFrom) {
+				++head;
+			} else {
+				// 容量翻倍，并把每个token放到它在新缓冲区中的位置上
+				std::vector<Token> grown(buffer.size() * 2);
+				for (auto i = head; i < produced; ++i) {
+					grown[i & (grown.size() - 1)] = buffer[i & (buffer.size() - 1)];
+				}
+				buffer = std::move(grown);
+			}
+		}
+
+		buffer[produced & (buffer.size() - 1)] = *token;
+		++produced;
+	}
+	return true;
+}
+
+auto LuNI::FindTopLevelSplits(std::string_view source, usize segments) -> std::vector<u32> {
+	std::vector<u32> splits;
+	if (segments < 2) return splits;
+
+	auto TargetOf = [&](usize k) { return source.size() * k / segments; };
+	usize next = 1; //< 正在寻找第几段的开头
+	usize depth = 0;
+	usize pendingDo = 0; //< 已经计入深度、还没有遇到`do`的`while`的个数
+	LexingState state{ source };
+	while (state.HasNext()) {
+		auto nextChar = *state.Peek();
+		switch (startStates[static_cast<u8>(nextChar)]) {
+			case LexStart::WHITESPACE: {
+				state.Advance(state.PeekWhitespace());
+				break;
+			}
+			case LexStart::IDENTIFIER: {
+				auto offset = state.Offset();
+				auto keyword = LookupKeyword(*state.TakeSome(state.PeekWhile(CC_IDENTIFIER_PART)));
+				if (!keyword) break;
+
+				switch (*keyword) {
+					case TokenType::KEYWORD_FUNCTION: {
+						if (depth == 0 && offset >= TargetOf(next)) {
+							splits.push_back(static_cast<u32>(offset));
+							// 一个很长的函数可能跨过了好几段的目标位置
+							while (next < segments && TargetOf(next) <= offset) ++next;
+							if (next == segments) return splits;
+						}
+						++depth;
+						break;
+					}
+					case TokenType::KEYWORD_WHILE: {
+						// `while`已经计入了深度，它的`do`不再算一层
+						++depth;
+						++pendingDo;
+						break;
+					}
+					case TokenType::KEYWORD_DO: {
+						if (pendingDo > 0) {
+							--pendingDo;
+						} else {
+							++depth;
+						}
+						break;
+					}
+					case TokenType::KEYWORD_IF:
+					case TokenType::KEYWORD_FOR:
+					case TokenType::KEYWORD_REPEAT: ++depth; break;
+					case TokenType::KEYWORD_END:
+					case TokenType::KEYWORD_UNTIL: if (depth > 0) --depth; break;
+					default: break;
+				}
+				break;
+			}
+			case LexStart::NUMBER: {
+				// 不需要检查格式，只要保证数字中的字母不会被当作名字
+				state.Advance(state.PeekWhile(CC_IDENTIFIER_PART | CC_NUMERAL));
+				break;
+			}
+			case LexStart::STRING: {
+				state.Advance();
+				TryLexSimpleString(state, nextChar);
+				break;
+			}
+			case LexStart::DASH: {
+				if (!TryLexComments(state)) state.Advance();
+				break;
+			}
+			case LexStart::LEFT_BRACKET: {
+				if (auto level = TryLexLongBracketOpen(state)) {
+					TryLexMultilineString(state, *level);
+				} else {
+					state.Advance();
+				}
+				break;
+			}
+			default: {
+				state.Advance();
+				break;
 			}
-#endif
-			spdlog::info("[Lexer] Discarded whitespace at {}\n", CurrentPosOf(state));
-			state.Advance();
-			continue;
 		}
 	}
-	return state.tokens;
+	return splits;
 }
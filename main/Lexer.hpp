@@ -1,14 +1,15 @@
 #pragma once
 
 #include "Error.hpp"
+#include "Symbol.hpp"
 #include "Util.hpp"
 #include "fwd.hpp"
 
 #include <fmt/format.h>
-#include <argparse/argparse.hpp>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace LuNI {
@@ -16,7 +17,7 @@ namespace LuNI {
 /// 表示token类型的enum。包含基础类型以及特殊类型（关键字、运算符，符号等）。
 ///
 /// 不包含注释token，所有的注释都会在lexing阶段被剔除。
-enum class TokenType {
+enum class TokenType : u8 {
 	// ======== 基础类型token ========
 
 	IDENTIFIER,
@@ -86,18 +87,141 @@ enum class TokenType {
 auto NormalizeTokenType(TokenType type) -> TokenType;
 auto StringifyTokenType(TokenType type) -> std::string_view;
 
+/// 从1开始的行号和列号（以字节为单位），只在输出错误信息或日志时由`LineIndex`计算
 struct TokenPos {
 	u32 line;
 	u32 column;
 };
 
+/// Token本身不储存文本，只记录其在源文件中的位置，需要时再通过`Text()`从源文件中切片，
+/// 或者通过`LineIndex`得到行列号
+///
+/// 对于字符串字面量，切片的范围是引号（或者长括号）之内的内容，转义序列保持原样。字符串在lexing时不驻留，
+/// 只有真正成为AST节点的字面量才由parser驻留。
+/// 数字字面量在lexing时就已经转换成了二进制值，parser不需要再读取它们的文本。
 struct Token {
-	std::string text;
-	TokenPos pos;
+	u32 offset;
+	u32 length;
 	TokenType type;
+	union {
+		i64 integer; //< 仅在INTEGER_LITERAL中有效
+		f64 number; //< 仅在FLOATING_POINT_LITERAL中有效
+		SymbolId symbol; //< 仅在IDENTIFIER中有效，驻留在`SymbolTable::Global()`中
+	};
+
+	auto Text(std::string_view source) const -> std::string_view {
+		return source.substr(offset, length);
+	}
+
+	/// token在源文件中真正的结尾，对于字符串字面量包括结尾的引号或者长括号，
+	/// 也就是下一个token可能开始的最早位置
+	auto End(std::string_view source) const -> u32;
+};
+
+/// 源文件中每一行开头的偏移量，用于把偏移量转换成行列号
+///
+/// 索引在第一次查询时才会建立，之后每次查询都是一次二分查找。查询会修改内部的缓存，所以不是线程安全的。
+class LineIndex {
+private:
+	std::string_view source;
+	mutable std::vector<u32> lineStarts;
+
+public:
+	explicit LineIndex(std::string_view source) noexcept;
+
+	auto PosOf(u32 offset) const -> TokenPos;
+	auto PosOf(const Token& token) const -> TokenPos;
 };
 
-auto DoLexing(argparse::ArgumentParser& args, const std::string& text) -> std::vector<Token>;
+class LexingState;
+
+/// 按需从源文件中生成token的流
+///
+/// 只缓存最近生成的一小段token（环形缓冲区），而不是整个文件的token，所以内存占用和文件大小无关。
+/// 通过`Pin`记录的位置之后的token在`Unpin`之前都不会被丢弃，缓冲区会在必要时扩容，
+/// 因此可以在任意时刻`Rewind`到一个仍然被pin住的位置，或者当前缓冲窗口内的任意位置。
+class TokenStream {
+public:
+	/// 缓冲区的初始容量，必须是2的幂
+	static constexpr usize kWindowSize = 256;
+
+private:
+	std::unique_ptr<LexingState> lexer;
+	std::vector<Token> buffer;
+	/// 以下都是token在整个流中的序号
+	usize head = 0; //< 缓冲区中最旧的token
+	usize produced = 0; //< 已经生成的token数量
+	usize cursor = 0; //< 下一个将被消耗的token
+	/// 被pin住的位置，由于Pin/Unpin按照后进先出的顺序配对，这个列表总是升序的
+	std::vector<usize> pins;
+	bool exhausted = false;
+
+public:
+	/// `source`必须比这个TokenStream存活得更久，参见`SourceFile`
+	///
+	/// 从`startOffset`开始生成token，它必须位于两个token之间（不能在字符串或者注释中间）。
+	/// token的偏移量和行号仍然相对于整个`source`
+	explicit TokenStream(std::string_view source, u32 startOffset = 0);
+	~TokenStream();
+
+	TokenStream(const TokenStream&) = delete;
+	TokenStream& operator=(const TokenStream&) = delete;
+
+	auto Source() const -> std::string_view;
+	auto Lines() const -> const LineIndex&;
+	/// 到目前为止生成的token中遇到的所有lexer错误，按照在源文件中的位置排列
+	auto Errors() const -> const std::vector<StandardError>&;
+
+	/// 查看第`offset`个尚未被消耗的token，到达文件末尾时返回nullptr
+	/// 返回的指针在下一次调用Peek/Take之前有效
+	auto Peek(usize offset = 0) -> const Token* {
+		auto index = cursor + offset;
+		if (index >= produced && !FillUntil(index)) return nullptr;
+		return &buffer[index & (buffer.size() - 1)];
+	}
+
+	auto Take() -> std::optional<Token> {
+		auto token = Peek();
+		if (!token) return {};
+		++cursor;
+		return *token;
+	}
+
+	auto Position() const -> usize {
+		return cursor;
+	}
+
+	auto Pin() -> usize {
+		pins.push_back(cursor);
+		return cursor;
+	}
+
+	auto Unpin(usize position) -> void;
+
+	auto Rewind(usize position) -> void;
+
+private:
+	auto FillUntil(usize index) -> bool;
+};
+
+struct LexingResult {
+	std::vector<Token> tokens;
+	std::vector<StandardError> errors;
+};
+
+/// 一次性生成所有token，主要用于调试和性能测试，parser使用的是`TokenStream`
+///
+/// `source`必须比返回的所有token存活得更久，参见`SourceFile`
+/// 不访问任何共享的可变状态，可以在多个线程上同时对不同的文件调用
+auto DoLexing(std::string_view source) -> LexingResult;
+
+/// 把源文件大致等分成`segments`段，返回第2段到最后一段的开头，升序排列
+///
+/// 每段的开头都是一个顶层的`function`关键字（第k段是第一个不早于`size * k / segments`的），所以各段可以独立解析。
+/// 只跳过注释和字符串、按照块关键字（`function`/`if`/`while`/`for`/`repeat`/`do`和`end`/`until`）计算嵌套深度，
+/// `while ... do`中的`do`不重复计算（这个语法中的`for`没有`do`）。
+/// 不生成token也不驻留名字，比完整的lexing快得多。找不到合适的位置时返回的数量会少于`segments - 1`。
+auto FindTopLevelSplits(std::string_view source, usize segments) -> std::vector<u32>;
 
 } // namespace LuNI
 
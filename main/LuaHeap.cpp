@@ -0,0 +1,399 @@
+#include "LuaHeap.hpp"
+
+#include "LuaTable.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+
+using namespace LuNI;
+
+/// 和`Metamethod`的顺序相同
+static constexpr std::array<std::string_view, kMetamethodCount> kMetamethodNames = {
+	"__index", "__newindex", "__len", "__eq", "__add", "__sub", "__mul", "__div",
+	"__mod", "__pow", "__unm", "__concat", "__lt", "__le", "__call",
+};
+
+/// 清除阶段每批检查的对象个数，以及每个对象计入的工作量
+static constexpr usize kSweepBatch = 64;
+static constexpr usize kSweepCost = 32;
+
+LuaHeap::LuaHeap()
+	: threshold{ kStepSize * 4 } {
+	for (usize i = 0; i < kMetamethodCount; ++i) {
+		metamethodNames[i] = NewString(kMetamethodNames[i]);
+	}
+	debt = static_cast<i64>(totalBytes) - static_cast<i64>(threshold);
+}
+
+LuaHeap::~LuaHeap() noexcept {
+	while (objects) {
+		Free(std::exchange(objects, objects->next));
+	}
+}
+
+auto LuaHeap::NewString(std::string_view text) -> LuaString* {
+	auto memory = ::operator new(sizeof(LuaString) + text.size());
+	auto string = new (memory) LuaString(static_cast<u32>(text.size()), SymbolTable::HashOf(text));
+	std::memcpy(string + 1, text.data(), text.size());
+	Link(string, SizeOf(string));
+	return string;
+}
+
+auto LuaHeap::NewTable(u32 arrayHint, u32 hashHint) -> LuaTable* {
+	auto table = new LuaTable(arrayHint, hashHint);
+	Link(table, SizeOf(table));
+	return table;
+}
+
+auto LuaHeap::NewFunction(const AstFunctionDefinitionNode& definition) -> LuaFunction* {
+	auto function = new LuaFunction(definition);
+	Link(function, SizeOf(function));
+	return function;
+}
+
+auto LuaHeap::Constant(SymbolId id) -> LuaString* {
+	if (id >= constants.size()) {
+		constants.resize(id + 1, nullptr);
+	}
+	if (!constants[id]) {
+		constants[id] = NewString(Symbols().Text(id));
+	}
+	return constants[id];
+}
+
+auto LuaHeap::Barrier(LuaTable* table, const LuaValue& value) -> void {
+	if (!value.IsObject()) return;
+	if (mode == GcMode::GENERATIONAL) {
+		if (table->age < GcAge::OLD1 || value.Object()->age >= GcAge::OLD1) return;
+		// TOUCHED2的表还在记忆集中，只需要让它多留一次小回收
+		if (table->age != GcAge::TOUCHED1 && table->age != GcAge::TOUCHED2) remembered.push_back(table);
+		table->age = GcAge::TOUCHED1;
+		return;
+	}
+
+	// 清除阶段黑色会被重置，不需要维持不变式
+	if (phase != Phase::PROPAGATE || table->color != GcColor::BLACK) return;
+	if (!IsWhite(value.Object())) return;
+
+	table->color = GcColor::GRAY;
+	grayAgain.push_back(table);
+}
+
+auto LuaHeap::SetMode(GcMode value) -> void {
+	if (value == mode) return;
+	if (value == GcMode::GENERATIONAL) {
+		EnterGenerational();
+	} else {
+		EnterIncremental();
+	}
+}
+
+auto LuaHeap::PerformStep() -> bool {
+	if (mode == GcMode::GENERATIONAL) {
+		if (totalBytes > majorThreshold) {
+			MajorCollection();
+		} else {
+			MinorCollection();
+		}
+		return true;
+	}
+
+	if (phase == Phase::PAUSE) StartCycle();
+
+	auto budget = kStepSize * parameters.stepMultiplier / 100;
+	auto deadline = std::chrono::steady_clock::now() + parameters.stepBudget;
+	usize work = 0;
+	while (phase != Phase::PAUSE) {
+		work += SingleStep();
+		if (work >= budget || std::chrono::steady_clock::now() >= deadline) break;
+	}
+
+	if (phase == Phase::PAUSE) {
+		debt = static_cast<i64>(totalBytes) - static_cast<i64>(threshold);
+		return true;
+	}
+	// 周期进行中，再分配kStepSize字节之后继续
+	debt = -static_cast<i64>(kStepSize);
+	return false;
+}
+
+auto LuaHeap::FullCollect() -> void {
+	if (mode == GcMode::GENERATIONAL) {
+		MajorCollection();
+		return;
+	}
+
+	// 正在进行的周期可能已经把一些对象标记成了黑色，先把它完成
+	while (phase != Phase::PAUSE) SingleStep();
+	StartCycle();
+	while (phase != Phase::PAUSE) SingleStep();
+	debt = static_cast<i64>(totalBytes) - static_cast<i64>(threshold);
+}
+
+auto LuaHeap::ObjectCount() const -> usize {
+	usize count = 0;
+	for (auto object = objects; object; object = object->next) {
+		++count;
+	}
+	return count;
+}
+
+auto LuaHeap::PerformRequest() -> void {
+	if (std::exchange(request, Request::NONE) == Request::FULL) {
+		FullCollect();
+	} else {
+		PerformStep();
+	}
+}
+
+auto LuaHeap::SizeOf(const LuaObject* object) -> usize {
+	switch (object->type) {
+		case LuaType::STRING: return sizeof(LuaString) + static_cast<const LuaString*>(object)->length;
+		case LuaType::TABLE: return static_cast<const LuaTable*>(object)->Footprint();
+		case LuaType::FUNCTION: return sizeof(LuaFunction);
+		default: return 0;
+	}
+}
+
+auto LuaHeap::Free(LuaObject* object) noexcept -> void {
+	switch (object->type) {
+		case LuaType::STRING: {
+			// 和NewString中的operator new对应，字符串本身可平凡析构
+			::operator delete(object);
+			break;
+		}
+		case LuaType::TABLE: {
+			delete static_cast<LuaTable*>(object);
+			break;
+		}
+		case LuaType::FUNCTION: {
+			delete static_cast<LuaFunction*>(object);
+			break;
+		}
+		default: break;
+	}
+}
+
+auto LuaHeap::Link(LuaObject* object, usize size) -> void {
+	object->color = currentWhite;
+	object->next = objects;
+	objects = object;
+	totalBytes += size;
+	debt += static_cast<i64>(size);
+}
+
+auto LuaHeap::MarkObject(LuaObject* object) -> void {
+	if (!IsWhite(object)) return;
+
+	// 只有表会引用其他对象，其余的对象直接变成黑色
+	if (object->type == LuaType::TABLE) {
+		object->color = GcColor::GRAY;
+		gray.push_back(object);
+	} else {
+		object->color = GcColor::BLACK;
+		markedBytes += SizeOf(object);
+	}
+}
+
+auto LuaHeap::MarkRoots() -> void {
+	for (auto string : constants) {
+		if (string) MarkObject(string);
+	}
+	for (auto name : metamethodNames) {
+		MarkObject(name);
+	}
+	if (rootMarker) rootMarker(*this);
+}
+
+auto LuaHeap::StartCycle() -> void {
+	LUNI_TRACE(INFO, INTERPRETER, "[GC] Starting a cycle with {} bytes in use", totalBytes);
+	phase = Phase::PROPAGATE;
+	markedBytes = 0;
+	MarkRoots();
+}
+
+auto LuaHeap::SingleStep() -> usize {
+	switch (phase) {
+		case Phase::PROPAGATE: {
+			if (gray.empty()) {
+				Atomic();
+				return 0;
+			}
+			auto object = gray.back();
+			gray.pop_back();
+			return Traverse(object);
+		}
+		case Phase::SWEEP: return SweepStep();
+		case Phase::PAUSE: return 0;
+	}
+	return 0;
+}
+
+auto LuaHeap::Traverse(LuaObject* object) -> usize {
+	object->color = GcColor::BLACK;
+	auto& table = *static_cast<LuaTable*>(object);
+	table.VisitReferences([this](const LuaValue& value) { Mark(value); });
+
+	auto size = SizeOf(object);
+	markedBytes += size;
+	return size;
+}
+
+auto LuaHeap::Atomic() -> void {
+	// 根的写入没有屏障，重新扫描一遍；之后不再有增量的步骤，一次把标记完成
+	MarkRoots();
+	gray.insert(gray.end(), grayAgain.begin(), grayAgain.end());
+	grayAgain.clear();
+	PropagateAll();
+
+	// 仍然是当前白色的对象都不可达。交换白色之后新分配的对象不会被这次清除释放
+	currentWhite = OtherWhite(currentWhite);
+	totalBytes = markedBytes;
+	sweepCursor = &objects;
+	phase = Phase::SWEEP;
+}
+
+auto LuaHeap::PropagateAll() -> void {
+	while (!gray.empty()) {
+		auto object = gray.back();
+		gray.pop_back();
+		Traverse(object);
+	}
+}
+
+auto LuaHeap::SweepStep() -> usize {
+	auto dead = OtherWhite(currentWhite);
+	usize work = 0;
+	for (usize i = 0; i < kSweepBatch && *sweepCursor; ++i) {
+		auto object = *sweepCursor;
+		if (object->color == dead) {
+			*sweepCursor = object->next;
+			Free(object);
+		} else {
+			object->color = currentWhite;
+			sweepCursor = &object->next;
+		}
+		work += kSweepCost;
+	}
+	if (!*sweepCursor) FinishCycle();
+	return work;
+}
+
+auto LuaHeap::FinishCycle() -> void {
+	sweepCursor = nullptr;
+	phase = Phase::PAUSE;
+	threshold = std::max(markedBytes / 100 * parameters.pause, kStepSize * 4);
+	LUNI_TRACE(INFO, INTERPRETER, "[GC] Cycle finished, {} bytes live, next cycle at {} bytes", markedBytes, threshold);
+}
+
+auto LuaHeap::EnterIncremental() -> void {
+	for (auto object = objects; object; object = object->next) {
+		object->color = currentWhite;
+		object->age = GcAge::NEW;
+	}
+	remembered.clear();
+	survivalStart = old1Start = oldStart = nullptr;
+
+	mode = GcMode::INCREMENTAL;
+	phase = Phase::PAUSE;
+	threshold = std::max(totalBytes / 100 * parameters.pause, kStepSize * 4);
+	debt = static_cast<i64>(totalBytes) - static_cast<i64>(threshold);
+}
+
+auto LuaHeap::EnterGenerational() -> void {
+	// 放弃正在进行的增量周期。不释放任何对象，所以在安全点之外调用也没有问题
+	gray.clear();
+	grayAgain.clear();
+	sweepCursor = nullptr;
+	phase = Phase::PAUSE;
+	for (auto object = objects; object; object = object->next) {
+		object->color = GcColor::BLACK;
+		object->age = GcAge::OLD;
+	}
+	survivalStart = old1Start = oldStart = objects;
+
+	mode = GcMode::GENERATIONAL;
+	oldBytes = totalBytes;
+	majorThreshold = std::max(oldBytes / 100 * (100 + parameters.majorMultiplier), kStepSize * 4);
+	SetMinorDebt();
+}
+
+auto LuaHeap::MinorCollection() -> void {
+	LUNI_TRACE(INFO, INTERPRETER, "[GC] Minor collection with {} bytes in use, {} old", totalBytes, oldBytes);
+	MarkRoots();
+	// 老对象已经是黑色，标记只会到达年轻对象。OLD1的对象变老时没有经过屏障，可能引用SURVIVAL的对象
+	for (auto object = old1Start; object != oldStart; object = object->next) {
+		if (object->type == LuaType::TABLE) Traverse(object);
+		if (object->age == GcAge::OLD1) object->age = GcAge::OLD;
+	}
+	for (auto object : remembered) {
+		Traverse(object);
+	}
+	PropagateAll();
+
+	// 新对象都在链表头部：NEW的那一段存活下来变成SURVIVAL，SURVIVAL的那一段变成OLD1
+	usize youngBytes = 0;
+	usize promotedBytes = 0;
+	auto survivalLink = SweepGeneration(&objects, survivalStart, GcAge::SURVIVAL, youngBytes);
+	SweepGeneration(survivalLink, old1Start, GcAge::OLD1, promotedBytes);
+	oldStart = old1Start;
+	old1Start = *survivalLink;
+	survivalStart = objects;
+
+	// 表被写入年轻对象之后要再经过两次小回收，它引用的对象才会全部变老
+	std::erase_if(remembered, [](LuaObject* object) {
+		if (object->age == GcAge::TOUCHED1) {
+			object->age = GcAge::TOUCHED2;
+			return false;
+		}
+		object->age = GcAge::OLD;
+		return true;
+	});
+
+	oldBytes += promotedBytes;
+	totalBytes = oldBytes + youngBytes;
+	SetMinorDebt();
+}
+
+auto LuaHeap::MajorCollection() -> void {
+	LUNI_TRACE(INFO, INTERPRETER, "[GC] Major collection with {} bytes in use", totalBytes);
+	for (auto object = objects; object; object = object->next) {
+		object->color = currentWhite;
+	}
+	remembered.clear();
+	markedBytes = 0;
+	MarkRoots();
+	PropagateAll();
+
+	usize liveBytes = 0;
+	SweepGeneration(&objects, nullptr, GcAge::OLD, liveBytes);
+	survivalStart = old1Start = oldStart = objects;
+
+	oldBytes = totalBytes = liveBytes;
+	majorThreshold = std::max(oldBytes / 100 * (100 + parameters.majorMultiplier), kStepSize * 4);
+	SetMinorDebt();
+}
+
+auto LuaHeap::SweepGeneration(LuaObject** cursor, LuaObject* limit, GcAge survivorAge, usize& survivorBytes) -> LuaObject** {
+	while (*cursor != limit) {
+		auto object = *cursor;
+		if (IsWhite(object)) {
+			*cursor = object->next;
+			Free(object);
+			continue;
+		}
+		// 老对象保持黑色，之后的标记不会再经过它们
+		object->age = survivorAge;
+		if (survivorAge == GcAge::SURVIVAL) object->color = currentWhite;
+		survivorBytes += SizeOf(object);
+		cursor = &object->next;
+	}
+	return cursor;
+}
+
+auto LuaHeap::SetMinorDebt() -> void {
+	debt = -static_cast<i64>(std::max(oldBytes / 100 * parameters.minorMultiplier, kStepSize * 4));
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "LuaValue.hpp"
+#include "Symbol.hpp"
+#include "Util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace LuNI {
+
+enum class GcMode : u8 {
+	INCREMENTAL,
+	GENERATIONAL,
+};
+
+/// 垃圾回收器的参数，含义和Lua的`collectgarbage("incremental", pause, stepmul)`以及
+/// `collectgarbage("generational", minormul, majormul)`相同
+struct GcParameters {
+	/// 一个周期结束之后，内存增长到存活对象大小的`pause`%时开始下一个周期
+	u32 pause = 200;
+	/// 每分配`LuaHeap::kStepSize`字节，回收器处理`kStepSize * stepMultiplier / 100`字节的对象
+	u32 stepMultiplier = 200;
+	/// 一次增量步骤的时间上限，到达时即使工作量还没有完成也会返回
+	std::chrono::microseconds stepBudget{ 500 };
+	/// 分代模式：新分配的内存达到老对象大小的`minorMultiplier`%时进行一次小回收
+	u32 minorMultiplier = 20;
+	/// 分代模式：老对象的大小比上一次大回收之后增长了`majorMultiplier`%时进行一次大回收
+	u32 majorMultiplier = 100;
+};
+
+/// 分配并拥有解释器创建的所有对象，用增量的三色标记-清除回收不可达的对象
+///
+/// 回收由分配产生的“债务”推动：每分配`kStepSize`字节，解释器在下一个安全点（两条语句之间）调用`Step`
+/// 完成一小段标记或者清除工作，每次停顿的长度受`GcParameters::stepBudget`限制，而不是一次停下整个程序。
+/// 回收器只在安全点运行，所以只存在于C++局部变量中的值不需要额外的保护。
+///
+/// 根（栈帧和全局变量）由`SetRootMarker`提供，在周期开始和原子阶段各扫描一次，所以写入根不需要屏障；
+/// 把对象写入一个已有的表之后则必须调用`Barrier`，否则已经是黑色的表可能引用白色的对象。
+/// 白色有两种，每个周期在原子阶段交换：清除阶段只释放旧的白色，清除期间新分配的对象是新的白色，不会被误释放。
+///
+/// 分代模式（`SetMode`）中，活过两次小回收的对象变老，之后只有大回收才会检查它们。对象链表按照年龄分成
+/// 连续的几段，因为新对象总是插入在链表头部：[NEW | SURVIVAL | OLD1 | OLD]。小回收只标记从根、OLD1的对象
+/// 和记忆集可以到达的年轻对象，只清除前两段，所以代价和年轻对象的数量成正比，而不是和整个堆成正比。
+/// 老对象一直是黑色，`Barrier`把写入了年轻对象的老表加入记忆集。分代模式的回收不是增量的，
+/// 不受`GcParameters::stepBudget`限制。
+///
+/// 字符串常量按照SymbolId缓存，同一个常量每次求值得到同一个对象；缓存中的字符串和元方法名永远不会被回收。
+class LuaHeap {
+public:
+	enum class Phase : u8 {
+		PAUSE, //< 两个周期之间
+		PROPAGATE, //< 增量标记
+		SWEEP, //< 增量清除
+	};
+
+	/// 由`collectgarbage`请求、在下一个安全点进行的回收
+	enum class Request : u8 {
+		NONE,
+		STEP, //< 一次增量步骤
+		FULL, //< 完整的回收
+	};
+
+	/// 对每个根调用`heap.Mark`
+	using RootMarker = std::function<void(LuaHeap& heap)>;
+
+	static constexpr usize kStepSize = 8 * 1024;
+
+private:
+	LuaObject* objects = nullptr;
+	std::vector<LuaString*> constants;
+	/// 在元表中查找元方法时使用的键，和`Metamethod`一一对应
+	std::array<LuaString*, kMetamethodCount> metamethodNames;
+
+	GcParameters parameters;
+	GcMode mode = GcMode::INCREMENTAL;
+	RootMarker rootMarker;
+	bool running = true;
+	Request request = Request::NONE;
+	Phase phase = Phase::PAUSE;
+	GcColor currentWhite = GcColor::WHITE0;
+	std::vector<LuaObject*> gray;
+	/// 被屏障重新变成灰色的表，到原子阶段再处理
+	std::vector<LuaObject*> grayAgain;
+	/// 清除阶段下一个要检查的对象的链接
+	LuaObject** sweepCursor = nullptr;
+
+	/// 分代模式：`objects`链表中每一段的第一个对象，为空表示这一段一直到链表末尾
+	LuaObject* survivalStart = nullptr;
+	LuaObject* old1Start = nullptr;
+	LuaObject* oldStart = nullptr;
+	/// 分代模式：引用了年轻对象的老表（年龄为TOUCHED1或者TOUCHED2）
+	std::vector<LuaObject*> remembered;
+	/// 分代模式：老对象的估计大小，以及触发下一次大回收的大小
+	usize oldBytes = 0;
+	usize majorThreshold = 0;
+
+	/// 所有对象的估计大小。表在创建之后的增长要到下一次标记时才会计入
+	usize totalBytes = 0;
+	/// 这个周期中已经标记的对象的大小，原子阶段之后就是存活对象的大小
+	usize markedBytes = 0;
+	/// 到达时开始下一个周期
+	usize threshold = 0;
+	/// 大于0时`Step`才会工作
+	i64 debt = 0;
+
+public:
+	LuaHeap();
+	~LuaHeap() noexcept;
+
+	LuaHeap(const LuaHeap&) = delete;
+	LuaHeap& operator=(const LuaHeap&) = delete;
+
+	auto NewString(std::string_view text) -> LuaString*;
+	auto NewTable(u32 arrayHint, u32 hashHint) -> LuaTable*;
+	auto NewFunction(const AstFunctionDefinitionNode& definition) -> LuaFunction*;
+
+	/// 驻留的字符串常量对应的对象，第一次使用时创建
+	auto Constant(SymbolId id) -> LuaString*;
+
+	auto MetamethodName(Metamethod event) const -> LuaString* {
+		return metamethodNames[static_cast<usize>(event)];
+	}
+
+	auto SetRootMarker(RootMarker marker) -> void {
+		rootMarker = std::move(marker);
+	}
+
+	auto Mark(const LuaValue& value) -> void {
+		if (value.IsObject()) MarkObject(value.Object());
+	}
+
+	/// 把`value`写入`table`之后调用。增量模式中，标记阶段中黑色的表引用了白色的对象时，把表重新变成灰色；
+	/// 分代模式中，老表引用了年轻对象时，把表加入记忆集
+	auto Barrier(LuaTable* table, const LuaValue& value) -> void;
+
+	/// 安全点：有回收请求，或者分配产生的债务足够时进行一次增量步骤
+	auto Step() -> void {
+		if (request != Request::NONE) {
+			PerformRequest();
+		} else if (debt > 0 && running) {
+			PerformStep();
+		}
+	}
+
+	/// 不在安全点时使用：记录请求，由下一次`Step`完成。停止的回收器也会处理请求
+	auto RequestCollection(Request value) -> void {
+		request = std::max(request, value);
+	}
+
+	/// 不管债务多少，立即进行一次增量步骤，返回这一步是否结束了一个周期。分代模式中进行一次小回收
+	/// （老对象增长得足够多时是大回收），总是返回true
+	auto PerformStep() -> bool;
+
+	/// 完成正在进行的周期，再进行一个完整的周期。分代模式中进行一次大回收
+	auto FullCollect() -> void;
+
+	auto Parameters() const -> const GcParameters& {
+		return parameters;
+	}
+
+	auto SetParameters(const GcParameters& value) -> void {
+		parameters = value;
+	}
+
+	auto Mode() const -> GcMode {
+		return mode;
+	}
+
+	/// 可以在任何时候调用，不会释放对象。进入分代模式时现有的对象全部变老，其中的垃圾由下一次大回收释放
+	auto SetMode(GcMode value) -> void;
+
+	/// 停止之后只有`PerformStep`和`FullCollect`会进行回收
+	auto SetRunning(bool value) -> void {
+		running = value;
+	}
+
+	auto IsRunning() const -> bool {
+		return running;
+	}
+
+	auto CurrentPhase() const -> Phase {
+		return phase;
+	}
+
+	auto BytesInUse() const -> usize {
+		return totalBytes;
+	}
+
+	/// 还没有被释放的对象个数，包括字符串常量和元方法名。需要遍历所有对象，只用于测试和调试
+	auto ObjectCount() const -> usize;
+
+private:
+	static auto IsWhite(const LuaObject* object) -> bool {
+		return object->color == GcColor::WHITE0 || object->color == GcColor::WHITE1;
+	}
+
+	static auto OtherWhite(GcColor white) -> GcColor {
+		return white == GcColor::WHITE0 ? GcColor::WHITE1 : GcColor::WHITE0;
+	}
+
+	static auto SizeOf(const LuaObject* object) -> usize;
+	static auto Free(LuaObject* object) noexcept -> void;
+
+	auto PerformRequest() -> void;
+	auto Link(LuaObject* object, usize size) -> void;
+	auto MarkObject(LuaObject* object) -> void;
+	auto MarkRoots() -> void;
+	auto StartCycle() -> void;
+	/// 返回完成的工作量，以字节计
+	auto SingleStep() -> usize;
+	auto Traverse(LuaObject* object) -> usize;
+	auto Atomic() -> void;
+	/// 遍历灰色列表直到它为空
+	auto PropagateAll() -> void;
+	auto SweepStep() -> usize;
+	auto FinishCycle() -> void;
+
+	auto EnterIncremental() -> void;
+	auto EnterGenerational() -> void;
+	auto MinorCollection() -> void;
+	auto MajorCollection() -> void;
+	/// 释放`[*cursor, limit)`中的白色对象，存活的对象变成`survivorAge`，返回停下时的链接
+	auto SweepGeneration(LuaObject** cursor, LuaObject* limit, GcAge survivorAge, usize& survivorBytes) -> LuaObject**;
+	/// 分代模式中分配多少字节之后进行下一次小回收
+	auto SetMinorDebt() -> void;
+};
+
+} // namespace LuNI
@@ -0,0 +1,266 @@
+#include "LuaTable.hpp"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <utility>
+
+using namespace LuNI;
+
+/// 哈希部分使用的槽位不超过容量的3/4，线性探测的查找长度保持在很小的范围内
+static constexpr usize kMaxLoadNumerator = 3;
+static constexpr usize kMaxLoadDenominator = 4;
+
+/// 能放下`count`个键的最小的哈希部分容量
+static auto CapacityFor(usize count) -> usize {
+	if (count == 0) return 0;
+	return std::bit_ceil((count * kMaxLoadDenominator + kMaxLoadNumerator - 1) / kMaxLoadNumerator);
+}
+
+/// 键的哈希值只取低位作为下标，先把高位的差异混合进低位
+static auto Mix(u64 x) -> u64 {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccd;
+	x ^= x >> 33;
+	return x;
+}
+
+/// `key`在数组部分中时为下标，否则为空
+static auto ArrayIndexOf(i64 key, usize arraySize) -> std::optional<usize> {
+	// 转换成无符号数之后0和负数都会变得很大，一次比较就能检查两端
+	auto index = static_cast<u64>(key) - 1;
+	if (index < arraySize) return static_cast<usize>(index);
+	return {};
+}
+
+LuaTable::LuaTable(u32 arrayHint, u32 hashHint)
+	: LuaObject(kType)
+	, array(arrayHint)
+	, nodeCapacity{ CapacityFor(hashHint) } {
+	if (nodeCapacity) nodes = std::make_unique<Node[]>(nodeCapacity);
+}
+
+auto LuaTable::Get(const LuaValue& key) const -> LuaValue {
+	auto normalized = NormalizeKey(key);
+	if (normalized.Type() == LuaType::INTEGER) return GetInteger(normalized.AsInteger());
+	if (normalized.IsNil()) return {};
+
+	auto node = FindNode(normalized);
+	return node ? node->value : LuaValue{};
+}
+
+auto LuaTable::GetInteger(i64 key) const -> LuaValue {
+	if (auto index = ArrayIndexOf(key, array.size())) return array[*index];
+
+	auto node = FindNode(LuaValue{ key });
+	return node ? node->value : LuaValue{};
+}
+
+auto LuaTable::Set(const LuaValue& key, const LuaValue& value) -> bool {
+	auto normalized = NormalizeKey(key);
+	if (normalized.IsNil()) return false;
+	if (normalized.Type() == LuaType::NUMBER && std::isnan(normalized.AsNumber())) return false;
+	if (normalized.Type() == LuaType::INTEGER) {
+		SetInteger(normalized.AsInteger(), value);
+		return true;
+	}
+	// 元方法的名字都是字符串，其他类型的键不会影响缓存
+	if (normalized.Type() == LuaType::STRING) absentMetamethods = 0;
+
+	if (auto node = FindNode(normalized)) {
+		node->value = value;
+	} else if (!value.IsNil()) {
+		SetNew(normalized, value);
+	}
+	return true;
+}
+
+auto LuaTable::SetInteger(i64 key, const LuaValue& value) -> void {
+	if (auto index = ArrayIndexOf(key, array.size())) {
+		array[*index] = value;
+		return;
+	}
+
+	auto boxed = LuaValue{ key };
+	if (auto node = FindNode(boxed)) {
+		node->value = value;
+	} else if (!value.IsNil()) {
+		SetNew(boxed, value);
+	}
+}
+
+auto LuaTable::Length() const -> i64 {
+	auto size = array.size();
+	if (size > 0 && array[size - 1].IsNil()) {
+		// 边界在数组部分中。二分查找时保持`array[lo - 1]`不为nil（或者lo为0），`array[hi - 1]`为nil
+		usize lo = 0;
+		usize hi = size;
+		while (hi - lo > 1) {
+			auto mid = lo + (hi - lo) / 2;
+			if (array[mid - 1].IsNil()) {
+				hi = mid;
+			} else {
+				lo = mid;
+			}
+		}
+		return static_cast<i64>(lo);
+	}
+	if (nodeCount == 0) return static_cast<i64>(size);
+
+	// 数组部分是满的，在哈希部分中继续：倍增找到一个为nil的键，再在两者之间二分
+	auto lo = static_cast<i64>(size);
+	auto hi = lo + 1;
+	while (!GetInteger(hi).IsNil()) {
+		lo = hi;
+		if (hi > std::numeric_limits<i64>::max() / 2) {
+			// 只有被刻意构造的表才会走到这里，逐个检查
+			i64 i = 1;
+			while (!GetInteger(i).IsNil()) ++i;
+			return i - 1;
+		}
+		hi *= 2;
+	}
+	while (hi - lo > 1) {
+		auto mid = lo + (hi - lo) / 2;
+		if (GetInteger(mid).IsNil()) {
+			hi = mid;
+		} else {
+			lo = mid;
+		}
+	}
+	return lo;
+}
+
+auto LuaTable::LookupMetamethod(Metamethod event, LuaString* name) const -> LuaValue {
+	auto node = FindNode(LuaValue{ name });
+	if (node && !node->value.IsNil()) return node->value;
+
+	absentMetamethods |= MetamethodBit(event);
+	return {};
+}
+
+auto LuaTable::NormalizeKey(const LuaValue& key) -> LuaValue {
+	if (key.Type() != LuaType::NUMBER) return key;
+
+	// 先检查范围，超出i64范围的浮点数转换成整数是未定义行为
+	auto number = key.AsNumber();
+	if (number >= -0x1p63 && number < 0x1p63) {
+		auto integer = static_cast<i64>(number);
+		if (static_cast<f64>(integer) == number) return LuaValue{ integer };
+	}
+	return key;
+}
+
+auto LuaTable::HashOf(const LuaValue& key) -> u64 {
+	switch (key.Type()) {
+		case LuaType::BOOLEAN: return Mix(key.AsBoolean() ? 1 : 2);
+		case LuaType::INTEGER: return Mix(static_cast<u64>(key.AsInteger()));
+		case LuaType::NUMBER: return Mix(std::bit_cast<u64>(key.AsNumber()));
+		case LuaType::LIGHT_FUNCTION: return Mix(reinterpret_cast<uintptr_t>(key.AsLightFunction()));
+		// 内容相同的字符串可能是不同的对象，必须使用内容的哈希值
+		case LuaType::STRING: return Mix(key.AsObject<LuaString>()->hash);
+		default: return Mix(reinterpret_cast<uintptr_t>(key.Object()));
+	}
+}
+
+auto LuaTable::FindNode(const LuaValue& key) const -> Node* {
+	if (nodeCapacity == 0) return nullptr;
+
+	auto mask = nodeCapacity - 1;
+	for (auto i = HashOf(key) & mask;; i = (i + 1) & mask) {
+		auto& node = nodes[i];
+		if (node.key.IsNil()) return nullptr;
+		if (node.key.RawEquals(key)) return &node;
+	}
+}
+
+auto LuaTable::InsertNode(const LuaValue& key, const LuaValue& value) -> void {
+	auto mask = nodeCapacity - 1;
+	auto i = HashOf(key) & mask;
+	while (!nodes[i].key.IsNil()) {
+		i = (i + 1) & mask;
+	}
+	nodes[i] = Node{ key, value };
+	++nodeCount;
+}
+
+auto LuaTable::SetNew(const LuaValue& key, const LuaValue& value) -> void {
+	if ((nodeCount + 1) * kMaxLoadDenominator > nodeCapacity * kMaxLoadNumerator) {
+		Rehash(key);
+		// 重新分配之后这个键可能属于数组部分
+		if (key.Type() == LuaType::INTEGER) {
+			if (auto index = ArrayIndexOf(key.AsInteger(), array.size())) {
+				array[*index] = value;
+				return;
+			}
+		}
+	}
+	InsertNode(key, value);
+}
+
+auto LuaTable::Rehash(const LuaValue& extraKey) -> void {
+	// nums[i]是满足2^(i-1) < k <= 2^i的整数键k的个数
+	std::array<usize, 64> nums{};
+	usize integerKeys = 0;
+	usize totalKeys = 0;
+	auto count = [&](const LuaValue& key) {
+		++totalKeys;
+		if (key.Type() != LuaType::INTEGER || key.AsInteger() < 1) return;
+		++nums[std::bit_width(static_cast<u64>(key.AsInteger() - 1))];
+		++integerKeys;
+	};
+
+	for (usize i = 0; i < array.size(); ++i) {
+		if (!array[i].IsNil()) count(LuaValue{ static_cast<i64>(i + 1) });
+	}
+	for (usize i = 0; i < nodeCapacity; ++i) {
+		if (!nodes[i].value.IsNil()) count(nodes[i].key);
+	}
+	count(extraKey);
+
+	// 数组部分取使得其中超过一半的位置被使用的最大的2的幂
+	usize arraySize = 0;
+	usize inArray = 0;
+	usize accumulated = 0;
+	for (usize i = 0, twoToI = 1; i < nums.size() && integerKeys > twoToI / 2; ++i, twoToI *= 2) {
+		accumulated += nums[i];
+		if (accumulated > twoToI / 2) {
+			arraySize = twoToI;
+			inArray = accumulated;
+		}
+	}
+	Resize(arraySize, totalKeys - inArray);
+}
+
+auto LuaTable::Resize(usize arraySize, usize hashSize) -> void {
+	auto oldNodes = std::move(nodes);
+	auto oldCapacity = std::exchange(nodeCapacity, CapacityFor(hashSize));
+	nodes = nodeCapacity ? std::make_unique<Node[]>(nodeCapacity) : nullptr;
+	nodeCount = 0;
+
+	// 数组部分缩小时，超出新大小的元素移到哈希部分
+	if (arraySize < array.size()) {
+		for (auto i = arraySize; i < array.size(); ++i) {
+			if (!array[i].IsNil()) InsertNode(LuaValue{ static_cast<i64>(i + 1) }, array[i]);
+		}
+		array.resize(arraySize);
+		array.shrink_to_fit();
+	} else {
+		array.resize(arraySize);
+	}
+
+	// 值为nil的键在这里被丢弃
+	for (usize i = 0; i < oldCapacity; ++i) {
+		auto& node = oldNodes[i];
+		if (node.value.IsNil()) continue;
+		if (node.key.Type() == LuaType::INTEGER) {
+			if (auto index = ArrayIndexOf(node.key.AsInteger(), array.size())) {
+				array[*index] = node.value;
+				continue;
+			}
+		}
+		InsertNode(node.key, node.value);
+	}
+}
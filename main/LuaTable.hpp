@@ -0,0 +1,124 @@
+#pragma once
+
+#include "LuaHeap.hpp"
+#include "LuaValue.hpp"
+#include "Util.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace LuNI {
+
+/// Lua的表：键为1到n的元素放在连续的数组部分，其余的键放在开放寻址（线性探测）的哈希部分
+///
+/// 和Lua官方实现一样，哈希部分放不下新的键时统计所有整数键，选出使数组部分超过一半被使用的最大的2的幂
+/// 作为数组部分的新大小，再把键在两部分之间迁移。哈希部分的容量按2的幂增长，所以插入的均摊代价是常数。
+///
+/// 值为浮点数的整数键（`t[2.0]`）和整数键相同。赋值为nil时键仍然留在哈希部分中，到下一次重新分配时才被清除。
+///
+/// 表由LuaHeap分配和回收。向已有的表写入对象（包括设置元表）之后要调用`LuaHeap::Barrier`。
+class LuaTable : public LuaObject {
+public:
+	static constexpr auto kType = LuaType::TABLE;
+
+private:
+	struct Node {
+		LuaValue key; //< 为nil表示空位
+		LuaValue value;
+	};
+
+	std::vector<LuaValue> array;
+	std::unique_ptr<Node[]> nodes;
+	/// 哈希部分的容量，为0或者2的幂
+	usize nodeCapacity = 0;
+	/// 哈希部分使用的槽位，包括值为nil的键
+	usize nodeCount = 0;
+
+	LuaTable* metatable = nullptr;
+	/// 这个表作为元表时已经确认不存在的元方法，第i位对应`Metamethod`的第i项。
+	/// 对这个表的字符串键赋值时清空，所以缓存总是和表的内容一致
+	mutable u32 absentMetamethods = 0;
+
+public:
+	/// `arrayHint`和`hashHint`来自表构造器中没有键和有键的元素个数，构造时不需要重新分配
+	LuaTable(u32 arrayHint, u32 hashHint);
+
+	auto Get(const LuaValue& key) const -> LuaValue;
+	auto GetInteger(i64 key) const -> LuaValue;
+
+	/// 键为nil或者NaN时返回false并且不修改表
+	auto Set(const LuaValue& key, const LuaValue& value) -> bool;
+	auto SetInteger(i64 key, const LuaValue& value) -> void;
+
+	/// `#`运算符：任意一个边界，也就是`t[n]`不为nil而`t[n + 1]`为nil的n（`t[1]`为nil时为0）
+	auto Length() const -> i64;
+
+	auto Metatable() const -> LuaTable* {
+		return metatable;
+	}
+
+	auto SetMetatable(LuaTable* table) -> void {
+		metatable = table;
+	}
+
+	/// 元表中名为`heap.MetamethodName(event)`的元方法，不存在时为nil
+	///
+	/// 没有元表，或者元表中已经确认没有这个元方法时，只检查一个指针和一个位，不查找哈希部分
+	auto FindMetamethod(Metamethod event, const LuaHeap& heap) const -> LuaValue {
+		if (!metatable || (metatable->absentMetamethods & MetamethodBit(event))) return {};
+		return metatable->LookupMetamethod(event, heap.MetamethodName(event));
+	}
+
+	auto ArraySize() const -> usize {
+		return array.size();
+	}
+
+	auto HashCapacity() const -> usize {
+		return nodeCapacity;
+	}
+
+	/// 表和两部分的存储占用的字节数，用于垃圾回收的计量
+	auto Footprint() const -> usize {
+		return sizeof(LuaTable) + array.capacity() * sizeof(LuaValue) + nodeCapacity * sizeof(Node);
+	}
+
+	/// 对表引用的每个值调用`visitor`：元表、数组部分，以及哈希部分中的键和值
+	///
+	/// 值为nil的键也会被访问，因为它们在下一次重新分配之前仍然留在哈希部分中，参与查找时的比较
+	template <typename F>
+	auto VisitReferences(F&& visitor) const -> void {
+		if (metatable) visitor(LuaValue{ metatable });
+		for (const auto& value : array) {
+			visitor(value);
+		}
+		for (usize i = 0; i < nodeCapacity; ++i) {
+			if (nodes[i].key.IsNil()) continue;
+			visitor(nodes[i].key);
+			visitor(nodes[i].value);
+		}
+	}
+
+private:
+	static constexpr auto MetamethodBit(Metamethod event) -> u32 {
+		return u32{ 1 } << static_cast<u32>(event);
+	}
+
+	/// 把这个表作为元表查找元方法，不存在时记录到`absentMetamethods`中
+	auto LookupMetamethod(Metamethod event, LuaString* name) const -> LuaValue;
+
+	/// 浮点数形式的整数键转换成整数
+	static auto NormalizeKey(const LuaValue& key) -> LuaValue;
+	static auto HashOf(const LuaValue& key) -> u64;
+
+	/// 值为`key`的槽位，不存在时为空
+	auto FindNode(const LuaValue& key) const -> Node*;
+	/// 不检查负载，调用者保证还有空位，`key`也不在表中
+	auto InsertNode(const LuaValue& key, const LuaValue& value) -> void;
+	auto SetNew(const LuaValue& key, const LuaValue& value) -> void;
+
+	/// 加入`extraKey`之前重新计算两部分的大小
+	auto Rehash(const LuaValue& extraKey) -> void;
+	auto Resize(usize arraySize, usize hashSize) -> void;
+};
+
+} // namespace LuNI
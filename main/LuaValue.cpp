@@ -0,0 +1,117 @@
+#include "LuaValue.hpp"
+
+#include <fmt/format.h>
+
+#include <cmath>
+#include <stdexcept>
+
+using namespace LuNI;
+
+auto LuaValue::ToString() const -> std::string {
+	switch (type) {
+		case LuaType::NIL: return "nil";
+		case LuaType::BOOLEAN: return as.boolean ? "true" : "false";
+		case LuaType::INTEGER: return fmt::format("{}", as.integer);
+		case LuaType::NUMBER: {
+			// 和Lua的LUAI_NUMFFORMAT相同，看起来像整数时加上".0"以区分整数和浮点数
+			auto text = fmt::format("{:.14g}", as.number);
+			if (text.find_first_of(".eEn") == std::string::npos) text += ".0";
+			return text;
+		}
+		case LuaType::LIGHT_FUNCTION: return fmt::format("builtin: {}", reinterpret_cast<const void*>(as.function));
+		case LuaType::STRING: return std::string(AsObject<LuaString>()->Text());
+		case LuaType::TABLE: return fmt::format("table: {}", static_cast<const void*>(as.object));
+		case LuaType::FUNCTION: return fmt::format("function: {}", static_cast<const void*>(as.object));
+	}
+	return {};
+}
+
+/// 整数和浮点数按照数学上的值比较。大整数转换成浮点数会丢失精度（2^53 + 1会变成2^53），
+/// 所以反过来只有值为整数、并且在i64范围内的浮点数才可能相等，再按整数比较
+static auto IntegerEqualsNumber(i64 integer, f64 number) -> bool {
+	// 先检查范围，超出i64范围的浮点数转换成整数是未定义行为
+	if (!(number >= -0x1p63 && number < 0x1p63)) return false;
+	auto truncated = static_cast<i64>(number);
+	return static_cast<f64>(truncated) == number && truncated == integer;
+}
+
+auto LuaValue::RawEquals(const LuaValue& that) const -> bool {
+	if (type != that.type) {
+		if (type == LuaType::INTEGER && that.type == LuaType::NUMBER) return IntegerEqualsNumber(as.integer, that.as.number);
+		if (type == LuaType::NUMBER && that.type == LuaType::INTEGER) return IntegerEqualsNumber(that.as.integer, as.number);
+		return false;
+	}
+	switch (type) {
+		case LuaType::NIL: return true;
+		case LuaType::BOOLEAN: return as.boolean == that.as.boolean;
+		case LuaType::INTEGER: return as.integer == that.as.integer;
+		case LuaType::NUMBER: return as.number == that.as.number;
+		case LuaType::LIGHT_FUNCTION: return as.function == that.as.function;
+		case LuaType::STRING: {
+			auto lhs = AsObject<LuaString>();
+			auto rhs = that.AsObject<LuaString>();
+			return lhs == rhs || (lhs->hash == rhs->hash && lhs->Text() == rhs->Text());
+		}
+		default: return as.object == that.as.object;
+	}
+}
+
+/// 整数运算按照Lua的规则在溢出时回绕
+static auto WrapInteger(u64 value) -> LuaValue {
+	return LuaValue{ static_cast<i64>(value) };
+}
+
+auto LuaValue::RawArith(BinaryOp op, const LuaValue& lhs, const LuaValue& rhs) -> std::optional<LuaValue> {
+	auto a = lhs.ToNumber();
+	auto b = rhs.ToNumber();
+	if (!a || !b) return {};
+
+	auto integers = lhs.type == LuaType::INTEGER && rhs.type == LuaType::INTEGER;
+	auto x = static_cast<u64>(lhs.as.integer);
+	auto y = static_cast<u64>(rhs.as.integer);
+	switch (op) {
+		case BinaryOp::ADD: return integers ? WrapInteger(x + y) : LuaValue{ *a + *b };
+		case BinaryOp::SUBTRACT: return integers ? WrapInteger(x - y) : LuaValue{ *a - *b };
+		case BinaryOp::MULTIPLY: return integers ? WrapInteger(x * y) : LuaValue{ *a * *b };
+		case BinaryOp::DIVIDE: return LuaValue{ *a / *b };
+		case BinaryOp::EXPONENT: return LuaValue{ std::pow(*a, *b) };
+		case BinaryOp::MOD: {
+			// 取模的结果和除数同号
+			if (integers) {
+				auto n = lhs.as.integer;
+				auto d = rhs.as.integer;
+				if (d == 0) throw std::runtime_error("Attempted to perform 'n%0'");
+				if (d == -1) return LuaValue{ i64{ 0 } };
+				auto r = n % d;
+				if (r != 0 && (r ^ d) < 0) r += d;
+				return LuaValue{ r };
+			}
+			auto r = std::fmod(*a, *b);
+			if (r != 0 && (r < 0) != (*b < 0)) r += *b;
+			return LuaValue{ r };
+		}
+		default: return {};
+	}
+}
+
+auto LuaValue::RawLessThan(const LuaValue& lhs, const LuaValue& rhs) -> std::optional<bool> {
+	if (lhs.type == LuaType::INTEGER && rhs.type == LuaType::INTEGER) return lhs.as.integer < rhs.as.integer;
+	if (lhs.type == LuaType::STRING && rhs.type == LuaType::STRING) {
+		return lhs.AsObject<LuaString>()->Text() < rhs.AsObject<LuaString>()->Text();
+	}
+	auto a = lhs.ToNumber();
+	auto b = rhs.ToNumber();
+	if (!a || !b) return {};
+	return *a < *b;
+}
+
+auto LuaValue::RawLessEqual(const LuaValue& lhs, const LuaValue& rhs) -> std::optional<bool> {
+	if (lhs.type == LuaType::INTEGER && rhs.type == LuaType::INTEGER) return lhs.as.integer <= rhs.as.integer;
+	if (lhs.type == LuaType::STRING && rhs.type == LuaType::STRING) {
+		return lhs.AsObject<LuaString>()->Text() <= rhs.AsObject<LuaString>()->Text();
+	}
+	auto a = lhs.ToNumber();
+	auto b = rhs.ToNumber();
+	if (!a || !b) return {};
+	return *a <= *b;
+}
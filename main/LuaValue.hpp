@@ -0,0 +1,202 @@
+#pragma once
+
+#include "AstNode.hpp"
+#include "Util.hpp"
+
+#include <cassert>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace LuNI {
+
+class LuaValue;
+class LuaTable;
+class LuaHeap;
+
+/// 不需要栈帧的C++函数（`print`、`sqrt`等），函数指针直接存放在LuaValue中
+using LuaCFunction = auto(*)(LuaHeap& heap, std::span<const LuaValue> params) -> LuaValue;
+
+enum class LuaType : u8 {
+	NIL,
+	BOOLEAN,
+	INTEGER,
+	NUMBER,
+	LIGHT_FUNCTION,
+	// 以下是堆上的对象，LuaValue中只保存指针
+	STRING,
+	TABLE,
+	FUNCTION,
+};
+
+/// 元表中可以定义的元方法
+enum class Metamethod : u8 {
+	INDEX,
+	NEWINDEX,
+	LEN,
+	EQ,
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	MOD,
+	POW,
+	UNM,
+	CONCAT,
+	LT,
+	LE,
+	CALL,
+};
+
+constexpr usize kMetamethodCount = static_cast<usize>(Metamethod::CALL) + 1;
+
+/// 垃圾回收中对象的颜色。白色有两种，每个回收周期交替使用，见LuaHeap
+enum class GcColor : u8 {
+	WHITE0,
+	WHITE1,
+	GRAY,
+	BLACK,
+};
+
+/// 分代模式中对象的年龄，见LuaHeap。增量模式不使用
+enum class GcAge : u8 {
+	NEW, //< 上一次小回收之后分配的
+	SURVIVAL, //< 活过了一次小回收
+	OLD1, //< 在上一次小回收中变老，下一次小回收还要遍历它，因为它可能引用SURVIVAL的对象
+	OLD,
+	TOUCHED1, //< 写入过年轻对象的老表，在记忆集中
+	TOUCHED2, //< 经过了一次小回收的TOUCHED1，下一次小回收之后离开记忆集
+};
+
+/// 所有堆上对象的公共头部，`type`和指向它的LuaValue的类型相同
+struct LuaObject {
+	LuaType type;
+	GcColor color = GcColor::WHITE0;
+	GcAge age = GcAge::NEW;
+	/// LuaHeap分配的所有对象串成一个链表，清除阶段沿着它释放不可达的对象
+	LuaObject* next = nullptr;
+
+protected:
+	explicit LuaObject(LuaType type) noexcept : type{ type } {}
+};
+
+/// 不可变的字符串，文本紧跟在对象之后，和对象一起分配
+struct LuaString : LuaObject {
+	static constexpr auto kType = LuaType::STRING;
+
+	u32 length;
+	u64 hash;
+
+	LuaString(u32 length, u64 hash) noexcept : LuaObject(kType), length{ length }, hash{ hash } {}
+
+	auto Text() const -> std::string_view {
+		return { reinterpret_cast<const char*>(this + 1), length };
+	}
+};
+
+/// 由脚本定义的函数
+struct LuaFunction : LuaObject {
+	static constexpr auto kType = LuaType::FUNCTION;
+
+	const AstFunctionDefinitionNode& definition;
+
+	explicit LuaFunction(const AstFunctionDefinitionNode& definition) noexcept : LuaObject(kType), definition{ definition } {}
+};
+
+/// 16字节的Lua值：1字节的类型标签加上8字节的数据
+///
+/// nil、布尔值、整数、浮点数和C++函数直接存放在值中，复制和算术都不需要分配内存；字符串和函数等
+/// 堆上的对象只保存指针，由LuaHeap负责分配和回收。检查类型只需要比较一次标签。
+class LuaValue {
+private:
+	union {
+		bool boolean;
+		i64 integer;
+		f64 number;
+		LuaCFunction function;
+		LuaObject* object;
+	} as;
+	LuaType type;
+
+public:
+	constexpr LuaValue() noexcept : as{ .integer = 0 }, type{ LuaType::NIL } {}
+	constexpr LuaValue(bool boolean) noexcept : as{ .boolean = boolean }, type{ LuaType::BOOLEAN } {}
+	constexpr LuaValue(i64 integer) noexcept : as{ .integer = integer }, type{ LuaType::INTEGER } {}
+	constexpr LuaValue(f64 number) noexcept : as{ .number = number }, type{ LuaType::NUMBER } {}
+	constexpr LuaValue(LuaCFunction function) noexcept : as{ .function = function }, type{ LuaType::LIGHT_FUNCTION } {}
+	LuaValue(LuaObject* object) noexcept : as{ .object = object }, type{ object->type } {}
+
+	auto Type() const -> LuaType {
+		return type;
+	}
+
+	auto IsNil() const -> bool {
+		return type == LuaType::NIL;
+	}
+
+	auto IsObject() const -> bool {
+		return type >= LuaType::STRING;
+	}
+
+	/// 只有nil和false为假
+	auto IsTruthy() const -> bool {
+		return type != LuaType::NIL && !(type == LuaType::BOOLEAN && !as.boolean);
+	}
+
+	auto AsBoolean() const -> bool {
+		assert(type == LuaType::BOOLEAN);
+		return as.boolean;
+	}
+
+	auto AsInteger() const -> i64 {
+		assert(type == LuaType::INTEGER);
+		return as.integer;
+	}
+
+	auto AsNumber() const -> f64 {
+		assert(type == LuaType::NUMBER);
+		return as.number;
+	}
+
+	auto AsLightFunction() const -> LuaCFunction {
+		assert(type == LuaType::LIGHT_FUNCTION);
+		return as.function;
+	}
+
+	auto Object() const -> LuaObject* {
+		assert(IsObject());
+		return as.object;
+	}
+
+	template <typename T>
+	auto AsObject() const -> T* {
+		assert(type == T::kType);
+		return static_cast<T*>(as.object);
+	}
+
+	/// 整数和浮点数都转换成浮点数，其他类型返回空
+	auto ToNumber() const -> std::optional<f64> {
+		if (type == LuaType::NUMBER) return as.number;
+		if (type == LuaType::INTEGER) return static_cast<f64>(as.integer);
+		return std::nullopt;
+	}
+
+	/// `print`和`tostring`使用的文本形式
+	auto ToString() const -> std::string;
+
+	/// 不考虑元方法的相等比较；字符串比较内容，其他对象比较地址
+	auto RawEquals(const LuaValue& that) const -> bool;
+
+	/// 两个操作数都是数字时的算术运算，整数运算溢出时回绕。否则返回空，由调用者查找元方法
+	static auto RawArith(BinaryOp op, const LuaValue& lhs, const LuaValue& rhs) -> std::optional<LuaValue>;
+	/// 两个数字或者两个字符串之间的`<`和`<=`，其他情况返回空
+	static auto RawLessThan(const LuaValue& lhs, const LuaValue& rhs) -> std::optional<bool>;
+	static auto RawLessEqual(const LuaValue& lhs, const LuaValue& rhs) -> std::optional<bool>;
+};
+
+static_assert(sizeof(LuaValue) == 16);
+static_assert(std::is_trivially_copyable_v<LuaValue>);
+
+} // namespace LuNI
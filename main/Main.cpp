@@ -1,19 +1,24 @@
 #include "Util.hpp"
+#include "AstCache.hpp"
 #include "Program.hpp"
+#include "SourceFile.hpp"
+#include "Lexer.hpp"
+#include "Optimizer.hpp"
 #include "Parser.hpp"
+#include "Resolver.hpp"
 #include "Interpreter.hpp"
+#include "ScopeGuard.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <future>
+#include <memory>
+#include <vector>
 #include <tl/expected.hpp>
 #include <argparse/argparse.hpp>
 
-using LuNI::Fmap;
-using LuNI::operator|;
-using LuNI::Bind;
-using LuNI::operator>>;
-
 using namespace LuNI::ErrorCodes;
 
 auto SetupArgParse() -> argparse::ArgumentParser {
@@ -32,6 +37,13 @@ auto SetupArgParse() -> argparse::ArgumentParser {
 		.help("Output interpreter logs along with errors")
 		.default_value(false)
 		.implicit_value(true);
+	program.add_argument("-O", "--optimize")
+		.help("Fold constant expressions, remove dead branches and propagate constant locals before running")
+		.default_value(false)
+		.implicit_value(true);
+	program.add_argument("--cache-dir")
+		.help("Cache parsed ASTs in this directory and reuse them for unchanged source files")
+		.default_value(std::string{});
 	program.add_argument("-b", "--run-bytecode")
 		.help("Run the files as bytecode generated by LuNI instead of run them as Lua source code")
 		.default_value(false)
@@ -43,49 +55,69 @@ auto SetupArgParse() -> argparse::ArgumentParser {
 	return program;
 }
 
-auto Err(u32 errorCode, std::string msg) -> tl::expected<LuNI::BytecodeProgram, LuNI::StandardError> {
+auto Err(u32 errorCode, std::string msg) -> tl::unexpected<LuNI::StandardError> {
 	return tl::unexpected(LuNI::StandardError{std::move(errorCode), std::move(msg)});
 }
 
+/// 一个输入文件的编译结果，编译可以在任意线程上进行，但执行必须按照命令行中的顺序
+struct CompiledInput {
+	// token和AST都直接引用源文件中的文本，所以`file`必须存活到程序运行结束
+	// 放在堆上以保证移动CompiledInput时文本的地址不变
+	std::unique_ptr<LuNI::SourceFile> file;
+	LuNI::ParsingResult ast;
+	LuNI::BytecodeProgram program;
+};
+
 auto ProgramFromSource(
-	argparse::ArgumentParser& args,
-	const std::string& path
-) -> tl::expected<LuNI::BytecodeProgram, LuNI::StandardError> {
-	auto ifs = std::ifstream{path};
-	if (!ifs) {
-		return Err(INPUT_FILE_NOT_FOUND, fmt::format("Unable to find source file {}", path));
+	const std::string& path,
+	bool optimize,
+	const LuNI::AstCache* cache,
+	usize parsingThreads
+) -> tl::expected<CompiledInput, LuNI::StandardError> {
+	auto file = LuNI::SourceFile::Open(path);
+	if (!file) {
+		return tl::unexpected(std::move(file.error()));
 	}
-	auto ifsBuf = std::stringstream{};
-	ifsBuf << ifs.rdbuf();
-	auto source = ifsBuf.str();
-
-	auto tokens = LuNI::DoLexing(args, source);
 
-#ifdef LUNI_DEBUG_INFO
-	for (const auto& token : tokens) {
-		fmt::print("[Debug][Lexer] '{}' at {} with type {}\n", token.text, token.pos, token.type);
+	auto result = CompiledInput{
+		.file = std::make_unique<LuNI::SourceFile>(std::move(*file)),
+		.ast = {},
+		.program = {},
+	};
+	auto source = result.file->Text();
+	auto cacheFlags = optimize ? u32{ LuNI::AstCache::OPTIMIZED } : 0;
+	if (auto cached = cache ? cache->Load(source, cacheFlags) : std::nullopt) {
+		result.ast = std::move(*cached);
+	} else {
+		// 大文件按顶层函数切分后并行解析，小文件仍然是lexer和parser交替进行
+		result.ast = LuNI::DoParallelParsing(source, parsingThreads);
+		// 有语法错误的AST可能不完整，交给调用者报告错误，不再做后续处理
+		if (!result.ast.errors.empty()) {
+			return result;
+		}
+		if (optimize) {
+			LuNI::OptimizeAst(result.ast);
+		}
+		if (cache) {
+			cache->Store(source, cacheFlags, result.ast);
+		}
 	}
-#endif // #ifdef LUNI_DEBUG_INFO
-
-	auto ast = LuNI::DoParsing(args, tokens);
-	auto& astRoot = *ast.root.get();
+	// 槽位不在缓存中，每次都重新计算
+	LuNI::ResolveScopes(*result.ast.root);
 
-	LuNI::RunProgram_WalkAST(args, astRoot);
-
-	return LuNI::BytecodeProgram{};
+	return result;
 }
 
 auto ProgramFromBytecode(
-	argparse::ArgumentParser& args,
 	const std::string& path
-) -> tl::expected<LuNI::BytecodeProgram, LuNI::StandardError> {
+) -> tl::expected<CompiledInput, LuNI::StandardError> {
 	auto ifs = std::ifstream{path};
 	if (!ifs) {
 		return Err(INPUT_FILE_NOT_FOUND, fmt::format("Unable to find bytecode file {}", path));
 	}
 
 	// TODO
-	return LuNI::BytecodeProgram{};
+	return CompiledInput{};
 }
 
 int main(int argc, char* argv[]) {
@@ -98,17 +130,58 @@ int main(int argc, char* argv[]) {
 		return -1;
 	}
 
+	// 日志事件在热路径上只写入环形缓冲区，由后台线程负责输出
+	u32 traceCategories = 0;
+	if (args["--verbose-lexing"] == true) traceCategories |= LuNI::Tracing::LEXER;
+	if (args["--verbose-parsing"] == true) traceCategories |= LuNI::Tracing::PARSER;
+	if (args["--verbose-execution"] == true) traceCategories |= LuNI::Tracing::INTERPRETER;
+	LuNI::Tracing::SetCategories(traceCategories);
+	LuNI::Tracing::StartFlusher();
+	DEFER { LuNI::Tracing::StopFlusher(); };
+
 	auto inputBytecode = args["--run-bytecode"] == true;
+	auto optimize = args["--optimize"] == true;
+	auto cacheDir = args.get<std::string>("--cache-dir");
+	auto cache = cacheDir.empty() ? std::nullopt : std::make_optional<LuNI::AstCache>(cacheDir);
+	auto cachePtr = cache ? &*cache : nullptr;
 	auto inputs = args.get<std::vector<std::string>>("inputs");
 
-	for (const auto& input : inputs) {
-		auto res = inputBytecode
-			? ProgramFromBytecode(args, input)
-			: ProgramFromSource(args, input);
-		if (!res) continue;
-		auto program = res.value();
+	// 所有输入文件的读取、lexing和parsing互相独立，在线程池上并行进行
+	auto compiled = std::vector<std::future<tl::expected<CompiledInput, LuNI::StandardError>>>{};
+	compiled.reserve(inputs.size());
+	{
+		auto hardwareThreads = std::max<usize>(std::thread::hardware_concurrency(), 1);
+		// 剩余的核心平分给每个文件内部的并行解析
+		auto parsingThreads = std::max<usize>(hardwareThreads / inputs.size(), 1);
+		auto pool = LuNI::ThreadPool{ std::min<usize>(inputs.size(), hardwareThreads) };
+		for (const auto& input : inputs) {
+			compiled.push_back(pool.Submit([&input, inputBytecode, optimize, cachePtr, parsingThreads]() {
+				return inputBytecode
+					? ProgramFromBytecode(input)
+					: ProgramFromSource(input, optimize, cachePtr, parsingThreads);
+			}));
+		}
+	}
 
-		LuNI::RunProgram(args, program);
+	// 执行仍然按照命令行中的顺序进行，遇到第一个无法编译的文件时停止
+	for (usize i = 0; i < compiled.size(); ++i) {
+		auto res = compiled[i].get();
+		if (!res) {
+			fmt::print(stderr, "{}\n", res.error().msg);
+			return 1;
+		}
+		auto& input = res.value();
+		if (!input.ast.errors.empty()) {
+			for (const auto& error : input.ast.errors) {
+				fmt::print(stderr, "{}: {}\n", inputs[i], error.msg);
+			}
+			return 1;
+		}
+
+		if (input.ast.root) {
+			LuNI::RunProgram_WalkAST(args, *input.ast.root);
+		}
+		LuNI::RunProgram(args, input.program);
 	}
 
 	return 0;
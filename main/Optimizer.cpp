@@ -0,0 +1,492 @@
+#include "Optimizer.hpp"
+
+#include "LuaValue.hpp"
+#include "Symbol.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace LuNI;
+
+namespace {
+/// 编译期就能确定的值，也就是字面量节点所表示的值
+struct Constant {
+	enum Type : u8 { NIL, BOOLEAN, INTEGER, NUMBER, STRING };
+
+	Type type;
+	union {
+		bool boolean;
+		i64 integer;
+		f64 number;
+		SymbolId string;
+	};
+
+	static auto Nil() -> Constant { return { .type = NIL, .integer = 0 }; }
+	static auto Boolean(bool value) -> Constant { return { .type = BOOLEAN, .boolean = value }; }
+	static auto Integer(i64 value) -> Constant { return { .type = INTEGER, .integer = value }; }
+	static auto Number(f64 value) -> Constant { return { .type = NUMBER, .number = value }; }
+	static auto String(SymbolId value) -> Constant { return { .type = STRING, .string = value }; }
+
+	/// 只有nil和false为假
+	auto IsTruthy() const -> bool {
+		return type != NIL && !(type == BOOLEAN && !boolean);
+	}
+
+	auto IsNumber() const -> bool {
+		return type == INTEGER || type == NUMBER;
+	}
+
+	auto AsNumber() const -> f64 {
+		return type == INTEGER ? static_cast<f64>(integer) : number;
+	}
+};
+
+class OptimizingState {
+private:
+	struct Binding {
+		SymbolId name;
+		/// 变量的值是常量并且从未被重新赋值时非空，参数和循环变量总是为空
+		const AstNode* constant;
+	};
+
+	/// 当前可见的所有局部变量，包括外层函数（脚本本身）的，内层的在后面
+	std::vector<Binding> bindings;
+
+public:
+	Arena& arena;
+	/// 被不带`local`的赋值修改过的局部变量声明，由第一遍扫描收集
+	std::unordered_set<const AstVarDefNode*> reassigned;
+
+public:
+	OptimizingState(Arena& arena)
+		: arena{ arena } {}
+
+	auto BeginBlock() const -> usize {
+		return bindings.size();
+	}
+
+	auto FinishBlock(usize block) -> void {
+		bindings.resize(block);
+	}
+
+	auto Declare(SymbolId name, const AstNode* constant = nullptr) -> void {
+		bindings.push_back({ name, constant });
+	}
+
+	/// 返回`name`所指的局部变量的常量值，`name`不是局部变量或者不是常量时返回空
+	auto ValueOf(SymbolId name) const -> const AstNode* {
+		for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+			if (it->name == name) return it->constant;
+		}
+		return nullptr;
+	}
+};
+
+/// 第一遍扫描只需要知道每个赋值所指的局部变量声明，作用域规则和`ResolveScopes`相同
+class AssignmentCollector {
+private:
+	struct Binding {
+		SymbolId name;
+		const AstVarDefNode* decl; //< 参数和循环变量为空
+	};
+
+	std::vector<Binding> bindings;
+	std::unordered_set<const AstVarDefNode*>& reassigned;
+
+public:
+	AssignmentCollector(std::unordered_set<const AstVarDefNode*>& reassigned)
+		: reassigned{ reassigned } {}
+
+	auto Collect(const AstNode* node) -> void {
+		if (!node) return;
+
+		switch (node->kind) {
+			case AstNode::KD_LocalVarDef: {
+				auto& varDef = node->As<AstVarDefNode>();
+				Collect(varDef.Value());
+				bindings.push_back({ varDef.name, &varDef });
+				break;
+			}
+			case AstNode::KD_GlobalVarDef: {
+				auto& varDef = node->As<AstVarDefNode>();
+				Collect(varDef.Value());
+				for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+					if (it->name != varDef.name) continue;
+					if (it->decl) reassigned.insert(it->decl);
+					break;
+				}
+				break;
+			}
+			case AstNode::KD_StatementBlock: {
+				auto block = bindings.size();
+				CollectChildren(*node);
+				bindings.resize(block);
+				break;
+			}
+			case AstNode::KD_For: {
+				auto& loop = node->As<AstForNode>();
+				Collect(loop.Start());
+				Collect(loop.Stop());
+				Collect(loop.Step());
+
+				auto block = bindings.size();
+				bindings.push_back({ loop.variable, nullptr });
+				Collect(loop.Body());
+				bindings.resize(block);
+				break;
+			}
+			case AstNode::KD_Until: {
+				auto& loop = node->As<AstUntilNode>();
+				auto block = bindings.size();
+				if (loop.Body()) CollectChildren(*loop.Body());
+				Collect(loop.Condition());
+				bindings.resize(block);
+				break;
+			}
+			case AstNode::KD_FunctionDefinition: {
+				auto& def = node->As<AstFunctionDefinitionNode>();
+				auto block = bindings.size();
+				for (auto param : def.params) {
+					bindings.push_back({ param, nullptr });
+				}
+				Collect(def.Body());
+				bindings.resize(block);
+				break;
+			}
+			default: {
+				CollectChildren(*node);
+				break;
+			}
+		}
+	}
+
+private:
+	auto CollectChildren(const AstNode& node) -> void {
+		for (auto child : node.GetChildren()) {
+			Collect(child);
+		}
+	}
+};
+}
+
+static auto ConstantOf(const AstNode* node) -> std::optional<Constant> {
+	if (!node) return {};
+
+	switch (node->kind) {
+		case AstNode::KD_Nil: return Constant::Nil();
+		case AstNode::KD_BooleanLiteral: return Constant::Boolean(node->As<AstBooleanLiteralNode>().value);
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = node->As<AstNumericLiteralNode>();
+			return literal.isInteger ? Constant::Integer(literal.integer) : Constant::Number(literal.number);
+		}
+		case AstNode::KD_StringLiteral: return Constant::String(node->As<AstStringLiteralNode>().value);
+		default: return {};
+	}
+}
+
+static auto NewLiteral(Arena& arena, const Constant& constant) -> AstNode* {
+	switch (constant.type) {
+		case Constant::NIL: return arena.New<AstNilNode>();
+		case Constant::BOOLEAN: return arena.New<AstBooleanLiteralNode>(constant.boolean);
+		case Constant::INTEGER: return arena.New<AstNumericLiteralNode>(constant.integer);
+		case Constant::NUMBER: return arena.New<AstNumericLiteralNode>(constant.number);
+		case Constant::STRING: return arena.New<AstStringLiteralNode>(constant.string);
+	}
+	return nullptr;
+}
+
+/// 字符串字面量中保存的是源文件中的原始文本，只有不含转义序列和换行（长字符串开头的换行会被忽略）的文本
+/// 才和它的值完全相同，可以在编译期比较、连接和求长度
+static auto IsPlainText(SymbolId string) -> bool {
+	return Symbols().Text(string).find_first_of("\\\r\n") == std::string_view::npos;
+}
+
+/// 整数运算按照Lua的规则在溢出时回绕
+static auto WrapInteger(u64 value) -> Constant {
+	return Constant::Integer(static_cast<i64>(value));
+}
+
+static auto FoldArithmetic(BinaryOp op, const Constant& lhs, const Constant& rhs) -> std::optional<Constant> {
+	// 运行时不会把字符串转换成数字，对非数字做算术会抛出错误，所以保留原样让错误在运行时发生
+	if (!lhs.IsNumber() || !rhs.IsNumber()) return {};
+
+	auto integers = lhs.type == Constant::INTEGER && rhs.type == Constant::INTEGER;
+	auto a = lhs.AsNumber();
+	auto b = rhs.AsNumber();
+	switch (op) {
+		case BinaryOp::ADD:
+			if (integers) return WrapInteger(static_cast<u64>(lhs.integer) + static_cast<u64>(rhs.integer));
+			return Constant::Number(a + b);
+		case BinaryOp::SUBTRACT:
+			if (integers) return WrapInteger(static_cast<u64>(lhs.integer) - static_cast<u64>(rhs.integer));
+			return Constant::Number(a - b);
+		case BinaryOp::MULTIPLY:
+			if (integers) return WrapInteger(static_cast<u64>(lhs.integer) * static_cast<u64>(rhs.integer));
+			return Constant::Number(a * b);
+		case BinaryOp::DIVIDE:
+			return Constant::Number(a / b);
+		case BinaryOp::EXPONENT:
+			return Constant::Number(std::pow(a, b));
+		case BinaryOp::MOD: {
+			// 取模的结果和除数同号
+			if (integers) {
+				// 整数对0取模是运行时错误，留给解释器报告
+				if (rhs.integer == 0) return {};
+				if (rhs.integer == -1) return Constant::Integer(0);
+				auto r = lhs.integer % rhs.integer;
+				if (r != 0 && (r ^ rhs.integer) < 0) r += rhs.integer;
+				return Constant::Integer(r);
+			}
+			auto r = std::fmod(a, b);
+			if (r != 0 && (r < 0) != (b < 0)) r += b;
+			return Constant::Number(r);
+		}
+		default: return {};
+	}
+}
+
+static auto FoldComparison(BinaryOp op, const Constant& lhs, const Constant& rhs) -> std::optional<Constant> {
+	if (op == BinaryOp::EQUALS || op == BinaryOp::NOT_EQUAL) {
+		std::optional<bool> equal;
+		if (lhs.IsNumber() && rhs.IsNumber()) {
+			// 和运行时相同，整数和浮点数之间按照精确的值比较
+			auto ValueOf = [](const Constant& constant) {
+				return constant.type == Constant::INTEGER ? LuaValue{ constant.integer } : LuaValue{ constant.number };
+			};
+			equal = ValueOf(lhs).RawEquals(ValueOf(rhs));
+		} else if (lhs.type != rhs.type) {
+			// 不同类型的值总是不相等，数字和字符串之间也不会自动转换
+			equal = false;
+		} else if (lhs.type == Constant::NIL) {
+			equal = true;
+		} else if (lhs.type == Constant::BOOLEAN) {
+			equal = lhs.boolean == rhs.boolean;
+		} else if (lhs.string == rhs.string) {
+			equal = true;
+		} else if (IsPlainText(lhs.string) && IsPlainText(rhs.string)) {
+			// 原始文本不同的字符串在转义之后可能相同
+			equal = false;
+		}
+		if (!equal) return {};
+		return Constant::Boolean(op == BinaryOp::EQUALS ? *equal : !*equal);
+	}
+
+	if (!lhs.IsNumber() || !rhs.IsNumber()) return {};
+	auto integers = lhs.type == Constant::INTEGER && rhs.type == Constant::INTEGER;
+	auto Compare = [&](auto compare) {
+		return Constant::Boolean(integers ? compare(lhs.integer, rhs.integer) : compare(lhs.AsNumber(), rhs.AsNumber()));
+	};
+	switch (op) {
+		case BinaryOp::LESS: return Compare([](auto a, auto b) { return a < b; });
+		case BinaryOp::GREATER: return Compare([](auto a, auto b) { return a > b; });
+		case BinaryOp::LESS_EQ: return Compare([](auto a, auto b) { return a <= b; });
+		case BinaryOp::GREATER_EQ: return Compare([](auto a, auto b) { return a >= b; });
+		default: return {};
+	}
+}
+
+/// `..`的操作数可以是字符串或者整数；浮点数转换成字符串的格式比较复杂，留给运行时处理
+static auto FoldConcat(const Constant& lhs, const Constant& rhs) -> std::optional<Constant> {
+	auto TextOf = [](const Constant& constant) -> std::optional<std::string> {
+		if (constant.type == Constant::INTEGER) return std::to_string(constant.integer);
+		if (constant.type == Constant::STRING && IsPlainText(constant.string)) return std::string{ Symbols().Text(constant.string) };
+		return {};
+	};
+
+	auto a = TextOf(lhs);
+	auto b = TextOf(rhs);
+	if (!a || !b) return {};
+	return Constant::String(Symbols().Intern(*a + *b));
+}
+
+static auto FoldBinaryOp(OptimizingState& state, AstBinaryOpNode& node) -> AstNode* {
+	auto lhs = ConstantOf(node.Lhs());
+	// 常量没有副作用，所以左边是常量时`and`/`or`的结果就是其中一边，右边不需要是常量
+	if (lhs && node.op == BinaryOp::AND) return lhs->IsTruthy() ? node.Rhs() : node.Lhs();
+	if (lhs && node.op == BinaryOp::OR) return lhs->IsTruthy() ? node.Lhs() : node.Rhs();
+
+	auto rhs = ConstantOf(node.Rhs());
+	if (!lhs || !rhs) return &node;
+
+	std::optional<Constant> result;
+	switch (node.op) {
+		case BinaryOp::CONCAT: result = FoldConcat(*lhs, *rhs); break;
+		case BinaryOp::LESS:
+		case BinaryOp::GREATER:
+		case BinaryOp::LESS_EQ:
+		case BinaryOp::GREATER_EQ:
+		case BinaryOp::NOT_EQUAL:
+		case BinaryOp::EQUALS: result = FoldComparison(node.op, *lhs, *rhs); break;
+		default: result = FoldArithmetic(node.op, *lhs, *rhs); break;
+	}
+	return result ? NewLiteral(state.arena, *result) : &node;
+}
+
+static auto FoldUnaryOp(OptimizingState& state, AstUnaryOpNode& node) -> AstNode* {
+	auto operand = ConstantOf(node.Operand());
+	if (!operand) return &node;
+
+	std::optional<Constant> result;
+	switch (node.op) {
+		case UnaryOp::NOT:
+			result = Constant::Boolean(!operand->IsTruthy());
+			break;
+		case UnaryOp::NEGATE:
+			if (operand->type == Constant::INTEGER) result = WrapInteger(0 - static_cast<u64>(operand->integer));
+			if (operand->type == Constant::NUMBER) result = Constant::Number(-operand->number);
+			break;
+		case UnaryOp::LENGTH:
+			if (operand->type == Constant::STRING && IsPlainText(operand->string)) {
+				result = Constant::Integer(static_cast<i64>(Symbols().Text(operand->string).size()));
+			}
+			break;
+	}
+	return result ? NewLiteral(state.arena, *result) : &node;
+}
+
+static auto Optimize(OptimizingState& state, AstNode* node) -> AstNode*;
+
+/// 优化表达式的所有子节点，表达式不会被删除，所以子节点的数量不变
+static auto OptimizeChildren(OptimizingState& state, AstNode& node) -> void {
+	for (auto& child : node.children) {
+		child = Optimize(state, child);
+	}
+}
+
+/// 优化语句列表，被删除的语句直接从列表中去掉
+static auto OptimizeStatements(OptimizingState& state, AstNode& node) -> void {
+	usize count = 0;
+	for (auto child : node.children) {
+		if (auto result = Optimize(state, child)) node.children[count++] = result;
+	}
+	node.children = node.children.first(count);
+}
+
+/// 返回替换`node`的节点，语句被完全删除时返回空
+static auto Optimize(OptimizingState& state, AstNode* node) -> AstNode* {
+	// 出错的产生式可能留下空的子节点
+	if (!node) return nullptr;
+
+	switch (node->kind) {
+		case AstNode::KD_Identifier: {
+			auto constant = ConstantOf(state.ValueOf(node->As<AstIdentifierNode>().name));
+			return constant ? NewLiteral(state.arena, *constant) : node;
+		}
+		case AstNode::KD_BinaryOp: {
+			OptimizeChildren(state, *node);
+			return FoldBinaryOp(state, node->As<AstBinaryOpNode>());
+		}
+		case AstNode::KD_UnaryOp: {
+			OptimizeChildren(state, *node);
+			return FoldUnaryOp(state, node->As<AstUnaryOpNode>());
+		}
+		case AstNode::KD_FunctionCall: {
+			// 被调用的变量不做常量传播，`local f = 1; f()`在运行时报告的仍然是调用了变量f
+			auto& call = node->As<AstFunctionCallNode>();
+			if (call.Callee() && call.Callee()->kind != AstNode::KD_Identifier) {
+				call.children[0] = Optimize(state, call.Callee());
+			}
+			for (auto& argument : call.children.subspan(1)) {
+				argument = Optimize(state, argument);
+			}
+			return node;
+		}
+		case AstNode::KD_LocalVarDef: {
+			auto& varDef = node->As<AstVarDefNode>();
+			OptimizeChildren(state, varDef);
+			auto value = varDef.Value();
+			auto constant = !state.reassigned.contains(&varDef) && ConstantOf(value) ? value : nullptr;
+			state.Declare(varDef.name, constant);
+			return node;
+		}
+		case AstNode::KD_StatementBlock: {
+			auto block = state.BeginBlock();
+			OptimizeStatements(state, *node);
+			state.FinishBlock(block);
+			return node;
+		}
+		case AstNode::KD_If: {
+			auto& branch = node->As<AstIfNode>();
+			branch.children[0] = Optimize(state, branch.Condition());
+			if (auto condition = ConstantOf(branch.Condition())) {
+				// 只保留会执行的那个分支，分支本身是一个语句块，可以直接作为语句
+				auto taken = condition->IsTruthy() ? branch.IfBody() : branch.ElseBody();
+				return Optimize(state, taken);
+			}
+			for (auto& body : branch.children.subspan(1)) {
+				body = Optimize(state, body);
+			}
+			return node;
+		}
+		case AstNode::KD_While: {
+			auto& loop = node->As<AstWhileNode>();
+			loop.children[0] = Optimize(state, loop.Condition());
+			if (auto condition = ConstantOf(loop.Condition()); condition && !condition->IsTruthy()) {
+				return nullptr;
+			}
+			loop.children[1] = Optimize(state, loop.Body());
+			return node;
+		}
+		case AstNode::KD_For: {
+			auto& loop = node->As<AstForNode>();
+			for (auto& expr : loop.children.first(3)) {
+				expr = Optimize(state, expr);
+			}
+
+			auto block = state.BeginBlock();
+			state.Declare(loop.variable);
+			loop.children[3] = Optimize(state, loop.Body());
+			state.FinishBlock(block);
+			return node;
+		}
+		case AstNode::KD_Until: {
+			// `until`的条件可以看到循环体中的局部变量
+			auto& loop = node->As<AstUntilNode>();
+			auto block = state.BeginBlock();
+			if (loop.Body()) OptimizeStatements(state, *loop.Body());
+			loop.children[1] = Optimize(state, loop.Condition());
+			state.FinishBlock(block);
+			return node;
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& def = node->As<AstFunctionDefinitionNode>();
+			auto block = state.BeginBlock();
+			for (auto param : def.params) {
+				state.Declare(param);
+			}
+			def.children[0] = Optimize(state, def.Body());
+			state.FinishBlock(block);
+			return node;
+		}
+		default: {
+			OptimizeChildren(state, *node);
+			return node;
+		}
+	}
+}
+
+auto LuNI::OptimizeAst(ParsingResult& ast) -> void {
+	if (!ast.root) return;
+
+	OptimizingState state{ ast.arena };
+	AssignmentCollector{ state.reassigned }.Collect(ast.root);
+
+	// 和普通的语句列表一样，但是`ranges`要和顶层节点保持一一对应
+	auto& root = *ast.root;
+	usize count = 0;
+	for (usize i = 0; i < root.children.size(); ++i) {
+		auto result = Optimize(state, root.children[i]);
+		if (!result) continue;
+		root.children[count] = result;
+		if (i < ast.ranges.size()) ast.ranges[count] = ast.ranges[i];
+		++count;
+	}
+	LUNI_TRACE(INFO, PARSER, "[Optimizer] Removed {} of {} top-level nodes", root.children.size() - count, root.children.size());
+	root.children = root.children.first(count);
+	ast.ranges.resize(std::min(ast.ranges.size(), count));
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Parser.hpp"
+
+namespace LuNI {
+
+/// 在解析之后、作用域解析之前对AST做的优化，由命令行的`-O`开启
+///
+/// - 折叠操作数都是常量的算术、比较、字符串连接、`not`/`-`/`#`以及常量开头的`and`/`or`
+/// - 删除条件为常量的`if`中不会执行的分支，以及条件为假的`while`循环
+/// - 把从未被重新赋值、且值为常量的`local`变量的引用替换成常量本身
+///
+/// 新节点分配在`ast.arena`中，被删除的顶层节点同时从`ast.ranges`中删除。
+/// 优化之后的树不再和源文件一一对应（例如常量传播依赖于整个文件），不能再交给`DoReparsing`。
+auto OptimizeAst(ParsingResult& ast) -> void;
+
+} // namespace LuNI
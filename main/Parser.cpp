@@ -1,10 +1,14 @@
 #include "Parser.hpp"
 
 #include "Lexer.hpp"
-#include "ScopeGuard.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 
-#include <fmt/core.h>
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+#include <algorithm>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <optional>
 #include <span>
@@ -13,20 +17,44 @@
 
 using namespace LuNI;
 
+static auto DescribeNode(const AstNode& node) -> std::string {
+	auto& symbols = Symbols();
+	switch (node.kind) {
+		case AstNode::KD_Identifier: return fmt::format("'{}'", symbols.Text(node.As<AstIdentifierNode>().name));
+		case AstNode::KD_StringLiteral: return fmt::format("'{}'", symbols.Text(node.As<AstStringLiteralNode>().value));
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = node.As<AstNumericLiteralNode>();
+			return literal.isInteger ? fmt::format("{}", literal.integer) : fmt::format("{}", literal.number);
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& def = node.As<AstFunctionDefinitionNode>();
+			auto params = std::string{};
+			for (auto param : def.params) {
+				if (!params.empty()) params += ", ";
+				params += symbols.Text(param);
+			}
+			return fmt::format("'{}'({})", symbols.Text(def.name), params);
+		}
+		case AstNode::KD_LocalVarDef:
+		case AstNode::KD_GlobalVarDef: return fmt::format("'{}'", symbols.Text(node.As<AstVarDefNode>().name));
+		case AstNode::KD_For: return fmt::format("'{}'", symbols.Text(node.As<AstForNode>().variable));
+		case AstNode::KD_BooleanLiteral: return node.As<AstBooleanLiteralNode>().value ? "true" : "false";
+		case AstNode::KD_BinaryOp: return std::string{ magic_enum::enum_name(node.As<AstBinaryOpNode>().op) };
+		case AstNode::KD_UnaryOp: return std::string{ magic_enum::enum_name(node.As<AstUnaryOpNode>().op) };
+		default: return {};
+	}
+}
+
 static auto PrintNode(const AstNode& node, u32 indent = 0) -> void {
-	char buffer[256];
-	if (auto& ptr = node.extraData) {
-		auto extras = std::visit(
-			[&](auto&& value) { return fmt::format("'{}'", value); },
-			*ptr);
-		fmt::format_to(buffer, "Node(type = {}, extras = {})\n", node.type, extras);
+	// 每个节点输出为一个独立的事件，缩进表示层级
+	auto extras = DescribeNode(node);
+	if (!extras.empty()) {
+		LUNI_TRACE(INFO, PARSER, "{:\t>{}}Node(type = {}, extras = {})", "", indent, magic_enum::enum_name(node.kind), extras);
 	} else {
-		fmt::format_to(buffer, "Node(type = {})\n", node.type);
+		LUNI_TRACE(INFO, PARSER, "{:\t>{}}Node(type = {})", "", indent, magic_enum::enum_name(node.kind));
 	}
 
-	fmt::print("{:\t>{}}", buffer, indent);
-
-	for (auto& child : node.children) {
+	for (auto child : node.GetChildren()) {
 		PrintNode(*child, indent + 1);
 	}
 }
@@ -34,155 +62,486 @@ static auto PrintNode(const AstNode& node, u32 indent = 0) -> void {
 namespace {
 class ParsingState {
 public:
-	struct Snapshot {
-		std::vector<Token>::const_iterator ptr;
-	};
-
-	enum class Continuation {
-		CONTINUE,
-		BREAK_EOF,
-		BREAK_NO_CONSUMPTION,
-	};
-
-public:
-	std::unique_ptr<AstNode> root;
+	Arena arena;
+	AstScriptNode* root;
 	std::vector<StandardError> errors;
 
 private:
-	const std::vector<Token>* tokens;
-	std::vector<Token>::const_iterator ptr;
-	usize lastIterRemaining = -1;
+	TokenStream* tokens;
+	/// 正在构建的子节点列表共用的栈，列表完成后再整体复制进arena。
+	/// 构建列表的函数总是嵌套调用，所以每个列表都位于栈顶
+	std::vector<AstNode*> pendingChildren;
+	std::vector<SymbolId> pendingNames;
+	std::vector<AstNode*> topLevelNodes;
+	std::vector<SourceRange> topLevelRanges;
+	/// 最后一个被消耗的token真正的结尾，字符串字面量包括结尾的引号或者长括号
+	u32 consumedEnd = 0;
 
 public:
-	ParsingState(const std::vector<Token>& tokensIn) noexcept
-		: root{ std::make_unique<AstNode>(AstNode::KD_Script) }
+	ParsingState(TokenStream& tokens)
+		: arena{}
+		, root{ arena.New<AstScriptNode>() }
+		, errors{}
+		, tokens{ &tokens } {}
+
+	/// 继续使用已有的arena和根节点，用于增量解析
+	ParsingState(TokenStream& tokens, Arena&& arena, AstScriptNode* root)
+		: arena{ std::move(arena) }
+		, root{ root }
 		, errors{}
-		, tokens{ &tokensIn }
-		, ptr{ tokensIn.begin() } {}
+		, tokens{ &tokens } {}
 
 	ParsingState(const ParsingState& that) = delete;
 	ParsingState& operator=(const ParsingState& that) = delete;
 	ParsingState(ParsingState&& that) = default;
 	ParsingState& operator=(ParsingState&& that) = default;
 
-	auto FetchContinuationState() -> Continuation {
-		auto remaining = std::distance(ptr, tokens->end());
-		if (remaining == lastIterRemaining) {
-			return remaining == 0
-				? Continuation::BREAK_EOF
-				: Continuation::BREAK_NO_CONSUMPTION;
-		} else {
-			lastIterRemaining = remaining;
-			return Continuation::CONTINUE;
-		}
+	auto HasNext() -> bool {
+		return tokens->Peek() != nullptr;
+	}
+
+	auto TextOf(const Token& token) const -> std::string_view {
+		return token.Text(tokens->Source());
+	}
+
+	/// 已经消耗的token数量，用于判断一个失败的产生式是否已经报告过错误
+	auto Position() const -> usize {
+		return tokens->Position();
+	}
+
+	/// 查看第`offset`个尚未被消耗的token而不消耗它
+	auto Peek(usize offset = 0) -> const Token* {
+		return tokens->Peek(offset);
+	}
+
+	auto Take() -> std::optional<Token> {
+		auto token = tokens->Take();
+		if (token) consumedEnd = token->End(tokens->Source());
+		return token;
+	}
+
+	auto ConsumedEnd() const -> u32 {
+		return consumedEnd;
+	}
+
+	/// 和`TakeIf`相同，但是在下一个token不是`type`时记录一个错误
+	auto Expect(TokenType type, u32 errorCode) -> std::optional<Token> {
+		if (auto token = TakeIf(type)) return token;
+		ReportError(errorCode, fmt::format("Expected '{}'", StringifyTokenType(type)));
+		return {};
+	}
+
+	/// 记录一个位于下一个token处的错误。错误只通过解析结果报告一次，这里的trace仅用于调试
+	auto ReportError(u32 errorCode, std::string_view message) -> void {
+		auto next = tokens->Peek();
+		auto offset = next ? next->offset : static_cast<u32>(tokens->Source().size());
+		auto pos = tokens->Lines().PosOf(offset);
+		errors.push_back(StandardError{ errorCode, fmt::format("{} at {}", message, pos) });
+		LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser] {} at {}", message, pos);
+	}
+
+	/// 缺少表达式，返回空方便直接`return`
+	auto ExpectedExpression() -> AstNode* {
+		ReportError(ErrorCodes::PARSER_EXPECTED_EXPRESSION, "Expected an expression");
+		return nullptr;
+	}
+
+	// 当下一个token为指定的类型时返回下一个token，否则返回空
+	/// 只有返回非空值的情况下才会消耗这个token
+	auto TakeIf(TokenType type) -> std::optional<Token> {
+		auto next = tokens->Peek();
+		if (!next || next->type != type) return {};
+		return Take();
 	}
 
-	auto HasNext() const -> bool {
-		return ptr != tokens->end();
+	/// 在arena中创建一个节点，节点不会被单独释放，而是随着整个arena一起释放
+	template <typename T, typename... Args>
+	auto NewNode(Args&&... args) -> T* {
+		return arena.New<T>(std::forward<Args>(args)...);
 	}
 
-	auto RecordSnapshot() const -> Snapshot {
-		return Snapshot{ ptr };
+	template <typename T>
+	auto NewNode(T* node, std::initializer_list<AstNode*> children) -> T* {
+		node->children = arena.NewArray(std::span<AstNode* const>(children.begin(), children.size()));
+		return node;
 	}
 
-	auto RestoreSnapshot(Snapshot snapshot) -> void {
-		this->ptr = std::move(snapshot.ptr);
+	/// 开始构建一个长度不定的子节点列表，返回值用于`FinishList`
+	auto BeginList() -> usize {
+		return pendingChildren.size();
 	}
 
-	auto Take() -> const Token* {
-		if (!HasNext()) return nullptr;
-		auto result = &*ptr;
-		++ptr;
+	auto AppendToList(AstNode* node) -> void {
+		pendingChildren.push_back(node);
+	}
+
+	auto FinishList(usize begin) -> std::span<AstNode*> {
+		auto items = std::span<AstNode* const>(pendingChildren).subspan(begin);
+		auto result = arena.NewArray(items);
+		pendingChildren.resize(begin);
 		return result;
 	}
 
-	// 当下一个token为指定的类型时返回下一个token，否则返回nullptr
-	/// 只有返回非空指针的情况下才会移动`ptr`
-	auto TakeIf(TokenType type) -> const Token* {
-		if (!HasNext()) return nullptr;
-		auto result = &*ptr;
-		if (result->type != type) {
-			return nullptr;
-		} else {
-			++ptr;
-			return result;
-		}
+	auto BeginNameList() -> usize {
+		return pendingNames.size();
 	}
 
-	auto TakeSome(usize items) -> std::span<const Token> {
-		if (!HasNext()) return {};
-		usize dist = std::distance(ptr, tokens->end());
-		auto itemsClamped = std::min(dist, items);
+	auto AppendToNameList(SymbolId name) -> void {
+		pendingNames.push_back(name);
+	}
 
-		return std::span<const Token>(ptr, itemsClamped);
+	auto FinishNameList(usize begin) -> std::span<SymbolId> {
+		auto items = std::span<const SymbolId>(pendingNames).subspan(begin);
+		auto result = arena.NewArray(items);
+		pendingNames.resize(begin);
+		return result;
+	}
+
+	auto AddTopLevel(AstNode* node, SourceRange range) -> void {
+		topLevelNodes.push_back(node);
+		topLevelRanges.push_back(range);
 	}
 
 	/// 将这个ParsingState转换s移动到返回的ParsingResult内，所以调用此函数之后任何对root AST节点
 	/// 或errors列表的操作都会造成UB
 	auto FinishParsing() -> ParsingResult {
-		return ParsingResult{ std::move(this->root), std::move(this->errors) };
+		root->children = arena.NewArray(std::span<AstNode* const>(topLevelNodes));
+		// lexer丢弃的字符不会出现在token中，parser本身察觉不到，所以lexer的错误要一并报告
+		auto& lexerErrors = tokens->Errors();
+		errors.insert(errors.begin(), lexerErrors.begin(), lexerErrors.end());
+		return ParsingResult{
+			std::move(this->arena),
+			this->root,
+			std::move(this->errors),
+			tokens->Source(),
+			std::move(this->topLevelRanges),
+		};
 	}
 };
 } // namespace
 
-// TODO 实现完整的parser backtracking使parser能够在有语法错误的情况下继续工作
+// ========================================
+// 表达式（Pratt parser）
+// ========================================
 
-static auto TryMatchArrayLiteral(ParsingState& state) -> std::unique_ptr<AstNode> {
-	return nullptr; // TODO
-}
+constexpr usize tokenTypeCount = static_cast<usize>(TokenType::SYMBOL_3_DOT) + 1;
+
+/// 二元运算符左右两侧的结合力，和Lua官方实现中的优先级一致。右侧结合力比左侧低的运算符是右结合的
+struct BinaryOperatorInfo {
+	BinaryOp op;
+	u8 leftPower; //< 为0表示这个token不是二元运算符
+	u8 rightPower;
+};
+
+/// 一元运算符的操作数的结合力，比除了“^”之外的所有二元运算符都高，所以`-x^2`是`-(x^2)`
+constexpr u8 kUnaryPower = 12;
 
-static auto TryMatchMetatableLiteral(ParsingState& state) -> std::unique_ptr<AstNode> {
-	return nullptr; // TODO
+constexpr auto binaryOperators = []() {
+	std::array<BinaryOperatorInfo, tokenTypeCount> table{};
+	auto set = [&](TokenType type, BinaryOp op, u8 left, u8 right) {
+		table[static_cast<usize>(type)] = BinaryOperatorInfo{ op, left, right };
+	};
+	set(TokenType::KEYWORD_OR, BinaryOp::OR, 1, 1);
+	set(TokenType::KEYWORD_AND, BinaryOp::AND, 2, 2);
+	set(TokenType::OPERATOR_LESS, BinaryOp::LESS, 3, 3);
+	set(TokenType::OPERATOR_GREATER, BinaryOp::GREATER, 3, 3);
+	set(TokenType::OPERATOR_LESS_EQ, BinaryOp::LESS_EQ, 3, 3);
+	set(TokenType::OPERATOR_GREATER_EQ, BinaryOp::GREATER_EQ, 3, 3);
+	set(TokenType::OPERATOR_NOT_EQUAL, BinaryOp::NOT_EQUAL, 3, 3);
+	set(TokenType::OPERATOR_EQUALS, BinaryOp::EQUALS, 3, 3);
+	set(TokenType::SYMBOL_2_DOT, BinaryOp::CONCAT, 9, 8); // 右结合
+	set(TokenType::OPERATOR_PLUS, BinaryOp::ADD, 10, 10);
+	set(TokenType::OPERATOR_MINUS, BinaryOp::SUBTRACT, 10, 10);
+	set(TokenType::OPERATOR_MULTIPLY, BinaryOp::MULTIPLY, 11, 11);
+	set(TokenType::OPERATOR_DIVIDE, BinaryOp::DIVIDE, 11, 11);
+	set(TokenType::OPERATOR_MOD, BinaryOp::MOD, 11, 11);
+	set(TokenType::OPERATOR_EXPONENT, BinaryOp::EXPONENT, 14, 13); // 右结合
+	return table;
+}();
+
+static auto UnaryOperatorOf(TokenType type) -> std::optional<UnaryOp> {
+	switch (type) {
+		case TokenType::KEYWORD_NOT: return UnaryOp::NOT;
+		case TokenType::OPERATOR_MINUS: return UnaryOp::NEGATE;
+		case TokenType::OPERATOR_LENGTH: return UnaryOp::LENGTH;
+		default: return {};
+	}
 }
 
-static auto TryMatchFunctionCall(ParsingState& state) -> std::unique_ptr<AstNode>;
-static auto TryMatchExpression(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	SCOPE_GUARD(snapshotGuard) { state.RestoreSnapshot(snapshot); };
+static auto TryMatchExpression(ParsingState& state) -> AstNode*;
+static auto MatchExpression(ParsingState& state) -> AstNode*;
+static auto MatchFunctionParams(ParsingState& state) -> void;
+static auto MatchTableConstructor(ParsingState& state) -> AstNode*;
+
+/// 名字或者括号内的表达式，之后可以跟任意数量的`.name`、`[key]`和`(args)`后缀
+static auto TryMatchSuffixedExpression(ParsingState& state) -> AstNode* {
+	auto first = state.Peek();
+	if (!first) return nullptr;
+
+	AstNode* expr;
+	switch (first->type) {
+		case TokenType::IDENTIFIER: {
+			state.Take();
+			expr = state.NewNode<AstIdentifierNode>(first->symbol);
+			break;
+		}
+		case TokenType::SYMBOL_LEFT_PAREN: {
+			state.Take();
+			expr = MatchExpression(state);
+			if (!expr) return nullptr;
+			if (!state.Expect(TokenType::SYMBOL_RIGHT_PAREN, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
+			break;
+		}
+		default: return nullptr;
+	}
+
+	while (auto next = state.Peek()) {
+		switch (next->type) {
+			case TokenType::SYMBOL_DOT: {
+				state.Take();
+				auto name = state.Expect(TokenType::IDENTIFIER, ErrorCodes::PARSER_EXPECTED_IDENTIFIER);
+				if (!name) return nullptr;
+				auto key = state.NewNode<AstStringLiteralNode>(name->symbol);
+				expr = state.NewNode(state.NewNode<AstIndexNode>(), { expr, key });
+				continue;
+			}
+			case TokenType::SYMBOL_LEFT_BRACKET: {
+				state.Take();
+				auto key = MatchExpression(state);
+				if (!key) return nullptr;
+				if (!state.Expect(TokenType::SYMBOL_RIGHT_BRACKET, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
+				expr = state.NewNode(state.NewNode<AstIndexNode>(), { expr, key });
+				continue;
+			}
+			case TokenType::SYMBOL_LEFT_PAREN: {
+				state.Take();
+				auto children = state.BeginList();
+				state.AppendToList(expr);
+				MatchFunctionParams(state);
+				auto call = state.NewNode<AstFunctionCallNode>();
+				call->children = state.FinishList(children);
+				if (!state.Expect(TokenType::SYMBOL_RIGHT_PAREN, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
+				expr = call;
+				continue;
+			}
+			default: break;
+		}
+		break;
+	}
+	return expr;
+}
 
-	auto first = state.Take();
+/// 不包含运算符的表达式
+static auto TryMatchSimpleExpression(ParsingState& state) -> AstNode* {
+	auto first = state.Peek();
 	if (!first) return nullptr; // EOF
+
 	switch (first->type) {
 		case TokenType::STRING_LITERAL: {
-			snapshotGuard.Cancel();
-			return AstNode::String(first->text);
+			state.Take();
+			// lexer不驻留字符串，只有成为节点的字面量才需要驻留
+			return state.NewNode<AstStringLiteralNode>(Symbols().Intern(state.TextOf(*first)));
 		}
 		case TokenType::INTEGER_LITERAL: {
-			snapshotGuard.Cancel();
-			return AstNode::Integer(std::stoi(first->text));
+			state.Take();
+			return state.NewNode<AstNumericLiteralNode>(first->integer);
 		}
 		case TokenType::FLOATING_POINT_LITERAL: {
-			snapshotGuard.Cancel();
-			return AstNode::Float(std::stof(first->text));
+			state.Take();
+			return state.NewNode<AstNumericLiteralNode>(first->number);
+		}
+		case TokenType::KEYWORD_NIL: {
+			state.Take();
+			return state.NewNode<AstNilNode>();
+		}
+		case TokenType::KEYWORD_TRUE:
+		case TokenType::KEYWORD_FALSE: {
+			state.Take();
+			return state.NewNode<AstBooleanLiteralNode>(first->type == TokenType::KEYWORD_TRUE);
+		}
+		case TokenType::SYMBOL_3_DOT: {
+			state.Take();
+			return state.NewNode<AstVarargNode>();
+		}
+		case TokenType::SYMBOL_LEFT_BRACE: {
+			return MatchTableConstructor(state);
 		}
 		default: {
-			// 重置之前那个吃掉的token
-			state.RestoreSnapshot(snapshot);
+			return TryMatchSuffixedExpression(state);
+		}
+	}
+}
+
+/// 解析所有左侧结合力大于`limit`的二元运算符组成的表达式
+///
+/// 只向前读取，不会回溯：如果第一个token不能开始一个表达式则不消耗任何token并返回空，
+/// 否则在遇到语法错误时记录错误并返回空。
+static auto MatchSubexpression(ParsingState& state, u8 limit) -> AstNode* {
+	auto first = state.Peek();
+	if (!first) return nullptr;
+
+	AstNode* lhs;
+	if (auto unary = UnaryOperatorOf(first->type)) {
+		state.Take();
+		auto position = state.Position();
+		auto operand = MatchSubexpression(state, kUnaryPower);
+		if (!operand) return state.Position() == position ? state.ExpectedExpression() : nullptr;
+		lhs = state.NewNode(state.NewNode<AstUnaryOpNode>(*unary), { operand });
+	} else {
+		lhs = TryMatchSimpleExpression(state);
+		if (!lhs) return nullptr;
+	}
+
+	while (auto next = state.Peek()) {
+		auto info = binaryOperators[static_cast<usize>(next->type)];
+		if (info.leftPower <= limit) break;
+
+		state.Take();
+		auto position = state.Position();
+		auto rhs = MatchSubexpression(state, info.rightPower);
+		if (!rhs) return state.Position() == position ? state.ExpectedExpression() : nullptr;
+		lhs = state.NewNode(state.NewNode<AstBinaryOpNode>(info.op), { lhs, rhs });
+	}
+	return lhs;
+}
+
+static auto TryMatchExpression(ParsingState& state) -> AstNode* {
+	return MatchSubexpression(state, 0);
+}
+
+/// 和`TryMatchExpression`相同，但是在没有表达式时记录一个错误
+static auto MatchExpression(ParsingState& state) -> AstNode* {
+	auto position = state.Position();
+	auto expr = TryMatchExpression(state);
+	// 如果已经消耗了token，错误已经在表达式内部报告过了
+	if (!expr && state.Position() == position) return state.ExpectedExpression();
+	return expr;
+}
+
+/// `{ ... }`。先把所有元素按照[key, value]收集起来，没有键的元素key为空；
+/// 全部没有键时生成KD_ArrayLiteral，否则生成KD_MetatableLiteral并给没有键的元素补上整数键
+static auto MatchTableConstructor(ParsingState& state) -> AstNode* {
+	state.Take(); // {
+
+	// 出错时也要先结束列表再返回，否则外层正在构建的列表会混进这些元素
+	auto fields = state.BeginList();
+	u32 arrayCount = 0;
+	auto failed = false;
+	while (auto next = state.Peek()) {
+		AstNode* key = nullptr;
+		if (next->type == TokenType::SYMBOL_LEFT_BRACKET) {
+			state.Take();
+			key = MatchExpression(state);
+			failed = !key
+				|| !state.Expect(TokenType::SYMBOL_RIGHT_BRACKET, ErrorCodes::PARSER_EXPECTED_OPERATOR)
+				|| !state.Expect(TokenType::OPERATOR_ASSIGN, ErrorCodes::PARSER_EXPECTED_OPERATOR);
+			if (failed) break;
+		} else if (auto second = state.Peek(1); next->type == TokenType::IDENTIFIER && second && second->type == TokenType::OPERATOR_ASSIGN) {
+			// `name = value`是`["name"] = value`的简写
+			key = state.NewNode<AstStringLiteralNode>(state.Take()->symbol);
+			state.Take(); // =
+		}
+
+		auto position = state.Position();
+		auto value = key ? MatchExpression(state) : TryMatchExpression(state);
+		if (!value) {
+			// 没有键并且没有消耗token说明元素已经结束了
+			failed = key || state.Position() != position;
 			break;
 		}
+		if (!key) ++arrayCount;
+		state.AppendToList(key);
+		state.AppendToList(value);
+
+		// 元素之间可以用逗号或者分号分隔，最后一个元素之后也可以有
+		if (!state.TakeIf(TokenType::SYMBOL_COMMA) && !state.TakeIf(TokenType::SYMBOL_SEMICOLON)) break;
+	}
+	auto items = state.FinishList(fields);
+	if (failed || !state.Expect(TokenType::SYMBOL_RIGHT_BRACE, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
+
+	if (arrayCount * 2 == items.size()) {
+		auto array = state.NewNode<AstArrayLiteralNode>();
+		for (usize i = 0; i < arrayCount; ++i) {
+			items[i] = items[i * 2 + 1];
+		}
+		array->children = items.first(arrayCount);
+		return array;
+	}
+
+	auto table = state.NewNode<AstMetatableLiteralNode>();
+	i64 index = 0;
+	for (usize i = 0; i < items.size(); i += 2) {
+		if (!items[i]) items[i] = state.NewNode<AstNumericLiteralNode>(++index);
 	}
+	table->arrayCount = arrayCount;
+	table->children = items;
+	return table;
+}
 
-	auto funcCall = TryMatchFunctionCall(state);
-	if (funcCall) {
-		snapshotGuard.Cancel();
-		return funcCall;
+// ========================================
+// 语句
+// ========================================
+//
+// 每种语句都可以由第一个token唯一确定（LL(1)），所以`TryMatchStatement`根据第一个token的类型查表，
+// 直接进入对应的产生式，不需要依次尝试每一种语句再回溯。
+// 下面的`Match*`函数都假设调用者已经检查过第一个token；一旦进入就不会回退，遇到语法错误时记录错误并返回空。
+
+using StatementParser = auto (*)(ParsingState& state) -> AstNode*;
+
+static auto MatchIfStatement(ParsingState& state) -> AstNode*;
+static auto MatchWhileStatement(ParsingState& state) -> AstNode*;
+static auto MatchRepeatStatement(ParsingState& state) -> AstNode*;
+static auto MatchForStatement(ParsingState& state) -> AstNode*;
+static auto MatchLocalVariableDeclaration(ParsingState& state) -> AstNode*;
+static auto MatchExpressionStatement(ParsingState& state) -> AstNode*;
+static auto MatchFunctionDefinition(ParsingState& state) -> AstNode*;
+
+/// 可以出现在语句块中的语句，以第一个token的类型为下标，不能开始一个语句的token为空
+constexpr auto statementParsers = []() {
+	std::array<StatementParser, tokenTypeCount> table{};
+	table[static_cast<usize>(TokenType::KEYWORD_IF)] = &MatchIfStatement;
+	table[static_cast<usize>(TokenType::KEYWORD_WHILE)] = &MatchWhileStatement;
+	table[static_cast<usize>(TokenType::KEYWORD_REPEAT)] = &MatchRepeatStatement;
+	table[static_cast<usize>(TokenType::KEYWORD_FOR)] = &MatchForStatement;
+	table[static_cast<usize>(TokenType::KEYWORD_LOCAL)] = &MatchLocalVariableDeclaration;
+	table[static_cast<usize>(TokenType::IDENTIFIER)] = &MatchExpressionStatement;
+	table[static_cast<usize>(TokenType::SYMBOL_LEFT_PAREN)] = &MatchExpressionStatement;
+	return table;
+}();
+
+/// 顶层额外允许函数定义
+constexpr auto topLevelParsers = []() {
+	auto table = statementParsers;
+	table[static_cast<usize>(TokenType::KEYWORD_FUNCTION)] = &MatchFunctionDefinition;
+	return table;
+}();
+
+/// 空语句`;`不产生任何节点，所以不在上面的表中，语句块和顶层都在查表之前用这个函数跳过它们
+static auto SkipEmptyStatements(ParsingState& state) -> void {
+	while (state.TakeIf(TokenType::SYMBOL_SEMICOLON)) {
 	}
+}
 
-	// TODO
+/// 下一个token不能开始一个语句时（比如`end`、`else`、`until`）不消耗任何token并返回空
+static auto TryMatchStatement(ParsingState& state) -> AstNode* {
+	auto first = state.Peek();
+	if (!first) return nullptr;
 
-	return nullptr;
+	auto parser = statementParsers[static_cast<usize>(first->type)];
+	return parser ? parser(state) : nullptr;
 }
 
-static auto TryMatchStatement(ParsingState& state) -> std::unique_ptr<AstNode>;
 /// 尝试匹配任意数量的语句组合（包括零个）
 /// 注意：这意味着该函数必然返回一个非空的AST节点
-static auto MatchStatementBlock(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto result = std::make_unique<AstNode>(ASTType::STATEMENT_BLOCK);
+static auto MatchStatementBlock(ParsingState& state) -> AstNode* {
+	auto result = state.NewNode<AstStatementBlockNode>();
+	auto statements = state.BeginList();
 	while (true) {
+		SkipEmptyStatements(state);
 		auto statement = TryMatchStatement(state);
 		if (!statement) break;
 
-		result->AddChild(std::move(statement));
+		state.AppendToList(statement);
 
 		// Lua允许在没有歧义的情况下不包含`end`或者其他结尾关键字之前的分隔符
 		// 比如说这是合法的：
@@ -200,6 +559,7 @@ static auto MatchStatementBlock(ParsingState& state) -> std::unique_ptr<AstNode>
 		// ```lua
 		// local a = 0; print("hello, world")print(a)
 		// ```
+		// （这里的分号是一个空语句，在下一次循环开始时被跳过）
 		// 以及
 		// ```lua
 		// local a = 0
@@ -207,349 +567,342 @@ static auto MatchStatementBlock(ParsingState& state) -> std::unique_ptr<AstNode>
 		// print(a)
 		// ```
 		// 是等价的
-
-		state.TakeIf(TokenType::SYMBOL_SEMICOLON);
 	}
+	result->children = state.FinishList(statements);
 	return result;
 }
 
-static auto TryMatchIfStatement(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
-
-	if (!state.TakeIf(TokenType::KEYWORD_IF)) return nullptr;
-#ifdef LUNI_DEBUG_INFO
-	fmt::print("[Debug][Parser.If] Found keyword 'if'\n");
-#endif // #ifdef LUNI_DEBUG_INFO
+static auto MatchIfStatement(ParsingState& state) -> AstNode* {
+	state.Take(); // if
+	LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser.If] Found keyword 'if'");
 
-	auto expr = TryMatchExpression(state);
+	auto expr = MatchExpression(state);
 	if (!expr) return nullptr;
-#ifdef LUNI_DEBUG_INFO
-	fmt::print("[Debug][Parser.If] Found if conditional (expression node)\n");
-#endif // #ifdef LUNI_DEBUG_INFO
+	LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser.If] Found if conditional (expression node)");
 
-	if (!state.TakeIf(TokenType::KEYWORD_THEN)) return nullptr;
-#ifdef LUNI_DEBUG_INFO
-	fmt::print("[Debug][Parser.If] Found keyword 'then'\n");
-#endif // #ifdef LUNI_DEBUG_INFO
+	if (!state.Expect(TokenType::KEYWORD_THEN, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
 	auto body = MatchStatementBlock(state);
-#ifdef LUNI_DEBUG_INFO
-	fmt::print("[Debug][Parser.If] Found if body (statement block node)\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-	auto elseOrEndKW = state.Take();
-	if (!elseOrEndKW) return nullptr;
-	switch (elseOrEndKW->type) {
-		case TokenType::KEYWORD_ELSE: {
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Found keyword 'else'\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			auto elseBody = MatchStatementBlock(state);
-			if (!elseBody) return nullptr;
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Found keyword 'end'\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			if (!state.TakeIf(TokenType::KEYWORD_END)) return nullptr;
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Found else body (statement block node)\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			// 检测到完整的if-cond-body-else-body
-			auto ifNode = std::make_unique<AstNode>(ASTType::IF);
-			ifNode->AddChild(std::move(expr));
-			ifNode->AddChild(std::move(body));
-			ifNode->AddChild(std::move(elseBody));
-
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Generated if statement with an else branch\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			snapshotGuard.Cancel();
-			return ifNode;
-		}
-		case TokenType::KEYWORD_END: {
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Found keyword 'end'\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			// 不带else语句的if-cond-body
-			auto ifNode = std::make_unique<AstNode>(ASTType::IF);
-			ifNode->AddChild(std::move(expr));
-			ifNode->AddChild(std::move(body));
-
-#ifdef LUNI_DEBUG_INFO
-			fmt::print("[Debug][Parser.If] Generated if statement with only `true` branch\n");
-#endif // #ifdef LUNI_DEBUG_INFO
-
-			snapshotGuard.Cancel();
-			return ifNode;
-		}
-		default: return nullptr;
+	LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser.If] Found if body (statement block node)");
+
+	if (state.TakeIf(TokenType::KEYWORD_ELSE)) {
+		auto elseBody = MatchStatementBlock(state);
+		if (!state.Expect(TokenType::KEYWORD_END, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
+
+		LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser.If] Generated if statement with an else branch");
+		return state.NewNode(state.NewNode<AstIfNode>(), { expr, body, elseBody });
 	}
-}
 
-static auto TryMatchWhileStatement(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
+	if (!state.Expect(TokenType::KEYWORD_END, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
+
+	LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser.If] Generated if statement with only `true` branch");
+	return state.NewNode(state.NewNode<AstIfNode>(), { expr, body });
+}
 
-	if (!state.TakeIf(TokenType::KEYWORD_WHILE)) return nullptr;
+static auto MatchWhileStatement(ParsingState& state) -> AstNode* {
+	state.Take(); // while
 
-	auto cond = TryMatchExpression(state);
+	auto cond = MatchExpression(state);
 	if (!cond) return nullptr;
 
-	if (!state.TakeIf(TokenType::KEYWORD_DO)) return nullptr;
+	if (!state.Expect(TokenType::KEYWORD_DO, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
 	auto body = MatchStatementBlock(state);
 
-	if (!state.TakeIf(TokenType::KEYWORD_END)) return nullptr;
+	if (!state.Expect(TokenType::KEYWORD_END, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
-	auto whileNode = std::make_unique<AstNode>(ASTType::WHILE);
-	whileNode->AddChild(std::move(cond));
-	whileNode->AddChild(std::move(body));
-
-	snapshotGuard.Cancel();
-	return whileNode;
+	return state.NewNode(state.NewNode<AstWhileNode>(), { cond, body });
 }
 
-static auto TryMatchUntilStatement(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
-
-	if (!state.TakeIf(TokenType::KEYWORD_REPEAT)) return nullptr;
+static auto MatchRepeatStatement(ParsingState& state) -> AstNode* {
+	state.Take(); // repeat
 
 	auto body = MatchStatementBlock(state);
 
-	if (!state.TakeIf(TokenType::KEYWORD_UNTIL)) return nullptr;
+	if (!state.Expect(TokenType::KEYWORD_UNTIL, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
-	auto cond = TryMatchExpression(state);
+	auto cond = MatchExpression(state);
 	if (!cond) return nullptr;
 
-	auto untilNode = std::make_unique<AstNode>(ASTType::UNTIL);
-	untilNode->AddChild(std::move(cond));
-	untilNode->AddChild(std::move(body));
-
-	snapshotGuard.Cancel();
-	return untilNode;
+	return state.NewNode(state.NewNode<AstUntilNode>(), { body, cond });
 }
 
-static auto TryMatchForStatement(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
+static auto MatchForStatement(ParsingState& state) -> AstNode* {
+	state.Take(); // for
 
-	if (!state.TakeIf(TokenType::KEYWORD_FOR)) return nullptr;
-
-	auto varName = state.TakeIf(TokenType::IDENTIFIER);
+	auto varName = state.Expect(TokenType::IDENTIFIER, ErrorCodes::PARSER_EXPECTED_IDENTIFIER);
 	if (!varName) return nullptr;
 
-	if (state.Take()->type != TokenType::KEYWORD_IN) return nullptr;
+	if (!state.Expect(TokenType::KEYWORD_IN, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
-	std::array<std::unique_ptr<AstNode>, 3> exprs;
+	std::array<AstNode*, 3> exprs{};
 	{
 		for (usize i = 0; i < 2; ++i) {
-			exprs[i] = TryMatchExpression(state);
+			exprs[i] = MatchExpression(state);
 			if (!exprs[i]) return nullptr;
 
-			if (!state.TakeIf(TokenType::SYMBOL_COMMA)) return nullptr;
+			if (!state.Expect(TokenType::SYMBOL_COMMA, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
 		}
 
 		exprs[2] = TryMatchExpression(state);
 		if (!exprs[2]) {
-			exprs[2] = std::make_unique<AstNode>(ASTType::INTEGER_LITERAL);
 			// 第三个参数默认为1
-			// 不手动指定u32的话编译器会无法完成int->(unsigned int->u32)->std::variant的隐式转换
-			exprs[2]->SetExtraData(u32{ 1 });
+			exprs[2] = state.NewNode<AstNumericLiteralNode>(i64{ 1 });
 		}
 	}
 
 	auto body = MatchStatementBlock(state);
 
-	if (!state.TakeIf(TokenType::KEYWORD_END)) return nullptr;
-
-	auto forNode = std::make_unique<AstNode>(ASTType::FOR);
-	forNode->AddChild(AstNode::Identifier(varName->text));
-	// 使用ranged-based for loops的话似乎不能从数组里move出来，只能复制或者取引用
-	forNode->AddChild(std::move(exprs[0]));
-	forNode->AddChild(std::move(exprs[1]));
-	forNode->AddChild(std::move(exprs[2]));
-	forNode->AddChild(std::move(body));
+	if (!state.Expect(TokenType::KEYWORD_END, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
-	snapshotGuard.Cancel();
-	return forNode;
+	return state.NewNode(
+		state.NewNode<AstForNode>(varName->symbol),
+		{ exprs[0], exprs[1], exprs[2], body });
 }
 
-static auto TryMatchVariableDeclaration(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
+/// `name = expr`中`=`之后的部分
+static auto MatchVariableValue(ParsingState& state, AstNode::Kind kind, const Token& name) -> AstNode* {
+	if (!state.Expect(TokenType::OPERATOR_ASSIGN, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
 
-	// 可选local修饰符
-	auto type = state.TakeIf(TokenType::KEYWORD_LOCAL) == nullptr
-		? ASTType::VARIABLE_DECLARATION
-		: ASTType::LOCAL_VARIABLE_DECLARATION;
+	auto expr = MatchExpression(state);
+	if (!expr) return nullptr;
 
-	auto name = state.TakeIf(TokenType::IDENTIFIER);
-	if (!name) return nullptr;
+	return state.NewNode(state.NewNode<AstVarDefNode>(kind, name.symbol), { expr });
+}
 
-	if (!state.TakeIf(TokenType::OPERATOR_ASSIGN)) return nullptr;
+static auto MatchLocalVariableDeclaration(ParsingState& state) -> AstNode* {
+	state.Take(); // local
 
-	auto expr = TryMatchExpression(state);
-	if (!expr) return nullptr;
+	auto name = state.Expect(TokenType::IDENTIFIER, ErrorCodes::PARSER_EXPECTED_IDENTIFIER);
+	if (!name) return nullptr;
 
-	auto varDec = std::make_unique<AstNode>(type);
-	varDec->AddChild(AstNode::Identifier(name->text));
-	varDec->AddChild(std::move(expr));
+	return MatchVariableValue(state, AstNode::KD_LocalVarDef, *name);
+}
+
+/// 以名字或者括号开头的语句：对全局变量赋值，或者函数调用
+static auto MatchExpressionStatement(ParsingState& state) -> AstNode* {
+	// 赋值和函数调用的前缀相同，多看一个token区分最常见的`name = expr`
+	auto second = state.Peek(1);
+	if (second && second->type == TokenType::OPERATOR_ASSIGN && state.Peek()->type == TokenType::IDENTIFIER) {
+		auto name = *state.Take();
+		return MatchVariableValue(state, AstNode::KD_GlobalVarDef, name);
+	}
 
-	snapshotGuard.Cancel();
-	return varDec;
+	// 作为语句时，后缀表达式必须以函数调用结尾（`a.b(c)`、`f(x)(y)`）
+	auto expr = TryMatchSuffixedExpression(state);
+	if (!expr) return nullptr;
+	if (expr->kind != AstNode::KD_FunctionCall) {
+		state.ReportError(ErrorCodes::PARSER_EXPECTED_STATEMENT, "Expected a function call or an assignment");
+		return nullptr;
+	}
+	return expr;
 }
 
-static auto MatchFunctionParams(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto params = std::make_unique<AstNode>(ASTType::FUNCTION_CALL_PARAMS);
+/// 把所有参数追加到当前正在构建的列表中
+static auto MatchFunctionParams(ParsingState& state) -> void {
 	while (true) {
 		auto param = TryMatchExpression(state);
 		if (!param) break;
 
-		params->AddChild(std::move(param));
+		state.AppendToList(param);
 
 		// Lua允许trailing commas
 		// 如果没有逗号了，那么当前参数列表肯定已经结束了（或者是语法错误）
 		// 如果还有逗号并且下次迭代时没有可用的表达式（参数）了，那么当前参数列表也会正常结束
 		if (!state.TakeIf(TokenType::SYMBOL_COMMA)) break;
 	}
-	return params;
 }
 
-static auto TryMatchFunctionCall(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
-
-	auto funcName = state.TakeIf(TokenType::IDENTIFIER);
-	if (!funcName) return nullptr;
-
-	if (!state.TakeIf(TokenType::SYMBOL_LEFT_PAREN)) return nullptr;
-	// 参数列表永远返回一个非空指针（因为参数列表可空）
-	auto paramList = MatchFunctionParams(state);
-	if (!state.TakeIf(TokenType::SYMBOL_RIGHT_PAREN)) return nullptr;
-
-	auto funcCall = std::make_unique<AstNode>(ASTType::FUNCTION_CALL);
-	funcCall->AddChild(AstNode::Identifier(funcName->text));
-	funcCall->AddChild(std::move(paramList));
-
-	snapshotGuard.Cancel();
-	return funcCall;
-}
-
-static auto TryMatchStatement(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto funcCall = TryMatchFunctionCall(state);
-	if (funcCall) return funcCall;
-
-	auto ifSt = TryMatchIfStatement(state);
-	if (ifSt) return ifSt;
-
-	auto whileSt = TryMatchWhileStatement(state);
-	if (whileSt) return whileSt;
-
-	auto untilSt = TryMatchUntilStatement(state);
-	if (untilSt) return untilSt;
-
-	auto forSt = TryMatchUntilStatement(state);
-	if (forSt) return forSt;
-
-	auto varDec = TryMatchVariableDeclaration(state);
-	if (varDec) return varDec;
-
-	return nullptr;
-}
-
-static auto MatchFunctionDefParams(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto params = std::make_unique<AstNode>(ASTType::FUNCTION_CALL_PARAMS);
+static auto MatchFunctionDefParams(ParsingState& state) -> std::span<SymbolId> {
+	auto params = state.BeginNameList();
 	while (true) {
 		auto param = state.TakeIf(TokenType::IDENTIFIER);
 		if (!param) break;
 
-		params->AddChild(AstNode::Identifier(param->text));
+		state.AppendToNameList(param->symbol);
 
 		// Lua允许trailing commas
 		if (!state.TakeIf(TokenType::SYMBOL_COMMA)) break;
 	}
-	return params;
+	return state.FinishNameList(params);
 }
 
-static auto TryMatchFunctionDefinition(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto snapshot = state.RecordSnapshot();
-	auto snapshotGuard = ScopeGuard([&]() { state.RestoreSnapshot(snapshot); });
+static auto MatchFunctionDefinition(ParsingState& state) -> AstNode* {
+	state.Take(); // function
 
-	if (!state.TakeIf(TokenType::KEYWORD_FUNCTION)) return nullptr;
-
-	auto name = state.TakeIf(TokenType::IDENTIFIER);
+	auto name = state.Expect(TokenType::IDENTIFIER, ErrorCodes::PARSER_EXPECTED_IDENTIFIER);
 	if (!name) return nullptr;
 
-	if (!state.TakeIf(TokenType::SYMBOL_LEFT_PAREN)) return nullptr;
+	if (!state.Expect(TokenType::SYMBOL_LEFT_PAREN, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
 	auto params = MatchFunctionDefParams(state);
-	if (!state.TakeIf(TokenType::SYMBOL_RIGHT_PAREN)) return nullptr;
+	if (!state.Expect(TokenType::SYMBOL_RIGHT_PAREN, ErrorCodes::PARSER_EXPECTED_OPERATOR)) return nullptr;
 
 	auto body = MatchStatementBlock(state);
 
-	if (!state.TakeIf(TokenType::KEYWORD_END)) return nullptr;
-
-	auto funcDef = std::make_unique<AstNode>(ASTType::FUNCTION_DEFINITION);
-	funcDef->AddChild(AstNode::Identifier(name->text));
-	funcDef->AddChild(std::move(params));
-	funcDef->AddChild(std::move(body));
+	if (!state.Expect(TokenType::KEYWORD_END, ErrorCodes::PARSER_EXPECTED_KEYWORD)) return nullptr;
 
-	snapshotGuard.Cancel();
+	auto funcDef = state.NewNode(state.NewNode<AstFunctionDefinitionNode>(name->symbol), { body });
+	funcDef->params = params;
 	return funcDef;
 }
 
-static auto TryMatchDefinition(ParsingState& state) -> std::unique_ptr<AstNode> {
-	auto functionDef = TryMatchFunctionDefinition(state);
-	if (functionDef) return functionDef;
+/// 解析一个顶层节点，下一个token不能开始任何顶层节点时返回false
+static auto MatchTopLevel(ParsingState& state) -> bool {
+	SkipEmptyStatements(state);
+	auto first = state.Peek();
+	if (!first) return true;
+
+	auto parser = topLevelParsers[static_cast<usize>(first->type)];
+	if (!parser) {
+		state.ReportError(ErrorCodes::PARSER_EXPECTED_STATEMENT, fmt::format("Unexpected '{}'", state.TextOf(*first)));
+		LUNI_TRACE(DEBUG, PARSER, "[Debug][Parser] No tokens are able to be consumed, finishing with error");
+		return false;
+	}
+
+	// 出错的语句返回空，但已经消耗了token，从出错的位置继续解析剩下的部分
+	auto begin = first->offset;
+	if (auto node = parser(state)) {
+		if (LUNI_TRACE_ENABLED(INFO, PARSER)) {
+			LUNI_TRACE(INFO, PARSER, "[Parser] Collected top-level node:");
+			PrintNode(*node);
+		}
+		state.AddTopLevel(node, SourceRange{ begin, state.ConsumedEnd() });
+	}
+	return true;
+}
+
+auto LuNI::DoParsing(TokenStream& tokens) -> ParsingResult {
+	ParsingState state{ tokens };
+	// 每次迭代至少消耗一个token，所以不会陷入死循环
+	while (state.Peek()) {
+		if (!MatchTopLevel(state)) return state.FinishParsing();
+	}
 
-	return nullptr;
+	LUNI_TRACE(INFO, PARSER, "[Parser] Reached end of file when parsing, finishing normally");
+	return state.FinishParsing();
 }
 
-auto LuNI::DoParsing(
-	argparse::ArgumentParser& args,
-	const std::vector<Token>& tokens) -> ParsingResult {
-	auto verbose = args["--verbose-parsing"] == true;
+/// 小于这个大小的文件切分和线程调度的开销比解析本身更大
+static constexpr usize kParallelParsingThreshold = 256 * 1024;
+/// 每个线程分到的段数，段越多负载越均衡
+static constexpr usize kSegmentsPerThread = 4;
 
+struct ParsedSegment {
+	ParsingResult result;
+	/// 是否恰好在下一段的开头（或者文件末尾）结束
+	bool aligned;
+};
+
+/// 解析从`begin`开始的顶层节点，直到下一个token位于`end`或者之后
+static auto ParseSegment(std::string_view source, u32 begin, u32 end) -> ParsedSegment {
+	TokenStream tokens{ source, begin };
 	ParsingState state{ tokens };
-	while (true) {
-		auto cont = state.FetchContinuationState();
-		switch (cont) {
-			case ParsingState::Continuation::CONTINUE:
-				break;
-			case ParsingState::Continuation::BREAK_EOF:
-				if (verbose) fmt::print("[Parser] Reached end of file when parsing, finishing normally");
-				goto end;
-			case ParsingState::Continuation::BREAK_NO_CONSUMPTION:
-				if (verbose) fmt::print("[Parser] No tokens are able to be consumed, finishing with error");
-				goto end;
+	while (auto next = state.Peek()) {
+		if (next->offset >= end) {
+			auto aligned = next->offset == end;
+			return { state.FinishParsing(), aligned };
 		}
+		if (!MatchTopLevel(state)) return { state.FinishParsing(), false };
+	}
+	return { state.FinishParsing(), end == source.size() };
+}
 
-		if (auto node = TryMatchDefinition(state)) {
-			if (verbose) {
-				fmt::print("Collected top-level definition:\n");
-				PrintNode(*node);
-				fmt::print("\n");
-				// fmt::print("Tok: {}\n", state.Take()->text);
-			}
-			state.root->AddChild(std::move(node));
-			continue;
+auto LuNI::DoParallelParsing(std::string_view source, usize threadCount) -> ParsingResult {
+	if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+	auto splits = source.size() >= kParallelParsingThreshold && threadCount > 1
+		? FindTopLevelSplits(source, threadCount * kSegmentsPerThread)
+		: std::vector<u32>{};
+	if (splits.empty()) {
+		TokenStream tokens{ source };
+		return DoParsing(tokens);
+	}
+
+	std::vector<std::future<ParsedSegment>> futures;
+	{
+		ThreadPool pool{ std::min(threadCount, splits.size() + 1) };
+		for (usize i = 0; i <= splits.size(); ++i) {
+			auto begin = i == 0 ? u32{ 0 } : splits[i - 1];
+			auto end = i == splits.size() ? static_cast<u32>(source.size()) : splits[i];
+			futures.push_back(pool.Submit([source, begin, end]() {
+				return ParseSegment(source, begin, end);
+			}));
+		}
+	}
+
+	// 按照源文件中的顺序拼接，所有段的节点都转移到同一个arena中
+	ParsingResult result;
+	result.root = result.arena.New<AstScriptNode>();
+	result.source = source;
+	std::vector<AstNode*> nodes;
+	for (auto& future : futures) {
+		auto segment = future.get();
+		if (!segment.aligned || !segment.result.errors.empty()) {
+			LUNI_TRACE(INFO, PARSER, "[Parser] A segment did not parse cleanly, reparsing the whole file sequentially");
+			TokenStream tokens{ source };
+			return DoParsing(tokens);
 		}
-		if (auto node = TryMatchStatement(state)) {
-			if (verbose) {
-				fmt::print("Collected top-level statement:\n");
-				PrintNode(*node);
-				fmt::print("\n");
+
+		auto children = segment.result.root->GetChildren();
+		nodes.insert(nodes.end(), children.begin(), children.end());
+		result.ranges.insert(result.ranges.end(), segment.result.ranges.begin(), segment.result.ranges.end());
+		result.arena.Adopt(std::move(segment.result.arena));
+	}
+	result.root->children = result.arena.NewArray(std::span<AstNode* const>(nodes));
+
+	LUNI_TRACE(INFO, PARSER, "[Parser] Parsed {} segments on {} threads", futures.size(), std::min(threadCount, splits.size() + 1));
+	return result;
+}
+
+auto LuNI::DoReparsing(ParsingResult&& previous, std::string_view source, const SourceEdit& edit) -> ParsingResult {
+	if (!previous.root || !previous.errors.empty()) {
+		LUNI_TRACE(INFO, PARSER, "[Parser] Previous result is not reusable, reparsing the whole file");
+		TokenStream tokens{ source };
+		return DoParsing(tokens);
+	}
+
+	auto oldNodes = previous.root->GetChildren();
+	auto oldRanges = std::span<const SourceRange>(previous.ranges);
+	auto shift = static_cast<i64>(edit.inserted) - static_cast<i64>(edit.removed);
+	auto editEnd = edit.offset + edit.inserted; //< 新文件中
+
+	// 第一个结尾不早于修改开头的节点，紧挨着修改的节点也算在内，因为修改可能和它的最后一个token连成一个token
+	auto first = static_cast<usize>(std::ranges::partition_point(oldRanges, [&](const SourceRange& range) {
+		return range.end < edit.offset;
+	}) - oldRanges.begin());
+	// 两个顶层节点之间只有空白、注释和空语句，所以可以从前一个节点的结尾开始重新生成token
+	auto lexStart = first > 0 ? oldRanges[first - 1].end : 0;
+
+	TokenStream tokens{ source, lexStart };
+	ParsingState state{ tokens, std::move(previous.arena), previous.root };
+
+	// 节点不引用源文件，所以旧节点可以直接重用；修改之前的节点在新文件中的位置也不变
+	for (usize i = 0; i < first; ++i) {
+		state.AddTopLevel(oldNodes[i], oldRanges[i]);
+	}
+
+	// 一旦下一个token位于修改之后，并且恰好是某个旧节点的开头，之后的token就和旧文件完全一样了，
+	// 而顶层节点之间的解析没有任何上下文，所以从这里开始的旧节点都可以直接重用
+	auto resume = oldNodes.size();
+	while (auto next = state.Peek()) {
+		if (next->offset >= editEnd) {
+			auto oldOffset = static_cast<u32>(next->offset - shift);
+			auto candidates = oldRanges.subspan(first);
+			auto it = std::ranges::partition_point(candidates, [&](const SourceRange& range) {
+				return range.begin < oldOffset;
+			});
+			if (it != candidates.end() && it->begin == oldOffset) {
+				resume = first + static_cast<usize>(it - candidates.begin());
+				break;
 			}
-			state.root->AddChild(std::move(node));
-			continue;
 		}
+		if (!MatchTopLevel(state)) break;
+	}
+
+	LUNI_TRACE(INFO, PARSER, "[Parser] Reused {} of {} top-level nodes", first + oldNodes.size() - resume, oldNodes.size());
+	for (auto i = resume; i < oldNodes.size(); ++i) {
+		auto range = oldRanges[i];
+		state.AddTopLevel(oldNodes[i], SourceRange{ static_cast<u32>(range.begin + shift), static_cast<u32>(range.end + shift) });
 	}
 
-end:
 	return state.FinishParsing();
 }
@@ -1,23 +1,63 @@
 #pragma once
 
+#include "Arena.hpp"
 #include "AstNode.hpp"
 #include "Error.hpp"
 #include "Util.hpp"
 #include "fwd.hpp"
 
 #include <fmt/format.h>
-#include <argparse/argparse.hpp>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace LuNI {
 
+/// 源文件中的一段范围[begin, end)
+struct SourceRange {
+	u32 begin;
+	u32 end;
+};
+
+/// 对源文件的一次修改：旧文件中的[offset, offset + removed)被替换成了新文件中的[offset, offset + inserted)
+struct SourceEdit {
+	u32 offset;
+	u32 removed;
+	u32 inserted;
+};
+
 struct ParsingResult {
-	std::unique_ptr<AstNode> root;
+	/// 拥有所有AST节点，随着ParsingResult一起一次性释放
+	Arena arena;
+	AstScriptNode* root = nullptr;
 	std::vector<StandardError> errors;
+	/// 解析的源文件，只用于`ranges`和错误信息，节点本身不引用它
+	std::string_view source;
+	/// `root->children`中每个顶层节点在`source`中的范围，从第一个token的开头到最后一个token的结尾
+	std::vector<SourceRange> ranges;
 };
 
-auto DoParsing(argparse::ArgumentParser& args, const std::vector<Token>& tokens) -> ParsingResult;
+/// 按需从`tokens`中拉取token，而不是预先生成整个文件的token
+/// 不访问任何共享的可变状态，可以在多个线程上同时解析不同的文件
+auto DoParsing(TokenStream& tokens) -> ParsingResult;
+
+/// 结果和`DoParsing(TokenStream{ source })`完全相同，但是把源文件在顶层的`function`处切分成若干段，
+/// 在`threadCount`个线程上同时解析，再按照源文件中的顺序拼接起来（`threadCount`为0时使用硬件线程数）
+///
+/// 顶层节点之间的解析没有任何上下文，所以只要每一段恰好在下一段的开头结束，拼接的结果就和顺序解析相同。
+/// 某一段没有对齐、或者有语法错误时，退回到对整个文件的顺序解析，以保证错误信息和顺序解析一致。
+/// 文件较小时直接顺序解析。
+auto DoParallelParsing(std::string_view source, usize threadCount = 0) -> ParsingResult;
+
+/// 在源文件被修改之后，只重新解析受影响的顶层节点
+///
+/// `previous`必须是修改之前的源文件的解析结果，`source`是修改之后的完整源文件。
+/// 只重新词法分析和语法分析从修改处之前的第一个顶层节点开始、直到重新对齐到某个旧的顶层节点开头为止的部分，
+/// 其余的节点原样重用。
+///
+/// 被替换掉的旧节点仍然占用arena，直到下一次完整的`DoParsing`。
+/// `previous`中有语法错误时，无法确定哪些节点是可靠的，因此退回到完整解析。
+auto DoReparsing(ParsingResult&& previous, std::string_view source, const SourceEdit& edit) -> ParsingResult;
 
 } // namespace LuNI
@@ -0,0 +1,156 @@
+#include "Resolver.hpp"
+
+#include "Symbol.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using namespace LuNI;
+
+namespace {
+class ResolvingState {
+private:
+	struct Binding {
+		SymbolId name;
+		u32 slot;
+	};
+
+	/// 一个函数（或者脚本本身）中当前可见的局部变量
+	struct FunctionScope {
+		/// 按照声明顺序排列，块结束时截断到块开始时的长度，所以当前可见的局部变量数量就是下一个空闲的槽位
+		std::vector<Binding> bindings;
+		u32 slotCount = 0;
+	};
+
+	/// 由外到内，第一项是脚本本身。目前函数只能定义在顶层，所以最多两层
+	std::vector<FunctionScope> functions;
+
+public:
+	auto BeginFunction() -> void {
+		functions.emplace_back();
+	}
+
+	/// 返回这个函数所需的槽位数
+	auto FinishFunction() -> u32 {
+		auto slotCount = functions.back().slotCount;
+		functions.pop_back();
+		return slotCount;
+	}
+
+	auto BeginBlock() const -> usize {
+		return functions.back().bindings.size();
+	}
+
+	auto FinishBlock(usize block) -> void {
+		functions.back().bindings.resize(block);
+	}
+
+	/// 声明一个新的局部变量，同一个块中同名的局部变量也会得到新的槽位（和Lua一样，之前的那个只是被遮蔽了）
+	auto Declare(SymbolId name) -> u32 {
+		auto& function = functions.back();
+		auto slot = static_cast<u32>(function.bindings.size());
+		function.bindings.push_back({ name, slot });
+		function.slotCount = std::max(function.slotCount, slot + 1);
+		return slot;
+	}
+
+	/// 从内到外查找`name`，最内层函数中找到的是局部变量，外层函数中找到的是upvalue
+	auto Lookup(SymbolId name, u32& slot) const -> VariableScope {
+		for (auto function = functions.rbegin(); function != functions.rend(); ++function) {
+			auto& bindings = function->bindings;
+			auto it = std::find_if(bindings.rbegin(), bindings.rend(), [&](const Binding& binding) {
+				return binding.name == name;
+			});
+			if (it == bindings.rend()) continue;
+
+			slot = it->slot;
+			return function == functions.rbegin() ? VariableScope::LOCAL : VariableScope::UPVALUE;
+		}
+		return VariableScope::GLOBAL;
+	}
+};
+}
+
+static auto Resolve(ResolvingState& state, AstNode* node) -> void;
+
+static auto ResolveChildren(ResolvingState& state, std::span<AstNode* const> children) -> void {
+	for (auto child : children) {
+		Resolve(state, child);
+	}
+}
+
+static auto Resolve(ResolvingState& state, AstNode* node) -> void {
+	// 出错的产生式可能留下空的子节点
+	if (!node) return;
+
+	switch (node->kind) {
+		case AstNode::KD_Identifier: {
+			auto& identifier = node->As<AstIdentifierNode>();
+			identifier.scope = state.Lookup(identifier.name, identifier.slot);
+			break;
+		}
+		case AstNode::KD_LocalVarDef: {
+			// `local x = x`中右边的`x`是外面的变量，所以先解析值再声明
+			auto& varDef = node->As<AstVarDefNode>();
+			Resolve(state, varDef.Value());
+			varDef.slot = state.Declare(varDef.name);
+			break;
+		}
+		case AstNode::KD_GlobalVarDef: {
+			auto& varDef = node->As<AstVarDefNode>();
+			Resolve(state, varDef.Value());
+			varDef.scope = state.Lookup(varDef.name, varDef.slot);
+			break;
+		}
+		case AstNode::KD_StatementBlock: {
+			auto block = state.BeginBlock();
+			ResolveChildren(state, node->GetChildren());
+			state.FinishBlock(block);
+			break;
+		}
+		case AstNode::KD_For: {
+			auto& loop = node->As<AstForNode>();
+			Resolve(state, loop.Start());
+			Resolve(state, loop.Stop());
+			Resolve(state, loop.Step());
+
+			auto block = state.BeginBlock();
+			loop.slot = state.Declare(loop.variable);
+			Resolve(state, loop.Body());
+			state.FinishBlock(block);
+			break;
+		}
+		case AstNode::KD_Until: {
+			// `until`的条件可以看到循环体中的局部变量，所以循环体的块到条件之后才结束
+			auto& loop = node->As<AstUntilNode>();
+			auto block = state.BeginBlock();
+			if (loop.Body()) ResolveChildren(state, loop.Body()->GetChildren());
+			Resolve(state, loop.Condition());
+			state.FinishBlock(block);
+			break;
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& def = node->As<AstFunctionDefinitionNode>();
+			state.BeginFunction();
+			for (auto param : def.params) {
+				state.Declare(param);
+			}
+			Resolve(state, def.Body());
+			def.slotCount = state.FinishFunction();
+			break;
+		}
+		default: {
+			ResolveChildren(state, node->GetChildren());
+			break;
+		}
+	}
+}
+
+auto LuNI::ResolveScopes(AstScriptNode& root) -> void {
+	ResolvingState state;
+	state.BeginFunction();
+	ResolveChildren(state, root.GetChildren());
+	root.slotCount = state.FinishFunction();
+	LUNI_TRACE(INFO, PARSER, "[Resolver] Script uses {} local slots", root.slotCount);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "AstNode.hpp"
+
+namespace LuNI {
+
+/// 作用域解析：把每个名字分类为局部变量、upvalue或者全局变量，并给每个局部变量和参数分配固定的槽位
+///
+/// 结果直接写回节点（`AstIdentifierNode::scope/slot`、`AstVarDefNode::slot`、`AstForNode::slot`，
+/// 以及函数和脚本的`slotCount`），解释器按下标访问局部变量，不需要按名字查找。
+/// 块结束之后，其中的局部变量的槽位会被之后的局部变量重用。
+///
+/// 每次都会覆盖之前的结果。顶层的局部变量会影响之后所有顶层节点的解析结果，
+/// 所以`DoReparsing`之后需要对整棵树重新调用。
+auto ResolveScopes(AstScriptNode& root) -> void;
+
+} // namespace LuNI
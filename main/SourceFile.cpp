@@ -0,0 +1,114 @@
+#include "SourceFile.hpp"
+
+#include <fmt/format.h>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define LUNI_USE_MMAP 1
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+using namespace LuNI;
+using namespace LuNI::ErrorCodes;
+
+static auto FileTooLarge(const std::string& path) -> tl::unexpected<StandardError> {
+	// Token使用u32储存偏移量
+	return tl::unexpected(StandardError{ INPUT_FILE_TOO_LARGE, fmt::format("Source file {} is larger than 4 GiB", path) });
+}
+
+auto SourceFile::Open(const std::string& path) -> tl::expected<SourceFile, StandardError> {
+	auto notFound = tl::unexpected(StandardError{ INPUT_FILE_NOT_FOUND, fmt::format("Unable to find source file {}", path) });
+
+	SourceFile result;
+#ifdef LUNI_USE_MMAP
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return notFound;
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return notFound;
+	}
+	if (static_cast<u64>(st.st_size) > std::numeric_limits<u32>::max()) {
+		::close(fd);
+		return FileTooLarge(path);
+	}
+
+	// mmap不接受长度为0的映射，空文件直接使用空的buffer即可
+	if (st.st_size > 0) {
+		auto size = static_cast<usize>(st.st_size);
+		void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr != MAP_FAILED) {
+			::close(fd);
+			// lexer总是从头到尾顺序读取文件
+			::madvise(ptr, size, MADV_SEQUENTIAL);
+
+			result.data = static_cast<const char*>(ptr);
+			result.size = size;
+			result.mapped = true;
+			return result;
+		}
+	}
+	::close(fd);
+#endif
+
+	// 无法使用mmap时（不支持的平台，或者是管道等特殊文件）一次性读取整个文件
+	auto ifs = std::ifstream{ path, std::ios::binary };
+	if (!ifs) return notFound;
+
+	ifs.seekg(0, std::ios::end);
+	auto end = ifs.tellg();
+	ifs.seekg(0, std::ios::beg);
+	if (end > 0) {
+		if (static_cast<u64>(end) > std::numeric_limits<u32>::max()) return FileTooLarge(path);
+		result.buffer.resize(static_cast<usize>(end));
+		ifs.read(result.buffer.data(), end);
+		result.buffer.resize(static_cast<usize>(ifs.gcount()));
+	}
+	result.data = result.buffer.data();
+	result.size = result.buffer.size();
+	return result;
+}
+
+SourceFile::~SourceFile() noexcept {
+	Release();
+}
+
+SourceFile::SourceFile(SourceFile&& that) noexcept
+	: data{ std::exchange(that.data, nullptr) }
+	, size{ std::exchange(that.size, 0) }
+	, mapped{ std::exchange(that.mapped, false) }
+	, buffer{ std::move(that.buffer) } {
+	// 移动std::string可能会使用SSO，此时指针需要重新指向新的buffer
+	if (!mapped) data = buffer.data();
+}
+
+SourceFile& SourceFile::operator=(SourceFile&& that) noexcept {
+	if (this != &that) {
+		Release();
+		this->data = std::exchange(that.data, nullptr);
+		this->size = std::exchange(that.size, 0);
+		this->mapped = std::exchange(that.mapped, false);
+		this->buffer = std::move(that.buffer);
+		if (!mapped) data = buffer.data();
+	}
+	return *this;
+}
+
+auto SourceFile::Release() noexcept -> void {
+#ifdef LUNI_USE_MMAP
+	if (mapped) {
+		::munmap(const_cast<char*>(data), size);
+	}
+#endif
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	buffer.clear();
+}
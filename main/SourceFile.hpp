@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Error.hpp"
+#include "Util.hpp"
+
+#include <string>
+#include <string_view>
+#include <tl/expected.hpp>
+
+namespace LuNI {
+
+/// 只读的源文件内容。在POSIX平台上直接将文件映射进内存，其他平台则一次性读取到缓冲区内
+///
+/// Token只储存其在源文件中的偏移量，所以SourceFile必须比由它生成的所有token和AST存活得更久。
+class SourceFile {
+private:
+	const char* data = nullptr;
+	usize size = 0;
+	bool mapped = false;
+	/// 仅在没有使用mmap时使用
+	std::string buffer;
+
+public:
+	static auto Open(const std::string& path) -> tl::expected<SourceFile, StandardError>;
+
+	SourceFile() noexcept = default;
+	~SourceFile() noexcept;
+
+	SourceFile(const SourceFile&) = delete;
+	SourceFile& operator=(const SourceFile&) = delete;
+	SourceFile(SourceFile&& that) noexcept;
+	SourceFile& operator=(SourceFile&& that) noexcept;
+
+	auto Text() const -> std::string_view {
+		return std::string_view(data, size);
+	}
+
+private:
+	auto Release() noexcept -> void;
+};
+
+} // namespace LuNI
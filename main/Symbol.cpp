@@ -0,0 +1,129 @@
+#include "Symbol.hpp"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+using namespace LuNI;
+
+SymbolTable::SlotTable::SlotTable(usize capacity)
+	: mask{ capacity - 1 }
+	, slots{ std::make_unique<std::atomic<u64>[]>(capacity) } {
+	for (usize i = 0; i < capacity; ++i) {
+		slots[i].store(kEmptySlot, std::memory_order_relaxed);
+	}
+}
+
+SymbolTable::SymbolTable() {
+	tables.push_back(std::make_unique<SlotTable>(1024));
+	current.store(tables.back().get(), std::memory_order_release);
+}
+
+auto SymbolTable::Global() -> SymbolTable& {
+	static SymbolTable instance;
+	return instance;
+}
+
+auto SymbolTable::HashOf(std::string_view text) -> u64 {
+	// 每次处理8个字节的乘法-异或哈希，字符串字面量可能很长，逐字节的哈希太慢
+	constexpr u64 kMultiplier = 0x9e3779b97f4a7c15;
+	auto hash = static_cast<u64>(text.size()) * kMultiplier;
+	auto data = text.data();
+	auto remaining = text.size();
+	while (remaining >= 8) {
+		u64 word;
+		std::memcpy(&word, data, 8);
+		hash = (std::rotl(hash, 29) ^ word) * kMultiplier;
+		data += 8;
+		remaining -= 8;
+	}
+	if (remaining > 0) {
+		u64 word = 0;
+		std::memcpy(&word, data, remaining);
+		hash = (std::rotl(hash, 29) ^ word) * kMultiplier;
+	}
+	// 最后再混合一次，让低位（哈希表的下标）也依赖于所有输入
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccd;
+	return hash ^ (hash >> 33);
+}
+
+auto SymbolTable::Locate(SymbolId id) -> std::pair<usize, usize> {
+	// 前k块一共有kFirstChunkSize * (2^k - 1)项
+	auto group = id / kFirstChunkSize + 1;
+	auto chunk = static_cast<usize>(std::bit_width(group) - 1);
+	auto index = id - kFirstChunkSize * ((usize{ 1 } << chunk) - 1);
+	return { chunk, index };
+}
+
+auto SymbolTable::Probe(const SlotTable& table, std::string_view text, u64 hash) const -> usize {
+	auto tag = TagOf(hash);
+	for (auto i = static_cast<usize>(hash) & table.mask;; i = (i + 1) & table.mask) {
+		// acquire：看到ID时，对应的项一定已经写好了
+		auto slot = table.slots[i].load(std::memory_order_acquire);
+		if (slot == kEmptySlot) return i;
+		// 先比较槽位中的哈希值高位，不匹配时不需要访问项和文本
+		if (static_cast<u32>(slot >> 32) != tag) continue;
+		auto& entry = EntryOf(static_cast<SymbolId>(slot));
+		if (entry.text == text) return i;
+	}
+}
+
+auto SymbolTable::Grow() -> void {
+	auto& old = *current.load(std::memory_order_relaxed);
+	auto next = std::make_unique<SlotTable>((old.mask + 1) * 2);
+	for (usize i = 0; i <= old.mask; ++i) {
+		auto slot = old.slots[i].load(std::memory_order_relaxed);
+		if (slot == kEmptySlot) continue;
+		auto j = static_cast<usize>(EntryOf(static_cast<SymbolId>(slot)).hash) & next->mask;
+		while (next->slots[j].load(std::memory_order_relaxed) != kEmptySlot) j = (j + 1) & next->mask;
+		next->slots[j].store(slot, std::memory_order_relaxed);
+	}
+	current.store(next.get(), std::memory_order_release);
+	tables.push_back(std::move(next));
+}
+
+auto SymbolTable::Find(std::string_view text) const -> SymbolId {
+	auto hash = HashOf(text);
+	auto& table = *current.load(std::memory_order_acquire);
+	auto id = IdOf(table.slots[Probe(table, text, hash)].load(std::memory_order_acquire));
+	if (id != kNone) return id;
+
+	// 可能刚被插入到了一张更新的表中
+	std::lock_guard lock{ mutex };
+	auto& latest = *current.load(std::memory_order_relaxed);
+	return IdOf(latest.slots[Probe(latest, text, hash)].load(std::memory_order_relaxed));
+}
+
+auto SymbolTable::Intern(std::string_view text) -> SymbolId {
+	auto hash = HashOf(text);
+	{
+		// 绝大多数名字都已经驻留过了，不需要加锁
+		auto& table = *current.load(std::memory_order_acquire);
+		auto id = IdOf(table.slots[Probe(table, text, hash)].load(std::memory_order_acquire));
+		if (id != kNone) return id;
+	}
+
+	std::lock_guard lock{ mutex };
+	// 可能在无锁查找之后被其他线程插入了
+	auto& table = *current.load(std::memory_order_relaxed);
+	auto slot = Probe(table, text, hash);
+	if (auto id = IdOf(table.slots[slot].load(std::memory_order_relaxed)); id != kNone) return id;
+
+	auto id = static_cast<SymbolId>(count.load(std::memory_order_relaxed));
+	auto [chunk, index] = Locate(id);
+	if (chunk >= kMaxChunks) throw std::length_error("Too many symbols");
+	if (!chunks[chunk]) {
+		chunks[chunk] = std::make_unique<Entry[]>(kFirstChunkSize << chunk);
+	}
+
+	auto copy = static_cast<char*>(storage.Allocate(text.size(), 1));
+	std::memcpy(copy, text.data(), text.size());
+	chunks[chunk][index] = Entry{ std::string_view(copy, text.size()), hash };
+	// release：其他线程看到这个ID之前，上面写入的项必须可见
+	table.slots[slot].store(u64{ TagOf(hash) } << 32 | id, std::memory_order_release);
+	count.store(id + 1, std::memory_order_relaxed);
+
+	if ((id + 1) * 2 > table.mask + 1) Grow();
+	return id;
+}
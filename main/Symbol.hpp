@@ -0,0 +1,116 @@
+#pragma once
+
+#include "Arena.hpp"
+#include "Util.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace LuNI {
+
+/// 驻留后的名字或者字符串常量，相同的文本总是得到相同的ID
+///
+/// ID从0开始连续分配，可以直接作为数组下标；比较两个名字只需要比较ID。
+using SymbolId = u32;
+
+/// 进程内共享的符号表，lexer、parser和解释器使用同一个实例（`SymbolTable::Global()`）
+///
+/// 文本会被复制到符号表自己的arena中，所以驻留之后源文件可以被释放。符号永远不会被删除。
+/// 所有成员函数都是线程安全的：多个文件可以在不同线程上同时进行词法分析。
+/// 查找已有的符号不加锁，只有插入新符号时才需要加锁。
+class SymbolTable {
+public:
+	static constexpr SymbolId kNone = ~SymbolId{ 0 };
+
+private:
+	struct Entry {
+		std::string_view text;
+		u64 hash;
+	};
+
+	/// 开放寻址的哈希表，每个槽位的高32位是哈希值的高32位，低32位是ID，空位为kEmptySlot。
+	/// 容量是2的幂，负载不超过1/2
+	///
+	/// 扩容时建立一张新表再整体替换，旧表不会被释放，所以正在无锁查找旧表的线程不受影响
+	/// （最多找不到刚插入的符号，然后在加锁之后重新查找）。
+	struct SlotTable {
+		usize mask;
+		std::unique_ptr<std::atomic<u64>[]> slots;
+
+		explicit SlotTable(usize capacity);
+	};
+
+	static constexpr u64 kEmptySlot = ~u64{ 0 };
+
+	/// 第k块有`kFirstChunkSize << k`项，块一旦分配就不再移动
+	static constexpr usize kFirstChunkSize = 1024;
+	static constexpr usize kMaxChunks = 32;
+
+	std::array<std::unique_ptr<Entry[]>, kMaxChunks> chunks;
+	std::atomic<SlotTable*> current;
+	std::atomic<usize> count = 0;
+
+	// ======== 以下只在持有`mutex`时访问 ========
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<SlotTable>> tables;
+	Arena storage;
+
+public:
+	SymbolTable();
+
+	SymbolTable(const SymbolTable&) = delete;
+	SymbolTable& operator=(const SymbolTable&) = delete;
+
+	static auto Global() -> SymbolTable&;
+
+	/// 文本的哈希值，和`Hash(Intern(text))`相同
+	static auto HashOf(std::string_view text) -> u64;
+
+	auto Intern(std::string_view text) -> SymbolId;
+
+	/// 不驻留，`text`不存在时返回kNone
+	auto Find(std::string_view text) const -> SymbolId;
+
+	auto Text(SymbolId id) const -> std::string_view {
+		return EntryOf(id).text;
+	}
+
+	auto Hash(SymbolId id) const -> u64 {
+		return EntryOf(id).hash;
+	}
+
+	auto Size() const -> usize {
+		return count.load(std::memory_order_relaxed);
+	}
+
+private:
+	static auto Locate(SymbolId id) -> std::pair<usize, usize>;
+
+	auto EntryOf(SymbolId id) const -> const Entry& {
+		auto [chunk, index] = Locate(id);
+		return chunks[chunk][index];
+	}
+
+	static auto TagOf(u64 hash) -> u32 {
+		return static_cast<u32>(hash >> 32);
+	}
+
+	static auto IdOf(u64 slot) -> SymbolId {
+		return slot == kEmptySlot ? kNone : static_cast<SymbolId>(slot);
+	}
+
+	/// 返回`text`所在的或者应该插入的槽位
+	auto Probe(const SlotTable& table, std::string_view text, u64 hash) const -> usize;
+	auto Grow() -> void;
+};
+
+/// `SymbolTable::Global()`的简写
+inline auto Symbols() -> SymbolTable& {
+	return SymbolTable::Global();
+}
+
+} // namespace LuNI
@@ -0,0 +1,134 @@
+#include "TextScan.hpp"
+
+#include <bit>
+
+#if defined(__AVX2__)
+#	define LUNI_SCAN_AVX2 1
+#	include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#	define LUNI_SCAN_SSE2 1
+#	include <emmintrin.h>
+#endif
+
+using namespace LuNI;
+
+// 每个SIMD实现都对一整个block计算一个位掩码，第i位表示block中的第i个字节是否匹配
+// 不足一个block的尾部交给逐字节的实现处理
+
+#if defined(LUNI_SCAN_AVX2)
+using Block = __m256i;
+constexpr usize kBlockSize = 32;
+
+static auto LoadBlock(const char* ptr) -> Block {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+}
+
+static auto MaskOfEqual(Block block, char c) -> u32 {
+	return static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c))));
+}
+
+static auto MaskOfAnyOf(Block block, char a, char b, char c) -> u32 {
+	auto eq = _mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_cmpeq_epi8(block, _mm256_set1_epi8(a)),
+			_mm256_cmpeq_epi8(block, _mm256_set1_epi8(b))),
+		_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+	return static_cast<u32>(_mm256_movemask_epi8(eq));
+}
+
+static auto MaskOfNonWhitespace(Block block) -> u32 {
+	// “\t\n\v\f\r”是连续的9~13，减去9之后做一次无符号的 <= 4 比较即可
+	auto shifted = _mm256_sub_epi8(block, _mm256_set1_epi8(9));
+	auto control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+	auto space = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+	return ~static_cast<u32>(_mm256_movemask_epi8(_mm256_or_si256(control, space)));
+}
+#elif defined(LUNI_SCAN_SSE2)
+using Block = __m128i;
+constexpr usize kBlockSize = 16;
+
+static auto LoadBlock(const char* ptr) -> Block {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+}
+
+static auto MaskOfEqual(Block block, char c) -> u32 {
+	return static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+}
+
+static auto MaskOfAnyOf(Block block, char a, char b, char c) -> u32 {
+	auto eq = _mm_or_si128(
+		_mm_or_si128(
+			_mm_cmpeq_epi8(block, _mm_set1_epi8(a)),
+			_mm_cmpeq_epi8(block, _mm_set1_epi8(b))),
+		_mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+	return static_cast<u32>(_mm_movemask_epi8(eq));
+}
+
+static auto MaskOfNonWhitespace(Block block) -> u32 {
+	// “\t\n\v\f\r”是连续的9~13，减去9之后做一次无符号的 <= 4 比较即可
+	auto shifted = _mm_sub_epi8(block, _mm_set1_epi8(9));
+	auto control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+	auto space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+	return ~static_cast<u32>(_mm_movemask_epi8(_mm_or_si128(control, space))) & 0xFFFF;
+}
+#endif
+
+static auto IsWhitespace(char c) -> bool {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+auto LuNI::FindAnyOf(const char* begin, const char* end, char a, char b, char c) -> const char* {
+	auto ptr = begin;
+#if defined(LUNI_SCAN_AVX2) || defined(LUNI_SCAN_SSE2)
+	while (static_cast<usize>(end - ptr) >= kBlockSize) {
+		auto mask = MaskOfAnyOf(LoadBlock(ptr), a, b, c);
+		if (mask != 0) return ptr + std::countr_zero(mask);
+		ptr += kBlockSize;
+	}
+#endif
+	for (; ptr != end; ++ptr) {
+		if (*ptr == a || *ptr == b || *ptr == c) return ptr;
+	}
+	return end;
+}
+
+auto LuNI::SkipWhitespace(const char* begin, const char* end) -> const char* {
+	auto ptr = begin;
+	// 大部分空白符都是很短的一段（单个空格、换行后的缩进），先逐字节检查一小段以免为此加载整个block
+	for (usize i = 0; i < 4 && ptr != end; ++i, ++ptr) {
+		if (!IsWhitespace(*ptr)) return ptr;
+	}
+#if defined(LUNI_SCAN_AVX2) || defined(LUNI_SCAN_SSE2)
+	while (static_cast<usize>(end - ptr) >= kBlockSize) {
+		auto mask = MaskOfNonWhitespace(LoadBlock(ptr));
+		if (mask != 0) return ptr + std::countr_zero(mask);
+		ptr += kBlockSize;
+	}
+#endif
+	for (; ptr != end; ++ptr) {
+		if (!IsWhitespace(*ptr)) return ptr;
+	}
+	return end;
+}
+
+auto LuNI::ScanNewlines(const char* begin, const char* end) -> NewlineScan {
+	NewlineScan result{ 0, nullptr };
+	auto ptr = begin;
+#if defined(LUNI_SCAN_AVX2) || defined(LUNI_SCAN_SSE2)
+	while (static_cast<usize>(end - ptr) >= kBlockSize) {
+		auto mask = MaskOfEqual(LoadBlock(ptr), '\n');
+		if (mask != 0) {
+			result.count += std::popcount(mask);
+			result.last = ptr + (31 - std::countl_zero(mask));
+		}
+		ptr += kBlockSize;
+	}
+#endif
+	for (; ptr != end; ++ptr) {
+		if (*ptr == '\n') {
+			++result.count;
+			result.last = ptr;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Util.hpp"
+
+namespace LuNI {
+
+// 用于lexer快速跳过大段文本（注释、字符串、空白符）的扫描函数
+//
+// 根据编译选项使用AVX2（定义了__AVX2__时）或SSE2实现，在其他平台上使用逐字节的实现。
+// 所有函数都只读取[begin, end)范围内的字节。
+
+/// 返回[begin, end)中第一个等于`a`、`b`或`c`的字节的位置，没有找到时返回`end`
+///
+/// 只需要查找一种或两种字节时可以重复传入同一个字节。
+auto FindAnyOf(const char* begin, const char* end, char a, char b, char c) -> const char*;
+
+/// 返回[begin, end)中第一个不是空白符（“ \t\n\r\v\f”）的字节的位置，没有找到时返回`end`
+auto SkipWhitespace(const char* begin, const char* end) -> const char*;
+
+struct NewlineScan {
+	usize count;
+	/// 最后一个换行符的位置，没有换行符时为nullptr
+	const char* last;
+};
+
+/// 统计[begin, end)中的换行符数量，同时找出最后一个换行符
+auto ScanNewlines(const char* begin, const char* end) -> NewlineScan;
+
+} // namespace LuNI
@@ -0,0 +1,40 @@
+#include "ThreadPool.hpp"
+
+using namespace LuNI;
+
+ThreadPool::ThreadPool(usize threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	workers.reserve(threadCount);
+	for (usize i = 0; i < threadCount; ++i) {
+		workers.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+ThreadPool::~ThreadPool() noexcept {
+	{
+		std::lock_guard lock{ mutex };
+		stopping = true;
+	}
+	available.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+auto ThreadPool::WorkerLoop() -> void {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock lock{ mutex };
+			available.wait(lock, [&]() { return stopping || !tasks.empty(); });
+			// 即使正在停止，也要先把队列里剩下的任务执行完
+			if (tasks.empty()) return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
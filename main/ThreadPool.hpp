@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace LuNI {
+
+/// 固定数量工作线程的线程池，任务按提交顺序（FIFO）被取出执行
+///
+/// 析构时会先执行完所有已提交的任务再回收线程。
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable available;
+	bool stopping = false;
+
+public:
+	/// `threadCount`为0时使用硬件支持的并发线程数
+	explicit ThreadPool(usize threadCount = 0);
+	~ThreadPool() noexcept;
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	auto ThreadCount() const -> usize {
+		return workers.size();
+	}
+
+	template <typename F>
+	auto Submit(F&& function) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+		using Result = std::invoke_result_t<std::decay_t<F>>;
+		// std::function要求可复制，所以用shared_ptr包装只能移动的packaged_task
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+		auto future = task->get_future();
+		{
+			std::lock_guard lock{ mutex };
+			tasks.emplace_back([task]() { (*task)(); });
+		}
+		available.notify_one();
+		return future;
+	}
+
+private:
+	auto WorkerLoop() -> void;
+};
+
+} // namespace LuNI
@@ -0,0 +1,141 @@
+#include "Trace.hpp"
+
+#include <spdlog/spdlog.h>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace LuNI;
+using namespace LuNI::Tracing;
+
+namespace {
+/// 有界的多生产者无锁队列（Dmitry Vyukov的算法），消费者一端由`consumerMutex`串行化
+///
+/// 每个槽位的`sequence`表示它的状态：等于写入位置时可以被生产者占用，
+/// 等于写入位置 + 1时表示已经发布、可以被消费者读取。
+class EventRing {
+public:
+	static constexpr usize kCapacity = 4096;
+
+private:
+	struct Cell {
+		std::atomic<usize> sequence;
+		detail::Event event;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	alignas(64) std::atomic<usize> enqueuePos{ 0 };
+	alignas(64) usize dequeuePos = 0;
+
+public:
+	std::atomic<u64> dropped{ 0 };
+	std::mutex consumerMutex;
+
+	EventRing()
+		: cells{ std::make_unique<Cell[]>(kCapacity) } {
+		for (usize i = 0; i < kCapacity; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	auto Reserve() -> detail::EventSlot {
+		auto pos = enqueuePos.load(std::memory_order_relaxed);
+		while (true) {
+			auto& cell = cells[pos & (kCapacity - 1)];
+			auto seq = cell.sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					return detail::EventSlot{ &cell.event, pos };
+				}
+			} else if (diff < 0) {
+				// 缓冲区已满
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return detail::EventSlot{ nullptr, 0 };
+			} else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	auto Commit(detail::EventSlot slot) -> void {
+		auto& cell = cells[slot.sequence & (kCapacity - 1)];
+		cell.sequence.store(slot.sequence + 1, std::memory_order_release);
+	}
+
+	/// 调用者必须持有`consumerMutex`
+	template <typename F>
+	auto Drain(F&& consume) -> void {
+		while (true) {
+			auto& cell = cells[dequeuePos & (kCapacity - 1)];
+			if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) return;
+
+			consume(cell.event);
+			cell.sequence.store(dequeuePos + kCapacity, std::memory_order_release);
+			++dequeuePos;
+		}
+	}
+};
+
+EventRing ring;
+
+std::thread flusher;
+std::atomic<bool> flusherRunning{ false };
+} // namespace
+
+static auto ToSpdlogLevel(Level level) -> spdlog::level::level_enum {
+	switch (level) {
+		case Level::TRACE: return spdlog::level::trace;
+		case Level::DEBUG: return spdlog::level::debug;
+		case Level::INFO: return spdlog::level::info;
+		case Level::WARN: return spdlog::level::warn;
+		case Level::ERROR: return spdlog::level::err;
+	}
+	UNREACHABLE;
+}
+
+auto detail::ReserveEvent() -> EventSlot {
+	return ring.Reserve();
+}
+
+auto detail::CommitEvent(EventSlot slot) -> void {
+	ring.Commit(slot);
+}
+
+auto Tracing::SetCategories(u32 categories) -> void {
+	detail::enabledCategories.store(categories, std::memory_order_relaxed);
+	// 事件的等级已经由LUNI_TRACE过滤过了，spdlog本身不需要再过滤
+	if (categories != 0) {
+		spdlog::set_level(spdlog::level::trace);
+	}
+}
+
+auto Tracing::Flush() -> void {
+	std::lock_guard lock{ ring.consumerMutex };
+	ring.Drain([](const detail::Event& event) {
+		spdlog::log(ToSpdlogLevel(event.level), "{}", std::string_view(event.text, event.length));
+	});
+
+	if (auto dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+		spdlog::warn("[Trace] Dropped {} events because the trace buffer was full", dropped);
+	}
+}
+
+auto Tracing::StartFlusher() -> void {
+	if (flusherRunning.exchange(true)) return;
+	flusher = std::thread([]() {
+		while (flusherRunning.load(std::memory_order_relaxed)) {
+			Flush();
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	});
+}
+
+auto Tracing::StopFlusher() -> void {
+	if (flusherRunning.exchange(false)) {
+		flusher.join();
+	}
+	Flush();
+}
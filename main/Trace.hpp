@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <fmt/format.h>
+#include <atomic>
+
+// 低于这个等级的LUNI_TRACE在编译期就会被完全移除（包括参数的求值）
+// 0 = TRACE, 1 = DEBUG, 2 = INFO, 3 = WARN, 4 = ERROR
+#ifndef LUNI_TRACE_MIN_LEVEL
+#	ifdef LUNI_DEBUG_INFO
+#		define LUNI_TRACE_MIN_LEVEL 0
+#	else
+#		define LUNI_TRACE_MIN_LEVEL 2
+#	endif
+#endif
+
+namespace LuNI::Tracing {
+
+enum class Level : u8 {
+	TRACE,
+	DEBUG,
+	INFO,
+	WARN,
+	ERROR,
+};
+
+/// 运行时可以单独开关的事件类别，对应命令行上的`--verbose-*`选项
+///
+/// WARN及以上等级的事件无视类别，总是会被记录。
+enum Category : u32 {
+	LEXER = 1 << 0,
+	PARSER = 1 << 1,
+	INTERPRETER = 1 << 2,
+};
+
+namespace detail {
+	inline std::atomic<u32> enabledCategories{ 0 };
+
+	struct Event {
+		static constexpr usize kMaxLength = 240;
+
+		Level level;
+		u32 category;
+		u32 length;
+		char text[kMaxLength];
+	};
+
+	/// 在事件缓冲区中预留的位置，写入完成后必须通过`CommitEvent`发布
+	struct EventSlot {
+		Event* event;
+		usize sequence;
+	};
+
+	/// 缓冲区已满时返回的`event`为空，该事件会被丢弃并计数，而不会阻塞调用者
+	auto ReserveEvent() -> EventSlot;
+	auto CommitEvent(EventSlot slot) -> void;
+} // namespace detail
+
+inline auto IsEnabled(Level level, u32 category) -> bool {
+	return level >= Level::WARN
+		|| (detail::enabledCategories.load(std::memory_order_relaxed) & category) != 0;
+}
+
+auto SetCategories(u32 categories) -> void;
+
+/// 将格式化好的事件写入无锁的环形缓冲区，实际的输出由后台线程完成
+template <typename... Args>
+auto Emit(Level level, u32 category, fmt::format_string<Args...> format, Args&&... args) -> void {
+	auto slot = detail::ReserveEvent();
+	if (!slot.event) return;
+
+	auto result = fmt::format_to_n(slot.event->text, detail::Event::kMaxLength, format, std::forward<Args>(args)...);
+	slot.event->level = level;
+	slot.event->category = category;
+	slot.event->length = static_cast<u32>(std::min(result.size, detail::Event::kMaxLength));
+	detail::CommitEvent(slot);
+}
+
+/// 将缓冲区中的所有事件输出到spdlog，可以在任意线程调用
+auto Flush() -> void;
+
+/// 启动定期调用`Flush`的后台线程
+auto StartFlusher() -> void;
+/// 停止后台线程并输出所有剩余的事件
+auto StopFlusher() -> void;
+
+} // namespace LuNI::Tracing
+
+/// 记录一个事件，用法：`LUNI_TRACE(INFO, LEXER, "format {}", args...)`
+///
+/// 等级低于LUNI_TRACE_MIN_LEVEL的事件在编译期被移除；类别没有被启用时，参数不会被求值。
+#define LUNI_TRACE(level, category, ...) \
+	do { \
+		if constexpr (static_cast<int>(::LuNI::Tracing::Level::level) >= LUNI_TRACE_MIN_LEVEL) { \
+			if (::LuNI::Tracing::IsEnabled(::LuNI::Tracing::Level::level, ::LuNI::Tracing::category)) { \
+				::LuNI::Tracing::Emit(::LuNI::Tracing::Level::level, ::LuNI::Tracing::category, __VA_ARGS__); \
+			} \
+		} \
+	} while (false)
+
+/// 类别是否被启用，用于包裹需要多个事件才能描述的输出（比如打印整个AST）
+#define LUNI_TRACE_ENABLED(level, category) \
+	(static_cast<int>(::LuNI::Tracing::Level::level) >= LUNI_TRACE_MIN_LEVEL \
+		&& ::LuNI::Tracing::IsEnabled(::LuNI::Tracing::Level::level, ::LuNI::Tracing::category))
@@ -1,14 +1,18 @@
 #pragma once
 
+#include "Util.hpp"
+
 namespace LuNI {
 
 // AstNode.hpp
 class AstNode;
 
 // Lexer.hpp
-enum class TokenType;
+enum class TokenType : u8;
 struct TokenPos;
 struct Token;
+class LineIndex;
+class TokenStream;
 
 // Parser.hpp
 struct ParsingResult;
@@ -0,0 +1,265 @@
+#include "Testing.hpp"
+
+#include "AstCache.hpp"
+#include "AstNode.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Symbol.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+
+using namespace LuNI;
+
+constexpr std::string_view kSource =
+	"local s = \"str\" .. [[long]]\n"
+	"t = { 1, 2.5, x = -3, [\"k\"] = true, nil }\n"
+	"function f(a, b)\n"
+	"  for i in 1, a, 2 if not b then print(i, #s) else b = i ^ 2 % 3 end end\n"
+	"  repeat a = a - 1 until a <= 0\n"
+	"end\n"
+	"while x ~= nil do x = t[x] end\n"
+	"f(t.x, 9223372036854775807)\n";
+
+static auto Parse(std::string_view source) -> ParsingResult {
+	auto tokens = TokenStream{ source };
+	return DoParsing(tokens);
+}
+
+/// 每个测试使用一个新的空目录
+class TempDirectory {
+public:
+	std::filesystem::path path;
+
+	TempDirectory() {
+		std::random_device random;
+		path = std::filesystem::temp_directory_path() / fmt::format("luni-cache-test-{:08x}", random());
+		std::filesystem::remove_all(path);
+	}
+
+	~TempDirectory() {
+		std::error_code error;
+		std::filesystem::remove_all(path, error);
+	}
+
+	/// 目录中唯一的缓存条目
+	auto Entry() const -> std::filesystem::path {
+		std::error_code error;
+		auto it = std::filesystem::directory_iterator{ path, error };
+		return error || it == std::filesystem::directory_iterator{} ? std::filesystem::path{} : it->path();
+	}
+};
+
+static auto ReadFile(const std::filesystem::path& path) -> std::string {
+	auto ifs = std::ifstream{ path, std::ios::binary };
+	return { std::istreambuf_iterator<char>{ ifs }, std::istreambuf_iterator<char>{} };
+}
+
+static auto WriteFile(const std::filesystem::path& path, std::string_view contents) -> void {
+	auto ofs = std::ofstream{ path, std::ios::binary | std::ios::trunc };
+	ofs.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+}
+
+/// 缓存文件的头部，和AstCache.cpp中的格式相同
+struct Header {
+	u32 magic;
+	u32 version;
+	u32 flags;
+	u32 sourceSize;
+	u64 sourceHash;
+	u64 bodyHash;
+};
+
+/// 替换条目的内容，并且重新计算头部中内容的哈希值，让损坏的内容通过哈希检查而由读取时的检查发现
+static auto WriteBody(const std::filesystem::path& path, std::string_view header, std::string_view body) -> void {
+	Header fields;
+	std::memcpy(&fields, header.data(), sizeof(Header));
+	fields.bodyHash = SymbolTable::HashOf(body);
+	std::string contents(reinterpret_cast<const char*>(&fields), sizeof(Header));
+	contents += body;
+	WriteFile(path, contents);
+}
+
+/// 比较两棵AST的结构以及节点自带的数据
+static auto SameTree(const AstNode& a, const AstNode& b) -> bool {
+	if (a.kind != b.kind || a.children.size() != b.children.size()) return false;
+	switch (a.kind) {
+		case AstNode::KD_Identifier: {
+			if (a.As<AstIdentifierNode>().name != b.As<AstIdentifierNode>().name) return false;
+			break;
+		}
+		case AstNode::KD_StringLiteral: {
+			if (a.As<AstStringLiteralNode>().value != b.As<AstStringLiteralNode>().value) return false;
+			break;
+		}
+		case AstNode::KD_NumericLiteral: {
+			auto& x = a.As<AstNumericLiteralNode>();
+			auto& y = b.As<AstNumericLiteralNode>();
+			if (x.isInteger != y.isInteger || (x.isInteger ? x.integer != y.integer : x.number != y.number)) return false;
+			break;
+		}
+		case AstNode::KD_BooleanLiteral: {
+			if (a.As<AstBooleanLiteralNode>().value != b.As<AstBooleanLiteralNode>().value) return false;
+			break;
+		}
+		case AstNode::KD_BinaryOp: {
+			if (a.As<AstBinaryOpNode>().op != b.As<AstBinaryOpNode>().op) return false;
+			break;
+		}
+		case AstNode::KD_UnaryOp: {
+			if (a.As<AstUnaryOpNode>().op != b.As<AstUnaryOpNode>().op) return false;
+			break;
+		}
+		case AstNode::KD_MetatableLiteral: {
+			if (a.As<AstMetatableLiteralNode>().arrayCount != b.As<AstMetatableLiteralNode>().arrayCount) return false;
+			break;
+		}
+		case AstNode::KD_LocalVarDef:
+		case AstNode::KD_GlobalVarDef: {
+			if (a.As<AstVarDefNode>().name != b.As<AstVarDefNode>().name) return false;
+			break;
+		}
+		case AstNode::KD_For: {
+			if (a.As<AstForNode>().variable != b.As<AstForNode>().variable) return false;
+			break;
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& x = a.As<AstFunctionDefinitionNode>();
+			auto& y = b.As<AstFunctionDefinitionNode>();
+			if (x.name != y.name || !std::ranges::equal(x.params, y.params)) return false;
+			break;
+		}
+		default: break;
+	}
+	for (usize i = 0; i < a.children.size(); ++i) {
+		if (!SameTree(*a.children[i], *b.children[i])) return false;
+	}
+	return true;
+}
+
+LUNI_TEST(StoredEntriesLoadAsTheSameTree) {
+	TempDirectory directory;
+	AstCache cache{ directory.path };
+	LUNI_CHECK(!cache.Load(kSource, 0));
+
+	auto parsed = Parse(kSource);
+	LUNI_CHECK(parsed.errors.empty());
+	cache.Store(kSource, 0, parsed);
+
+	auto loaded = cache.Load(kSource, 0);
+	LUNI_CHECK(loaded.has_value());
+	if (!loaded) return;
+	LUNI_CHECK(loaded->errors.empty());
+	LUNI_CHECK(loaded->source.data() == kSource.data());
+	LUNI_CHECK(SameTree(*parsed.root, *loaded->root));
+	LUNI_CHECK(std::ranges::equal(parsed.ranges, loaded->ranges, [](const SourceRange& a, const SourceRange& b) {
+		return a.begin == b.begin && a.end == b.end;
+	}));
+}
+
+LUNI_TEST(MismatchedEntriesAreMisses) {
+	TempDirectory directory;
+	AstCache cache{ directory.path };
+	cache.Store(kSource, 0, Parse(kSource));
+	LUNI_CHECK(cache.Load(kSource, 0).has_value());
+
+	// 不同的选项和不同的源文件各有自己的条目
+	LUNI_CHECK(!cache.Load(kSource, AstCache::OPTIMIZED));
+	auto edited = std::string{ kSource } + "x = 1\n";
+	LUNI_CHECK(!cache.Load(edited, 0));
+
+	// 即使条目的文件名对得上，头部记录的版本、选项或者源文件大小不同也是未命中
+	auto entry = directory.Entry();
+	auto original = ReadFile(entry);
+	for (auto field : { offsetof(Header, magic), offsetof(Header, version), offsetof(Header, flags), offsetof(Header, sourceSize) }) {
+		auto contents = original;
+		contents[field] = static_cast<char>(contents[field] + 1);
+		WriteFile(entry, contents);
+		LUNI_CHECK(!cache.Load(kSource, 0));
+	}
+	WriteFile(entry, original);
+	LUNI_CHECK(cache.Load(kSource, 0).has_value());
+}
+
+LUNI_TEST(DamagedEntriesAreMisses) {
+	TempDirectory directory;
+	AstCache cache{ directory.path };
+	cache.Store(kSource, 0, Parse(kSource));
+	auto entry = directory.Entry();
+	auto original = ReadFile(entry);
+	auto header = std::string_view{ original }.substr(0, sizeof(Header));
+	auto body = std::string_view{ original }.substr(sizeof(Header));
+
+	// 截断的条目无论是否修正了哈希值都不能被读取
+	for (usize size = 0; size < original.size(); ++size) {
+		WriteFile(entry, std::string_view{ original }.substr(0, size));
+		LUNI_CHECK(!cache.Load(kSource, 0));
+		if (size >= sizeof(Header)) {
+			WriteBody(entry, header, body.substr(0, size - sizeof(Header)));
+			LUNI_CHECK(!cache.Load(kSource, 0));
+		}
+	}
+
+	// 内容被改动而哈希值没有更新时是未命中
+	auto flipped = original;
+	flipped.back() = static_cast<char>(flipped.back() ^ 1);
+	WriteFile(entry, flipped);
+	LUNI_CHECK(!cache.Load(kSource, 0));
+
+	// 哈希值被同时更新时，改动后的内容可能仍然是一棵合法的树，但是不能让读取崩溃
+	std::mt19937 rng{ 19 };
+	for (usize round = 0; round < 2000; ++round) {
+		auto damaged = std::string{ body };
+		for (usize i = 0, count = 1 + rng() % 3; i < count; ++i) {
+			damaged[rng() % damaged.size()] = static_cast<char>(rng());
+		}
+		WriteBody(entry, header, damaged);
+		auto loaded = cache.Load(kSource, 0);
+		LUNI_CHECK(!loaded || (loaded->root && loaded->ranges.size() == loaded->root->children.size()));
+	}
+}
+
+LUNI_TEST(DeeplyNestedEntriesAreMisses) {
+	TempDirectory directory;
+	AstCache cache{ directory.path };
+	cache.Store(kSource, 0, Parse(kSource));
+	auto entry = directory.Entry();
+	auto original = ReadFile(entry);
+
+	// 没有名字的表，然后是一百万层只有一个子节点的语句块
+	std::string body;
+	body.push_back(0);
+	body.push_back(static_cast<char>(AstNode::KD_Script));
+	body.push_back(1);
+	for (usize i = 0; i < 1'000'000; ++i) {
+		body.push_back(static_cast<char>(AstNode::KD_StatementBlock));
+		body.push_back(1);
+	}
+	WriteBody(entry, std::string_view{ original }.substr(0, sizeof(Header)), body);
+	LUNI_CHECK(!cache.Load(kSource, 0));
+
+	// 嵌套过深的树不会被写入
+	TempDirectory other;
+	AstCache otherCache{ other.path };
+	std::string deep = "x = ";
+	for (usize i = 0; i < 1500; ++i) deep += "not ";
+	deep += "x\n";
+	auto parsed = Parse(deep);
+	LUNI_CHECK(parsed.errors.empty());
+	otherCache.Store(deep, 0, parsed);
+	LUNI_CHECK(!otherCache.Load(deep, 0));
+	LUNI_CHECK(other.Entry().empty());
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
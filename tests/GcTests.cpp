@@ -0,0 +1,302 @@
+#include "Testing.hpp"
+
+#include "LuaHeap.hpp"
+#include "LuaTable.hpp"
+#include "LuaValue.hpp"
+
+#include <chrono>
+
+using namespace LuNI;
+
+/// 只有一个根表的堆，测试通过根表控制哪些对象可达
+struct RootedHeap {
+	LuaHeap heap;
+	LuaTable* root;
+
+	RootedHeap()
+		: root{ heap.NewTable(0, 0) } {
+		heap.SetRootMarker([this](LuaHeap& heap) { heap.Mark(LuaValue{ root }); });
+	}
+
+	/// 分配`count`个不可达的表
+	auto AllocateGarbage(usize count) -> void {
+		for (usize i = 0; i < count; ++i) {
+			heap.NewTable(4, 4);
+		}
+	}
+
+	/// 分配`count`个由根表的数组部分引用的表
+	auto AllocateReachable(usize count) -> void {
+		for (usize i = 0; i < count; ++i) {
+			auto table = heap.NewTable(0, 0);
+			root->SetInteger(root->Length() + 1, LuaValue{ table });
+			heap.Barrier(root, LuaValue{ table });
+		}
+	}
+
+	/// 进行增量步骤直到一个周期结束，返回步骤的次数
+	auto FinishCycle() -> usize {
+		usize steps = 1;
+		while (!heap.PerformStep()) ++steps;
+		return steps;
+	}
+};
+
+LUNI_TEST(FullCollectFreesUnreachableObjects) {
+	RootedHeap h;
+	h.AllocateReachable(10);
+	auto live = h.heap.ObjectCount();
+	h.AllocateGarbage(100);
+	LUNI_CHECK(h.heap.ObjectCount() == live + 100);
+
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+	LUNI_CHECK(h.heap.CurrentPhase() == LuaHeap::Phase::PAUSE);
+	for (i64 i = 1; i <= 10; ++i) {
+		LUNI_CHECK(h.root->GetInteger(i).Type() == LuaType::TABLE);
+	}
+
+	// 不再被引用的对象在下一次回收中释放
+	h.root->SetInteger(10, LuaValue{});
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live - 1);
+}
+
+LUNI_TEST(StepLoopsFreeUnreachableObjects) {
+	RootedHeap h;
+	// 足够多的对象，清除阶段才会分成好几步
+	h.AllocateReachable(500);
+	auto live = h.heap.ObjectCount();
+	h.AllocateGarbage(500);
+
+	// 周期开始之前分配的垃圾在这个周期中释放
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+
+	auto parameters = h.heap.Parameters();
+	parameters.stepMultiplier = 1;
+	h.heap.SetParameters(parameters);
+
+	// 标记阶段中分配的不可达对象在原子阶段之后就是垃圾
+	LUNI_CHECK(!h.heap.PerformStep());
+	LUNI_CHECK(h.heap.CurrentPhase() == LuaHeap::Phase::PROPAGATE);
+	h.AllocateGarbage(100);
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+
+	// 清除阶段中分配的对象是新的白色，不会被这次清除释放，而是留到下一个周期
+	while (h.heap.CurrentPhase() != LuaHeap::Phase::SWEEP) {
+		LUNI_CHECK(!h.heap.PerformStep());
+	}
+	h.AllocateGarbage(100);
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live + 100);
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+
+	// 由安全点驱动：分配产生的债务足够时Step才会工作
+	h.heap.SetParameters(GcParameters{});
+	h.AllocateGarbage(2000);
+	for (usize i = 0; i < 100000 && h.heap.ObjectCount() > live + 1000; ++i) {
+		h.heap.Step();
+		h.AllocateGarbage(1);
+	}
+	LUNI_CHECK(h.heap.ObjectCount() <= live + 1000);
+}
+
+LUNI_TEST(BarrierKeepsObjectsStoredIntoBlackTables) {
+	RootedHeap h;
+	auto parameters = h.heap.Parameters();
+	// 没有时间预算时每一步只处理一个对象
+	parameters.stepBudget = std::chrono::microseconds{ 0 };
+	h.heap.SetParameters(parameters);
+	h.AllocateReachable(20);
+
+	// 根表最先被遍历，之后还有它引用的表是灰色的
+	LUNI_CHECK(!h.heap.PerformStep());
+	LUNI_CHECK(h.heap.CurrentPhase() == LuaHeap::Phase::PROPAGATE);
+	LUNI_CHECK(h.root->color == GcColor::BLACK);
+
+	auto metatable = h.heap.NewTable(0, 0);
+	auto value = h.heap.NewTable(0, 0);
+	h.root->SetMetatable(metatable);
+	h.heap.Barrier(h.root, LuaValue{ metatable });
+	h.root->Set(LuaValue{ i64{ 100 } }, LuaValue{ value });
+	h.heap.Barrier(h.root, LuaValue{ value });
+	LUNI_CHECK(h.root->color == GcColor::GRAY);
+
+	auto live = h.heap.ObjectCount();
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+	LUNI_CHECK(h.root->Metatable() == metatable);
+	LUNI_CHECK(h.root->GetInteger(100).Object() == value);
+
+	// 下一个周期从头标记，两个表仍然可达
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+}
+
+LUNI_TEST(StepsHonorTheWorkBudget) {
+	constexpr usize kTables = 2000;
+	auto StepsForCycle = [](u32 stepMultiplier) {
+		RootedHeap h;
+		auto parameters = h.heap.Parameters();
+		parameters.stepMultiplier = stepMultiplier;
+		parameters.stepBudget = std::chrono::seconds{ 10 };
+		h.heap.SetParameters(parameters);
+		h.AllocateReachable(kTables);
+		h.heap.FullCollect();
+
+		auto live = h.heap.BytesInUse();
+		auto steps = h.FinishCycle();
+		// 每一步在工作量达到预算之后就停下，最多超出一个对象
+		auto budget = LuaHeap::kStepSize * stepMultiplier / 100;
+		LUNI_CHECK(steps >= live / (budget + live / kTables * 4));
+		return steps;
+	};
+	auto small = StepsForCycle(50);
+	auto large = StepsForCycle(1000);
+	LUNI_CHECK(small > 1);
+	LUNI_CHECK(small > large);
+
+	// 时间预算用完时即使工作量还没有达到也会返回
+	RootedHeap h;
+	auto parameters = h.heap.Parameters();
+	parameters.stepMultiplier = 100000;
+	parameters.stepBudget = std::chrono::microseconds{ 0 };
+	h.heap.SetParameters(parameters);
+	h.AllocateReachable(100);
+	LUNI_CHECK(h.FinishCycle() > 100);
+}
+
+// ======== 分代模式 ========
+
+LUNI_TEST(MinorCollectionFreesYoungGarbage) {
+	RootedHeap h;
+	h.AllocateReachable(10);
+	// 垃圾的大小不能触发大回收
+	auto parameters = h.heap.Parameters();
+	parameters.majorMultiplier = 100000;
+	h.heap.SetParameters(parameters);
+	h.heap.SetMode(GcMode::GENERATIONAL);
+	auto live = h.heap.ObjectCount();
+
+	h.AllocateGarbage(100);
+	h.AllocateReachable(5);
+	LUNI_CHECK(h.heap.PerformStep());
+	LUNI_CHECK(h.heap.ObjectCount() == live + 5);
+	// 活过一次小回收的对象还是年轻的，不可达之后下一次小回收就会释放
+	auto survivor = h.root->GetInteger(15).Object();
+	LUNI_CHECK(survivor->age == GcAge::SURVIVAL);
+	h.root->SetInteger(15, LuaValue{});
+	h.heap.PerformStep();
+	LUNI_CHECK(h.heap.ObjectCount() == live + 4);
+}
+
+LUNI_TEST(RememberedSetKeepsOldToYoungReferences) {
+	RootedHeap h;
+	auto old = h.heap.NewTable(0, 0);
+	h.root->SetInteger(1, LuaValue{ old });
+	h.heap.SetMode(GcMode::GENERATIONAL);
+	LUNI_CHECK(old->age == GcAge::OLD && old->color == GcColor::BLACK);
+
+	// 老表不会被小回收遍历，只有屏障把它加入记忆集之后它引用的年轻对象才会被标记
+	auto young = h.heap.NewTable(0, 0);
+	old->SetInteger(1, LuaValue{ young });
+	h.heap.Barrier(old, LuaValue{ young });
+	LUNI_CHECK(old->age == GcAge::TOUCHED1);
+
+	auto live = h.heap.ObjectCount();
+	for (int i = 0; i < 4; ++i) {
+		h.heap.PerformStep();
+		LUNI_CHECK(h.heap.ObjectCount() == live);
+		LUNI_CHECK(old->GetInteger(1).Object() == young);
+	}
+	LUNI_CHECK(young->age == GcAge::OLD);
+
+	// 老对象之间的引用不需要记忆集，断开之后由大回收释放
+	old->SetInteger(1, LuaValue{});
+	h.heap.PerformStep();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live - 1);
+}
+
+LUNI_TEST(ObjectsAgeThroughMinorCollections) {
+	RootedHeap h;
+	auto table = h.heap.NewTable(0, 0);
+	h.root->SetInteger(1, LuaValue{ table });
+	h.heap.SetMode(GcMode::GENERATIONAL);
+
+	auto young = h.heap.NewTable(0, 0);
+	table->SetInteger(1, LuaValue{ young });
+	h.heap.Barrier(table, LuaValue{ young });
+	LUNI_CHECK(young->age == GcAge::NEW);
+	LUNI_CHECK(table->age == GcAge::TOUCHED1);
+
+	h.heap.PerformStep();
+	LUNI_CHECK(young->age == GcAge::SURVIVAL);
+	LUNI_CHECK(table->age == GcAge::TOUCHED2);
+
+	h.heap.PerformStep();
+	LUNI_CHECK(young->age == GcAge::OLD1);
+	LUNI_CHECK(table->age == GcAge::OLD);
+
+	h.heap.PerformStep();
+	LUNI_CHECK(young->age == GcAge::OLD);
+
+	// 再次写入年轻对象时重新进入记忆集
+	auto another = h.heap.NewTable(0, 0);
+	table->SetInteger(2, LuaValue{ another });
+	h.heap.Barrier(table, LuaValue{ another });
+	LUNI_CHECK(table->age == GcAge::TOUCHED1);
+	// 写入老对象不需要记忆集
+	young->SetInteger(1, LuaValue{ table });
+	h.heap.Barrier(young, LuaValue{ table });
+	LUNI_CHECK(young->age == GcAge::OLD);
+}
+
+LUNI_TEST(SwitchingModesKeepsLiveObjects) {
+	RootedHeap h;
+	h.AllocateReachable(20);
+	auto live = h.heap.ObjectCount();
+	h.AllocateGarbage(50);
+
+	// 进入分代模式时现有的对象全部变老，其中的垃圾要等到大回收
+	h.heap.SetMode(GcMode::GENERATIONAL);
+	LUNI_CHECK(h.heap.Mode() == GcMode::GENERATIONAL);
+	h.heap.PerformStep();
+	LUNI_CHECK(h.heap.ObjectCount() == live + 50);
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live);
+
+	// 回到增量模式时所有对象都重新变成年轻的白色对象
+	h.AllocateReachable(5);
+	h.AllocateGarbage(50);
+	h.heap.PerformStep();
+	h.heap.SetMode(GcMode::INCREMENTAL);
+	LUNI_CHECK(h.heap.Mode() == GcMode::INCREMENTAL);
+	LUNI_CHECK(h.heap.CurrentPhase() == LuaHeap::Phase::PAUSE);
+	LUNI_CHECK(h.root->age == GcAge::NEW);
+	h.FinishCycle();
+	LUNI_CHECK(h.heap.ObjectCount() == live + 5);
+
+	// 增量周期进行到一半时进入分代模式会放弃这个周期，不释放任何对象
+	auto parameters = h.heap.Parameters();
+	parameters.stepBudget = std::chrono::microseconds{ 0 };
+	h.heap.SetParameters(parameters);
+	h.AllocateGarbage(50);
+	LUNI_CHECK(!h.heap.PerformStep());
+	h.heap.SetMode(GcMode::GENERATIONAL);
+	LUNI_CHECK(h.heap.CurrentPhase() == LuaHeap::Phase::PAUSE);
+	LUNI_CHECK(h.heap.ObjectCount() == live + 55);
+	h.heap.FullCollect();
+	LUNI_CHECK(h.heap.ObjectCount() == live + 5);
+	for (i64 i = 1; i <= 25; ++i) {
+		LUNI_CHECK(h.root->GetInteger(i).Type() == LuaType::TABLE);
+	}
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
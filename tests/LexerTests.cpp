@@ -0,0 +1,106 @@
+#include "Testing.hpp"
+
+#include "Error.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+
+#include <string>
+#include <string_view>
+
+using namespace LuNI;
+
+static auto Contains(std::string_view text, std::string_view part) -> bool {
+	return text.find(part) != std::string_view::npos;
+}
+
+LUNI_TEST(ValidSourceHasNoErrors) {
+	auto result = DoLexing("local s = \"a\\\"b\" .. [==[x]]y]==] -- c\n--[[ d ]] return 0x1p4, 3.5e-2");
+	LUNI_CHECK(result.errors.empty());
+	LUNI_CHECK(result.tokens.size() == 10);
+}
+
+LUNI_TEST(UnexpectedCharacterIsReported) {
+	auto result = DoLexing("y = @\nprint(2)");
+	LUNI_CHECK(result.errors.size() == 1);
+	LUNI_CHECK(result.errors[0].id == ErrorCodes::LEXER_UNEXPECTED_CHARACTER);
+	LUNI_CHECK(Contains(result.errors[0].msg, "'@'"));
+	LUNI_CHECK(Contains(result.errors[0].msg, "1:5"));
+	// 出错的字符被丢弃，lexer继续生成后面的token
+	LUNI_CHECK(result.tokens.size() == 6);
+}
+
+LUNI_TEST(UnprintableCharacterIsReportedInHex) {
+	auto result = DoLexing("x = 1\x01");
+	LUNI_CHECK(result.errors.size() == 1);
+	LUNI_CHECK(Contains(result.errors[0].msg, "'\\x01'"));
+}
+
+LUNI_TEST(UnfinishedStringsAndCommentsAreReported) {
+	auto simple = DoLexing("s = 'abc");
+	LUNI_CHECK(simple.errors.size() == 1);
+	LUNI_CHECK(simple.errors[0].id == ErrorCodes::LEXER_UNFINISHED_STRING);
+	LUNI_CHECK(Contains(simple.errors[0].msg, "1:5"));
+
+	auto longString = DoLexing("s = [==[abc]]");
+	LUNI_CHECK(longString.errors.size() == 1);
+	LUNI_CHECK(longString.errors[0].id == ErrorCodes::LEXER_UNFINISHED_STRING);
+
+	auto longComment = DoLexing("x = 1\n--[[ never closed");
+	LUNI_CHECK(longComment.errors.size() == 1);
+	LUNI_CHECK(longComment.errors[0].id == ErrorCodes::LEXER_UNFINISHED_COMMENT);
+	LUNI_CHECK(Contains(longComment.errors[0].msg, "2:1"));
+}
+
+LUNI_TEST(MalformedNumbersAreReported) {
+	for (auto source : { "y = 3..2", "y = 12abc", "y = 0x", "y = 1e+", "y = 1.2.3", "y = .5e" }) {
+		auto result = DoLexing(source);
+		LUNI_CHECK(result.errors.size() == 1);
+		LUNI_CHECK(!result.errors.empty() && result.errors[0].id == ErrorCodes::LEXER_MALFORMED_NUMBER);
+		LUNI_CHECK(!result.errors.empty() && Contains(result.errors[0].msg, "1:5"));
+		// 整个数字被跳过，只剩下“y”和“=”
+		LUNI_CHECK(result.tokens.size() == 2);
+	}
+}
+
+LUNI_TEST(MalformedNumberFailsParsing) {
+	constexpr std::string_view source = "y = 3..2\nprint(x)";
+	auto tokens = TokenStream{ source };
+	auto result = DoParsing(tokens);
+	LUNI_CHECK(!result.errors.empty());
+	LUNI_CHECK(!result.errors.empty() && result.errors[0].id == ErrorCodes::LEXER_MALFORMED_NUMBER);
+	LUNI_CHECK(!result.errors.empty() && Contains(result.errors[0].msg, "'3..2'"));
+}
+
+LUNI_TEST(ParserReportsLexerErrors) {
+	constexpr std::string_view source = "y = @\nprint(2)";
+	auto tokens = TokenStream{ source };
+	auto serial = DoParsing(tokens);
+	LUNI_CHECK(!serial.errors.empty());
+	LUNI_CHECK(!serial.errors.empty() && serial.errors[0].id == ErrorCodes::LEXER_UNEXPECTED_CHARACTER);
+
+	auto parallel = DoParallelParsing(source, 2);
+	LUNI_CHECK(!parallel.errors.empty());
+}
+
+LUNI_TEST(SplitsSkipNestedDoBlocks) {
+	// 只看关键字的话，`do ... end`结束之后函数内部的`function`看起来就在顶层
+	constexpr std::string_view chunk =
+		"function f()\n"
+		"  do g() end\n"
+		"  while x do function inner() end end\n"
+		"  function inner() end\n"
+		"end\n";
+	std::string source;
+	for (usize i = 0; i < 999; ++i) source += chunk;
+
+	// 段数和函数个数互质，目标位置大多落在函数中间
+	auto splits = FindTopLevelSplits(source, 7);
+	LUNI_CHECK(splits.size() == 6);
+	for (auto split : splits) {
+		LUNI_CHECK(split % chunk.size() == 0);
+	}
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
@@ -0,0 +1,169 @@
+#include "Testing.hpp"
+
+#include "AstNode.hpp"
+#include "Lexer.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+#include "Symbol.hpp"
+
+#include <fmt/format.h>
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace LuNI;
+
+static auto ParseAndOptimize(std::string_view source) -> ParsingResult {
+	auto tokens = TokenStream{ source };
+	auto result = DoParsing(tokens);
+	LUNI_CHECK(result.errors.empty());
+	OptimizeAst(result);
+	return result;
+}
+
+/// 把表达式写成带括号的前缀形式，字面量写成它的值，比如`"a" .. x`是("a" .. x)
+static auto Render(const AstNode& node) -> std::string {
+	constexpr std::string_view binaryNames[] = {
+		"or", "and", "<", ">", "<=", ">=", "~=", "==", "..", "+", "-", "*", "/", "%", "^",
+	};
+	constexpr std::string_view unaryNames[] = { "not", "-", "#" };
+	switch (node.kind) {
+		case AstNode::KD_Nil: return "nil";
+		case AstNode::KD_BooleanLiteral: return node.As<AstBooleanLiteralNode>().value ? "true" : "false";
+		case AstNode::KD_Identifier: return std::string{ Symbols().Text(node.As<AstIdentifierNode>().name) };
+		case AstNode::KD_StringLiteral: return fmt::format("\"{}\"", Symbols().Text(node.As<AstStringLiteralNode>().value));
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = node.As<AstNumericLiteralNode>();
+			return literal.isInteger ? fmt::format("{}", literal.integer) : fmt::format("{}f", literal.number);
+		}
+		case AstNode::KD_BinaryOp: {
+			auto& op = node.As<AstBinaryOpNode>();
+			return fmt::format("({} {} {})", binaryNames[static_cast<usize>(op.op)], Render(*op.Lhs()), Render(*op.Rhs()));
+		}
+		case AstNode::KD_UnaryOp: {
+			auto& op = node.As<AstUnaryOpNode>();
+			return fmt::format("({} {})", unaryNames[static_cast<usize>(op.op)], Render(*op.Operand()));
+		}
+		case AstNode::KD_FunctionCall: {
+			auto& call = node.As<AstFunctionCallNode>();
+			auto text = fmt::format("(call {}", Render(*call.Callee()));
+			for (auto arg : call.Arguments()) text += " " + Render(*arg);
+			return text + ")";
+		}
+		default: return "?";
+	}
+}
+
+/// 优化`v = expression`之后赋给v的值
+static auto OptimizeExpression(std::string_view expression) -> std::string {
+	auto source = fmt::format("v = {}", expression);
+	auto result = ParseAndOptimize(source);
+	if (result.root->GetChildren().size() != 1) return "<error>";
+	return Render(*result.root->GetChildren()[0]->As<AstVarDefNode>().Value());
+}
+
+static auto CheckExpressions(std::span<const std::pair<std::string_view, std::string_view>> cases) -> void {
+	for (auto [expression, expected] : cases) {
+		auto actual = OptimizeExpression(expression);
+		if (actual != expected) {
+			fmt::print(stderr, "'{}' optimized to {}, expected {}\n", expression, actual, expected);
+		}
+		LUNI_CHECK(actual == expected);
+	}
+}
+
+LUNI_TEST(FoldsConstantExpressions) {
+	constexpr std::pair<std::string_view, std::string_view> cases[] = {
+		{ "1 + 2 * 3", "7" },
+		{ "7 / 2", "3.5f" },
+		{ "-7 % 3", "2" },
+		{ "7 % -3", "-2" },
+		{ "2 ^ 10", "1024f" },
+		{ "9223372036854775807 + 1", "-9223372036854775808" },
+		{ "1 < 2", "true" },
+		{ "1 == 1.0", "true" },
+		{ "9007199254740993 == 2^53", "false" },
+		{ "9007199254740992 == 2^53", "true" },
+		{ "1 == \"1\"", "false" },
+		{ "not nil", "true" },
+		{ "-(1 + 1)", "-2" },
+		{ "nil and x", "nil" },
+		{ "1 or x", "1" },
+		{ "false or x", "x" },
+		// 操作数不是常量，或者折叠会改变运行时的行为时保持原样
+		{ "x + 1", "(+ x 1)" },
+		{ "1 % 0", "(% 1 0)" },
+		{ "\"a\" + 1", "(+ \"a\" 1)" },
+	};
+	CheckExpressions(cases);
+}
+
+LUNI_TEST(FoldsOnlyPlainTextStrings) {
+	constexpr std::pair<std::string_view, std::string_view> cases[] = {
+		{ "\"ab\" .. \"cd\"", "\"abcd\"" },
+		{ "\"n\" .. 1", "\"n1\"" },
+		{ "#\"hello\"", "5" },
+		{ "\"a\" == \"a\"", "true" },
+		{ "\"a\" == \"b\"", "false" },
+		// 含有转义序列的字符串的原始文本和它的值不同，不能在编译期处理
+		{ "\"a\\n\" .. \"b\"", "(.. \"a\\n\" \"b\")" },
+		{ "#\"\\65\"", "(# \"\\65\")" },
+		{ "\"\\65\" == \"A\"", "(== \"\\65\" \"A\")" },
+		// 浮点数转换成字符串的格式留给运行时处理
+		{ "\"n\" .. 1.5", "(.. \"n\" 1.5f)" },
+	};
+	CheckExpressions(cases);
+}
+
+LUNI_TEST(RemovesConstantBranchesAndLoops) {
+	auto result = ParseAndOptimize(
+		"if false then a() end\n"
+		"while false do b() end\n"
+		"if 1 then c() else d() end\n"
+		"if nil then e() else f() end\n"
+		"while x do g() end\n");
+	auto statements = result.root->GetChildren();
+	LUNI_CHECK(statements.size() == 3);
+	LUNI_CHECK(result.ranges.size() == 3);
+	// 被保留的分支作为语句块代替整个if
+	LUNI_CHECK(statements[0]->kind == AstNode::KD_StatementBlock);
+	LUNI_CHECK(Render(*statements[0]->GetChildren()[0]) == "(call c)");
+	LUNI_CHECK(statements[1]->kind == AstNode::KD_StatementBlock);
+	LUNI_CHECK(Render(*statements[1]->GetChildren()[0]) == "(call f)");
+	LUNI_CHECK(statements[2]->kind == AstNode::KD_While);
+}
+
+LUNI_TEST(PropagatesOnlyUnmodifiedLocals) {
+	auto result = ParseAndOptimize(
+		"local a = 2\n"
+		"local b = 3\n"
+		"b = 4\n"
+		"local c = x\n"
+		"print(a * 10, b, c)\n"
+		"if y then local a = 5 print(a) end\n"
+		"print(a)\n"
+		"function f(a) print(a) end\n");
+	auto statements = result.root->GetChildren();
+	LUNI_CHECK(statements.size() == 8);
+	LUNI_CHECK(Render(*statements[4]) == "(call print 20 b c)");
+	LUNI_CHECK(Render(*statements[5]->As<AstIfNode>().IfBody()->GetChildren()[1]) == "(call print 5)");
+	LUNI_CHECK(Render(*statements[6]) == "(call print 2)");
+	// 参数遮蔽了同名的常量
+	auto& function = statements[7]->As<AstFunctionDefinitionNode>();
+	LUNI_CHECK(Render(*function.Body()->GetChildren()[0]) == "(call print a)");
+}
+
+LUNI_TEST(KeepsCalleeIdentifiers) {
+	auto result = ParseAndOptimize(
+		"local f = 1\n"
+		"local n = 2\n"
+		"f(n)\n");
+	auto statements = result.root->GetChildren();
+	LUNI_CHECK(Render(*statements[2]) == "(call f 2)");
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
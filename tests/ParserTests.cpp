@@ -0,0 +1,323 @@
+#include "Testing.hpp"
+
+#include "AstNode.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Symbol.hpp"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <string>
+#include <string_view>
+
+using namespace LuNI;
+
+static auto Parse(std::string_view source) -> ParsingResult {
+	auto tokens = TokenStream{ source };
+	return DoParsing(tokens);
+}
+
+LUNI_TEST(EmptyStatementsAtTopLevel) {
+	for (auto source : { ";", ";;", "; x = 1", "x = 1;", "x = 1;; ;y = 2", "function f() end; f()" }) {
+		auto result = Parse(source);
+		LUNI_CHECK(result.errors.empty());
+	}
+	auto result = Parse(";x = 1;;y = 2;");
+	LUNI_CHECK(result.errors.empty());
+	LUNI_CHECK(result.root->GetChildren().size() == 2);
+	LUNI_CHECK(result.ranges.size() == 2);
+}
+
+LUNI_TEST(EmptyStatementsInBlocks) {
+	constexpr std::string_view source =
+		"if x then ; y = 1 ;; end\n"
+		"while x do ; end\n"
+		"repeat ; until x\n"
+		"function f() ; g() ; end\n";
+	auto result = Parse(source);
+	LUNI_CHECK(result.errors.empty());
+	LUNI_CHECK(result.root->GetChildren().size() == 4);
+
+	auto& ifNode = *result.root->GetChildren()[0];
+	LUNI_CHECK(ifNode.kind == AstNode::KD_If);
+	// 空语句不产生节点，then分支只有`y = 1`
+	LUNI_CHECK(ifNode.GetChildren()[1]->GetChildren().size() == 1);
+}
+
+LUNI_TEST(EmptyStatementsWithParallelParsing) {
+	std::string source;
+	while (source.size() < 512 * 1024) {
+		source += ";function f() ; x = 1; end;\n;y = 2\n";
+	}
+	auto serial = Parse(source);
+	auto parallel = DoParallelParsing(source, 4);
+	LUNI_CHECK(serial.errors.empty());
+	LUNI_CHECK(parallel.errors.empty());
+	LUNI_CHECK(parallel.root->GetChildren().size() == serial.root->GetChildren().size());
+}
+
+// ======== 表达式 ========
+
+/// 把表达式写成带括号的前缀形式，比如`-x^2`是"(- (^ x 2))"
+static auto Render(const AstNode& node) -> std::string {
+	constexpr std::string_view binaryNames[] = {
+		"or", "and", "<", ">", "<=", ">=", "~=", "==", "..", "+", "-", "*", "/", "%", "^",
+	};
+	constexpr std::string_view unaryNames[] = { "not", "-", "#" };
+	switch (node.kind) {
+		case AstNode::KD_Identifier: return std::string{ Symbols().Text(node.As<AstIdentifierNode>().name) };
+		case AstNode::KD_StringLiteral: return fmt::format("\"{}\"", Symbols().Text(node.As<AstStringLiteralNode>().value));
+		case AstNode::KD_NumericLiteral: {
+			auto& literal = node.As<AstNumericLiteralNode>();
+			return literal.isInteger ? fmt::format("{}", literal.integer) : fmt::format("{}", literal.number);
+		}
+		case AstNode::KD_BinaryOp: {
+			auto& op = node.As<AstBinaryOpNode>();
+			return fmt::format("({} {} {})", binaryNames[static_cast<usize>(op.op)], Render(*op.Lhs()), Render(*op.Rhs()));
+		}
+		case AstNode::KD_UnaryOp: {
+			auto& op = node.As<AstUnaryOpNode>();
+			return fmt::format("({} {})", unaryNames[static_cast<usize>(op.op)], Render(*op.Operand()));
+		}
+		case AstNode::KD_FunctionCall: {
+			auto& call = node.As<AstFunctionCallNode>();
+			auto text = fmt::format("(call {}", Render(*call.Callee()));
+			for (auto arg : call.Arguments()) text += " " + Render(*arg);
+			return text + ")";
+		}
+		case AstNode::KD_Index: {
+			auto& index = node.As<AstIndexNode>();
+			return fmt::format("(index {} {})", Render(*index.Object()), Render(*index.Key()));
+		}
+		default: return "?";
+	}
+}
+
+static auto RenderExpression(std::string_view expression) -> std::string {
+	auto source = fmt::format("v = {}", expression);
+	auto result = Parse(source);
+	if (!result.errors.empty() || result.root->GetChildren().size() != 1) return "<error>";
+	return Render(*result.root->GetChildren()[0]->As<AstVarDefNode>().Value());
+}
+
+LUNI_TEST(OperatorPrecedenceAndAssociativity) {
+	constexpr std::pair<std::string_view, std::string_view> cases[] = {
+		// 一元运算符比除了“^”之外的所有二元运算符结合得更紧
+		{ "-x^2", "(- (^ x 2))" },
+		{ "-x*2", "(* (- x) 2)" },
+		{ "#t + 1", "(+ (# t) 1)" },
+		{ "not a == b", "(== (not a) b)" },
+		{ "2^-3", "(^ 2 (- 3))" },
+		// “^”和“..”是右结合的，其余的二元运算符都是左结合的
+		{ "2^3^2", "(^ 2 (^ 3 2))" },
+		{ "a..b..c", "(.. a (.. b c))" },
+		{ "a - b - c", "(- (- a b) c)" },
+		{ "a / b * c", "(* (/ a b) c)" },
+		{ "a or b and c", "(or a (and b c))" },
+		{ "a and b or c", "(or (and a b) c)" },
+		{ "a < b == c", "(== (< a b) c)" },
+		{ "a .. b + c", "(.. a (+ b c))" },
+		{ "a + b .. c", "(.. (+ a b) c)" },
+		{ "1 + 2 * 3 ^ 2", "(+ 1 (* 2 (^ 3 2)))" },
+		{ "(1 + 2) * 3", "(* (+ 1 2) 3)" },
+		{ "a or b < c .. d + e * -f ^ g", "(or a (< b (.. c (+ d (* e (- (^ f g)))))))" },
+		{ "t.f(x)[1]", "(index (call (index t \"f\") x) 1)" },
+	};
+	for (auto [expression, expected] : cases) {
+		auto actual = RenderExpression(expression);
+		if (actual != expected) {
+			fmt::print(stderr, "'{}' parsed as {}, expected {}\n", expression, actual, expected);
+		}
+		LUNI_CHECK(actual == expected);
+	}
+}
+
+LUNI_TEST(SuffixedCallStatements) {
+	auto calls = Parse("t.f(x)\nf(x)(y)\n");
+	LUNI_CHECK(calls.errors.empty());
+	LUNI_CHECK(calls.root->GetChildren().size() == 2);
+	// 不以调用结尾的后缀表达式不是语句
+	LUNI_CHECK(!Parse("t.f\n").errors.empty());
+}
+
+// ======== 增量解析 ========
+
+/// 比较两棵AST的结构以及名字和字面量
+static auto SameTree(const AstNode& a, const AstNode& b) -> bool {
+	if (a.kind != b.kind || a.children.size() != b.children.size()) return false;
+	switch (a.kind) {
+		case AstNode::KD_Identifier: {
+			if (a.As<AstIdentifierNode>().name != b.As<AstIdentifierNode>().name) return false;
+			break;
+		}
+		case AstNode::KD_StringLiteral: {
+			if (a.As<AstStringLiteralNode>().value != b.As<AstStringLiteralNode>().value) return false;
+			break;
+		}
+		case AstNode::KD_NumericLiteral: {
+			auto& x = a.As<AstNumericLiteralNode>();
+			auto& y = b.As<AstNumericLiteralNode>();
+			if (x.isInteger != y.isInteger || (x.isInteger ? x.integer != y.integer : x.number != y.number)) return false;
+			break;
+		}
+		case AstNode::KD_LocalVarDef:
+		case AstNode::KD_GlobalVarDef: {
+			if (a.As<AstVarDefNode>().name != b.As<AstVarDefNode>().name) return false;
+			break;
+		}
+		case AstNode::KD_FunctionDefinition: {
+			auto& x = a.As<AstFunctionDefinitionNode>();
+			auto& y = b.As<AstFunctionDefinitionNode>();
+			if (x.name != y.name || !std::ranges::equal(x.params, y.params)) return false;
+			break;
+		}
+		default: break;
+	}
+	for (usize i = 0; i < a.children.size(); ++i) {
+		if (!SameTree(*a.children[i], *b.children[i])) return false;
+	}
+	return true;
+}
+
+/// 增量解析的结果必须和对修改后的文件做完整解析完全相同
+static auto CheckReparse(ParsingResult&& previous, std::string_view source, const SourceEdit& edit) -> ParsingResult {
+	auto full = Parse(source);
+	auto incremental = DoReparsing(std::move(previous), source, edit);
+
+	bool same = full.errors.empty() == incremental.errors.empty();
+	if (same && full.errors.empty()) {
+		same = SameTree(*full.root, *incremental.root)
+			&& std::ranges::equal(full.ranges, incremental.ranges, [](const SourceRange& a, const SourceRange& b) {
+				return a.begin == b.begin && a.end == b.end;
+			});
+	}
+	if (!same) {
+		fmt::print(stderr, "reparse differs after inserting {} and removing {} at {}:\n{}\n",
+			edit.inserted, edit.removed, edit.offset, source);
+	}
+	LUNI_CHECK(same);
+	return incremental;
+}
+
+LUNI_TEST(RangesIncludeStringDelimiters) {
+	constexpr std::string_view source = "local s = \"abc\"\nt = [==[x]]y]==]\nu = 'q'";
+	auto result = Parse(source);
+	LUNI_CHECK(result.errors.empty());
+	LUNI_CHECK(result.ranges.size() == 3);
+	LUNI_CHECK(result.ranges.size() == 3 && result.ranges[0].end == source.find('\n'));
+	LUNI_CHECK(result.ranges.size() == 3 && result.ranges[1].end == source.rfind('\n'));
+	LUNI_CHECK(result.ranges.size() == 3 && result.ranges[2].end == source.size());
+}
+
+LUNI_TEST(ReparseAfterStringAtChunkBoundary) {
+	// 第一个节点以字符串结尾，修改位于第二个节点中，重新lexing必须从结尾的引号之后开始
+	std::string before = "local s = \"abc\"\nfunction f(a)\n  y = 2\nend\n";
+	std::string after = before;
+	after.insert(30, "q = 5\n");
+	auto result = CheckReparse(Parse(before), after, SourceEdit{ 30, 0, 6 });
+	LUNI_CHECK(result.errors.empty());
+	LUNI_CHECK(result.root->GetChildren().size() == 2);
+
+	std::string longBefore = "t = [==[\n]]x]==]\nfunction f(a)\n  y = 2\nend\n";
+	std::string longAfter = longBefore;
+	longAfter.insert(31, "q = 5\n");
+	CheckReparse(Parse(longBefore), longAfter, SourceEdit{ 31, 0, 6 });
+
+	// 紧贴在字符串结尾之后的修改
+	std::string adjacentBefore = "s = 'abc'\nx = 1\n";
+	std::string adjacentAfter = adjacentBefore;
+	adjacentAfter.insert(9, " .. 'd'");
+	CheckReparse(Parse(adjacentBefore), adjacentAfter, SourceEdit{ 9, 0, 7 });
+}
+
+/// 随机生成的顶层语句，大量使用字符串、长括号和注释，使它们经常出现在节点的边界上
+static auto RandomStatement(std::mt19937& rng, usize index) -> std::string {
+	switch (rng() % 7) {
+		case 0: return fmt::format("local s{} = \"str{}\"\n", index, index);
+		case 1: return fmt::format("t{} = [[long\n{}]] .. [==[x]]y]==]\n", index, index);
+		case 2: return fmt::format("print('a{}', \"b\")\n", index);
+		case 3: return fmt::format("function f{}(a, b)\n  x = \"q\" .. a\n  y = [=[z]=]\nend\n", index);
+		case 4: return fmt::format("if x then y = [[{}]] else z = '{}' end\n", index, index);
+		case 5: return fmt::format("-- comment {}\nx = {}\n", index, index);
+		default: return fmt::format("--[[ block\n]] while x do x = \"{}\" end;\n", index);
+	}
+}
+
+LUNI_TEST(RandomEditsMatchFullParsing) {
+	constexpr std::string_view insertions[] = {
+		"q = 5\n", "\"", "'", "]]", "[[", "x", " ", "\n", "local r = 'w'\n", "--", "end\n", ";", "..'z'",
+		"function g()\n  h()\nend\n", "y = [==[\n]==]\n",
+	};
+	std::mt19937 rng{ 15 };
+	for (usize round = 0; round < 40; ++round) {
+		std::string source;
+		for (usize i = 0; i < 30; ++i) source += RandomStatement(rng, i);
+		auto current = Parse(source);
+		LUNI_CHECK(current.errors.empty());
+
+		for (usize step = 0; step < 50; ++step) {
+			// 一半的修改位于顶层节点的边界附近
+			u32 offset;
+			if (rng() % 2 == 0 && !current.ranges.empty()) {
+				auto& range = current.ranges[rng() % current.ranges.size()];
+				offset = (rng() % 2 == 0 ? range.end : range.begin) + static_cast<u32>(rng() % 3) - 1;
+				offset = std::min<u32>(offset, static_cast<u32>(source.size()));
+			} else {
+				offset = static_cast<u32>(rng() % (source.size() + 1));
+			}
+			auto removed = std::min<u32>(static_cast<u32>(rng() % 4 == 0 ? rng() % 12 : 0), static_cast<u32>(source.size() - offset));
+			auto inserted = insertions[rng() % std::size(insertions)];
+
+			auto next = source;
+			next.replace(offset, removed, inserted);
+			current = CheckReparse(std::move(current), next, SourceEdit{ offset, removed, static_cast<u32>(inserted.size()) });
+			source = std::move(next);
+		}
+	}
+}
+
+// ======== 并行解析 ========
+
+/// 带有各种嵌套语句块的函数，以及函数之间的顶层循环
+static auto NestedBlocksChunk(usize index) -> std::string {
+	return fmt::format(
+		"function f{0}(a, b)\n"
+		"  while a do\n"
+		"    if b then while b do b = nil end else a = nil end\n"
+		"    for i in 1, a, 1 repeat a = a - i until a < 0 end\n"
+		"  end\n"
+		"  s = \"end do while\" -- end function\n"
+		"end\n"
+		"while x{0} do if y then z = [[ end ]] end end\n"
+		"repeat x = {0} until x\n",
+		index);
+}
+
+LUNI_TEST(ParallelParsingMatchesSerialWithNestedBlocks) {
+	std::string source;
+	for (usize i = 0; source.size() < 512 * 1024; ++i) {
+		source += NestedBlocksChunk(i);
+	}
+	auto serial = Parse(source);
+	LUNI_CHECK(serial.errors.empty());
+
+	// 每个切分点都必须是一个顶层节点的开头，否则并行解析只能退回到顺序解析
+	auto splits = FindTopLevelSplits(source, 16);
+	LUNI_CHECK(splits.size() == 15);
+	for (auto split : splits) {
+		auto aligned = std::ranges::any_of(serial.ranges, [&](const SourceRange& range) { return range.begin == split; });
+		LUNI_CHECK(aligned);
+	}
+
+	auto parallel = DoParallelParsing(source, 4);
+	LUNI_CHECK(parallel.errors.empty());
+	LUNI_CHECK(SameTree(*serial.root, *parallel.root));
+	LUNI_CHECK(std::ranges::equal(serial.ranges, parallel.ranges, [](const SourceRange& a, const SourceRange& b) {
+		return a.begin == b.begin && a.end == b.end;
+	}));
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
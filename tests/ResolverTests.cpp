@@ -0,0 +1,141 @@
+#include "Testing.hpp"
+
+#include "AstNode.hpp"
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "Resolver.hpp"
+#include "Symbol.hpp"
+
+#include <string_view>
+#include <vector>
+
+using namespace LuNI;
+
+static auto ParseAndResolve(std::string_view source) -> ParsingResult {
+	auto tokens = TokenStream{ source };
+	auto result = DoParsing(tokens);
+	LUNI_CHECK(result.errors.empty());
+	if (result.root) ResolveScopes(*result.root);
+	return result;
+}
+
+/// 按照源文件中的顺序收集所有类型为`kind`的节点
+static auto Collect(AstNode& node, AstNode::Kind kind, std::vector<AstNode*>& out) -> void {
+	if (node.kind == kind) out.push_back(&node);
+	for (auto child : node.GetChildren()) {
+		if (child) Collect(*child, kind, out);
+	}
+}
+
+/// 所有名为`name`的变量读取
+static auto Reads(AstNode& root, std::string_view name) -> std::vector<AstIdentifierNode*> {
+	std::vector<AstNode*> nodes;
+	Collect(root, AstNode::KD_Identifier, nodes);
+	std::vector<AstIdentifierNode*> result;
+	for (auto node : nodes) {
+		auto& identifier = node->As<AstIdentifierNode>();
+		if (Symbols().Text(identifier.name) == name) result.push_back(&identifier);
+	}
+	return result;
+}
+
+/// 所有名为`name`的局部变量声明和赋值
+static auto Definitions(AstNode& root, std::string_view name) -> std::vector<AstVarDefNode*> {
+	std::vector<AstNode*> nodes;
+	Collect(root, AstNode::KD_LocalVarDef, nodes);
+	Collect(root, AstNode::KD_GlobalVarDef, nodes);
+	std::vector<AstVarDefNode*> result;
+	for (auto node : nodes) {
+		auto& varDef = node->As<AstVarDefNode>();
+		if (Symbols().Text(varDef.name) == name) result.push_back(&varDef);
+	}
+	return result;
+}
+
+LUNI_TEST(SiblingBlocksReuseSlots) {
+	auto result = ParseAndResolve(
+		"local a = 1\n"
+		"if a then local b = 2 local c = 3 print(b, c) end\n"
+		"while a do local d = 4 print(d) end\n"
+		"local e = 5\n");
+	auto& root = *result.root;
+	LUNI_CHECK(Definitions(root, "a")[0]->slot == 0);
+	LUNI_CHECK(Definitions(root, "b")[0]->slot == 1);
+	LUNI_CHECK(Definitions(root, "c")[0]->slot == 2);
+	// if块结束之后，while块中的局部变量和之后的顶层局部变量重用它的槽位
+	LUNI_CHECK(Definitions(root, "d")[0]->slot == 1);
+	LUNI_CHECK(Definitions(root, "e")[0]->slot == 1);
+	LUNI_CHECK(Reads(root, "d")[0]->scope == VariableScope::LOCAL && Reads(root, "d")[0]->slot == 1);
+	LUNI_CHECK(root.slotCount == 3);
+}
+
+LUNI_TEST(FunctionsCaptureScriptLocalsAsUpvalues) {
+	auto result = ParseAndResolve(
+		"local u = 1\n"
+		"function f(p, q)\n"
+		"  local l = u\n"
+		"  print(u, p, q, l, g)\n"
+		"  u = 2\n"
+		"end\n");
+	auto& root = *result.root;
+	std::vector<AstNode*> functions;
+	Collect(root, AstNode::KD_FunctionDefinition, functions);
+	LUNI_CHECK(functions.size() == 1);
+	LUNI_CHECK(functions[0]->As<AstFunctionDefinitionNode>().slotCount == 3);
+
+	for (auto read : Reads(root, "u")) {
+		LUNI_CHECK(read->scope == VariableScope::UPVALUE && read->slot == 0);
+	}
+	LUNI_CHECK(Reads(root, "p")[0]->scope == VariableScope::LOCAL && Reads(root, "p")[0]->slot == 0);
+	LUNI_CHECK(Reads(root, "q")[0]->scope == VariableScope::LOCAL && Reads(root, "q")[0]->slot == 1);
+	LUNI_CHECK(Reads(root, "l")[0]->scope == VariableScope::LOCAL && Reads(root, "l")[0]->slot == 2);
+	LUNI_CHECK(Reads(root, "g")[0]->scope == VariableScope::GLOBAL);
+	// 不带local的赋值写入外层的局部变量
+	auto assignment = Definitions(root, "u")[1];
+	LUNI_CHECK(assignment->kind == AstNode::KD_GlobalVarDef);
+	LUNI_CHECK(assignment->scope == VariableScope::UPVALUE && assignment->slot == 0);
+}
+
+LUNI_TEST(LocalInitializerSeesOuterVariable) {
+	auto result = ParseAndResolve(
+		"local x = x\n"
+		"local x = x\n"
+		"print(x)\n");
+	auto& root = *result.root;
+	auto reads = Reads(root, "x");
+	LUNI_CHECK(reads.size() == 3);
+	// 第一个`local x = x`的右边还没有任何局部变量x
+	LUNI_CHECK(reads[0]->scope == VariableScope::GLOBAL);
+	// 第二个的右边是第一个x，而不是它自己
+	LUNI_CHECK(reads[1]->scope == VariableScope::LOCAL && reads[1]->slot == 0);
+	LUNI_CHECK(Definitions(root, "x")[1]->slot == 1);
+	LUNI_CHECK(reads[2]->scope == VariableScope::LOCAL && reads[2]->slot == 1);
+}
+
+LUNI_TEST(UntilConditionSeesBodyLocals) {
+	auto result = ParseAndResolve(
+		"local a = 0\n"
+		"repeat local done = a a = 1 until done\n"
+		"print(done)\n");
+	auto& root = *result.root;
+	auto reads = Reads(root, "done");
+	LUNI_CHECK(reads.size() == 2);
+	LUNI_CHECK(reads[0]->scope == VariableScope::LOCAL && reads[0]->slot == 1);
+	// 循环之后这个局部变量已经不可见了
+	LUNI_CHECK(reads[1]->scope == VariableScope::GLOBAL);
+}
+
+LUNI_TEST(CalleesAreResolvedLikeOtherReads) {
+	auto result = ParseAndResolve(
+		"local p = print\n"
+		"p(1)\n"
+		"function f() p(2) end\n");
+	auto reads = Reads(*result.root, "p");
+	LUNI_CHECK(reads.size() == 2);
+	LUNI_CHECK(reads[0]->scope == VariableScope::LOCAL && reads[0]->slot == 0);
+	LUNI_CHECK(reads[1]->scope == VariableScope::UPVALUE && reads[1]->slot == 0);
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
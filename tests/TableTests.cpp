@@ -0,0 +1,195 @@
+#include "Testing.hpp"
+
+#include "LuaHeap.hpp"
+#include "LuaTable.hpp"
+#include "LuaValue.hpp"
+#include "Symbol.hpp"
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <variant>
+
+using namespace LuNI;
+
+/// 参照实现中的键：整数（包括值为整数的浮点数）、非整数的浮点数、布尔值和字符串
+using ModelKey = std::variant<i64, f64, bool, std::string>;
+
+/// `Length()`返回的必须是一个边界：`t[n]`不为nil而`t[n + 1]`为nil，或者`t[1]`为nil时为0
+static auto IsBorder(const LuaTable& table) -> bool {
+	auto n = table.Length();
+	if (n < 0) return false;
+	if (n == 0) return table.GetInteger(1).IsNil();
+	return !table.GetInteger(n).IsNil() && table.GetInteger(n + 1).IsNil();
+}
+
+/// 和std::map对照的表，每个操作同时作用于两者
+class CheckedTable {
+private:
+	LuaHeap& heap;
+	LuaTable* table;
+	std::map<ModelKey, i64> model;
+
+public:
+	CheckedTable(LuaHeap& heap, u32 arrayHint, u32 hashHint)
+		: heap{ heap }, table{ heap.NewTable(arrayHint, hashHint) } {}
+
+	auto Table() const -> const LuaTable& {
+		return *table;
+	}
+
+	auto Model() const -> const std::map<ModelKey, i64>& {
+		return model;
+	}
+
+	/// 同一个键的不同写法都必须找到同一个槽位：值为整数的浮点数等于整数，新分配的字符串等于驻留的字符串
+	auto ToValue(const ModelKey& key, bool alternate) -> LuaValue {
+		return std::visit(Overloaded{
+			[&](i64 integer) { return alternate ? LuaValue{ static_cast<f64>(integer) } : LuaValue{ integer }; },
+			[&](f64 number) { return LuaValue{ number }; },
+			[&](bool boolean) { return LuaValue{ boolean }; },
+			[&](const std::string& text) {
+				return alternate ? LuaValue{ heap.NewString(text) } : LuaValue{ heap.Constant(Symbols().Intern(text)) };
+			},
+		}, key);
+	}
+
+	auto Set(const ModelKey& key, std::optional<i64> value, bool alternate) -> bool {
+		auto luaValue = value ? LuaValue{ *value } : LuaValue{};
+		bool ok = table->Set(ToValue(key, alternate), luaValue);
+		if (value) {
+			model[key] = *value;
+		} else {
+			model.erase(key);
+		}
+		return ok;
+	}
+
+	/// 表中的每个键都和参照实现一致
+	auto Matches(bool alternate) -> bool {
+		for (auto& [key, value] : model) {
+			auto actual = table->Get(ToValue(key, alternate));
+			if (actual.Type() != LuaType::INTEGER || actual.AsInteger() != value) return false;
+		}
+		return true;
+	}
+
+	/// 不在参照实现中的键在表中必须为nil
+	auto MissingKeyIsNil(const ModelKey& key) -> bool {
+		return model.contains(key) || table->Get(ToValue(key, false)).IsNil();
+	}
+};
+
+static auto RandomKey(std::mt19937& rng, i64 maxInteger) -> ModelKey {
+	switch (rng() % 10) {
+		case 0: return static_cast<f64>(rng() % 1000) + 0.5;
+		case 1: return rng() % 2 == 0;
+		case 2:
+		case 3: return "k" + std::to_string(rng() % 300);
+		case 4: return -static_cast<i64>(rng() % 50);
+		default: return static_cast<i64>(1 + rng() % static_cast<u64>(maxInteger));
+	}
+}
+
+LUNI_TEST(RandomSetAndClearMatchesStdMap) {
+	LuaHeap heap;
+	std::mt19937 rng{ 22 };
+	for (usize round = 0; round < 60; ++round) {
+		auto checked = CheckedTable{ heap, static_cast<u32>(rng() % 8), static_cast<u32>(rng() % 8) };
+		// 不同的轮次使用不同的整数键范围，使表在稠密（适合数组部分）和稀疏之间变化
+		auto maxInteger = i64{ 1 } << (2 + round % 10);
+		usize mismatches = 0;
+		usize badBorders = 0;
+		for (usize step = 0; step < 3000; ++step) {
+			auto op = rng() % 100;
+			if (op < 25) {
+				// 顺序追加，走数组部分的快速路径
+				auto next = checked.Table().Length() + 1;
+				checked.Set(next, static_cast<i64>(step), false);
+			} else if (op < 35) {
+				// 清除边界上的元素，边界随之移动
+				auto n = checked.Table().Length();
+				if (n > 0) checked.Set(n, std::nullopt, false);
+			} else if (op < 55) {
+				checked.Set(RandomKey(rng, maxInteger), std::nullopt, rng() % 2 == 0);
+			} else {
+				checked.Set(RandomKey(rng, maxInteger), static_cast<i64>(step), rng() % 2 == 0);
+			}
+
+			if (!IsBorder(checked.Table())) ++badBorders;
+			if (step % 100 == 0 && !(checked.Matches(false) && checked.Matches(true))) ++mismatches;
+			if (!checked.MissingKeyIsNil(RandomKey(rng, maxInteger * 2))) ++mismatches;
+		}
+		LUNI_CHECK(mismatches == 0);
+		LUNI_CHECK(badBorders == 0);
+		LUNI_CHECK(checked.Matches(false));
+		LUNI_CHECK(checked.Matches(true));
+	}
+}
+
+LUNI_TEST(InvalidKeysAreRejected) {
+	LuaHeap heap;
+	auto table = heap.NewTable(0, 0);
+	LUNI_CHECK(!table->Set(LuaValue{}, LuaValue{ i64{ 1 } }));
+	LUNI_CHECK(!table->Set(LuaValue{ std::numeric_limits<f64>::quiet_NaN() }, LuaValue{ i64{ 1 } }));
+	LUNI_CHECK(table->Length() == 0);
+	LUNI_CHECK(table->HashCapacity() == 0);
+}
+
+LUNI_TEST(SequentialKeysMigrateToArrayPart) {
+	LuaHeap heap;
+	auto forward = heap.NewTable(0, 0);
+	for (i64 i = 1; i <= 100000; ++i) {
+		forward->SetInteger(i, LuaValue{ i });
+	}
+	LUNI_CHECK(forward->ArraySize() >= 100000);
+	LUNI_CHECK(forward->HashCapacity() == 0);
+	LUNI_CHECK(forward->Length() == 100000);
+
+	// 倒序插入时所有键都先进入哈希部分，重新分配时再迁移到数组部分
+	auto backward = heap.NewTable(0, 0);
+	for (i64 i = 1024; i >= 1; --i) {
+		backward->Set(LuaValue{ static_cast<f64>(i) }, LuaValue{ i });
+	}
+	LUNI_CHECK(backward->ArraySize() >= 512);
+	LUNI_CHECK(backward->Length() == 1024);
+	bool all = true;
+	for (i64 i = 1; i <= 1024; ++i) {
+		all = all && backward->GetInteger(i).AsInteger() == i;
+	}
+	LUNI_CHECK(all);
+}
+
+LUNI_TEST(ManyStringKeys) {
+	LuaHeap heap;
+	auto checked = CheckedTable{ heap, 0, 0 };
+	for (i64 i = 0; i < 10000; ++i) {
+		checked.Set("key" + std::to_string(i), i, i % 2 == 0);
+	}
+	LUNI_CHECK(checked.Table().ArraySize() == 0);
+	LUNI_CHECK(checked.Matches(false));
+	LUNI_CHECK(checked.Matches(true));
+	LUNI_CHECK(checked.Table().Length() == 0);
+}
+
+LUNI_TEST(IntegerFloatEqualityIsExact) {
+	constexpr i64 k2To53 = i64{ 1 } << 53;
+	LUNI_CHECK(LuaValue{ i64{ 3 } }.RawEquals(LuaValue{ 3.0 }));
+	LUNI_CHECK(LuaValue{ -0.0 }.RawEquals(LuaValue{ i64{ 0 } }));
+	LUNI_CHECK(LuaValue{ static_cast<f64>(k2To53) }.RawEquals(LuaValue{ k2To53 }));
+	// 2^53 + 1不能用浮点数表示，转换成浮点数之后会等于2^53
+	LUNI_CHECK(!LuaValue{ k2To53 + 1 }.RawEquals(LuaValue{ static_cast<f64>(k2To53) }));
+	LUNI_CHECK(!LuaValue{ static_cast<f64>(k2To53) }.RawEquals(LuaValue{ k2To53 + 1 }));
+	// 2^63超出了i64的范围，转换成浮点数的最大整数却等于它
+	LUNI_CHECK(!LuaValue{ std::numeric_limits<i64>::max() }.RawEquals(LuaValue{ 0x1p63 }));
+	LUNI_CHECK(LuaValue{ std::numeric_limits<i64>::min() }.RawEquals(LuaValue{ -0x1p63 }));
+	LUNI_CHECK(!LuaValue{ i64{ 1 } }.RawEquals(LuaValue{ 1.5 }));
+	LUNI_CHECK(!LuaValue{ i64{ 0 } }.RawEquals(LuaValue{ std::nan("") }));
+	LUNI_CHECK(!LuaValue{ i64{ 1 } }.RawEquals(LuaValue{ true }));
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
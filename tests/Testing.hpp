@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <fmt/format.h>
+#include <vector>
+
+/// 单元测试共用的极简注册和断言，不依赖任何测试框架
+///
+/// 每个测试文件都是一个独立的可执行文件，用`LUNI_TEST`定义测试，在`main`中返回`RunAllTests()`。
+namespace LuNI::Testing {
+
+struct TestCase {
+	const char* name;
+	void (*run)();
+};
+
+inline auto Registry() -> std::vector<TestCase>& {
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+inline auto FailureCount() -> usize& {
+	static usize failures = 0;
+	return failures;
+}
+
+inline auto Register(const char* name, void (*run)()) -> bool {
+	Registry().push_back(TestCase{ name, run });
+	return true;
+}
+
+inline auto Fail(const char* file, int line, const char* expression) -> void {
+	++FailureCount();
+	fmt::print(stderr, "{}:{}: check failed: {}\n", file, line, expression);
+}
+
+/// 依次运行所有测试，有任何检查失败时返回1
+inline auto RunAllTests() -> int {
+	usize failedTests = 0;
+	for (auto& test : Registry()) {
+		auto before = FailureCount();
+		test.run();
+		bool passed = FailureCount() == before;
+		if (!passed) ++failedTests;
+		fmt::print("[{}] {}\n", passed ? "PASS" : "FAIL", test.name);
+	}
+	fmt::print("{} of {} tests passed\n", Registry().size() - failedTests, Registry().size());
+	return failedTests == 0 ? 0 : 1;
+}
+
+} // namespace LuNI::Testing
+
+#define LUNI_TEST(name) \
+	static auto name() -> void; \
+	[[maybe_unused]] static const bool name##Registered = ::LuNI::Testing::Register(#name, &name); \
+	static auto name() -> void
+
+/// 失败时只记录并继续执行，这样一次运行能看到所有失败的检查
+#define LUNI_CHECK(condition) \
+	do { \
+		if (!(condition)) ::LuNI::Testing::Fail(__FILE__, __LINE__, #condition); \
+	} while (false)
@@ -0,0 +1,298 @@
+#include "Testing.hpp"
+
+#include "Lexer.hpp"
+#include "Symbol.hpp"
+
+#include <bit>
+#include <cctype>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace LuNI;
+
+static auto SameToken(const Token& a, const Token& b) -> bool {
+	if (a.offset != b.offset || a.length != b.length || a.type != b.type) return false;
+	switch (a.type) {
+		case TokenType::INTEGER_LITERAL: return a.integer == b.integer;
+		case TokenType::FLOATING_POINT_LITERAL: return std::bit_cast<u64>(a.number) == std::bit_cast<u64>(b.number);
+		case TokenType::IDENTIFIER: return a.symbol == b.symbol;
+		default: return true;
+	}
+}
+
+// ======== 随机脚本 ========
+
+/// 生成由随机token组成的源文件，token之间总是有空白符或者注释，因此每个token的边界都是确定的
+static auto RandomSource(std::mt19937& rng, usize tokenCount) -> std::string {
+	auto Pick = [&](usize n) { return static_cast<usize>(rng() % n); };
+	auto RandomName = [&]() {
+		std::string name(1 + Pick(10), 'a');
+		for (auto& c : name) c = "abcdefghijklmnopqrstuvwxyz_ABCXYZ"[Pick(33)];
+		if (Pick(4) == 0) name += std::to_string(Pick(100));
+		return name;
+	};
+	auto Spellings = []() {
+		std::vector<std::string_view> result;
+		for (auto i = static_cast<u32>(TokenType::KEYWORD_AND); i <= static_cast<u32>(TokenType::SYMBOL_3_DOT); ++i) {
+			result.push_back(StringifyTokenType(static_cast<TokenType>(i)));
+		}
+		return result;
+	}();
+	constexpr std::string_view separators[] = {
+		" ", "\n", "\t", "  \r\n", " -- line comment\n", " --[[ block ]] ", " --[=[ ]] still ]=]\n", "\n--\n",
+	};
+	constexpr std::string_view numbers[] = {
+		"0", "7", "42", "1234567890", "3.25", "0.5e-3", "1e10", "2E+4", ".5", "0xff", "0X1p4", "0x.8", "9007199254740993",
+	};
+
+	std::string source;
+	for (usize i = 0; i < tokenCount; ++i) {
+		switch (Pick(6)) {
+			case 0: source += RandomName(); break;
+			case 1: source += Spellings[Pick(Spellings.size())]; break;
+			case 2: source += numbers[Pick(std::size(numbers))]; break;
+			case 3: source += std::to_string(rng()); break;
+			case 4: {
+				auto quote = Pick(2) == 0 ? '"' : '\'';
+				source += quote;
+				source += RandomName();
+				if (Pick(2) == 0) source += std::string{ '\\', quote } + "\\\\ \\n";
+				source += quote;
+				break;
+			}
+			case 5: {
+				auto level = std::string(Pick(3), '=');
+				source += "[" + level + "[" + (Pick(2) == 0 ? "\n" : "") + RandomName();
+				// 等级不同的结尾不会结束这个字符串
+				if (!level.empty()) source += "]]";
+				source += "\n]" + level + "]";
+				break;
+			}
+		}
+		source += separators[Pick(std::size(separators))];
+	}
+	return source;
+}
+
+// ======== 参考lexer ========
+
+static auto LongBracketLevel(std::string_view source, usize at) -> std::optional<usize> {
+	if (at >= source.size() || source[at] != '[') return {};
+	usize level = 0;
+	while (at + 1 + level < source.size() && source[at + 1 + level] == '=') ++level;
+	if (at + 1 + level < source.size() && source[at + 1 + level] == '[') return level;
+	return {};
+}
+
+static auto LongBracketClose(std::string_view source, usize from, usize level) -> usize {
+	auto close = "]" + std::string(level, '=') + "]";
+	auto at = source.find(close, from);
+	return at == std::string_view::npos ? source.size() : at;
+}
+
+/// 逐字符实现的朴素lexer，只支持`RandomSource`生成的（格式正确的）输入，用来对照表驱动的lexer
+static auto ReferenceLex(std::string_view source) -> std::vector<Token> {
+	auto IsNamePart = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+	auto Make = [](usize begin, usize length, TokenType type) {
+		return Token{ .offset = static_cast<u32>(begin), .length = static_cast<u32>(length), .type = type, .integer = 0 };
+	};
+
+	std::vector<Token> tokens;
+	usize i = 0;
+	while (i < source.size()) {
+		auto c = source[i];
+		if (std::isspace(static_cast<unsigned char>(c))) {
+			++i;
+		} else if (source.substr(i, 2) == "--") {
+			if (auto level = LongBracketLevel(source, i + 2)) {
+				auto close = LongBracketClose(source, i + 4 + *level, *level);
+				i = std::min(source.size(), close + *level + 2);
+			} else {
+				auto newline = source.find('\n', i);
+				i = newline == std::string_view::npos ? source.size() : newline + 1;
+			}
+		} else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+			auto begin = i;
+			while (i < source.size() && IsNamePart(source[i])) ++i;
+			auto text = source.substr(begin, i - begin);
+			auto token = Make(begin, i - begin, TokenType::IDENTIFIER);
+			for (auto t = static_cast<u32>(TokenType::KEYWORD_AND); t <= static_cast<u32>(TokenType::KEYWORD_WHILE); ++t) {
+				if (StringifyTokenType(static_cast<TokenType>(t)) == text) token.type = static_cast<TokenType>(t);
+			}
+			if (token.type == TokenType::IDENTIFIER) token.symbol = Symbols().Intern(text);
+			tokens.push_back(token);
+		} else if (std::isdigit(static_cast<unsigned char>(c))
+			|| (c == '.' && i + 1 < source.size() && std::isdigit(static_cast<unsigned char>(source[i + 1])))) {
+			auto begin = i;
+			bool hex = source.substr(i, 2) == "0x" || source.substr(i, 2) == "0X";
+			if (hex) i += 2;
+			while (i < source.size()) {
+				auto d = source[i];
+				auto prev = i > begin ? source[i - 1] : '\0';
+				bool exponentSign = (d == '+' || d == '-') && (hex ? (prev == 'p' || prev == 'P') : (prev == 'e' || prev == 'E'));
+				if (!std::isxdigit(static_cast<unsigned char>(d)) && d != '.' && !exponentSign && !(hex && (d == 'p' || d == 'P'))) break;
+				++i;
+			}
+			auto text = std::string{ source.substr(begin, i - begin) };
+			bool isFloat = text.find_first_of(hex ? ".pP" : ".eE") != std::string::npos;
+			auto token = Make(begin, i - begin, isFloat ? TokenType::FLOATING_POINT_LITERAL : TokenType::INTEGER_LITERAL);
+			if (isFloat) {
+				token.number = std::strtod(text.c_str(), nullptr);
+			} else {
+				// 和Lua一样，超出范围的十进制整数变成浮点数，十六进制整数则回绕
+				errno = 0;
+				auto value = std::strtoull(text.c_str(), nullptr, hex ? 16 : 10);
+				if (!hex && (errno == ERANGE || value > static_cast<u64>(INT64_MAX))) {
+					token.type = TokenType::FLOATING_POINT_LITERAL;
+					token.number = std::strtod(text.c_str(), nullptr);
+				} else {
+					token.integer = static_cast<i64>(value);
+				}
+			}
+			tokens.push_back(token);
+		} else if (c == '"' || c == '\'') {
+			auto begin = ++i;
+			while (i < source.size() && source[i] != c) i += source[i] == '\\' ? 2 : 1;
+			tokens.push_back(Make(begin, i - begin, TokenType::STRING_LITERAL));
+			++i;
+		} else if (auto level = LongBracketLevel(source, i)) {
+			auto begin = i + *level + 2;
+			if (begin < source.size() && source[begin] == '\n') ++begin;
+			auto close = LongBracketClose(source, begin, *level);
+			tokens.push_back(Make(begin, close - begin, TokenType::STRING_LITERAL));
+			i = close + *level + 2;
+		} else {
+			// 最长匹配
+			std::optional<Token> best;
+			for (auto t = static_cast<u32>(TokenType::OPERATOR_PLUS); t <= static_cast<u32>(TokenType::SYMBOL_3_DOT); ++t) {
+				auto spelling = StringifyTokenType(static_cast<TokenType>(t));
+				if (source.substr(i, spelling.size()) == spelling && (!best || best->length < spelling.size())) {
+					best = Make(i, spelling.size(), static_cast<TokenType>(t));
+				}
+			}
+			if (!best) return tokens;
+			tokens.push_back(*best);
+			i += best->length;
+		}
+	}
+	return tokens;
+}
+
+// ======== 测试 ========
+
+LUNI_TEST(DoLexingMatchesReferenceLexer) {
+	for (u32 seed = 1; seed <= 20; ++seed) {
+		std::mt19937 rng{ seed };
+		auto source = RandomSource(rng, 2000);
+		auto actual = DoLexing(source);
+		auto expected = ReferenceLex(source);
+		LUNI_CHECK(actual.errors.empty());
+		LUNI_CHECK(actual.tokens.size() == expected.size());
+		for (usize i = 0; i < std::min(actual.tokens.size(), expected.size()); ++i) {
+			if (!SameToken(actual.tokens[i], expected[i])) {
+				fmt::print(stderr, "seed {}: token {} differs, '{}' vs '{}'\n",
+					seed, i, actual.tokens[i].Text(source), expected[i].Text(source));
+				LUNI_CHECK(SameToken(actual.tokens[i], expected[i]));
+				break;
+			}
+		}
+	}
+}
+
+LUNI_TEST(TokenStreamMatchesDoLexing) {
+	std::mt19937 rng{ 42 };
+	auto source = RandomSource(rng, 5000);
+	auto expected = DoLexing(source).tokens;
+
+	TokenStream stream{ source };
+	usize count = 0;
+	bool same = true;
+	while (auto token = stream.Take()) {
+		same = same && count < expected.size() && SameToken(*token, expected[count]);
+		++count;
+	}
+	LUNI_CHECK(same);
+	LUNI_CHECK(count == expected.size());
+	LUNI_CHECK(stream.Errors().empty());
+}
+
+LUNI_TEST(TokenStreamResumesAtAnyTokenBoundary) {
+	std::mt19937 rng{ 7 };
+	auto source = RandomSource(rng, 400);
+	auto expected = DoLexing(source).tokens;
+
+	for (usize start = 0; start < expected.size(); start += 37) {
+		// 字符串token的偏移量在引号之内，不是一个可以开始lexing的位置
+		while (start < expected.size() && expected[start].type == TokenType::STRING_LITERAL) ++start;
+		if (start == expected.size()) break;
+		TokenStream stream{ source, expected[start].offset };
+		bool same = true;
+		for (auto i = start; i < expected.size(); ++i) {
+			auto token = stream.Take();
+			same = same && token && SameToken(*token, expected[i]);
+		}
+		LUNI_CHECK(same);
+		LUNI_CHECK(!stream.Take());
+	}
+}
+
+LUNI_TEST(RandomNestedPinRewindUnpin) {
+	std::mt19937 rng{ 2024 };
+	auto source = RandomSource(rng, 50000);
+	auto expected = DoLexing(source).tokens;
+
+	TokenStream stream{ source };
+	std::vector<usize> pins;
+	usize mismatches = 0;
+	usize longestPinnedSpan = 0;
+	auto Check = [&](const Token* token, usize index) {
+		if (index >= expected.size()) {
+			if (token) ++mismatches;
+		} else if (!token || !SameToken(*token, expected[index])) {
+			++mismatches;
+		}
+	};
+
+	while (stream.Position() < expected.size()) {
+		auto op = rng() % 100;
+		if (op < 45) {
+			// 一次消耗一段token，偶尔很长，使被pin住的范围超过初始的缓冲区大小
+			auto count = op < 2 ? 300 + rng() % 1000 : 1 + rng() % 16;
+			for (usize i = 0; i < count; ++i) {
+				auto index = stream.Position();
+				auto token = stream.Take();
+				Check(token ? &*token : nullptr, index);
+			}
+		} else if (op < 60) {
+			auto offset = rng() % 8;
+			Check(stream.Peek(offset), stream.Position() + offset);
+		} else if (op < 75) {
+			if (pins.size() < 16) pins.push_back(stream.Pin());
+		} else if (op < 90) {
+			if (!pins.empty()) {
+				longestPinnedSpan = std::max(longestPinnedSpan, stream.Position() - pins.front());
+				stream.Rewind(pins.back());
+				LUNI_CHECK(stream.Position() == pins.back());
+			}
+		} else if (!pins.empty()) {
+			stream.Unpin(pins.back());
+			pins.pop_back();
+		}
+	}
+	while (!pins.empty()) {
+		stream.Unpin(pins.back());
+		pins.pop_back();
+	}
+
+	LUNI_CHECK(mismatches == 0);
+	LUNI_CHECK(!stream.Peek());
+	// 确认测试确实覆盖了缓冲区扩容的情况
+	LUNI_CHECK(longestPinnedSpan > TokenStream::kWindowSize);
+}
+
+int main() {
+	return Testing::RunAllTests();
+}
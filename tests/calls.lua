@@ -0,0 +1,15 @@
+local t = {f = print}
+t.f("field call")
+t["f"]("index call")
+
+function greet(name)
+	print("hello", name)
+end
+handlers = {greet = greet}
+handlers.greet("table")
+local p = print
+p("local callee")
+function shout(s)
+	p(s)
+end
+shout("upvalue callee")
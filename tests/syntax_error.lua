@@ -0,0 +1,3 @@
+-- luni must report the syntax error below and exit without running anything
+print("unreachable")
+y = @